@@ -18,6 +18,12 @@ typedef enum ni_autoip_state {
 
 typedef struct ni_autoip_device	ni_autoip_device_t;
 
+typedef struct ni_autoip_stats {
+	unsigned int		conflicts;
+	unsigned int		defenses;
+	unsigned int		defenses_limited;
+} ni_autoip_stats_t;
+
 struct ni_autoip_device {
 	ni_autoip_device_t *	next;
 	unsigned int		users;
@@ -25,7 +31,7 @@ struct ni_autoip_device {
 	char *			ifname;
 	ni_linkinfo_t		link;
 
-	ni_arp_socket_t *	arp_socket;
+	ni_arp_subscription_t *	arp;
 	ni_capture_devinfo_t	devinfo;
 
 	unsigned int		notify : 1,
@@ -41,9 +47,11 @@ struct ni_autoip_device {
 	    unsigned int	nprobes;
 	    unsigned int	nclaims;
 	    unsigned int	nconflicts;
-	    time_t		last_defense;
+	    struct timeval	last_defense;
 	} autoip;
 
+	ni_autoip_stats_t	stats;
+
 	ni_addrconf_lease_t *	lease;
 };
 
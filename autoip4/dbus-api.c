@@ -218,6 +218,20 @@ __wicked_dbus_autoip4_set_name(ni_dbus_object_t *object,
 	return TRUE;
 }
 
+/*
+ * Conflict and defense counters of the device
+ */
+static void *
+ni_objectmodel_get_autoip_stats(const ni_dbus_object_t *object, ni_bool_t write_access, DBusError *error)
+{
+	ni_autoip_device_t *dev = ni_dbus_object_get_handle(object);
+
+	return &dev->stats;
+}
+
+#define AUTOIP4_STATS_PROPERTY(dbus_name, member_name) \
+	NI_DBUS_GENERIC_UINT_PROPERTY(autoip_stats, dbus_name, member_name, RO)
+
 #define WICKED_INTERFACE_PROPERTY(type, __name, rw) \
 	NI_DBUS_PROPERTY(type, __name, __wicked_dbus_autoip4, rw)
 #define WICKED_INTERFACE_PROPERTY_SIGNATURE(signature, __name, rw) \
@@ -225,6 +239,9 @@ __wicked_dbus_autoip4_set_name(ni_dbus_object_t *object,
 
 static ni_dbus_property_t	wicked_dbus_autoip4_properties[] = {
 	WICKED_INTERFACE_PROPERTY(STRING, name, RO),
+	AUTOIP4_STATS_PROPERTY(conflicts, conflicts),
+	AUTOIP4_STATS_PROPERTY(defenses, defenses),
+	AUTOIP4_STATS_PROPERTY(defenses-limited, defenses_limited),
 
 	{ NULL }
 };
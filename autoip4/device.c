@@ -82,9 +82,9 @@ ni_autoip_device_by_index(unsigned int ifindex)
 static void
 ni_autoip_device_close(ni_autoip_device_t *dev)
 {
-	if (dev->arp_socket)
-		ni_arp_socket_close(dev->arp_socket);
-	dev->arp_socket = NULL;
+	if (dev->arp)
+		ni_arp_unsubscribe(dev->arp);
+	dev->arp = NULL;
 
 	if (dev->fsm.timer) {
 		ni_timer_cancel(dev->fsm.timer);
@@ -31,8 +31,8 @@
 #define IPV4LL_PROBE_WAIT_MIN		1000
 #define IPV4LL_PROBE_WAIT_MAX		2000
 
-/* How long we wait after the last probe */
-#define IPV4LL_ANNOUNCE_DELAY		2000
+/* How long we wait after the last probe (the arp engine waits
+ * PROBE_WAIT_MAX) and between the announcements */
 #define IPV4LL_ANNOUNCE_WAIT		2000
 
 #define IPV4LL_PROBE_COUNT		3
@@ -41,9 +41,19 @@
 #define IPV4LL_RATE_LIMIT_INTERVAL	60000
 #define IPV4LL_DEFEND_INTERVAL		10000
 
+/* How many defenses all devices together may send per second */
+#define IPV4LL_DEFEND_RATE		8
+#define IPV4LL_DEFEND_RATE_BURST	8
+
+static ni_token_bucket_t	ni_autoip_defend_limit = {
+	.rate	= IPV4LL_DEFEND_RATE,
+	.burst	= IPV4LL_DEFEND_RATE_BURST,
+};
+
 extern int	ni_autoip_device_get_address(ni_autoip_device_t *, struct in_addr *);
 static int	ni_autoip_send_arp(ni_autoip_device_t *);
-static void	ni_autoip_fsm_process_arp_packet(ni_arp_socket_t *, const ni_arp_packet_t *, void *);
+static void	ni_autoip_fsm_process_arp_event(ni_arp_subscription_t *, ni_arp_event_t,
+				const ni_arp_packet_t *, void *);
 static void	ni_autoip_fsm_set_timeout(ni_autoip_device_t *, unsigned int, unsigned int);
 static void	__ni_autoip_fsm_timeout(void *, const ni_timer_t *);
 
@@ -97,6 +107,10 @@ ni_autoip_fsm_select(ni_autoip_device_t *dev)
 void
 ni_autoip_fsm_conflict(ni_autoip_device_t *dev)
 {
+	if (dev->arp)
+		ni_arp_unsubscribe(dev->arp);
+	dev->arp = NULL;
+
 	ni_autoip_device_drop_lease(dev);
 	dev->autoip.nconflicts++;
 	ni_autoip_fsm_select(dev);
@@ -122,7 +136,7 @@ ni_autoip_fsm_conflict(ni_autoip_device_t *dev)
 void
 ni_autoip_fsm_defend(ni_autoip_device_t *dev, const ni_hwaddr_t *hwa)
 {
-	time_t now = time(NULL);
+	struct timeval now, delta;
 
 	if (dev->fsm.state != NI_AUTOIP_STATE_CLAIMED) {
 		ni_error("%s: shouldn't be called in state %s", __FUNCTION__,
@@ -130,16 +144,30 @@ ni_autoip_fsm_defend(ni_autoip_device_t *dev, const ni_hwaddr_t *hwa)
 		return;
 	}
 
-	if (dev->autoip.last_defense && now - dev->autoip.last_defense < IPV4LL_DEFEND_INTERVAL) {
+	ni_timer_get_time(&now);
+	timersub(&now, &dev->autoip.last_defense, &delta);
+	if (timerisset(&dev->autoip.last_defense)
+	 && delta.tv_sec * 1000 + delta.tv_usec / 1000 < IPV4LL_DEFEND_INTERVAL) {
 		ni_debug_autoip("%s: failed to defend address %s (claimed by %s)", dev->ifname,
 				inet_ntoa(dev->autoip.candidate),
 				ni_link_address_print(hwa));
 		ni_autoip_fsm_conflict(dev);
+		return;
+	}
+
+	/*
+	 * In an ARP storm, many devices may see conflicts at once; the
+	 * defense is optional, so we limit the rate of all of them, but
+	 * record the conflict to give up the address on the next one.
+	 */
+	dev->autoip.last_defense = now;
+	if (ni_token_bucket_take(&ni_autoip_defend_limit)) {
+		dev->stats.defenses++;
+		ni_arp_defend(dev->arp, hwa);
 	} else {
-		dev->autoip.last_defense = now;
-		ni_arp_send_reply(dev->arp_socket,
-				dev->autoip.candidate,
-				hwa, dev->autoip.candidate);
+		dev->stats.defenses_limited++;
+		ni_debug_autoip("%s: not defending address %s, rate limit reached",
+				dev->ifname, inet_ntoa(dev->autoip.candidate));
 	}
 }
 
@@ -172,83 +200,76 @@ ni_autoip_fsm_build_lease(ni_autoip_device_t *dev)
 }
 
 
+/*
+ * Probe for the candidate and claim it; the arp engine sends the
+ * probes and announcements and tells us when they are done.
+ */
 int
 ni_autoip_send_arp(ni_autoip_device_t *dev)
 {
 	struct in_addr claim = dev->autoip.candidate;
-	struct in_addr null = { 0 };
-
-	if (dev->arp_socket == NULL) {
-		dev->arp_socket = ni_arp_socket_open(&dev->devinfo,
-				ni_autoip_fsm_process_arp_packet,
-				dev);
-		if (dev->arp_socket == NULL)
-			return -1;
-	}
 
-	if (dev->autoip.nprobes) {
-		ni_debug_autoip("arp_validate: probing for %s", inet_ntoa(claim));
-		ni_arp_send_request(dev->arp_socket, null, claim);
-
-		dev->autoip.nprobes -= 1;
-		if (dev->autoip.nprobes != 0)
-			ni_autoip_fsm_set_timeout(dev, IPV4LL_PROBE_WAIT_MIN, IPV4LL_PROBE_WAIT_MAX);
-		else
-			ni_autoip_fsm_set_timeout(dev, IPV4LL_ANNOUNCE_DELAY, IPV4LL_ANNOUNCE_DELAY);
-	} else if (dev->autoip.nclaims) {
-		ni_debug_autoip("arp_validate: claiming %s", inet_ntoa(claim));
-		ni_arp_send_grat_request(dev->arp_socket, claim);
-
-		dev->autoip.nclaims -= 1;
-		if (dev->autoip.nclaims != 0) {
-			ni_autoip_fsm_set_timeout(dev, IPV4LL_ANNOUNCE_WAIT, IPV4LL_ANNOUNCE_WAIT);
-		} else {
-			/* Wow, we're done! */
-			ni_debug_autoip("%s: successfully claimed %s", dev->ifname, inet_ntoa(claim));
-
-			/* Build the lease */
-			ni_autoip_fsm_build_lease(dev);
-
-			dev->fsm.state = NI_AUTOIP_STATE_CLAIMED;
-			dev->autoip.nconflicts = 0;
-			dev->autoip.last_defense = 0;
-		}
-	} else {
-		ni_error("%s: nprobes and nclaims are zero; shouldn't be here", __FUNCTION__);
-		ni_autoip_fsm_conflict(dev);
+	if (dev->arp)
+		ni_arp_unsubscribe(dev->arp);
+	dev->arp = ni_arp_subscribe(&dev->devinfo, claim,
+			ni_autoip_fsm_process_arp_event, dev);
+	if (dev->arp == NULL)
 		return -1;
-	}
+
+	ni_debug_autoip("arp_validate: probing for %s", inet_ntoa(claim));
+	ni_arp_probe(dev->arp, dev->autoip.nprobes,
+			IPV4LL_PROBE_WAIT_MIN, IPV4LL_PROBE_WAIT_MAX);
+	ni_arp_announce(dev->arp, dev->autoip.nclaims,
+			IPV4LL_ANNOUNCE_WAIT, IPV4LL_ANNOUNCE_WAIT);
 	return 0;
 }
 
 void
-ni_autoip_fsm_process_arp_packet(ni_arp_socket_t *arph, const ni_arp_packet_t *pkt, void *user_data)
+ni_autoip_fsm_process_arp_event(ni_arp_subscription_t *sub, ni_arp_event_t event,
+		const ni_arp_packet_t *pkt, void *user_data)
 {
 	ni_autoip_device_t *dev = user_data;
 
-	/* Ignore any ARP replies that seem to come from our own
-	 * MAC address. Some helpful switches seem to generate
-	 * these. */
-	if (ni_link_address_equal(&dev->devinfo.hwaddr, &pkt->sha))
-		return;
+	switch (event) {
+	case NI_ARP_EVENT_VERIFIED:
+		ni_debug_autoip("arp_validate: claiming %s", inet_ntoa(dev->autoip.candidate));
+		break;
 
-	if (pkt->sip.s_addr != dev->autoip.candidate.s_addr)
-		return;
+	case NI_ARP_EVENT_ANNOUNCED:
+		if (dev->fsm.state != NI_AUTOIP_STATE_CLAIMING)
+			break;
 
-	switch (dev->fsm.state) {
-	case NI_AUTOIP_STATE_CLAIMING:
-		ni_debug_autoip("address %s already in use by %s",
-				inet_ntoa(pkt->sip),
-				ni_link_address_print(&pkt->sha));
-		ni_autoip_fsm_conflict(dev);
-		break;
+		/* Wow, we're done! */
+		ni_debug_autoip("%s: successfully claimed %s", dev->ifname,
+				inet_ntoa(dev->autoip.candidate));
 
-	case NI_AUTOIP_STATE_CLAIMED:
-		ni_autoip_fsm_defend(dev, &pkt->sha);
+		/* Build the lease */
+		ni_autoip_fsm_build_lease(dev);
+
+		dev->fsm.state = NI_AUTOIP_STATE_CLAIMED;
+		dev->autoip.nconflicts = 0;
+		timerclear(&dev->autoip.last_defense);
 		break;
 
-	default:
-		/* ignore */;
+	case NI_ARP_EVENT_CONFLICT:
+		switch (dev->fsm.state) {
+		case NI_AUTOIP_STATE_CLAIMING:
+			ni_debug_autoip("address %s already in use by %s",
+					inet_ntoa(dev->autoip.candidate),
+					ni_link_address_print(&pkt->sha));
+			dev->stats.conflicts++;
+			ni_autoip_fsm_conflict(dev);
+			break;
+
+		case NI_AUTOIP_STATE_CLAIMED:
+			dev->stats.conflicts++;
+			ni_autoip_fsm_defend(dev, &pkt->sha);
+			break;
+
+		default:
+			/* ignore */;
+		}
+		break;
 	}
 }
 
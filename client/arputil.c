@@ -51,31 +51,27 @@ struct arp_handle {
 	ni_bool_t		replies;
 
 	const char *		ifname;
+	unsigned int		ifindex;
 	ni_sockaddr_t		ipaddr;
 	ni_hwaddr_t		hwaddr;
 
-	ni_arp_socket_t *	sock;
-	const ni_timer_t *	timer;
+	ni_arp_subscription_t *	sub;
 };
 
-static ni_bool_t	__do_arp_validate_send(struct arp_handle *);
-
 static void
 __do_arp_handle_close(struct arp_handle *handle)
 {
 	if (handle) {
-		if (handle->sock)
-			ni_arp_socket_close(handle->sock);
-		handle->sock = NULL;
+		if (handle->sub)
+			ni_arp_unsubscribe(handle->sub);
+		handle->sub = NULL;
 		ni_server_deactivate_interface_events();
 	}
 }
 
 static void
-__do_arp_validate_process(ni_arp_socket_t *sock, const ni_arp_packet_t *pkt,
-		void *user_data)
+__do_arp_validate_process(struct arp_handle *handle, const ni_arp_packet_t *pkt)
 {
-	struct arp_handle *handle = user_data;
 	ni_netconfig_t *nc = ni_global_state_handle(0);
 	const ni_netdev_t *ifp;
 	ni_bool_t false_alarm = FALSE;
@@ -93,22 +89,13 @@ __do_arp_validate_process(ni_arp_socket_t *sock, const ni_arp_packet_t *pkt,
 		return;
 	}
 
-	/* Ignore any ARP replies that seem to come from our own
-	 * MAC address. Some helpful switches seem to generate
-	 * these. */
-	if (ni_link_address_equal(&sock->dev_info.hwaddr, &pkt->sha)) {
-		ni_debug_application("%s: adress in use by ourself",
-				handle->ifname);
-		return;
-	}
-
-	/* As well as ARP replies that seem to come from our own
+	/* Ignore ARP replies that seem to come from our own
 	 * host: dup if same address, not a dup if there are two
 	 * interfaces connected to the same broadcast domain.
 	 */
 	ni_sockaddr_set_ipv4(&addr, pkt->sip, 0);
 	for (ifp = ni_netconfig_devlist(nc); ifp; ifp = ifp->next) {
-		if (ifp->link.ifindex == sock->dev_info.ifindex)
+		if (ifp->link.ifindex == handle->ifindex)
 			continue;
 
 		if (!ni_netdev_link_is_up(ifp))
@@ -144,65 +131,33 @@ __do_arp_validate_process(ni_arp_socket_t *sock, const ni_arp_packet_t *pkt,
 }
 
 static void
-__do_arp_validate_timeout(void *user_data, const ni_timer_t *timer)
+__do_arp_validate_event(ni_arp_subscription_t *sub, ni_arp_event_t event,
+		const ni_arp_packet_t *pkt, void *user_data)
 {
-	struct arp_handle * handle = user_data;
+	struct arp_handle *handle = user_data;
 
-	if (!user_data || !handle->timer || handle->timer != timer)
-		return;
+	switch (event) {
+	case NI_ARP_EVENT_VERIFIED:
+		handle->replies = FALSE;
+		if (handle->nclaims) {
+			ni_debug_application("%s: arp validate: claiming %s use",
+					handle->ifname,
+					ni_sockaddr_print(&handle->ipaddr));
+		} else {
+			__do_arp_handle_close(handle);
+		}
+		break;
 
-	handle->timer = NULL;
-	if (!__do_arp_validate_send(handle)) {
+	case NI_ARP_EVENT_ANNOUNCED:
 		__do_arp_handle_close(handle);
-	}
-}
-
-static void
-__do_arp_validate_arm_timer(struct arp_handle *handle)
-{
-	if (handle->timer) {
-		ni_timer_rearm(handle->timer, handle->timeout);
-	} else {
-		handle->timer = ni_timer_register(handle->timeout,
-				__do_arp_validate_timeout, handle);
-	}
-}
-
-static ni_bool_t
-__do_arp_validate_send(struct arp_handle *handle)
-{
-	struct in_addr null = { 0 };
-	ni_bool_t ret = FALSE;
+		break;
 
-	if (!handle->hwaddr.len && handle->nprobes) {
-		ni_debug_application("%s: arp validate: probing for %s",
-				handle->ifname,
-				ni_sockaddr_print(&handle->ipaddr));
-
-		handle->nprobes--;
-		handle->replies = TRUE;
-		if ((ret = ni_arp_send_request(handle->sock, null,
-				handle->ipaddr.sin.sin_addr) > 0)) {
-			__do_arp_validate_arm_timer(handle);
-		}
-	} else
-	if (!handle->hwaddr.len && handle->nclaims) {
-		ni_debug_application("%s: arp validate: claiming %s use",
-				handle->ifname,
-				ni_sockaddr_print(&handle->ipaddr));
-
-		handle->nclaims--;
-		handle->replies = FALSE;
-		if ((ret = ni_arp_send_grat_request(handle->sock,
-				handle->ipaddr.sin.sin_addr) > 0)) {
-			if (handle->nclaims) {
-				__do_arp_validate_arm_timer(handle);
-			} else if (handle->sock) {
-				__do_arp_handle_close(handle);
-			}
-		}
+	case NI_ARP_EVENT_CONFLICT:
+		__do_arp_validate_process(handle, pkt);
+		if (handle->hwaddr.len)
+			__do_arp_handle_close(handle);
+		break;
 	}
-	return ret;
 }
 
 static int
@@ -256,18 +211,26 @@ __do_arp_validate(struct arp_handle *handle)
 	if ((ret = __do_arp_validate_init(handle, &dev_info)) != 0)
 		return ret;
 
-	handle->sock = ni_arp_socket_open(&dev_info,
-			__do_arp_validate_process, handle);
-	if (!handle->sock || !handle->sock->user_data) {
+	handle->ifindex = dev_info.ifindex;
+	handle->sub = ni_arp_subscribe(&dev_info, handle->ipaddr.sin.sin_addr,
+			__do_arp_validate_event, handle);
+	if (!handle->sub) {
 		ni_error("%s: Cannot initialize arp socket", handle->ifname);
 		__do_arp_handle_close(handle);
 		return NI_LSB_RC_ERROR;
 	}
 
-	if (!__do_arp_validate_send(handle)) {
-		__do_arp_handle_close(handle);
-		ni_error("%s: Cannot send arp packet", handle->ifname);
-		return NI_LSB_RC_ERROR;
+	if (handle->nprobes) {
+		ni_debug_application("%s: arp validate: probing for %s",
+				handle->ifname,
+				ni_sockaddr_print(&handle->ipaddr));
+		handle->replies = TRUE;
+		ni_arp_probe(handle->sub, handle->nprobes,
+				handle->timeout, handle->timeout);
+	}
+	if (handle->nclaims) {
+		ni_arp_announce(handle->sub, handle->nclaims,
+				handle->timeout, handle->timeout);
 	}
 
 	ret = NI_WICKED_RC_ERROR;
@@ -280,10 +243,6 @@ __do_arp_validate(struct arp_handle *handle)
 			break;
 		ret = NI_WICKED_RC_ERROR;
 	}
-	if (handle->timer) {
-		ni_timer_cancel(handle->timer);
-		handle->timer = NULL;
-	}
 	__do_arp_handle_close(handle);
 
 	return handle->hwaddr.len ? NI_LSB_RC_NOT_ALLOWED : ret;
@@ -322,16 +322,19 @@ ni_do_ifcheck(int argc, char **argv)
 		goto cleanup;
 	}
 
-	if (!ni_fsm_create_client(fsm)) {
-		/* Severe error we always explicitly return */
-		status = NI_WICKED_RC_ERROR;
-		goto cleanup;
-	}
+	/* Use the status snapshot of wickedd when available */
+	if (!ni_fsm_refresh_state_snapshot(fsm)) {
+		if (!ni_fsm_create_client(fsm)) {
+			/* Severe error we always explicitly return */
+			status = NI_WICKED_RC_ERROR;
+			goto cleanup;
+		}
 
-	if (!ni_fsm_refresh_state(fsm)) {
-		/* Severe error we always explicitly return */
-		status = NI_WICKED_RC_ERROR;
-		goto cleanup;
+		if (!ni_fsm_refresh_state(fsm)) {
+			/* Severe error we always explicitly return */
+			status = NI_WICKED_RC_ERROR;
+			goto cleanup;
+		}
 	}
 
 	status = NI_WICKED_ST_OK;
@@ -38,8 +38,11 @@
 #include <wicked/netinfo.h>
 #include <wicked/logging.h>
 #include <wicked/fsm.h>
+#include <wicked/xml.h>
 
 #include "wicked-client.h"
+#include "client/ifconfig.h"
+#include "client/client_state.h"
 #include "appconfig.h"
 #include "ifcheck.h"
 #include "ifup.h"
@@ -47,6 +50,207 @@
 #include "ifreload.h"
 #include "ifstatus.h"
 
+/*
+ * What a config change requires to be applied to an existing device
+ */
+typedef enum {
+	NI_IFRELOAD_CHANGE_NONE = 0,	/* update the config uuid only	*/
+	NI_IFRELOAD_CHANGE_INPLACE,	/* re-apply the changed nodes only	*/
+	NI_IFRELOAD_CHANGE_RECREATE,	/* ifdown and ifup incl. children	*/
+} ni_ifreload_change_t;
+
+/*
+ * Interface config nodes, which can be changed on a device
+ * which is up without to take it and it's children down.
+ * Adding or removing them requires a recreate though.
+ *
+ * The fsm calls only the methods using a changed node then,
+ * e.g. firewallUp, changeProtocol or requestLease of static
+ * addrconf, and just updates the client state for control.
+ * The link mtu is not among them: linkUp does not change it
+ * on a device which is up.
+ */
+static const char *	ni_ifreload_inplace_nodes[] = {
+	"control",
+	"firewall",
+	"ethtool",
+	"ipv4",
+	"ipv6",
+	"ipv4:static",
+	"ipv6:static",
+	NULL
+};
+
+static ni_bool_t
+ni_ifreload_inplace_node(const char *name)
+{
+	const char **np;
+
+	for (np = ni_ifreload_inplace_nodes; *np; ++np) {
+		if (ni_string_eq(*np, name))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static ni_bool_t
+ni_ifreload_cdata_eq(const char *a, const char *b)
+{
+	return ni_string_empty(a) ? ni_string_empty(b) : ni_string_eq(a, b);
+}
+
+static ni_bool_t
+ni_ifreload_node_eq(const xml_node_t *a, const xml_node_t *b, const char *skip)
+{
+	const xml_node_t *ca, *cb;
+	unsigned int i;
+
+	if (!ni_string_eq(a->name, b->name) || !ni_ifreload_cdata_eq(a->cdata, b->cdata))
+		return FALSE;
+
+	if (a->attrs.count != b->attrs.count)
+		return FALSE;
+	for (i = 0; i < a->attrs.count; ++i) {
+		const ni_var_t *va = &a->attrs.data[i];
+		const ni_var_t *vb = &b->attrs.data[i];
+
+		if (!ni_string_eq(va->name, vb->name) || !ni_string_eq(va->value, vb->value))
+			return FALSE;
+	}
+
+	ca = a->children;
+	cb = b->children;
+	while (ca || cb) {
+		if (ca && skip && ni_string_eq(ca->name, skip)) {
+			ca = ca->next;
+			continue;
+		}
+		if (cb && skip && ni_string_eq(cb->name, skip)) {
+			cb = cb->next;
+			continue;
+		}
+		if (!ca || !cb || !ni_ifreload_node_eq(ca, cb, NULL))
+			return FALSE;
+		ca = ca->next;
+		cb = cb->next;
+	}
+	return TRUE;
+}
+
+/*
+ * Find the child of @parent with the same name and position among
+ * the equally named siblings as @peer has in it's own parent node.
+ */
+static const xml_node_t *
+ni_ifreload_peer_child(const xml_node_t *parent, const xml_node_t *peer)
+{
+	const xml_node_t *child;
+	unsigned int nth = 0;
+
+	for (child = peer->parent->children; child && child != peer; child = child->next) {
+		if (ni_string_eq(child->name, peer->name))
+			nth++;
+	}
+	for (child = parent->children; child; child = child->next) {
+		if (ni_string_eq(child->name, peer->name) && nth-- == 0)
+			return child;
+	}
+	return NULL;
+}
+
+static ni_ifreload_change_t
+ni_ifreload_node_change(const xml_node_t *old, const xml_node_t *new)
+{
+	if (!old || !new)
+		return NI_IFRELOAD_CHANGE_RECREATE;
+
+	if (ni_ifreload_node_eq(old, new, NULL))
+		return NI_IFRELOAD_CHANGE_NONE;
+
+	if (ni_ifreload_inplace_node(new->name))
+		return NI_IFRELOAD_CHANGE_INPLACE;
+
+	return NI_IFRELOAD_CHANGE_RECREATE;
+}
+
+/*
+ * Compare the applied and the new config of an interface node by node,
+ * ignoring the order of the top level nodes, and return the strongest
+ * change needed to apply it and the names of the changed nodes.
+ */
+static ni_ifreload_change_t
+ni_ifreload_config_change(const char *ifname, const xml_node_t *old, const xml_node_t *new,
+			ni_string_array_t *changed)
+{
+	ni_ifreload_change_t change = NI_IFRELOAD_CHANGE_NONE;
+	ni_ifreload_change_t node_change;
+	const xml_node_t *child;
+
+	for (child = new->children; child; child = child->next) {
+		node_change = ni_ifreload_node_change(ni_ifreload_peer_child(old, child), child);
+		if (node_change > change)
+			change = node_change;
+
+		if (node_change != NI_IFRELOAD_CHANGE_NONE) {
+			if (ni_string_array_index(changed, child->name) < 0)
+				ni_string_array_append(changed, child->name);
+			ni_debug_application("%s: <%s> config node changed (%s)",
+				ifname, child->name,
+				node_change == NI_IFRELOAD_CHANGE_INPLACE ?
+				"in-place" : "recreate");
+		}
+	}
+	for (child = old->children; child; child = child->next) {
+		if (!ni_ifreload_peer_child(new, child)) {
+			ni_debug_application("%s: <%s> config node removed",
+				ifname, child->name);
+			change = NI_IFRELOAD_CHANGE_RECREATE;
+		}
+	}
+	return change;
+}
+
+static ni_ifreload_change_t
+ni_ifreload_worker_config_change(ni_ifworker_t *w)
+{
+	ni_ifreload_change_t change = NI_IFRELOAD_CHANGE_RECREATE;
+	ni_client_state_t *cs;
+	xml_node_t *applied;
+	ni_uuid_t uuid;
+
+	if (!ni_ifcheck_worker_config_exists(w) || !w->device || !w->object)
+		return change;
+
+	if (ni_string_eq_nocase(w->control.mode, "off"))
+		return change;
+
+	if (!(cs = w->device->client_state) || ni_string_empty(cs->config.origin))
+		return change;
+
+	if (!(applied = ni_client_state_config_load_node(w->device->link.ifindex)))
+		return change;
+
+	/* a stale copy is not the config the device has been set up with */
+	if (ni_ifconfig_generate_uuid(applied, &uuid) &&
+	    ni_uuid_equal(&uuid, &cs->config.uuid))
+		change = ni_ifreload_config_change(w->name, applied, w->config.node,
+							&w->config.changed);
+
+	/* a recreate runs the full ifup */
+	if (change != NI_IFRELOAD_CHANGE_INPLACE)
+		ni_string_array_destroy(&w->config.changed);
+
+	xml_node_free(applied);
+	return change;
+}
+
+static void
+ni_ifreload_worker_update_config(ni_ifworker_t *w)
+{
+	ni_call_set_client_state_config(w->object, &w->config.meta);
+	ni_client_state_config_save_node(w->config.node, w->device->link.ifindex);
+}
+
 static int
 ni_do_ifreload_direct(int argc, char **argv)
 {
@@ -73,6 +277,7 @@ ni_do_ifreload_direct(int argc, char **argv)
 	ni_string_array_t opt_ifconfig = NI_STRING_ARRAY_INIT;
 	ni_ifworker_array_t up_marked = NI_IFWORKER_ARRAY_INIT;
 	ni_ifworker_array_t down_marked = NI_IFWORKER_ARRAY_INIT;
+	ni_ifworker_array_t inplace_marked = NI_IFWORKER_ARRAY_INIT;
 	ni_string_array_t ifnames = NI_STRING_ARRAY_INIT;
 	ni_ifmatcher_t ifmatch;
 	ni_bool_t check_prio = TRUE;
@@ -266,6 +471,26 @@ usage:
 			continue;
 		}
 
+		/* apply changes not requiring an ifdown without it */
+		switch (ni_ifreload_worker_config_change(w)) {
+		case NI_IFRELOAD_CHANGE_NONE:
+			ni_info("skipping %s interface: "
+				"no relevant configuration changes", w->name);
+			ni_ifreload_worker_update_config(w);
+			continue;
+
+		case NI_IFRELOAD_CHANGE_INPLACE:
+			ni_info("skipping ifdown operation for %s interface: "
+				"configuration changes applicable in place", w->name);
+			if (opt_persistent)
+				ni_ifworker_control_set_persistent(w, TRUE);
+			ni_ifworker_array_append(&inplace_marked, w);
+			continue;
+
+		default:
+			break;
+		}
+
 		/* Mark persistend when requested */
 		if (opt_persistent)
 			ni_ifworker_control_set_persistent(w, TRUE);
@@ -308,7 +533,7 @@ usage:
 		}
 	}
 
-	if (0 == nmarked && 0 == up_marked.count) {
+	if (0 == nmarked && 0 == up_marked.count && 0 == inplace_marked.count) {
 		ni_note("ifreload: no matching interfaces");
 		status = NI_WICKED_RC_SUCCESS;
 		goto cleanup;
@@ -331,6 +556,12 @@ usage:
 	}
 
 	ni_fsm_pull_in_children(&up_marked);
+	/* in-place changes do not touch the children; the fsm runs the
+	 * calls for the config nodes in w->config.changed only */
+	for (i = 0; i < inplace_marked.count; ++i) {
+		if (ni_ifworker_array_index(&up_marked, inplace_marked.data[i]) < 0)
+			ni_ifworker_array_append(&up_marked, inplace_marked.data[i]);
+	}
 	/* Drop deleted or apply the up range */
 	ni_fsm_reset_matching_workers(fsm, &up_marked, &up_range, FALSE);
 
@@ -364,6 +595,7 @@ cleanup:
 	ni_string_array_destroy(&ifnames);
 	ni_string_array_destroy(&opt_ifconfig);
 	ni_ifworker_array_destroy(&down_marked);
+	ni_ifworker_array_destroy(&inplace_marked);
 	ni_ifworker_array_destroy(&up_marked);
 	return status;
 }
@@ -393,6 +625,7 @@ ni_do_ifreload_nanny(int argc, char **argv)
 	};
 	ni_ifworker_array_t up_marked = NI_IFWORKER_ARRAY_INIT;
 	ni_ifworker_array_t down_marked = NI_IFWORKER_ARRAY_INIT;
+	ni_ifworker_array_t inplace_marked = NI_IFWORKER_ARRAY_INIT;
 	ni_string_array_t opt_ifconfig = NI_STRING_ARRAY_INIT;
 	ni_string_array_t ifnames = NI_STRING_ARRAY_INIT;
 	ni_nanny_fsm_monitor_t *monitor = NULL;
@@ -584,6 +817,24 @@ usage:
 			continue;
 		}
 
+		/* apply changes not requiring an ifdown without it */
+		switch (ni_ifreload_worker_config_change(w)) {
+		case NI_IFRELOAD_CHANGE_NONE:
+			ni_info("skipping %s interface: "
+				"no relevant configuration changes", w->name);
+			ni_ifreload_worker_update_config(w);
+			continue;
+
+		case NI_IFRELOAD_CHANGE_INPLACE:
+			ni_info("skipping ifdown operation for %s interface: "
+				"configuration changes applicable in place", w->name);
+			ni_ifworker_array_append(&inplace_marked, w);
+			continue;
+
+		default:
+			break;
+		}
+
 		/* Remember all changed devices */
 		if (ni_ifcheck_worker_config_exists(w) &&
 		    !ni_string_eq_nocase(w->control.mode, "off")) {
@@ -622,7 +873,7 @@ usage:
 		}
 	}
 
-	if (0 == nmarked && 0 == up_marked.count) {
+	if (0 == nmarked && 0 == up_marked.count && 0 == inplace_marked.count) {
 		ni_note("ifreload: no matching interfaces");
 		status = NI_WICKED_RC_SUCCESS;
 		goto cleanup;
@@ -646,6 +897,12 @@ usage:
 	}
 
 	ni_fsm_pull_in_children(&up_marked);
+	/* in-place changes do not touch the children; the fsm runs the
+	 * calls for the config nodes in w->config.changed only */
+	for (i = 0; i < inplace_marked.count; ++i) {
+		if (ni_ifworker_array_index(&up_marked, inplace_marked.data[i]) < 0)
+			ni_ifworker_array_append(&up_marked, inplace_marked.data[i]);
+	}
 	ni_ifworkers_flatten(&up_marked);
 
 	/* anything to ifup? */
@@ -686,6 +943,7 @@ cleanup:
 	ni_nanny_fsm_monitor_free(monitor);
 	ni_string_array_destroy(&opt_ifconfig);
 	ni_ifworker_array_destroy(&down_marked);
+	ni_ifworker_array_destroy(&inplace_marked);
 	ni_ifworker_array_destroy(&up_marked);
 	return status;
 }
@@ -720,16 +720,22 @@ ni_do_ifstatus(int argc, char **argv)
 			goto usage;
 	}
 
-	if (!ni_fsm_create_client(fsm)) {
-		/* Severe error we always explicitly return */
-		status = NI_WICKED_ST_ERROR;
-		goto cleanup;
-	}
+	/*
+	 * The status snapshot of wickedd provides all we show,
+	 * except of the verbose details we've to query via D-Bus.
+	 */
+	if (opt_verbose > OPT_NORMAL || !ni_fsm_refresh_state_snapshot(fsm)) {
+		if (!ni_fsm_create_client(fsm)) {
+			/* Severe error we always explicitly return */
+			status = NI_WICKED_ST_ERROR;
+			goto cleanup;
+		}
 
-	if (!ni_fsm_refresh_state(fsm)) {
-		/* Severe error we always explicitly return */
-		status = NI_WICKED_ST_ERROR;
-		goto cleanup;
+		if (!ni_fsm_refresh_state(fsm)) {
+			/* Severe error we always explicitly return */
+			status = NI_WICKED_ST_ERROR;
+			goto cleanup;
+		}
 	}
 
 	if (check_config && opt_ifconfig.count == 0) {
@@ -0,0 +1,241 @@
+/*
+ *	wicked client lldp actions and utilities
+ *
+ *	Copyright (C) 2014 SUSE LINUX Products GmbH, Nuernberg, Germany.
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License along
+ *	with this program; if not, see <http://www.gnu.org/licenses/> or write
+ *	to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *	Boston, MA 02110-1301 USA.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include <wicked/types.h>
+#include <wicked/netinfo.h>
+#include <wicked/address.h>
+#include <wicked/logging.h>
+#include <wicked/util.h>
+#include <wicked/dbus.h>
+#include <wicked/dbus-errors.h>
+#include <wicked/objectmodel.h>
+#include <wicked/client.h>
+
+#include "lldputil.h"
+
+enum { OPT_HELP };
+
+/*
+ * Print a chassis-id or port-id struct as "subtype value"
+ */
+static void
+__do_lldp_print_id(const char *name, const ni_dbus_variant_t *dict)
+{
+	const ni_dbus_variant_t *strct, *member;
+	unsigned char data[64];
+	unsigned int len;
+	const char *kind, *value;
+	char buf[256];
+
+	if (!(strct = ni_dbus_dict_get(dict, name))
+	 || !ni_dbus_struct_get_string(strct, 0, &kind))
+		return;
+
+	value = "";
+	if ((member = ni_dbus_struct_get(strct, 1)) != NULL) {
+		if (ni_dbus_variant_get_string(member, &value)) {
+			/* printed as is */
+		} else
+		if (ni_dbus_variant_get_byte_array_minmax(member, data, &len, 0, sizeof(data))) {
+			ni_opaque_t packed;
+			ni_sockaddr_t addr;
+
+			if (ni_string_eq(kind, "net-address")) {
+				memcpy(packed.data, data, len);
+				packed.len = len;
+				if (ni_sockaddr_unpack(&addr, &packed))
+					value = ni_sockaddr_print(&addr);
+			} else {
+				value = ni_format_hex(data, len, buf, sizeof(buf));
+			}
+		}
+	}
+	printf("  %-18s %s %s\n", name, kind, value ? value : "");
+}
+
+static void
+__do_lldp_print_neighbor(const ni_dbus_variant_t *dict)
+{
+	const ni_dbus_variant_t *sub;
+	const char *string;
+	uint32_t value, expires;
+	uint16_t vid;
+
+	__do_lldp_print_id("chassis-id", dict);
+	__do_lldp_print_id("port-id", dict);
+
+	if (ni_dbus_dict_get_uint32(dict, "ttl", &value)) {
+		if (ni_dbus_dict_get_uint32(dict, "expires", &expires))
+			printf("  %-18s %u (expires in %u sec)\n", "ttl", value, expires);
+		else
+			printf("  %-18s %u\n", "ttl", value);
+	}
+	if (ni_dbus_dict_get_string(dict, "port-description", &string) && !ni_string_empty(string))
+		printf("  %-18s %s\n", "port-description", string);
+
+	if ((sub = ni_dbus_dict_get(dict, "system")) != NULL) {
+		if (ni_dbus_dict_get_string(sub, "name", &string))
+			printf("  %-18s %s\n", "system-name", string);
+		if (ni_dbus_dict_get_string(sub, "descr", &string))
+			printf("  %-18s %s\n", "system-description", string);
+		if (ni_dbus_dict_get_uint32(sub, "capabilities", &value) && value)
+			printf("  %-18s 0x%04x\n", "system-capabilities", value);
+	}
+
+	if ((sub = ni_dbus_dict_get(dict, "ieee-802-1")) != NULL) {
+		if (ni_dbus_dict_get_uint16(sub, "pvid", &vid) && vid)
+			printf("  %-18s %u\n", "port-vlan-id", vid);
+		if (ni_dbus_dict_get_string(sub, "vlan-name", &string))
+			printf("  %-18s %s\n", "vlan-name", string);
+		if (ni_dbus_dict_get_uint16(sub, "mgmt-vid", &vid) && vid)
+			printf("  %-18s %u\n", "management-vlan-id", vid);
+	}
+}
+
+static int
+__do_lldp_neighbors(ni_dbus_object_t *object, const char *ifname)
+{
+	ni_dbus_variant_t result = NI_DBUS_VARIANT_INIT;
+	DBusError error = DBUS_ERROR_INIT;
+	unsigned int i;
+
+	if (!ni_dbus_object_call_variant(object, NI_OBJECTMODEL_LLDP_INTERFACE,
+				"lldpNeighbors", 0, NULL, 1, &result, &error)) {
+		ni_dbus_print_error(&error, "%s: lldpNeighbors() failed", ifname);
+		dbus_error_free(&error);
+		return 1;
+	}
+
+	if (!ni_dbus_variant_is_dict_array(&result)) {
+		ni_error("%s: lldpNeighbors(): cannot parse response", ifname);
+		ni_dbus_variant_destroy(&result);
+		return 1;
+	}
+
+	for (i = 0; i < result.array.len; ++i) {
+		printf("%s: neighbor %u\n", ifname, i + 1);
+		__do_lldp_print_neighbor(&result.variant_array_value[i]);
+	}
+
+	ni_dbus_variant_destroy(&result);
+	return 0;
+}
+
+static int
+ni_do_lldp_neighbors(int argc, char **argv)
+{
+	static struct option options[] = {
+		{ "help",	no_argument,	NULL,	OPT_HELP },
+		{ NULL,		no_argument,	NULL,	0 }
+	};
+	ni_dbus_object_t *list_object, *object;
+	ni_bool_t found;
+	int c, i, rv = 0;
+
+	optind = 1;
+	while ((c = getopt_long(argc, argv, "h", options, NULL)) != EOF) {
+		switch (c) {
+		default:
+		case OPT_HELP:
+		case 'h':
+			fprintf(stderr,
+				"wicked [options] lldp neighbors [ifname ...]\n"
+				"\nShow the neighbors learned by the LLDP agents of the\n"
+				"given or all interfaces.\n"
+				"\nSupported options:\n"
+				"  --help\n"
+				"      Show this help text.\n"
+				);
+			return c == OPT_HELP || c == 'h' ? 0 : 1;
+		}
+	}
+
+	ni_objectmodel_init(NULL);
+	if (!(list_object = ni_call_get_netif_list_object())
+	 || !ni_dbus_object_refresh_children(list_object)) {
+		ni_error("Couldn't get list of active network interfaces");
+		return 1;
+	}
+
+	for (object = list_object->children; object; object = object->next) {
+		ni_netdev_t *dev = ni_objectmodel_unwrap_netif(object, NULL);
+
+		if (!dev || !dev->name)
+			continue;
+		if (!ni_dbus_object_get_service(object, NI_OBJECTMODEL_LLDP_INTERFACE))
+			continue;
+
+		found = optind >= argc;
+		for (i = optind; i < argc && !found; ++i)
+			found = ni_string_eq(argv[i], dev->name);
+		if (found && __do_lldp_neighbors(object, dev->name))
+			rv = 1;
+	}
+
+	return rv;
+}
+
+int
+ni_do_lldp(int argc, char **argv)
+{
+	static struct option options[] = {
+		{ "help",	no_argument,	NULL,	OPT_HELP },
+		{ NULL,		no_argument,	NULL,	0 }
+	};
+	const char *cmd;
+	int c;
+
+	optind = 1;
+	while ((c = getopt_long(argc, argv, "+h", options, NULL)) != EOF) {
+		switch (c) {
+		default:
+		case OPT_HELP:
+		case 'h':
+		usage:
+			fprintf(stderr,
+				"wicked [options] lldp <subcommand>\n"
+				"\nSupported subcommands:\n"
+				"  neighbors [ifname ...]\n"
+				"      Show the neighbors learned by the LLDP agents\n"
+				);
+			return c == OPT_HELP || c == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind >= argc)
+		goto usage;
+
+	cmd = argv[optind];
+	if (ni_string_eq(cmd, "neighbors"))
+		return ni_do_lldp_neighbors(argc - optind, argv + optind);
+
+	fprintf(stderr, "Unsupported lldp subcommand %s\n", cmd);
+	return 1;
+}
@@ -56,6 +56,7 @@
 #include "ifreload.h"
 #include "ifstatus.h"
 #include "arputil.h"
+#include "lldputil.h"
 
 enum {
 	OPT_HELP,
@@ -179,6 +180,7 @@ main(int argc, char **argv)
 				"  convert     [subcommand]\n"
 				"  xpath       [options] expr ...\n"
 				"  arp         [options] <ifname> <IP>\n"
+				"  lldp        [subcommand]\n"
 				);
 			goto done;
 
@@ -308,6 +310,9 @@ main(int argc, char **argv)
 	} else
 	if (!strcmp(cmd, "arp")) {
 		status = ni_do_arp(argc - optind, argv + optind);
+	} else
+	if (!strcmp(cmd, "lldp")) {
+		status = ni_do_lldp(argc - optind, argv + optind);
 	} else {
 		fprintf(stderr, "Unsupported command %s\n", cmd);
 		goto usage;
@@ -39,6 +39,8 @@
 #include <sys/types.h>
 #include <pwd.h>
 #include <grp.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include <wicked/address.h>
 #include <wicked/util.h>
@@ -71,7 +73,24 @@
 
 typedef ni_bool_t (*try_function_t)(const ni_sysconfig_t *, ni_netdev_t *, const char *);
 
-static ni_compat_netdev_t *	__ni_suse_read_interface(const char *, const char *);
+/*
+ * A single ifcfg file to parse; parsing may happen in a worker
+ * thread, the results are merged in file order by the caller.
+ */
+typedef struct ni_suse_ifcfg {
+	char *			pathname;
+	ni_compat_netdev_t *	compat;
+	ni_bool_t		routes;
+} ni_suse_ifcfg_t;
+
+typedef struct ni_suse_ifcfg_pool {
+	pthread_mutex_t		lock;
+	unsigned int		next;
+	unsigned int		count;
+	ni_suse_ifcfg_t *	files;
+} ni_suse_ifcfg_pool_t;
+
+static ni_bool_t		__ni_suse_read_interface(ni_suse_ifcfg_t *);
 static ni_bool_t		__ni_suse_read_globals(const char *, const char *);
 static void			__ni_suse_free_globals(void);
 static void			__ni_suse_show_unapplied_routes(void);
@@ -91,7 +110,16 @@ static ni_bool_t		__ni_wireless_parse_psk_auth(const ni_sysconfig_t *, ni_wirele
 static ni_bool_t		__ni_wireless_parse_eap_auth(const ni_sysconfig_t *, ni_wireless_network_t *,
 							const char *, const char *, ni_wireless_ap_scan_mode_t);
 static ni_bool_t		__ni_suse_parse_dhcp4_user_class(const ni_sysconfig_t *, ni_compat_netdev_t *, const char *);
+static ni_bool_t		__ni_suse_bootproto_static(const ni_sysconfig_t *, const ni_netdev_t *);
+static void			__ni_suse_addrconf_global_routes(ni_compat_netdev_t *);
 
+/*
+ * The global config, dhcp, routes and ifsysctl settings are read once
+ * by __ni_suse_read_globals() before any ifcfg file is parsed and are
+ * shared read-only by the (parallel) ifcfg file parsers then.
+ * The global routes are assigned to the interfaces while merging the
+ * results in file order, as this modifies them.
+ */
 static char *			__ni_suse_default_hostname;
 static ni_sysconfig_t *		__ni_suse_config_defaults;
 static ni_sysconfig_t *		__ni_suse_dhcp_defaults;
@@ -116,6 +144,8 @@ static ni_bool_t		__ni_ipv6_disbled;
 #define __NI_SUSE_ROUTES_GLOBAL			"routes"
 #define __NI_SUSE_IFSYSCTL_FILE			"ifsysctl"
 
+#define __NI_SUSE_IFCFG_WORKERS_MAX		64
+
 #define __NI_VLAN_TAG_MAX			4094
 #define __NI_WIRELESS_WPA_PSK_HEX_LEN	64
 #define __NI_WIRELESS_WPA_PSK_MIN_LEN	8
@@ -146,21 +176,6 @@ __ni_suse_ifcfg_valid_suffix(const char *name, size_t pfxlen)
 	return TRUE;
 }
 
-static ni_bool_t
-__ni_suse_ifcfg_valid_prefix(const char *basename, const char *prefix)
-{
-	size_t pfxlen;
-
-	if (!basename || !prefix)
-		return FALSE;
-
-	pfxlen = strlen(prefix);
-	if (strncmp(basename, prefix, pfxlen))
-		return FALSE;
-
-	return TRUE;
-}
-
 static int
 __ni_suse_ifcfg_scan_files(const char *dirname, ni_string_array_t *res)
 {
@@ -188,14 +203,111 @@ __ni_suse_ifcfg_scan_files(const char *dirname, ni_string_array_t *res)
 	return res->count - count;
 }
 
+/*
+ * Number of threads to parse the ifcfg files with as configured
+ * by WICKED_IFCFG_PARSE_WORKERS in the global config file.
+ */
+static unsigned int
+__ni_suse_ifcfg_workers(unsigned int count)
+{
+	unsigned int workers = 1;
+	const char *value;
+	long ncpus;
+
+	if (!__ni_suse_config_defaults)
+		return 1;
+
+	value = ni_sysconfig_get_value(__ni_suse_config_defaults,
+					"WICKED_IFCFG_PARSE_WORKERS");
+	if (ni_string_empty(value))
+		return 1;
+
+	if (ni_string_eq_nocase(value, "auto")) {
+		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		workers = ncpus > 0 ? ncpus : 1;
+	} else
+	if (ni_parse_uint(value, &workers, 10) < 0) {
+		ni_warn("%s: cannot parse WICKED_IFCFG_PARSE_WORKERS=\"%s\"",
+				__ni_suse_config_defaults->pathname, value);
+		return 1;
+	}
+
+	if (workers > __NI_SUSE_IFCFG_WORKERS_MAX)
+		workers = __NI_SUSE_IFCFG_WORKERS_MAX;
+	if (workers > count)
+		workers = count;
+	return workers ? workers : 1;
+}
+
+static void *
+__ni_suse_ifcfg_worker(void *arg)
+{
+	ni_suse_ifcfg_pool_t *pool = arg;
+	unsigned int i;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		i = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (i >= pool->count)
+			break;
+
+		__ni_suse_read_interface(&pool->files[i]);
+	}
+	return NULL;
+}
+
+/*
+ * Parse the ifcfg files using a pool of worker threads.
+ * The calling thread is one of the workers, so we're still
+ * processing all files when no thread could be started.
+ */
+static void
+__ni_suse_ifcfg_parse_parallel(ni_suse_ifcfg_t *files, unsigned int count,
+				unsigned int workers)
+{
+	ni_suse_ifcfg_pool_t pool;
+	pthread_t *threads;
+	unsigned int i, started = 0;
+	int err;
+
+	memset(&pool, 0, sizeof(pool));
+	pthread_mutex_init(&pool.lock, NULL);
+	pool.count = count;
+	pool.files = files;
+
+	threads = xcalloc(workers, sizeof(threads[0]));
+	for (i = 1; i < workers; ++i) {
+		if ((err = pthread_create(&threads[started], NULL,
+					__ni_suse_ifcfg_worker, &pool))) {
+			ni_warn("unable to start ifcfg parser thread: %s",
+					strerror(err));
+			break;
+		}
+		started++;
+	}
+	ni_debug_readwrite("Parsing %u ifcfg files using %u threads",
+				count, started + 1);
+
+	__ni_suse_ifcfg_worker(&pool);
+
+	for (i = 0; i < started; ++i)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+	pthread_mutex_destroy(&pool.lock);
+}
+
 ni_bool_t
 __ni_suse_get_ifconfig(const char *root, const char *path, ni_compat_ifconfig_t *result)
 {
 	ni_string_array_t files = NI_STRING_ARRAY_INIT;
+	ni_suse_ifcfg_t *ifcfgs = NULL;
 	ni_bool_t success = FALSE;
 	char *pathname = NULL;
 	const char *_path = __NI_SUSE_SYSCONFIG_NETWORK_DIR;
-	unsigned int i;
+	unsigned int i, workers;
 
 	if (!ni_string_empty(path))
 		_path = path;
@@ -215,24 +327,48 @@ __ni_suse_get_ifconfig(const char *root, const char *path, ni_compat_ifconfig_t
 			goto done;
 		}
 
+		ifcfgs = xcalloc(files.count, sizeof(ifcfgs[0]));
 		for (i = 0; i < files.count; ++i) {
 			const char *filename = files.data[i];
 			const char *ifname = filename + (sizeof(__NI_SUSE_CONFIG_IFPREFIX)-1);
-			char pathbuf[PATH_MAX];
+			ni_suse_ifcfg_t *ifcfg = &ifcfgs[i];
+
+			if (!ni_netdev_name_is_valid(ifname)) {
+				ni_error("Rejecting suspect interface name: %s", ifname);
+				continue;
+			}
+
+			ni_string_printf(&ifcfg->pathname, "%s/%s", pathname, filename);
+			ifcfg->compat = ni_compat_netdev_new(ifname);
+		}
+
+		workers = __ni_suse_ifcfg_workers(files.count);
+		if (workers > 1) {
+			__ni_suse_ifcfg_parse_parallel(ifcfgs, files.count, workers);
+		} else {
+			for (i = 0; i < files.count; ++i)
+				__ni_suse_read_interface(&ifcfgs[i]);
+		}
+
+		for (i = 0; i < files.count; ++i) {
+			ni_suse_ifcfg_t *ifcfg = &ifcfgs[i];
 			ni_compat_netdev_t *compat;
 
-			snprintf(pathbuf, sizeof(pathbuf), "%s/%s", pathname, filename);
-			if (!(compat = __ni_suse_read_interface(pathbuf, ifname)))
+			if (!(compat = ifcfg->compat))
 				continue;
 
+			if (ifcfg->routes)
+				__ni_suse_addrconf_global_routes(compat);
+
 			/*
 			 * TODO: source should not contain root-dir, ...
 			 * Can't change it not without to make the uuid useless.
 			 *
 			snprintf(pathbuf, sizeof(pathbuf), "%s/%s", path, filename);
 			*/
-			ni_compat_netdev_client_state_set(compat->dev, pathbuf);
+			ni_compat_netdev_client_state_set(compat->dev, ifcfg->pathname);
 			ni_compat_netdev_array_append(&result->netdevs, compat);
+			ifcfg->compat = NULL;
 		}
 
 		if (__ni_suse_config_defaults) {
@@ -258,6 +394,13 @@ __ni_suse_get_ifconfig(const char *root, const char *path, ni_compat_ifconfig_t
 	success = TRUE;
 
 done:
+	if (ifcfgs) {
+		for (i = 0; i < files.count; ++i) {
+			ni_string_free(&ifcfgs[i].pathname);
+			ni_compat_netdev_free(ifcfgs[i].compat);
+		}
+		free(ifcfgs);
+	}
 	ni_string_free(&pathname);
 	__ni_suse_free_globals();
 	ni_string_array_destroy(&files);
@@ -311,6 +454,7 @@ __ni_suse_read_global_ifsysctl(const char *root, const char *path)
 	unsigned int i;
 
 	ni_var_array_destroy(&__ni_suse_global_ifsysctl);
+	ni_var_array_index(&__ni_suse_global_ifsysctl);
 
 	if (ni_string_empty(root))
 		root = "";
@@ -1125,49 +1269,30 @@ error:
 /*
  * Read the configuration of a single interface from a sysconfig file
  */
-static ni_compat_netdev_t *
-__ni_suse_read_interface(const char *filename, const char *ifname)
+static ni_bool_t
+__ni_suse_read_interface(ni_suse_ifcfg_t *ifcfg)
 {
-	const char *basename = ni_basename(filename);
-	size_t pfxlen = sizeof(__NI_SUSE_CONFIG_IFPREFIX)-1;
-	ni_compat_netdev_t *compat = NULL;
 	ni_sysconfig_t *sc;
 
-	if (ni_string_len(ifname) == 0) {
-		if (!__ni_suse_ifcfg_valid_prefix(basename, __NI_SUSE_CONFIG_IFPREFIX)) {
-			ni_error("Rejecting file without '%s' prefix: %s",
-				__NI_SUSE_CONFIG_IFPREFIX, filename);
-			return NULL;
-		}
-		if (!__ni_suse_ifcfg_valid_suffix(basename, pfxlen)) {
-			ni_error("Rejecting blacklisted %sfile: %s",
-				__NI_SUSE_CONFIG_IFPREFIX, filename);
-			return NULL;
-		}
-		ifname = basename + pfxlen;
-	}
-
-	if (!ni_netdev_name_is_valid(ifname)) {
-		ni_error("Rejecting suspect interface name: %s", ifname);
-		return NULL;
-	}
+	if (!ifcfg->compat)
+		return FALSE;
 
-	if (!(sc = ni_sysconfig_read(filename)))
+	if (!(sc = ni_sysconfig_read(ifcfg->pathname)))
 		goto error;
 
-	compat = ni_compat_netdev_new(ifname);
-	if (!compat || !__ni_suse_sysconfig_read(sc, compat))
+	if (!__ni_suse_sysconfig_read(sc, ifcfg->compat))
 		goto error;
 
+	ifcfg->routes = __ni_suse_bootproto_static(sc, ifcfg->compat->dev);
 	ni_sysconfig_destroy(sc);
-	return compat;
+	return TRUE;
 
 error:
 	if (sc)
 		ni_sysconfig_destroy(sc);
-	if (compat)
-		ni_compat_netdev_free(compat);
-	return NULL;
+	ni_compat_netdev_free(ifcfg->compat);
+	ifcfg->compat = NULL;
+	return FALSE;
 }
 
 /*
@@ -2705,9 +2830,11 @@ __try_tunnel_tuntap(const ni_sysconfig_t *sc, ni_compat_netdev_t *compat)
 
 	if ((value = ni_sysconfig_get_value(sc, "TUNNEL_SET_OWNER"))) {
 		if (ni_parse_uint(value, &tuntap->owner, 10)) {
-			struct passwd *pw;
+			struct passwd pwbuf, *pw = NULL;
+			char buf[4096];
 
-			if (!(pw = getpwnam(value))) {
+			/* reentrant, we may run in a parser thread */
+			if (getpwnam_r(value, &pwbuf, buf, sizeof(buf), &pw) || !pw) {
 				ni_error("ifcfg-%s: Cannot parse TUNNEL_SET_OWNER='%s'",
 					dev->name, value);
 				return -1;
@@ -2717,9 +2844,10 @@ __try_tunnel_tuntap(const ni_sysconfig_t *sc, ni_compat_netdev_t *compat)
 	}
 	if ((value = ni_sysconfig_get_value(sc, "TUNNEL_SET_GROUP"))) {
 		if (ni_parse_uint(value, &tuntap->group, 10)) {
-			struct group *gr;
+			struct group grbuf, *gr = NULL;
+			char buf[4096];
 
-			if (!(gr = getgrnam(value))) {
+			if (getgrnam_r(value, &grbuf, buf, sizeof(buf), &gr) || !gr) {
 				ni_error("ifcfg-%s: Cannot parse TUNNEL_SET_GROUP='%s'",
 					dev->name, value);
 				return -1;
@@ -3060,7 +3188,6 @@ __ni_suse_addrconf_static(const ni_sysconfig_t *sc, ni_compat_netdev_t *compat)
 	ni_bool_t ipv4_enabled = TRUE;
 	ni_bool_t ipv6_enabled = TRUE;
 	const char *routespath;
-	ni_stringbuf_t out = NI_STRINGBUF_INIT_DYNAMIC;
 
 	if (dev->ipv4 && ni_tristate_is_disabled(dev->ipv4->conf.enabled))
 		ipv4_enabled = FALSE;
@@ -3108,6 +3235,29 @@ __ni_suse_addrconf_static(const ni_sysconfig_t *sc, ni_compat_netdev_t *compat)
 		__ni_suse_read_routes(&dev->routes, routespath, dev->name);
 	}
 
+	return TRUE;
+}
+
+/*
+ * Assign the matching global routes to the interface.
+ *
+ * Called while merging the parsed ifcfg files in file order as it
+ * modifies the global routes: a route gets the device name of the
+ * first interface it matches on.
+ */
+static void
+__ni_suse_addrconf_global_routes(ni_compat_netdev_t *compat)
+{
+	ni_netdev_t *dev = compat->dev;
+	ni_bool_t ipv4_enabled = TRUE;
+	ni_bool_t ipv6_enabled = TRUE;
+	ni_stringbuf_t out = NI_STRINGBUF_INIT_DYNAMIC;
+
+	if (dev->ipv4 && ni_tristate_is_disabled(dev->ipv4->conf.enabled))
+		ipv4_enabled = FALSE;
+	if (dev->ipv6 && ni_tristate_is_disabled(dev->ipv6->conf.enabled))
+		ipv6_enabled = FALSE;
+
 	if (__ni_suse_global_routes) {
 		ni_route_table_t *tab;
 		unsigned int i;
@@ -3182,8 +3332,6 @@ __ni_suse_addrconf_static(const ni_sysconfig_t *sc, ni_compat_netdev_t *compat)
 			}
 		}
 	}
-
-	return TRUE;
 }
 
 static ni_bool_t
@@ -3498,6 +3646,26 @@ __ni_suse_addrconf_autoip4(const ni_sysconfig_t *sc, ni_compat_netdev_t *compat,
 	return TRUE;
 }
 
+/*
+ * Whether __ni_suse_bootproto applies the static addrconf (and routes)
+ */
+static ni_bool_t
+__ni_suse_bootproto_static(const ni_sysconfig_t *sc, const ni_netdev_t *dev)
+{
+	const char *bootproto;
+
+	if ((bootproto = ni_sysconfig_get_value(sc, "BOOTPROTO")) == NULL)
+		return TRUE;
+	else if (!bootproto[0] || ni_string_eq(dev->name, "lo"))
+		return TRUE;
+
+	if (ni_string_eq_nocase(bootproto, "none") ||
+	    ni_string_eq_nocase(bootproto, "ibft"))
+		return FALSE;
+
+	return TRUE;
+}
+
 static ni_bool_t
 __ni_suse_bootproto(const ni_sysconfig_t *sc, ni_compat_netdev_t *compat)
 {
@@ -3652,6 +3820,7 @@ __ni_suse_read_ifsysctl(ni_sysconfig_t *sc, ni_compat_netdev_t *compat)
 	if (ni_string_empty(dirname))
 		return FALSE;
 
+	ni_var_array_index(&ifsysctl);
 	ni_var_array_copy(&ifsysctl, &__ni_suse_global_ifsysctl);
 	snprintf(pathbuf, sizeof(pathbuf), "%s/%s-%s", dirname,
 			__NI_SUSE_IFSYSCTL_FILE, dev->name);
@@ -32,6 +32,80 @@ static const char *	__ni_dhcp4_print_doflags(unsigned int);
 static uint32_t ni_dhcp4_xid;
 ni_dhcp4_device_t *	ni_dhcp4_active;
 
+/*
+ * The active devices are additionally hashed by ifindex and by the
+ * xid of the last message sent, as they're looked up for every event
+ * and received packet.
+ */
+#define NI_DHCP4_DEVICE_HASH_SIZE	64
+
+static ni_dhcp4_device_t *	ni_dhcp4_ifindex_hash[NI_DHCP4_DEVICE_HASH_SIZE];
+static ni_dhcp4_device_t *	ni_dhcp4_xid_hash[NI_DHCP4_DEVICE_HASH_SIZE];
+
+/*
+ * Rate limit of the initial broadcasts, shared by all devices
+ */
+static ni_token_bucket_t	ni_dhcp4_transmit_bucket;
+
+/*
+ * Renewal times of the leases by server, when aligned
+ */
+static ni_timer_align_t *	ni_dhcp4_renewal_groups;
+
+static void			ni_dhcp4_device_transmit_cancel(ni_dhcp4_device_t *);
+
+static void
+ni_dhcp4_device_hash_xid(ni_dhcp4_device_t *dev)
+{
+	ni_dhcp4_device_t **pos, *cur;
+
+	pos = &ni_dhcp4_xid_hash[dev->hash.xid % NI_DHCP4_DEVICE_HASH_SIZE];
+	for ( ; (cur = *pos) != NULL; pos = &cur->hash.xid_next) {
+		if (cur == dev) {
+			*pos = dev->hash.xid_next;
+			break;
+		}
+	}
+	dev->hash.xid_next = NULL;
+	dev->hash.xid = dev->dhcp4.xid;
+
+	if (dev->hash.xid) {
+		pos = &ni_dhcp4_xid_hash[dev->hash.xid % NI_DHCP4_DEVICE_HASH_SIZE];
+		dev->hash.xid_next = *pos;
+		*pos = dev;
+	}
+}
+
+static void
+ni_dhcp4_device_unhash(ni_dhcp4_device_t *dev)
+{
+	ni_dhcp4_device_t **pos, *cur;
+
+	pos = &ni_dhcp4_ifindex_hash[dev->link.ifindex % NI_DHCP4_DEVICE_HASH_SIZE];
+	for ( ; (cur = *pos) != NULL; pos = &cur->hash.ifindex_next) {
+		if (cur == dev) {
+			*pos = dev->hash.ifindex_next;
+			break;
+		}
+	}
+	dev->hash.ifindex_next = NULL;
+
+	dev->dhcp4.xid = 0;
+	ni_dhcp4_device_hash_xid(dev);
+}
+
+/*
+ * Assign a new xid for the next message
+ */
+static void
+ni_dhcp4_device_new_xid(ni_dhcp4_device_t *dev)
+{
+	if (ni_dhcp4_xid == 0)
+		ni_dhcp4_xid = random();
+	dev->dhcp4.xid = ni_dhcp4_xid++;
+	ni_dhcp4_device_hash_xid(dev);
+}
+
 /*
  * Create and destroy dhcp4 device handles
  */
@@ -61,6 +135,10 @@ ni_dhcp4_device_new(const char *ifname, const ni_linkinfo_t *link)
 	/* append to end of list */
 	*pos = dev;
 
+	pos = &ni_dhcp4_ifindex_hash[dev->link.ifindex % NI_DHCP4_DEVICE_HASH_SIZE];
+	dev->hash.ifindex_next = *pos;
+	*pos = dev;
+
 	return dev;
 }
 
@@ -69,7 +147,8 @@ ni_dhcp4_device_by_index(unsigned int ifindex)
 {
 	ni_dhcp4_device_t *dev;
 
-	for (dev = ni_dhcp4_active; dev; dev = dev->next) {
+	dev = ni_dhcp4_ifindex_hash[ifindex % NI_DHCP4_DEVICE_HASH_SIZE];
+	for ( ; dev; dev = dev->hash.ifindex_next) {
 		if (dev->system.ifindex == ifindex)
 			return dev;
 	}
@@ -77,6 +156,27 @@ ni_dhcp4_device_by_index(unsigned int ifindex)
 	return NULL;
 }
 
+/*
+ * Find the device, which is waiting for a reply with this xid.
+ * The chains may contain devices, which reset their xid since.
+ */
+ni_dhcp4_device_t *
+ni_dhcp4_device_by_xid(uint32_t xid)
+{
+	ni_dhcp4_device_t *dev;
+
+	if (xid == 0)
+		return NULL;
+
+	dev = ni_dhcp4_xid_hash[xid % NI_DHCP4_DEVICE_HASH_SIZE];
+	for ( ; dev; dev = dev->hash.xid_next) {
+		if (dev->dhcp4.xid == xid)
+			return dev;
+	}
+
+	return NULL;
+}
+
 static void
 ni_dhcp4_device_close(ni_dhcp4_device_t *dev)
 {
@@ -91,6 +191,7 @@ ni_dhcp4_device_close(ni_dhcp4_device_t *dev)
 		ni_timer_cancel(dev->defer.timer);
 		dev->defer.timer = NULL;
 	}
+	ni_dhcp4_device_transmit_cancel(dev);
 	if (dev->fsm.timer) {
 		ni_warn("%s: timer active for %s", __func__, dev->ifname);
 		ni_timer_cancel(dev->fsm.timer);
@@ -153,7 +254,12 @@ ni_dhcp4_device_free(ni_dhcp4_device_t *dev)
 			break;
 		}
 	}
+	ni_dhcp4_device_unhash(dev);
 	free(dev);
+
+	/* the renewals to align with are gone with the last device */
+	if (!ni_dhcp4_active)
+		ni_timer_align_destroy(&ni_dhcp4_renewal_groups);
 }
 
 /*
@@ -539,7 +645,7 @@ ni_dhcp4_device_start(ni_dhcp4_device_t *dev)
 {
 	ni_netconfig_t *nc;
 	ni_netdev_t *ifp;
-	ni_int_range_t jitter = { .max = 500, /* msec */ };
+	ni_int_range_t jitter = { .min = 0 };
 	unsigned long msec = dev->config->start_delay * 1000;
 
 	ni_dhcp4_device_drop_buffer(dev);
@@ -552,6 +658,7 @@ ni_dhcp4_device_start(ni_dhcp4_device_t *dev)
 	}
 
 	/* Reuse defer pointer for this one-shot timer */
+	jitter.max = ni_dhcp4_config_start_jitter();
 	msec = ni_timeout_randomize(msec, &jitter);
 	dev->defer.timer = ni_timer_register(msec, ni_dhcp4_device_start_delayed, dev);
 
@@ -598,16 +705,91 @@ ni_dhcp4_device_prepare_message(void *data)
 	return 0;
 }
 
+/*
+ * Advance the renewal to the one of other leases from the same server,
+ * when they're close (see <renewal-window>), to renew them together.
+ */
+unsigned long
+ni_dhcp4_device_align_renewal(const ni_dhcp4_device_t *dev, const ni_addrconf_lease_t *lease,
+				unsigned long timeout)
+{
+	unsigned long window = ni_dhcp4_config_renewal_window() * 1000UL;
+
+	if (window > timeout / 4)
+		window = timeout / 4;
+	if (!window || !lease || !lease->dhcp4.server_id.s_addr)
+		return timeout;
+
+	return ni_timer_align(&ni_dhcp4_renewal_groups, &lease->dhcp4.server_id,
+			sizeof(lease->dhcp4.server_id), timeout, window);
+}
+
+/*
+ * Send the initial message now or, when the transmit rate limit
+ * is exceeded, as soon as it permits. The capture retransmits on
+ * its own timeout afterwards.
+ */
+static void
+ni_dhcp4_device_transmit_delayed(void *user_data, const ni_timer_t *timer)
+{
+	ni_dhcp4_device_t *dev = user_data;
+
+	if (dev->transmit.timer != timer) {
+		ni_warn("%s: bad timer handle", __func__);
+		return;
+	}
+	dev->transmit.timer = NULL;
+
+	if (!dev->capture)
+		return;
+
+	ni_debug_dhcp("%s: sending delayed %s with xid 0x%x", dev->ifname,
+			ni_dhcp4_message_name(dev->transmit.msg_code),
+			htonl(dev->dhcp4.xid));
+	if (ni_capture_send(dev->capture, &dev->message, &dev->transmit.timeout) < 0)
+		ni_debug_dhcp("unable to broadcast message");
+}
+
+static int
+ni_dhcp4_device_transmit(ni_dhcp4_device_t *dev, const ni_timeout_param_t *timeout)
+{
+	const ni_config_transmit_rate_t *tr = ni_dhcp4_config_transmit_rate();
+	ni_token_bucket_t *tb = &ni_dhcp4_transmit_bucket;
+	unsigned long delay;
+
+	if (tb->rate != tr->rate || tb->burst != (tr->burst ? tr->burst : 1))
+		ni_token_bucket_init(tb, tr->rate, tr->burst);
+
+	if (!(delay = ni_token_bucket_reserve(tb, 0)))
+		return ni_capture_send(dev->capture, &dev->message, timeout);
+
+	ni_debug_dhcp("%s: delaying %s by %lu msec to limit the transmit rate",
+			dev->ifname, ni_dhcp4_message_name(dev->transmit.msg_code), delay);
+	ni_capture_disarm_retransmit(dev->capture);
+	dev->transmit.timeout = *timeout;
+	dev->transmit.timer = ni_timer_register(delay, ni_dhcp4_device_transmit_delayed, dev);
+	return 0;
+}
+
+static void
+ni_dhcp4_device_transmit_cancel(ni_dhcp4_device_t *dev)
+{
+	if (dev->transmit.timer) {
+		ni_timer_cancel(dev->transmit.timer);
+		dev->transmit.timer = NULL;
+	}
+}
+
 int
 ni_dhcp4_device_send_message(ni_dhcp4_device_t *dev, unsigned int msg_code, const ni_addrconf_lease_t *lease)
 {
 	ni_timeout_param_t timeout;
 	int rv;
 
+	ni_dhcp4_device_transmit_cancel(dev);
+
 	/* Assign a new XID to this message */
-	if (ni_dhcp4_xid == 0)
-		ni_dhcp4_xid = random();
-	dev->dhcp4.xid = ni_dhcp4_xid++;
+	ni_dhcp4_device_new_xid(dev);
 
 	dev->transmit.msg_code = msg_code;
 	dev->transmit.lease = lease;
@@ -640,7 +822,7 @@ ni_dhcp4_device_send_message(ni_dhcp4_device_t *dev, unsigned int msg_code, cons
 		timeout.jitter.max = 1;
 		timeout.timeout_callback = ni_dhcp4_device_prepare_message;
 		timeout.timeout_data = dev;
-		rv = ni_capture_send(dev->capture, &dev->message, &timeout);
+		rv = ni_dhcp4_device_transmit(dev, &timeout);
 		break;
 
 	default:
@@ -669,10 +851,10 @@ ni_dhcp4_device_send_message_unicast(ni_dhcp4_device_t *dev, unsigned int msg_co
 		.sin_port = htons(DHCP4_SERVER_PORT),
 	};
 
+	ni_dhcp4_device_transmit_cancel(dev);
+
 	/* Assign a new XID to this message */
-	if (ni_dhcp4_xid == 0)
-		ni_dhcp4_xid = random();
-	dev->dhcp4.xid = ni_dhcp4_xid++;
+	ni_dhcp4_device_new_xid(dev);
 
 	dev->transmit.msg_code = msg_code;
 	dev->transmit.lease = lease;
@@ -697,6 +879,7 @@ ni_dhcp4_device_disarm_retransmit(ni_dhcp4_device_t *dev)
 	/* Clear retransmit timer */
 	if (dev->capture)
 		ni_capture_disarm_retransmit(dev->capture);
+	ni_dhcp4_device_transmit_cancel(dev);
 
 	/* Drop the message buffer */
 	ni_dhcp4_device_drop_buffer(dev);
@@ -713,7 +896,7 @@ void
 ni_dhcp4_device_arp_close(ni_dhcp4_device_t *dev)
 {
 	if (dev->arp.handle) {
-		ni_arp_socket_close(dev->arp.handle);
+		ni_arp_unsubscribe(dev->arp.handle);
 		dev->arp.handle = NULL;
 	}
 }
@@ -803,3 +986,21 @@ ni_dhcp4_config_max_lease_time(void)
 {
 	return ni_global.config->addrconf.dhcp4.lease_time;
 }
+
+unsigned int
+ni_dhcp4_config_renewal_window(void)
+{
+	return ni_global.config->addrconf.dhcp4.renewal_window;
+}
+
+unsigned int
+ni_dhcp4_config_start_jitter(void)
+{
+	return ni_global.config->addrconf.dhcp4.start_jitter;
+}
+
+const ni_config_transmit_rate_t *
+ni_dhcp4_config_transmit_rate(void)
+{
+	return &ni_global.config->addrconf.dhcp4.transmit_rate;
+}
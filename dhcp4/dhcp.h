@@ -14,6 +14,7 @@
 #include <wicked/wicked.h>
 #include <wicked/socket.h>
 #include "netinfo_priv.h"
+#include "appconfig.h"
 #include "buffer.h"
 
 enum fsm_state {
@@ -30,6 +31,7 @@ enum fsm_state {
 };
 
 typedef struct ni_dhcp4_message ni_dhcp4_message_t;
+typedef struct ni_dhcp4_option_index ni_dhcp4_option_index_t;
 typedef struct ni_dhcp4_config ni_dhcp4_config_t;
 typedef struct ni_dhcp4_request	ni_dhcp4_request_t;
 
@@ -37,6 +39,12 @@ typedef struct ni_dhcp4_device {
 	struct ni_dhcp4_device *	next;
 	unsigned int		users;
 
+	struct {
+	    struct ni_dhcp4_device *ifindex_next;
+	    struct ni_dhcp4_device *xid_next;
+	    uint32_t		xid;		/* key of the xid chain */
+	} hash;
+
 	char *			ifname;
 	ni_linkinfo_t		link;
 
@@ -66,6 +74,8 @@ typedef struct ni_dhcp4_device {
 	struct {
 	    unsigned int	msg_code;
 	    const ni_addrconf_lease_t *lease;
+	    const ni_timer_t *	timer;		/* delayed by the rate limit */
+	    ni_timeout_param_t	timeout;
 	} transmit;
 
 	struct {
@@ -77,7 +87,7 @@ typedef struct ni_dhcp4_device {
 	ni_buffer_t		message;
 
 	struct {
-	   ni_arp_socket_t *	handle;
+	   ni_arp_subscription_t *handle;
 	   unsigned int		nprobes;
 	   unsigned int		nclaims;
 	} arp;
@@ -225,6 +235,12 @@ extern int		ni_dhcp4_build_message(const ni_dhcp4_device_t *,
 extern void		ni_dhcp4_fsm_link_up(ni_dhcp4_device_t *);
 extern void		ni_dhcp4_fsm_link_down(ni_dhcp4_device_t *);
 
+extern int		ni_dhcp4_option_index_build(ni_dhcp4_option_index_t *,
+				const ni_dhcp4_message_t *, const ni_buffer_t *);
+extern int		ni_dhcp4_option_index_get(ni_dhcp4_option_index_t *, unsigned int, ni_buffer_t *);
+extern int		ni_dhcp4_parse_message_type(ni_dhcp4_option_index_t *, struct in_addr *);
+extern int		ni_dhcp4_parse_options(const ni_dhcp4_message_t *, ni_dhcp4_option_index_t *,
+				ni_addrconf_lease_t **);
 extern int		ni_dhcp4_parse_response(const ni_dhcp4_message_t *, ni_buffer_t *, ni_addrconf_lease_t **);
 
 extern int		ni_dhcp4_socket_open(ni_dhcp4_device_t *);
@@ -235,6 +251,9 @@ extern void		ni_dhcp4_device_stop(ni_dhcp4_device_t *);
 extern unsigned int	ni_dhcp4_device_uptime(const ni_dhcp4_device_t *, unsigned int);
 extern ni_dhcp4_device_t *ni_dhcp4_device_new(const char *, const ni_linkinfo_t *);
 extern ni_dhcp4_device_t *ni_dhcp4_device_by_index(unsigned int);
+extern ni_dhcp4_device_t *ni_dhcp4_device_by_xid(uint32_t);
+extern unsigned long	ni_dhcp4_device_align_renewal(const ni_dhcp4_device_t *,
+				const ni_addrconf_lease_t *, unsigned long);
 extern ni_dhcp4_device_t *ni_dhcp4_device_get(ni_dhcp4_device_t *);
 extern void		ni_dhcp4_device_put(ni_dhcp4_device_t *);
 extern void		ni_dhcp4_device_event(ni_dhcp4_device_t *, ni_netdev_t *, ni_event_t);
@@ -266,6 +285,9 @@ extern int		ni_dhcp4_config_ignore_server(struct in_addr);
 extern int		ni_dhcp4_config_have_server_preference(void);
 extern int		ni_dhcp4_config_server_preference(struct in_addr);
 extern unsigned int	ni_dhcp4_config_max_lease_time(void);
+extern unsigned int	ni_dhcp4_config_start_jitter(void);
+extern unsigned int	ni_dhcp4_config_renewal_window(void);
+extern const ni_config_transmit_rate_t *ni_dhcp4_config_transmit_rate(void);
 extern void		ni_dhcp4_config_free(ni_dhcp4_config_t *);
 
 extern ni_dhcp4_request_t *ni_dhcp4_request_new(void);
@@ -36,7 +36,8 @@ static const char *	ni_dhcp4_fsm_state_name(enum fsm_state);
 static int		ni_dhcp4_process_offer(ni_dhcp4_device_t *, ni_addrconf_lease_t *);
 static int		ni_dhcp4_process_ack(ni_dhcp4_device_t *, ni_addrconf_lease_t *);
 static int		ni_dhcp4_process_nak(ni_dhcp4_device_t *);
-static void		ni_dhcp4_fsm_process_arp_packet(ni_arp_socket_t *, const ni_arp_packet_t *, void *);
+static void		ni_dhcp4_fsm_process_arp_event(ni_arp_subscription_t *, ni_arp_event_t,
+					const ni_arp_packet_t *, void *);
 static void		ni_dhcp4_fsm_fail_lease(ni_dhcp4_device_t *);
 static int		ni_dhcp4_fsm_validate_lease(ni_dhcp4_device_t *, ni_addrconf_lease_t *);
 static void		ni_dhcp4_send_event(enum ni_dhcp4_event, ni_dhcp4_device_t *, ni_addrconf_lease_t *);
@@ -74,9 +75,11 @@ ni_dhcp4_fsm_init_device(ni_dhcp4_device_t *dev)
 int
 ni_dhcp4_fsm_process_dhcp4_packet(ni_dhcp4_device_t *dev, ni_buffer_t *msgbuf)
 {
+	ni_dhcp4_option_index_t index;
 	ni_dhcp4_message_t *message;
 	ni_addrconf_lease_t *lease = NULL;
-	int msg_code;
+	struct in_addr srv_addr;
+	int msg_code, weight = 0;
 
 	if (dev->fsm.state == NI_DHCP4_STATE_VALIDATING) {
 		/* We arrive here, when some dhcp4 packet arrives after
@@ -101,27 +104,17 @@ ni_dhcp4_fsm_process_dhcp4_packet(ni_dhcp4_device_t *dev, ni_buffer_t *msgbuf)
 		return -1;
 	}
 
-	msg_code = ni_dhcp4_parse_response(message, msgbuf, &lease);
-	if (msg_code < 0) {
+	if (ni_dhcp4_option_index_build(&index, message, msgbuf) < 0 ||
+	    (msg_code = ni_dhcp4_parse_message_type(&index, &srv_addr)) < 0) {
 		/* Ignore this message, time out later */
 		ni_error("unable to parse DHCP4 response");
 		return -1;
 	}
 
-	/* set reqest client-id in the response early to have it in test mode */
-	ni_opaque_set(&lease->dhcp4.client_id,	dev->config->client_id.data,
-						dev->config->client_id.len);
-
-	ni_debug_dhcp("%s: received %s message in state %s",
-			dev->ifname, ni_dhcp4_message_name(msg_code),
-			ni_dhcp4_fsm_state_name(dev->fsm.state));
-
 	/* When receiving a DHCP4 OFFER, verify sender address against list of
-	 * servers to ignore, and preferred servers. */
+	 * servers to ignore, and preferred servers. This happens before the
+	 * lease is parsed, so rejected offers cost no more than the index. */
 	if (msg_code == DHCP4_OFFER && dev->fsm.state == NI_DHCP4_STATE_SELECTING) {
-		struct in_addr srv_addr = lease->dhcp4.server_id;
-		int weight = 0;
-
 		if (ni_dhcp4_config_ignore_server(srv_addr)) {
 			ni_debug_dhcp("%s: ignoring DHCP4 offer from %s",
 					dev->ifname, inet_ntoa(srv_addr));
@@ -146,7 +139,7 @@ ni_dhcp4_fsm_process_dhcp4_packet(ni_dhcp4_device_t *dev, ni_buffer_t *msgbuf)
 				weight = 100;
 
 			ni_debug_dhcp("received lease offer from %s; server weight=%d (best offer=%d)",
-					inet_ntoa(lease->dhcp4.server_id), weight,
+					inet_ntoa(srv_addr), weight,
 					dev->best_offer.weight);
 
 			/* negative weight means never. */
@@ -154,15 +147,33 @@ ni_dhcp4_fsm_process_dhcp4_packet(ni_dhcp4_device_t *dev, ni_buffer_t *msgbuf)
 				goto out;
 
 			/* weight between 0 and 100 means maybe. */
-			if (weight < 100) {
-				if (dev->best_offer.weight < weight) {
-					ni_dhcp4_device_set_best_offer(dev, lease, weight);
-					return 0;
-				}
+			if (weight < 100 && dev->best_offer.weight >= weight)
 				goto out;
-			}
-			/* If the weight has maximum value, just accept this offer. */
 		}
+	}
+
+	msg_code = ni_dhcp4_parse_options(message, &index, &lease);
+	if (msg_code < 0) {
+		/* Ignore this message, time out later */
+		ni_error("unable to parse DHCP4 response");
+		return -1;
+	}
+
+	/* set reqest client-id in the response early to have it in test mode */
+	ni_opaque_set(&lease->dhcp4.client_id,	dev->config->client_id.data,
+						dev->config->client_id.len);
+
+	ni_debug_dhcp("%s: received %s message in state %s",
+			dev->ifname, ni_dhcp4_message_name(msg_code),
+			ni_dhcp4_fsm_state_name(dev->fsm.state));
+
+	if (msg_code == DHCP4_OFFER && dev->fsm.state == NI_DHCP4_STATE_SELECTING) {
+		/* weight between 0 and 100 means maybe; wait for more. */
+		if (!dev->dhcp4.accept_any_offer && weight < 100) {
+			ni_dhcp4_device_set_best_offer(dev, lease, weight);
+			return 0;
+		}
+		/* If the weight has maximum value, just accept this offer. */
 		ni_dhcp4_device_set_best_offer(dev, lease, weight);
 		lease = NULL;
 	}
@@ -553,8 +564,7 @@ ni_dhcp4_fsm_timeout(ni_dhcp4_device_t *dev)
 		break;
 
 	case NI_DHCP4_STATE_VALIDATING:
-		/* Send the next ARP probe */
-		ni_dhcp4_fsm_arp_validate(dev);
+		/* The ARP probes are sent by the arp engine */
 		break;
 
 	case NI_DHCP4_STATE_BOUND:
@@ -762,9 +772,13 @@ ni_dhcp4_fsm_commit_lease(ni_dhcp4_device_t *dev, ni_addrconf_lease_t *lease)
 			dev->defer.timer = NULL;
 		}
 		if (dev->config->dry_run == NI_DHCP4_RUN_NORMAL) {
-			ni_debug_dhcp("%s: schedule renewal of lease in %u seconds",
-					dev->ifname, lease->dhcp4.renewal_time);
-			ni_dhcp4_fsm_set_timeout(dev, lease->dhcp4.renewal_time);
+			unsigned long msec;
+
+			msec = ni_dhcp4_device_align_renewal(dev, lease,
+					lease->dhcp4.renewal_time * 1000UL);
+			ni_debug_dhcp("%s: schedule renewal of lease in %lu.%03lu seconds",
+					dev->ifname, msec / 1000, msec % 1000);
+			ni_dhcp4_fsm_set_timeout_msec(dev, msec);
 		}
 
 		/* If the user requested a specific route metric, apply it now */
@@ -941,6 +955,10 @@ ni_dhcp4_fsm_validate_lease(ni_dhcp4_device_t *dev, ni_addrconf_lease_t *lease)
 		return -1;
 	}
 
+	if (dev->fsm.timer) {
+		ni_timer_cancel(dev->fsm.timer);
+		dev->fsm.timer = NULL;
+	}
 	dev->fsm.state = NI_DHCP4_STATE_VALIDATING;
 	return 0;
 }
@@ -948,49 +966,34 @@ ni_dhcp4_fsm_validate_lease(ni_dhcp4_device_t *dev, ni_addrconf_lease_t *lease)
 int
 ni_dhcp4_fsm_arp_validate(ni_dhcp4_device_t *dev)
 {
-	struct in_addr null = { 0 };
 	struct in_addr claim;
 
 	if (!dev->lease)
 		return -1;
 
 	claim = dev->lease->dhcp4.address;
-	if (dev->arp.handle == NULL) {
-		dev->arp.handle = ni_arp_socket_open(&dev->system,
-				ni_dhcp4_fsm_process_arp_packet, dev);
-		if (!dev->arp.handle->user_data) {
-			ni_error("%s: unable to create ARP handle", dev->ifname);
-			return -1;
-		}
+	ni_dhcp4_device_arp_close(dev);
+	dev->arp.handle = ni_arp_subscribe(&dev->system, claim,
+			ni_dhcp4_fsm_process_arp_event, dev);
+	if (!dev->arp.handle) {
+		ni_error("%s: unable to create ARP handle", dev->ifname);
+		return -1;
 	}
 
-	if (dev->arp.nprobes) {
-		ni_debug_dhcp("%s: arp validate: probing for %s",
-				dev->ifname, inet_ntoa(claim));
-		ni_arp_send_request(dev->arp.handle, null, claim);
-		dev->arp.nprobes--;
-	} else if (dev->arp.nclaims) {
-		ni_debug_dhcp("%s: arp validate: claiming %s",
-				dev->ifname, inet_ntoa(claim));
-		ni_arp_send_grat_request(dev->arp.handle, claim);
-		dev->arp.nclaims--;
-	} else {
-		/* Wow, we're done! */
-		ni_info("%s: Successfully validated DHCPv4 address %s",
+	ni_debug_dhcp("%s: arp validate: probing for %s",
 			dev->ifname, inet_ntoa(claim));
-		ni_dhcp4_fsm_commit_lease(dev, dev->lease);
-		ni_dhcp4_device_arp_close(dev);
-		return 0;
+	ni_arp_probe(dev->arp.handle, dev->arp.nprobes,
+			NI_DHCP4_ARP_TIMEOUT, NI_DHCP4_ARP_TIMEOUT);
+	if (dev->arp.nclaims) {
+		ni_arp_announce(dev->arp.handle, dev->arp.nclaims,
+				NI_DHCP4_ARP_TIMEOUT, NI_DHCP4_ARP_TIMEOUT);
 	}
-
-	ni_dhcp4_fsm_set_timeout_msec(dev, NI_DHCP4_ARP_TIMEOUT);
 	return 0;
 }
 
-void
-ni_dhcp4_fsm_process_arp_packet(ni_arp_socket_t *arph, const ni_arp_packet_t *pkt, void *user_data)
+static void
+ni_dhcp4_fsm_process_arp_packet(ni_dhcp4_device_t *dev, const ni_arp_packet_t *pkt)
 {
-	ni_dhcp4_device_t *dev = user_data;
 	ni_netconfig_t *nc = ni_global_state_handle(0);
 	const ni_netdev_t *ifp;
 	ni_bool_t false_alarm = FALSE;
@@ -1003,13 +1006,7 @@ ni_dhcp4_fsm_process_arp_packet(ni_arp_socket_t *arph, const ni_arp_packet_t *pk
 	if (pkt->sip.s_addr != dev->lease->dhcp4.address.s_addr)
 		return;
 
-	/* Ignore any ARP replies that seem to come from our own
-	 * MAC address. Some helpful switches seem to generate
-	 * these. */
-	if (ni_link_address_equal(&dev->system.hwaddr, &pkt->sha))
-		return;
-
-	/* As well as ARP replies that seem to come from our own
+	/* Ignore ARP replies that seem to come from our own
 	 * host: dup if same address, not a dup if there are two
 	 * interfaces connected to the same broadcast domain.
 	 */
@@ -1042,6 +1039,34 @@ ni_dhcp4_fsm_process_arp_packet(ni_arp_socket_t *arph, const ni_arp_packet_t *pk
 	ni_dhcp4_fsm_decline(dev);
 }
 
+void
+ni_dhcp4_fsm_process_arp_event(ni_arp_subscription_t *sub, ni_arp_event_t event,
+		const ni_arp_packet_t *pkt, void *user_data)
+{
+	ni_dhcp4_device_t *dev = user_data;
+
+	if (dev->fsm.state != NI_DHCP4_STATE_VALIDATING || !dev->lease)
+		return;
+
+	switch (event) {
+	case NI_ARP_EVENT_VERIFIED:
+		if (dev->arp.nclaims)
+			break;
+		/* fallthrough */
+
+	case NI_ARP_EVENT_ANNOUNCED:
+		ni_info("%s: Successfully validated DHCPv4 address %s",
+			dev->ifname, inet_ntoa(dev->lease->dhcp4.address));
+		ni_dhcp4_fsm_commit_lease(dev, dev->lease);
+		ni_dhcp4_device_arp_close(dev);
+		break;
+
+	case NI_ARP_EVENT_CONFLICT:
+		ni_dhcp4_fsm_process_arp_packet(dev, pkt);
+		break;
+	}
+}
+
 /*
  * NAKs in different states need to be treated differently.
  */
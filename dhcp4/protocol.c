@@ -41,6 +41,7 @@
 #include <wicked/xml.h>
 #include "dhcp4/dhcp.h"
 #include "dhcp4/protocol.h"
+#include "appconfig.h"
 #include "buffer.h"
 #include "socket_priv.h"
 
@@ -102,9 +103,22 @@ ni_dhcp4_socket_open(ni_dhcp4_device_t *dev)
 	prot_info.eth_protocol = ETHERTYPE_IP;
 	prot_info.ip_protocol = IPPROTO_UDP;
 	prot_info.ip_port = DHCP4_CLIENT_PORT;
+	prot_info.shared = ni_global.config && ni_global.config->addrconf.dhcp4.shared_capture;
+
+	/* Let the kernel drop replies to other clients and transactions */
+	prot_info.dhcp_xid = dev->dhcp4.xid;
+	switch (dev->system.hwaddr.type) {
+	case ARPHRD_ETHER:
+	case ARPHRD_IEEE802:
+		prot_info.dhcp_chaddr = dev->system.hwaddr;
+		break;
+	default:
+		break;
+	}
 
 	if ((capture = dev->capture) != NULL) {
-		if (ni_capture_is_valid(capture, ETHERTYPE_IP))
+		if (ni_capture_is_valid(capture, ETHERTYPE_IP) &&
+		    ni_capture_set_filter(capture, &prot_info) == 0)
 			return 0;
 
 		ni_capture_free(dev->capture);
@@ -127,13 +141,24 @@ static void
 ni_dhcp4_socket_recv(ni_socket_t *sock)
 {
 	ni_capture_t *capture = sock->user_data;
+	ni_dhcp4_message_t *message;
+	ni_dhcp4_device_t *dev;
 	ni_buffer_t buf;
 
-	if (ni_capture_recv(capture, &buf) >= 0) {
-		ni_dhcp4_device_t *dev = ni_capture_get_user_data(capture);
+	if (ni_capture_recv(capture, &buf) < 0)
+		return;
 
-		ni_dhcp4_fsm_process_dhcp4_packet(dev, &buf);
+	dev = ni_capture_get_user_data(capture);
+	if (ni_buffer_count(&buf) >= sizeof(*message)) {
+		/* drop replies to other (e.g. earlier) transactions early */
+		message = ni_buffer_head(&buf);
+		if (ni_dhcp4_device_by_xid(message->xid) != dev) {
+			ni_debug_dhcp("%s: ignoring packet with xid 0x%x",
+					dev->ifname, htonl(message->xid));
+			return;
+		}
 	}
+	ni_dhcp4_fsm_process_dhcp4_packet(dev, &buf);
 }
 
 /*
@@ -212,11 +237,11 @@ ni_dhcp4_option_next(ni_buffer_t *bp, ni_buffer_t *optbuf)
 		return -1;
 	if (bp->head == bp->tail)
 		return DHCP4_END;
-	if (bp->tail - bp->head < 2)
-		goto underflow;
 
 	code = bp->base[bp->head++];
 	if (code != DHCP4_PAD && code != DHCP4_END) {
+		if (bp->head == bp->tail)
+			goto underflow;
 		count = bp->base[bp->head++];
 		if (bp->tail - bp->head < count)
 			goto underflow;
@@ -1580,16 +1605,169 @@ ni_dhcp4_apply_routes(ni_addrconf_lease_t *lease, ni_route_array_t *routes)
 	ni_route_array_destroy(&temp);
 }
 
+/*
+ * Index the options of a DHCP4 response: record where each option is
+ * found in the options field and, when overloaded, in the file and
+ * sname fields. Options split into several parts (RFC 3396) end up as
+ * a chain of spans, which are concatenated when the option is fetched.
+ */
+static int
+ni_dhcp4_option_index_scan(ni_dhcp4_option_index_t *index, const void *data, size_t len,
+				ni_bool_t overloaded)
+{
+	ni_buffer_t area, buf;
+	int option;
+
+	ni_buffer_init_reader(&area, (void *) data, len);
+	while (ni_buffer_count(&area)) {
+		ni_dhcp4_option_span_t *span;
+
+		option = ni_dhcp4_option_next(&area, &buf);
+		if (option < 0) {
+			ni_debug_dhcp("unable to parse DHCP4 response: truncated packet");
+			return -1;
+		}
+
+		if (option == DHCP4_PAD)
+			continue;
+
+		if (option == DHCP4_END)
+			break;
+
+		if (ni_buffer_count(&buf) == 0) {
+			ni_error("option %d has zero length", option);
+			return -1;
+		}
+
+		if (option == DHCP4_OPTIONSOVERLOADED) {
+			if (overloaded)
+				ni_debug_dhcp("DHCP4: ignoring OVERLOAD option in overloaded data");
+			else
+				index->overload = ni_buffer_getc(&buf);
+			continue;
+		}
+
+		if (index->count >= NI_DHCP4_OPTION_SPAN_MAX) {
+			ni_debug_dhcp("unable to parse DHCP4 response: too many options");
+			return -1;
+		}
+
+		span = &index->span[index->count];
+		span->data = ni_buffer_head(&buf);
+		span->len = ni_buffer_count(&buf);
+		span->next = 0;
+
+		if (index->last[option]) {
+			index->span[index->last[option] - 1].next = index->count + 1;
+		} else {
+			index->first[option] = index->count + 1;
+			index->codes[index->ncodes++] = option;
+		}
+		index->last[option] = ++index->count;
+	}
+	return 0;
+}
+
+int
+ni_dhcp4_option_index_build(ni_dhcp4_option_index_t *index, const ni_dhcp4_message_t *message,
+				const ni_buffer_t *options)
+{
+	index->overload = 0;
+	index->count = 0;
+	index->ncodes = 0;
+	memset(index->first, 0, sizeof(index->first));
+	memset(index->last, 0, sizeof(index->last));
+
+	if (options->underflow)
+		return -1;
+
+	if (ni_dhcp4_option_index_scan(index, ni_buffer_head(options),
+					ni_buffer_count(options), FALSE) < 0)
+		return -1;
+
+	if ((index->overload & DHCP4_OVERLOAD_BOOTFILE) &&
+	    ni_dhcp4_option_index_scan(index, message->bootfile,
+					sizeof(message->bootfile), TRUE) < 0)
+		return -1;
+
+	if ((index->overload & DHCP4_OVERLOAD_SERVERNAME) &&
+	    ni_dhcp4_option_index_scan(index, message->servername,
+					sizeof(message->servername), TRUE) < 0)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Get the data of an indexed option. Returns the option length, 0 when
+ * the option is not present and -1 when it cannot be reassembled.
+ */
+int
+ni_dhcp4_option_index_get(ni_dhcp4_option_index_t *index, unsigned int code, ni_buffer_t *optbuf)
+{
+	const ni_dhcp4_option_span_t *span;
+	unsigned int pos, len;
+
+	memset(optbuf, 0, sizeof(*optbuf));
+	if (code > DHCP4_END || !(pos = index->first[code]))
+		return 0;
+
+	span = &index->span[pos - 1];
+	if (!span->next) {
+		ni_buffer_init_reader(optbuf, (void *) span->data, span->len);
+		return span->len;
+	}
+
+	for (len = 0; pos; pos = span->next) {
+		span = &index->span[pos - 1];
+		if (len + span->len > sizeof(index->concat)) {
+			ni_debug_dhcp("DHCP4 option %s: concatenated data too long",
+					ni_dhcp4_option_name(code));
+			return -1;
+		}
+		memcpy(index->concat + len, span->data, span->len);
+		len += span->len;
+	}
+	ni_buffer_init_reader(optbuf, index->concat, len);
+	return len;
+}
+
+/*
+ * Get the message type and server identifier of an indexed response,
+ * enough to decide whether to look at an offer at all.
+ */
+int
+ni_dhcp4_parse_message_type(ni_dhcp4_option_index_t *index, struct in_addr *server_id)
+{
+	ni_buffer_t buf;
+
+	server_id->s_addr = 0;
+	if (ni_dhcp4_option_index_get(index, DHCP4_SERVERIDENTIFIER, &buf) > 0)
+		ni_dhcp4_option_get_ipv4(&buf, server_id);
+
+	if (ni_dhcp4_option_index_get(index, DHCP4_MESSAGETYPE, &buf) <= 0)
+		return -1;
+	return ni_buffer_getc(&buf);
+}
+
 /*
  * Parse a DHCP4 response.
- * FIXME: RFC2131 states that the server is allowed to split a DHCP4 option into
- * several (partial) options if the total length exceeds 255 octets. We don't
- * handle this yet.
  */
 int
 ni_dhcp4_parse_response(const ni_dhcp4_message_t *message, ni_buffer_t *options, ni_addrconf_lease_t **leasep)
 {
-	ni_buffer_t overload_buf;
+	ni_dhcp4_option_index_t index;
+
+	if (ni_dhcp4_option_index_build(&index, message, options) < 0)
+		return -1;
+
+	return ni_dhcp4_parse_options(message, &index, leasep);
+}
+
+int
+ni_dhcp4_parse_options(const ni_dhcp4_message_t *message, ni_dhcp4_option_index_t *index,
+			ni_addrconf_lease_t **leasep)
+{
 	ni_addrconf_lease_t *lease;
 	ni_route_array_t default_routes = NI_ROUTE_ARRAY_INIT;
 	ni_route_array_t static_routes = NI_ROUTE_ARRAY_INIT;
@@ -1600,11 +1778,10 @@ ni_dhcp4_parse_response(const ni_dhcp4_message_t *message, ni_buffer_t *options,
 	ni_string_array_t nis_servers = NI_STRING_ARRAY_INIT;
 	char *nisdomain = NULL;
 	char *tmp = NULL;
-	int opt_overload = 0;
 	int msg_type = -1;
-	int use_bootserver = 1;
-	int use_bootfile = 1;
-	unsigned int pfxlen;
+	int use_bootserver = !(index->overload & DHCP4_OVERLOAD_SERVERNAME);
+	int use_bootfile = !(index->overload & DHCP4_OVERLOAD_BOOTFILE);
+	unsigned int pfxlen, i;
 
 	lease = ni_addrconf_lease_new(NI_ADDRCONF_DHCP, AF_INET);
 
@@ -1617,28 +1794,12 @@ ni_dhcp4_parse_response(const ni_dhcp4_message_t *message, ni_buffer_t *options,
 	lease->dhcp4.boot_saddr.s_addr = message->siaddr;
 	lease->dhcp4.relay_addr.s_addr = message->giaddr;
 
-parse_more:
-	/* Loop as long as we still have data in the buffer. */
-	while (ni_buffer_count(options) && !options->underflow) {
+	for (i = 0; i < index->ncodes; ++i) {
+		unsigned int option = index->codes[i];
 		ni_buffer_t buf;
-		int option;
-
-		option = ni_dhcp4_option_next(options, &buf);
-
-		//ni_debug_dhcp("handle option %s (%d)", ni_dhcp4_option_name(option), option);
-		if (option == DHCP4_PAD)
-			continue;
-
-		if (option == DHCP4_END)
-			break;
-
-		if (option < 0)
-			goto error;
 
-		if (ni_buffer_count(&buf) == 0) {
-			ni_error("option %d has zero length", option);
+		if (ni_dhcp4_option_index_get(index, option, &buf) < 0)
 			goto error;
-		}
 
 		switch (option) {
 		case DHCP4_MESSAGETYPE:
@@ -1766,18 +1927,6 @@ parse_more:
 				goto error;
 			break;
 
-		case DHCP4_OPTIONSOVERLOADED:
-			if (options != &overload_buf) {
-				opt_overload = ni_buffer_getc(&buf);
-				if (opt_overload == EOF)
-					goto error;
-			} else {
-				ni_debug_dhcp("DHCP4: ignoring OVERLOAD option in overloaded data");
-				if (ni_buffer_getc(&buf) == EOF)
-					goto error;
-			}
-			break;
-
 		case DHCP4_FQDN:
 			/* We ignore replies about FQDN */
 			break;
@@ -1806,39 +1955,13 @@ parse_more:
 					ni_dhcp4_option_name(option),
 					ni_buffer_count(&buf));
 		}
-
 	}
 
-	if (options->underflow) {
-		ni_debug_dhcp("unable to parse DHCP4 response: truncated packet");
+	if (msg_type < 0) {
+		ni_debug_dhcp("unable to parse DHCP4 response: no message type");
 		goto error;
 	}
 
-	if (opt_overload) {
-		const void *more_data = NULL;
-		size_t size = 0;
-
-		if (opt_overload & DHCP4_OVERLOAD_BOOTFILE) {
-			use_bootfile = 0;
-			more_data = message->bootfile;
-			size = sizeof(message->bootfile);
-			opt_overload &= ~DHCP4_OVERLOAD_BOOTFILE;
-		} else
-		if (opt_overload & DHCP4_OVERLOAD_SERVERNAME) {
-			use_bootserver = 0;
-			more_data = message->servername;
-			size = sizeof(message->servername);
-			opt_overload &= ~DHCP4_OVERLOAD_SERVERNAME;
-		} else {
-			opt_overload = 0;
-		}
-		if (more_data) {
-			ni_buffer_init_reader(&overload_buf, (void *) more_data, size);
-			options = &overload_buf;
-			goto parse_more;
-		}
-	}
-
 	if (use_bootserver && message->servername[0]) {
 		char tmp[sizeof(message->servername)];
 		size_t len;
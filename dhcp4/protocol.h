@@ -159,6 +159,34 @@ struct ni_dhcp4_message {
 	uint32_t		cookie;		/* DHCP4 magic cookie */
 };
 
+/*
+ * Index of the options in a received message. Each option code maps
+ * to the chain of its spans in the options, file and sname fields (in
+ * this order, see RFC 3396), which point into the message buffer.
+ * Spans are numbered from 1; 0 terminates a chain.
+ */
+#define NI_DHCP4_OPTION_SPAN_MAX	255
+#define NI_DHCP4_OPTION_CONCAT_MAX	4096
+
+typedef struct ni_dhcp4_option_span {
+	const unsigned char *	data;
+	unsigned char		len;
+	unsigned char		next;
+} ni_dhcp4_option_span_t;
+
+struct ni_dhcp4_option_index {
+	unsigned char		overload;
+	unsigned int		count;
+	unsigned int		ncodes;
+	unsigned char		codes[256];	/* in order of appearance */
+	unsigned char		first[256];
+	unsigned char		last[256];
+	ni_dhcp4_option_span_t	span[NI_DHCP4_OPTION_SPAN_MAX];
+
+	/* reassembly of split options, valid until the next get */
+	unsigned char		concat[NI_DHCP4_OPTION_CONCAT_MAX];
+};
+
 /* Work out if we have a private address or not
  * 10/8
  * 172.16/12
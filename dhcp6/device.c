@@ -77,6 +77,26 @@
 static ni_opaque_t		ni_dhcp6_duid;
 ni_dhcp6_device_t *		ni_dhcp6_active;
 
+/*
+ * The active devices are additionally hashed by ifindex and by the
+ * xid of the last message sent, as they're looked up for every event
+ * and received packet.
+ */
+#define NI_DHCP6_DEVICE_HASH_SIZE	64
+
+static ni_dhcp6_device_t *	ni_dhcp6_ifindex_hash[NI_DHCP6_DEVICE_HASH_SIZE];
+static ni_dhcp6_device_t *	ni_dhcp6_xid_hash[NI_DHCP6_DEVICE_HASH_SIZE];
+
+/*
+ * Rate limit of the initial transmissions, shared by all devices
+ */
+static ni_token_bucket_t	ni_dhcp6_transmit_bucket;
+
+/*
+ * Renewal times of the leases by server, when aligned
+ */
+static ni_timer_align_t *	ni_dhcp6_renewal_groups;
+
 static void			ni_dhcp6_device_close(ni_dhcp6_device_t *);
 static void			ni_dhcp6_device_free(ni_dhcp6_device_t *);
 
@@ -111,6 +131,10 @@ ni_dhcp6_device_new(const char *ifname, const ni_linkinfo_t *link)
 	/* append to end of list */
 	*pos = dev;
 
+	pos = &ni_dhcp6_ifindex_hash[dev->link.ifindex % NI_DHCP6_DEVICE_HASH_SIZE];
+	dev->hash.ifindex_next = *pos;
+	*pos = dev;
+
 	return dev;
 }
 
@@ -119,13 +143,89 @@ ni_dhcp6_device_by_index(unsigned int ifindex)
 {
 	ni_dhcp6_device_t *dev;
 
-	for (dev = ni_dhcp6_active; dev; dev = dev->next) {
+	dev = ni_dhcp6_ifindex_hash[ifindex % NI_DHCP6_DEVICE_HASH_SIZE];
+	for ( ; dev; dev = dev->hash.ifindex_next) {
 		if (dev->link.ifindex == ifindex)
 			return dev;
 	}
 	return NULL;
 }
 
+/*
+ * Find the device (on the interface, if ifindex is not 0), which is
+ * waiting for a reply with this xid. The chains may contain devices,
+ * which reset their xid since they've been hashed.
+ */
+ni_dhcp6_device_t *
+ni_dhcp6_device_by_xid(unsigned int ifindex, unsigned int xid)
+{
+	ni_dhcp6_device_t *dev;
+
+	if (xid == 0)
+		return NULL;
+
+	dev = ni_dhcp6_xid_hash[xid % NI_DHCP6_DEVICE_HASH_SIZE];
+	for ( ; dev; dev = dev->hash.xid_next) {
+		if (dev->dhcp6.xid != xid)
+			continue;
+		if (!ifindex || dev->link.ifindex == ifindex)
+			return dev;
+	}
+	return NULL;
+}
+
+static void
+ni_dhcp6_device_hash_xid(ni_dhcp6_device_t *dev)
+{
+	ni_dhcp6_device_t **pos, *cur;
+
+	pos = &ni_dhcp6_xid_hash[dev->hash.xid % NI_DHCP6_DEVICE_HASH_SIZE];
+	for ( ; (cur = *pos) != NULL; pos = &cur->hash.xid_next) {
+		if (cur == dev) {
+			*pos = dev->hash.xid_next;
+			break;
+		}
+	}
+	dev->hash.xid_next = NULL;
+	dev->hash.xid = dev->dhcp6.xid;
+
+	if (dev->hash.xid) {
+		pos = &ni_dhcp6_xid_hash[dev->hash.xid % NI_DHCP6_DEVICE_HASH_SIZE];
+		dev->hash.xid_next = *pos;
+		*pos = dev;
+	}
+}
+
+static void
+ni_dhcp6_device_unhash(ni_dhcp6_device_t *dev)
+{
+	ni_dhcp6_device_t **pos, *cur;
+
+	pos = &ni_dhcp6_ifindex_hash[dev->link.ifindex % NI_DHCP6_DEVICE_HASH_SIZE];
+	for ( ; (cur = *pos) != NULL; pos = &cur->hash.ifindex_next) {
+		if (cur == dev) {
+			*pos = dev->hash.ifindex_next;
+			break;
+		}
+	}
+	dev->hash.ifindex_next = NULL;
+
+	dev->dhcp6.xid = 0;
+	ni_dhcp6_device_hash_xid(dev);
+}
+
+/*
+ * Assign a new (24 bit, non-zero) xid for the next message
+ */
+void
+ni_dhcp6_device_new_xid(ni_dhcp6_device_t *dev)
+{
+	do {
+		dev->dhcp6.xid = random() & NI_DHCP6_XID_MASK;
+	} while (dev->dhcp6.xid == 0);
+	ni_dhcp6_device_hash_xid(dev);
+}
+
 /*
  * Refcount handling
  */
@@ -207,6 +307,7 @@ ni_dhcp6_device_free(ni_dhcp6_device_t *dev)
 	ni_dhcp6_device_set_request(dev, NULL);
 
 	ni_string_free(&dev->ifname);
+	ni_dhcp6_device_unhash(dev);
 	dev->link.ifindex = 0;
 
 	for (pos = &ni_dhcp6_active; *pos; pos = &(*pos)->next) {
@@ -217,6 +318,10 @@ ni_dhcp6_device_free(ni_dhcp6_device_t *dev)
 	}
 
 	free(dev);
+
+	/* the renewals to align with are gone with the last device */
+	if (!ni_dhcp6_active)
+		ni_timer_align_destroy(&ni_dhcp6_renewal_groups);
 }
 
 
@@ -464,6 +569,8 @@ ni_dhcp6_device_set_lladdr(ni_dhcp6_device_t *dev, const ni_address_t *addr)
 		dev->ifname, ni_sockaddr_print(&addr->local_addr));
 
 	memcpy(&dev->link.addr, &addr->local_addr, sizeof(dev->link.addr));
+	/* the shared socket sends it as IPV6_PKTINFO source */
+	dev->link.addr.six.sin6_scope_id = dev->link.ifindex;
 	return 0;
 }
 
@@ -588,31 +695,72 @@ ni_dhcp6_device_transmit_start(ni_dhcp6_device_t *dev)
 	return ni_dhcp6_device_transmit(dev);
 }
 
+/*
+ * Advance the renewal to the one of other leases from the same server,
+ * when they're close (see <renewal-window>), to renew them together.
+ */
+unsigned long
+ni_dhcp6_device_align_renewal(const ni_dhcp6_device_t *dev, unsigned long timeout)
+{
+	unsigned long window = ni_dhcp6_config_renewal_window() * 1000UL;
+	const ni_opaque_t *server_id;
+
+	if (window > timeout / 4)
+		window = timeout / 4;
+	if (!window || !dev->lease)
+		return timeout;
+
+	server_id = &dev->lease->dhcp6.server_id;
+	return ni_timer_align(&ni_dhcp6_renewal_groups, server_id->data,
+			server_id->len, timeout, window);
+}
+
+static unsigned long
+ni_dhcp6_device_transmit_reserve(unsigned long delay)
+{
+	const ni_config_transmit_rate_t *tr = &ni_global.config->addrconf.dhcp6.transmit_rate;
+	ni_token_bucket_t *tb = &ni_dhcp6_transmit_bucket;
+
+	if (tb->rate != tr->rate || tb->burst != (tr->burst ? tr->burst : 1))
+		ni_token_bucket_init(tb, tr->rate, tr->burst);
+
+	return ni_token_bucket_reserve(tb, delay);
+}
+
 static int
 ni_dhcp6_device_transmit_arm_delay(ni_dhcp6_device_t *dev)
 {
 	ni_int_range_t jitter;
-	unsigned long  delay;
+	unsigned long  delay, wait;
 
 	/*
-	 * rfc3315#section-5.5 (17.1.2, 18.1.2, 18.1.5):
+	 * rfc8415#section-15 (18.2.1, 18.2.3, 18.2.6):
 	 *
-	 * Initial delay is a MUST for Solicit, Confirm and InfoRequest.
+	 * Initial delay is a MUST for Solicit, Confirm and InfoRequest,
+	 * RAND in [0 .. MAX_DELAY], to desynchronize clients starting
+	 * at the same time. It is applied after the start delay.
 	 */
-	if (dev->retrans.delay == 0)
+	/* only the initial messages are delayed and rate-limited */
+	if (!dev->retrans.delay && !dev->retrans.defer)
 		return FALSE;
 
-	ni_debug_dhcp("%s: setting initial transmit delay of %u [%d .. %d] msec",
-			dev->ifname, dev->retrans.delay,
-			0 - dev->retrans.jitter,
-			0 + dev->retrans.jitter);
+	delay = dev->retrans.defer;
+	if (dev->retrans.delay) {
+		jitter.min = 0;
+		jitter.max = dev->retrans.delay;
+		delay = ni_timeout_randomize(delay, &jitter);
+	}
+
+	/* and then, we have to wait for our turn */
+	wait = ni_dhcp6_device_transmit_reserve(delay);
+	if (delay + wait == 0)
+		return FALSE;
 
-	/* we can use base jitter as is, it's 0.1 msec already */
-	jitter.min = 0 - dev->retrans.jitter;
-	jitter.max = 0 + dev->retrans.jitter;
-	delay = ni_timeout_randomize(dev->retrans.delay, &jitter);
+	ni_debug_dhcp("%s: setting initial transmit delay of %lu + %lu msec",
+			dev->ifname, delay, wait);
 
-	ni_dhcp6_fsm_set_timeout_msec(dev, delay);
+	dev->retrans.delay = delay + wait;
+	ni_dhcp6_fsm_set_timeout_msec(dev, dev->retrans.delay);
 
 	return TRUE;
 }
@@ -1157,7 +1305,7 @@ ni_dhcp6_address_event(ni_dhcp6_device_t *dev, ni_netdev_t *ifp, ni_event_t even
 		if (addr->local_addr.ss_family == AF_INET6 &&
 		    ni_sockaddr_equal(&addr->local_addr, &dev->link.addr)) {
 			/*
-			 * Multicast socket is bound to and unusable now; disarm
+			 * Source address of our messages is gone now; disarm
 			 * until a link-local address update event arrives ...
 			 */
 			ni_dhcp6_fsm_reset(dev);
@@ -1223,7 +1371,8 @@ ni_dhcp6_device_transmit(ni_dhcp6_device_t *dev)
 		return rv;
 	}
 
-	rv = ni_dhcp6_socket_send(dev->mcast.sock, &dev->message, &dev->mcast.dest);
+	rv = ni_dhcp6_socket_send(dev->mcast.sock, &dev->message, &dev->mcast.dest,
+					&dev->link.addr);
 	if (rv <= 0 || (size_t)rv != cnt) {
 		/* Hmm... advance retrans.count here? Use stop? */
 
@@ -1232,7 +1381,7 @@ ni_dhcp6_device_transmit(ni_dhcp6_device_t *dev)
 				dev->ifname, dev->retrans.count + 1, name, xid,
 				cnt, ni_sockaddr_print(&dev->mcast.dest));
 
-		/* Close and try reopen socket while next run */
+		/* Detach and try to reattach while next run */
 		ni_dhcp6_mcast_socket_close(dev);
 		ni_buffer_clear(&dev->message);
 		return -1;
@@ -1356,6 +1505,12 @@ ni_dhcp6_config_server_preference(const struct in6_addr *addr, const ni_opaque_t
 	return FALSE;
 }
 
+unsigned int
+ni_dhcp6_config_renewal_window(void)
+{
+	return ni_global.config->addrconf.dhcp6.renewal_window;
+}
+
 unsigned int
 ni_dhcp6_config_max_lease_time(void)
 {
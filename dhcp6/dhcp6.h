@@ -166,6 +166,12 @@ struct ni_dhcp6_device {
 	struct ni_dhcp6_device *next;
 	unsigned int		users;
 
+	struct {
+	    ni_dhcp6_device_t *	ifindex_next;	/* ifindex hash chain		*/
+	    ni_dhcp6_device_t *	xid_next;	/* xid hash chain		*/
+	    unsigned int	xid;		/* key of the xid chain		*/
+	} hash;
+
 	char *			ifname;		/* cached interface name	*/
 	struct ni_dhcp6_link {
 	    unsigned int	ifindex;	/* interface index		*/
@@ -176,7 +182,7 @@ struct ni_dhcp6_device {
 	uint32_t		iaid;		/* default IA interface-id	*/
 
 	struct {
-	    ni_socket_t *	sock;		/* multicast socket		*/
+	    ni_socket_t *	sock;		/* shared socket, when attached	*/
 	    ni_sockaddr_t	dest;		/* relays & servers multicast	*/
 	} mcast;
 
@@ -195,6 +201,7 @@ struct ni_dhcp6_device {
 	    struct timeval	start;		/* when we've sent first msg        */
 	    unsigned int	count;		/* transfer count                   */
 	    unsigned int	delay;		/* initial delay                    */
+	    unsigned int	defer;		/* start delay before initial delay */
 	    unsigned int	jitter;		/* jitter base for 1000 msec        */
 	    unsigned int	duration;	/* max duration in msec             */
 	    struct timeval	deadline;	/* next delay/timeout deadline      */
@@ -226,11 +233,16 @@ struct ni_dhcp6_device {
 /*
  * -- device methods
  */
+extern ni_dhcp6_device_t *	ni_dhcp6_active;
+
 extern ni_dhcp6_device_t *	ni_dhcp6_device_new(const char *, const ni_linkinfo_t *);
 extern ni_dhcp6_device_t *	ni_dhcp6_device_get(ni_dhcp6_device_t *);
 extern void			ni_dhcp6_device_put(ni_dhcp6_device_t *);
 
 extern ni_dhcp6_device_t *	ni_dhcp6_device_by_index(unsigned int);
+extern ni_dhcp6_device_t *	ni_dhcp6_device_by_xid(unsigned int, unsigned int);
+extern void			ni_dhcp6_device_new_xid(ni_dhcp6_device_t *);
+extern unsigned long		ni_dhcp6_device_align_renewal(const ni_dhcp6_device_t *, unsigned long);
 extern ni_dhcp6_device_t *	ni_dhcp6_device_by_index_show_all(unsigned int);
 
 extern void			ni_dhcp6_device_set_request(ni_dhcp6_device_t *, ni_dhcp6_request_t *);
@@ -73,7 +73,8 @@ static unsigned int		ni_dhcp6_fsm_mark_rebind_ia(ni_dhcp6_device_t *);
 
 static void			ni_dhcp6_send_event(enum ni_dhcp6_event, const ni_dhcp6_device_t *, ni_addrconf_lease_t *);
 
-static int			__fsm_parse_client_options(ni_dhcp6_device_t *, struct ni_dhcp6_message *, ni_buffer_t *);
+static int			__fsm_parse_client_options(ni_dhcp6_device_t *, struct ni_dhcp6_message *,
+							const ni_dhcp6_option_index_t *);
 
 
 
@@ -452,7 +453,8 @@ ni_dhcp6_fsm_timeout(ni_dhcp6_device_t *dev)
 }
 
 static inline ni_bool_t
-__fsm_select_best_offer(const ni_dhcp6_device_t *dev, const ni_addrconf_lease_t *lease, int weight)
+__fsm_select_best_offer(const ni_dhcp6_device_t *dev, const struct in6_addr *server_addr,
+			const ni_opaque_t *server_id, int weight)
 {
 	/* when we don't have any or this is a better offer, remember it */
 	if (dev->best_offer.lease == NULL || dev->best_offer.weight < weight)
@@ -469,15 +471,61 @@ __fsm_select_best_offer(const ni_dhcp6_device_t *dev, const ni_addrconf_lease_t
 	if (dev->lease && dev->lease->dhcp6.server_id.len > 0 &&
 	    !IN6_IS_ADDR_UNSPECIFIED(&dev->lease->dhcp6.server_addr)) {
 
-		if (IN6_ARE_ADDR_EQUAL(&dev->lease->dhcp6.server_addr, &lease->dhcp6.server_addr) ||
-		    ni_opaque_eq(&dev->lease->dhcp6.server_id, &lease->dhcp6.server_id))
+		if (IN6_ARE_ADDR_EQUAL(&dev->lease->dhcp6.server_addr, server_addr) ||
+		    ni_opaque_eq(&dev->lease->dhcp6.server_id, server_id))
 			return TRUE;
 	}
 	return FALSE;
 }
 
+/*
+ * Judge an offer by the options it carries before the lease is parsed.
+ * Returns -1 when the offer is unacceptable, 0 when it is not better
+ * than the best offer we have and 1 when the lease is worth parsing.
+ */
+static int
+__fsm_select_check_offer(const ni_dhcp6_device_t *dev, const struct ni_dhcp6_message *msg,
+			const ni_dhcp6_option_index_t *opts, ni_bool_t rapid_commit, char **hint)
+{
+	ni_dhcp6_offer_info_t info;
+	int weight = 0;
+
+	/* let the parser complain about it */
+	if (ni_dhcp6_parse_offer_info(opts, &info) < 0)
+		return 1;
+
+	if (info.rapid_commit != rapid_commit) {
+		ni_string_printf(hint, rapid_commit ? "rapid commit not set" :
+					"advertise with rapid commit option");
+		return -1;
+	}
+	if (info.status != NI_DHCP6_STATUS_SUCCESS) {
+		ni_string_printf(hint, "status %s", ni_dhcp6_status_name(info.status));
+		return -1;
+	}
+	if (!ni_dhcp6_config_server_preference(&msg->sender, &info.server_id, &weight))
+		weight = info.server_pref;
+	if (weight < 0) {
+		ni_string_printf(hint, "blacklisted server");
+		return -1;
+	}
+	if (!info.addrs) {
+		ni_string_printf(hint, rapid_commit ? "rapid-commit lease without address" :
+					"lease offer without address");
+		return -1;
+	}
+
+	/* the address count is an upper bound, the lease may have less */
+	weight += info.addrs;
+	if (dev->best_offer.lease &&
+	    !__fsm_select_best_offer(dev, &msg->sender, &info.server_id, weight))
+		return 0;
+
+	return 1;
+}
+
 static int
-__fsm_select_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, ni_buffer_t *opts, char **hint)
+__fsm_select_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, const ni_dhcp6_option_index_t *opts, char **hint)
 {
 	unsigned int count;
 	int weight = 0;
@@ -485,10 +533,18 @@ __fsm_select_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, n
 
 	switch (msg->type) {
 	case NI_DHCP6_ADVERTISE:
+		switch (__fsm_select_check_offer(dev, msg, opts, FALSE, hint)) {
+		case -1:
+			goto cleanup;
+		case 0:
+			goto check_best_advertise;
+		default:
+			break;
+		}
+
 		if (__fsm_parse_client_options(dev, msg, opts) < 0)
 			return -1;
 
-
 		if (msg->lease->dhcp6.rapid_commit) {
 			ni_string_printf(hint, "advertise with rapid commit option");
 			goto cleanup;
@@ -541,7 +597,8 @@ __fsm_select_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, n
 			goto cleanup;
 		}
 
-		if(__fsm_select_best_offer(dev, msg->lease, weight)) {
+		if(__fsm_select_best_offer(dev, &msg->lease->dhcp6.server_addr,
+					&msg->lease->dhcp6.server_id, weight)) {
 			ni_dhcp6_device_set_best_offer(dev, msg->lease, weight);
 			msg->lease = NULL;
 			ni_debug_verbose(NI_LOG_DEBUG1, NI_TRACE_DHCP,
@@ -553,6 +610,7 @@ __fsm_select_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, n
 			goto cleanup;
 		}
 
+check_best_advertise:
 		if (dev->best_offer.lease && dev->retrans.count > 1) {
 			/* if the weight has maximum value, just accept this offer */
 			if (dev->best_offer.weight > 255) {
@@ -568,6 +626,15 @@ __fsm_select_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, n
 	break;
 
 	case NI_DHCP6_REPLY:
+		switch (__fsm_select_check_offer(dev, msg, opts, TRUE, hint)) {
+		case -1:
+			goto cleanup;
+		case 0:
+			goto check_best_reply;
+		default:
+			break;
+		}
+
 		if (__fsm_parse_client_options(dev, msg, opts) < 0)
 			return -1;
 
@@ -622,7 +689,8 @@ __fsm_select_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, n
 		}
 		weight += count;
 
-		if(__fsm_select_best_offer(dev, msg->lease, weight)) {
+		if(__fsm_select_best_offer(dev, &msg->lease->dhcp6.server_addr,
+					&msg->lease->dhcp6.server_id, weight)) {
 			ni_dhcp6_device_set_best_offer(dev, msg->lease, weight);
 			msg->lease = NULL;
 			ni_debug_verbose(NI_LOG_DEBUG1, NI_TRACE_DHCP,
@@ -634,6 +702,7 @@ __fsm_select_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, n
 			goto cleanup;
 		}
 
+check_best_reply:
 		if (dev->best_offer.lease && dev->retrans.count > 1) {
 			/* if the weight has maximum value, just accept this offer */
 			if (dev->best_offer.weight > 255) {
@@ -657,7 +726,7 @@ cleanup:
 }
 
 static int
-__fsm_request_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, ni_buffer_t *opts, char **hint)
+__fsm_request_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, const ni_dhcp6_option_index_t *opts, char **hint)
 {
 	int rv = 1;
 
@@ -725,7 +794,7 @@ cleanup:
 }
 
 static int
-__fsm_confirm_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, ni_buffer_t *opts, char **hint)
+__fsm_confirm_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, const ni_dhcp6_option_index_t *opts, char **hint)
 {
 	int rv = 1;
 
@@ -784,7 +853,7 @@ cleanup:
 }
 
 static int
-__fsm_renew_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, ni_buffer_t *opts, char **hint)
+__fsm_renew_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, const ni_dhcp6_option_index_t *opts, char **hint)
 {
 	int rv = 1;
 
@@ -841,7 +910,7 @@ cleanup:
 
 
 static int
-__fsm_rebind_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, ni_buffer_t *opts, char **hint)
+__fsm_rebind_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, const ni_dhcp6_option_index_t *opts, char **hint)
 {
 	int rv = 1;
 
@@ -891,7 +960,8 @@ __fsm_rebind_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, n
 		}
 		weight += count;
 
-		if(__fsm_select_best_offer(dev, msg->lease, weight)) {
+		if(__fsm_select_best_offer(dev, &msg->lease->dhcp6.server_addr,
+					&msg->lease->dhcp6.server_id, weight)) {
 			ni_dhcp6_device_set_best_offer(dev, msg->lease, weight);
 			msg->lease = NULL;
 		} else if (!dev->best_offer.lease) {
@@ -936,7 +1006,7 @@ cleanup:
 
 
 static int
-__fsm_decline_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, ni_buffer_t *opts, char **hint)
+__fsm_decline_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, const ni_dhcp6_option_index_t *opts, char **hint)
 {
 	int rv = 1;
 
@@ -962,7 +1032,7 @@ cleanup:
 }
 
 static int
-__fsm_release_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, ni_buffer_t *opts, char **hint)
+__fsm_release_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, const ni_dhcp6_option_index_t *opts, char **hint)
 {
 	int rv = 1;
 
@@ -1023,7 +1093,7 @@ cleanup:
 }
 
 static int
-__fsm_inforeq_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, ni_buffer_t *opts, char **hint)
+__fsm_inforeq_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, const ni_dhcp6_option_index_t *opts, char **hint)
 {
 	int weight = 0;
 	int rv = 1;
@@ -1062,7 +1132,8 @@ __fsm_inforeq_process_msg(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg,
 			weight = 0;
 		}
 
-		if(__fsm_select_best_offer(dev, msg->lease, weight)) {
+		if(__fsm_select_best_offer(dev, &msg->lease->dhcp6.server_addr,
+					&msg->lease->dhcp6.server_id, weight)) {
 			ni_dhcp6_device_set_best_offer(dev, msg->lease, weight);
 			msg->lease = NULL;
 			ni_debug_verbose(NI_LOG_DEBUG1, NI_TRACE_DHCP,
@@ -1097,7 +1168,7 @@ cleanup:
 }
 
 static int
-__fsm_parse_client_options(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, ni_buffer_t *opts)
+__fsm_parse_client_options(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg, const ni_dhcp6_option_index_t *opts)
 {
 	ni_addrconf_lease_t *lease = NULL;
 
@@ -1108,7 +1179,7 @@ __fsm_parse_client_options(ni_dhcp6_device_t *dev, struct ni_dhcp6_message *msg,
 	/* set the server address in the lease */
 	memcpy(&lease->dhcp6.server_addr, &msg->sender, sizeof(lease->dhcp6.server_addr));
 
-	if (ni_dhcp6_parse_client_options(dev, opts, lease) < 0) {
+	if (ni_dhcp6_parse_indexed_options(dev, opts, lease) < 0) {
 		ni_error("%s: unable to parse options in %s message xid 0x%06x from %s",
 			dev->ifname, ni_dhcp6_message_name(msg->type),
 			msg->xid, ni_dhcp6_address_print(&msg->sender));
@@ -1150,6 +1221,7 @@ ni_dhcp6_fsm_process_client_message(ni_dhcp6_device_t *dev, unsigned int msg_typ
 	static unsigned int err_cnt = 0;
 	char * hint = NULL;
 	struct ni_dhcp6_message msg;
+	ni_dhcp6_option_index_t index;
 	int state = dev->fsm.state;
 	int rv = 1;
 
@@ -1163,31 +1235,38 @@ ni_dhcp6_fsm_process_client_message(ni_dhcp6_device_t *dev, unsigned int msg_typ
 			ni_dhcp6_fsm_state_name(dev->fsm.state),
 			ni_dhcp6_address_print(&msg.sender));
 
+	if (ni_dhcp6_option_index_build(&index, options) < 0) {
+		ni_error("%s: unable to parse options in %s message xid 0x%06x from %s",
+			dev->ifname, ni_dhcp6_message_name(msg.type),
+			msg.xid, ni_dhcp6_address_print(&msg.sender));
+		return -1;
+	}
+
 	ni_string_printf(&hint, "unexpected");
 	switch (state) {
 	case NI_DHCP6_STATE_SELECTING:
-		rv = __fsm_select_process_msg(dev, &msg, options, &hint);
+		rv = __fsm_select_process_msg(dev, &msg, &index, &hint);
 	break;
 	case NI_DHCP6_STATE_REQUESTING:
-		rv = __fsm_request_process_msg(dev, &msg, options, &hint);
+		rv = __fsm_request_process_msg(dev, &msg, &index, &hint);
 	break;
 	case NI_DHCP6_STATE_CONFIRMING:
-		rv = __fsm_confirm_process_msg(dev, &msg, options, &hint);
+		rv = __fsm_confirm_process_msg(dev, &msg, &index, &hint);
 	break;
 	case NI_DHCP6_STATE_RENEWING:
-		rv = __fsm_renew_process_msg(dev, &msg, options, &hint);
+		rv = __fsm_renew_process_msg(dev, &msg, &index, &hint);
 	break;
 	case NI_DHCP6_STATE_REBINDING:
-		rv = __fsm_rebind_process_msg(dev, &msg, options, &hint);
+		rv = __fsm_rebind_process_msg(dev, &msg, &index, &hint);
 	break;
 	case NI_DHCP6_STATE_DECLINING:
-		rv = __fsm_decline_process_msg(dev, &msg, options, &hint);
+		rv = __fsm_decline_process_msg(dev, &msg, &index, &hint);
 	break;
 	case NI_DHCP6_STATE_RELEASING:
-		rv = __fsm_release_process_msg(dev, &msg, options, &hint);
+		rv = __fsm_release_process_msg(dev, &msg, &index, &hint);
 	break;
 	case NI_DHCP6_STATE_REQUESTING_INFO:
-		rv = __fsm_inforeq_process_msg(dev, &msg, options, &hint);
+		rv = __fsm_inforeq_process_msg(dev, &msg, &index, &hint);
 	break;
 
 	default:
@@ -1272,7 +1351,7 @@ ni_dhcp6_fsm_solicit(ni_dhcp6_device_t *dev)
 			goto cleanup;
 
 		if (dev->config->start_delay) {
-			dev->retrans.delay = dev->config->start_delay * 1000;
+			dev->retrans.defer = dev->config->start_delay * 1000;
 		}
 
 		if (dev->config->defer_timeout) {
@@ -1764,14 +1843,17 @@ ni_dhcp6_fsm_bound(ni_dhcp6_device_t *dev)
 					dev->ifname,
 					ni_dhcp6_fsm_state_name(dev->fsm.state));
 		} else {
+			unsigned long msec;
+
+			msec = ni_dhcp6_device_align_renewal(dev, timeout * 1000UL);
 			ni_timer_get_time(&now);
-			now.tv_sec += timeout;
+			now.tv_sec += msec / 1000;
 
-			ni_debug_dhcp("%s: Reached %s state, scheduled RENEW in %u sec at %s",
+			ni_debug_dhcp("%s: Reached %s state, scheduled RENEW in %lu sec at %s",
 					dev->ifname, ni_dhcp6_fsm_state_name(dev->fsm.state),
-					timeout, ni_dhcp6_print_timeval(&now));
+					msec / 1000, ni_dhcp6_print_timeval(&now));
 
-			ni_dhcp6_fsm_set_timeout_msec(dev, timeout * 1000);
+			ni_dhcp6_fsm_set_timeout_msec(dev, msec);
 		}
 		return 0;
 	}
@@ -74,6 +74,7 @@
 //extern int	ni_dhcp6_device_retransmit(ni_dhcp6_device_t *dev);
 
 static void	ni_dhcp6_socket_recv		(ni_socket_t *);
+static void	ni_dhcp6_socket_error		(ni_socket_t *);
 static int	ni_dhcp6_process_packet		(ni_dhcp6_device_t *dev, ni_buffer_t *msgbuf,
 						 const struct in6_addr *sender);
 
@@ -83,16 +84,33 @@ static void	ni_dhcp6_socket_check_timeout	(ni_socket_t *sock, const struct timev
 static int	ni_dhcp6_option_next(ni_buffer_t *options, ni_buffer_t *optbuf);
 static int	ni_dhcp6_option_get_duid(ni_buffer_t *bp, ni_opaque_t *duid);
 
-static int	__ni_dhcp6_parse_client_options(ni_dhcp6_device_t *dev, ni_buffer_t *buffer,
+static int	__ni_dhcp6_parse_client_options(ni_dhcp6_device_t *dev,
+						const ni_dhcp6_option_index_t *index,
 						ni_addrconf_lease_t *lease, ni_bool_t request);
 
 
 /*
- * Open a multicast socket bound to link-local address and dhcp6 client port.
- *
+ * A single socket bound to the dhcp6 client port serves the devices on
+ * all links: received packets are dispatched by the interface index in
+ * their packet info and sent ones carry the link-local source address
+ * and interface in their packet info.
+ */
+#define NI_DHCP6_RECV_BATCH	8
+
+typedef struct ni_dhcp6_recv_batch {
+	ni_buffer_t		rbuf[NI_DHCP6_RECV_BATCH];
+} ni_dhcp6_recv_batch_t;
+
+static struct ni_dhcp6_mcast_socket {
+	ni_socket_t *		sock;
+	unsigned int		users;
+} ni_dhcp6_mcast;
+
+/*
+ * Open the socket bound to the dhcp6 client port.
  */
 static int
-__ni_dhcp6_mcast_socket_open(const struct ni_dhcp6_link *link, const char *ifname)
+__ni_dhcp6_mcast_socket_open(void)
 {
 	ni_sockaddr_t saddr;
 	int fd, on;
@@ -113,83 +131,127 @@ __ni_dhcp6_mcast_socket_open(const struct ni_dhcp6_link *link, const char *ifnam
 	 *   for which it is requesting configuration information as the source
 	 *   address in the header of the IP datagram.
 	 *   [...]
+	 *
+	 * The source address is set per packet, see ni_dhcp6_socket_send.
 	 */
 	if ((fd = socket (PF_INET6, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
-		ni_error("%s: Cannot open socket(INET6, DGRAM, UDP): %m", ifname);
+		ni_error("Cannot open DHCPv6 socket(INET6, DGRAM, UDP): %m");
 		return -1;
 	}
 
 	on = 1;
 	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1)
-		ni_error("%s: Cannot set setsockopt(SO_REUSEADDR): %m", ifname);
+		ni_error("Cannot set DHCPv6 setsockopt(SO_REUSEADDR): %m");
 #if defined(SO_REUSEPORT)
 	if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1)
-		ni_error("%s: Cannot set setsockopt(SO_REUSEPORT): %m", ifname);
+		ni_error("Cannot set DHCPv6 setsockopt(SO_REUSEPORT): %m");
 #endif
-	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &on, sizeof(on)) == -1)
-		ni_error("%s: Cannot set setsockopt(SO_RCVBUF): %m", ifname);
+	if (setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on)) == -1)
+		ni_error("Cannot set DHCPv6 setsockopt(IPV6_V6ONLY): %m");
 
 	if (setsockopt(fd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &on, sizeof(on)) != 0)
-		ni_error("%s: Cannot set setsockopt(IPV6_RECVPKTINFO): %m", ifname);
+		ni_error("Cannot set DHCPv6 setsockopt(IPV6_RECVPKTINFO): %m");
 
 	if (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
-		ni_error("%s: Cannot set fcntl(SETDF, CLOEXEC): %m", ifname);
-
+		ni_error("Cannot set DHCPv6 fcntl(SETDF, CLOEXEC): %m");
 
-	ni_sockaddr_set_ipv6(&saddr, link->addr.six.sin6_addr, NI_DHCP6_CLIENT_PORT);
-	saddr.six.sin6_scope_id = link->ifindex;
+	ni_sockaddr_set_ipv6(&saddr, in6addr_any, NI_DHCP6_CLIENT_PORT);
 	if (bind(fd, &saddr.sa, sizeof(saddr.six)) == -1) {
-		ni_error("%s: Cannot bind(%s): %m", ifname, ni_sockaddr_print(&saddr));
+		ni_error("Cannot bind DHCPv6 socket to [%s]:%u: %m",
+			ni_sockaddr_print(&saddr), NI_DHCP6_CLIENT_PORT);
 		close(fd);
 		return -1;
 	}
 
-	/*
-	 * Set the device index for outgoing multicast packets on the socket.
-	 */
-	on = link->ifindex;
-	if (setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &on, sizeof(on)) != 0) {
-		ni_error("%s: Cannot set setsockopt(IPV6_MULTICAST_IF, %d: %m",
-			ifname, on);
-	}
-
-	ni_debug_dhcp("%s: bound DHCPv6 socket to [%s%%%u]:%u",
-		ifname, ni_sockaddr_print(&saddr), saddr.six.sin6_scope_id,
-		ntohs(saddr.six.sin6_port));
+	ni_debug_dhcp("bound DHCPv6 socket to [%s]:%u",
+		ni_sockaddr_print(&saddr), NI_DHCP6_CLIENT_PORT);
 
 	return fd;
 }
 
+static void
+ni_dhcp6_recv_batch_free(void *user_data)
+{
+	ni_dhcp6_recv_batch_t *batch = user_data;
+	unsigned int i;
+
+	for (i = 0; i < NI_DHCP6_RECV_BATCH; ++i)
+		ni_buffer_destroy(&batch->rbuf[i]);
+	free(batch);
+}
+
+static ni_socket_t *
+ni_dhcp6_mcast_socket_get(void)
+{
+	ni_dhcp6_recv_batch_t *batch;
+	ni_dhcp6_device_t *dev;
+	ni_socket_t *sock, *old;
+	unsigned int i;
+	int fd;
+
+	/* on a receive error, reopen it for all devices; the broken one
+	 * stays in place until the new one is ready */
+	if ((old = ni_dhcp6_mcast.sock) != NULL && old->active && !old->error)
+		return old;
+
+	if ((fd = __ni_dhcp6_mcast_socket_open()) == -1)
+		return NULL;
+
+	if (!(sock = ni_socket_wrap(fd, SOCK_DGRAM))) {
+		ni_error("Unable to prepare DHCPv6 multicast socket");
+		close(fd);
+		return NULL;
+	}
+	sock->receive = ni_dhcp6_socket_recv;
+	sock->handle_error = ni_dhcp6_socket_error;
+	sock->get_timeout = ni_dhcp6_socket_get_timeout;
+	sock->check_timeout = ni_dhcp6_socket_check_timeout;
+
+	/* See rfc2460#section-5, Packet Size Issues. Allocate max buffers */
+	batch = xcalloc(1, sizeof(*batch));
+	for (i = 0; i < NI_DHCP6_RECV_BATCH; ++i)
+		ni_buffer_init_dynamic(&batch->rbuf[i], NI_DHCP6_RBUF_SIZE);
+	sock->user_data = batch;
+	sock->release_user_data = ni_dhcp6_recv_batch_free;
+
+	ni_socket_activate(sock);
+	ni_dhcp6_mcast.sock = sock;
+
+	if (old) {
+		for (dev = ni_dhcp6_active; dev; dev = dev->next) {
+			if (dev->mcast.sock == old)
+				dev->mcast.sock = sock;
+		}
+		ni_socket_close(old);
+	}
+	return sock;
+}
+
 /*
- * Open a DHCP6 socket for send and receive
+ * Attach the device to the DHCP6 socket for send and receive
  */
 int
 ni_dhcp6_mcast_socket_open(ni_dhcp6_device_t *dev)
 {
-	int fd;
+	ni_socket_t *sock;
 
 	/*
 	 * We call this function for verification before transmission.
-	 * When the socket is open but the device not ready anymore,
-	 * close the socket as it is bound to the link-local address
-	 * and return error.
+	 * When the device is not ready anymore, detach it as we can't
+	 * send from its link-local address and return error.
 	 */
 	if ( !ni_dhcp6_device_is_ready(dev, NULL)) {
 		ni_debug_dhcp("%s: interface is not ready", dev->ifname);
 
-		/* transient error: close the socket and wait for
+		/* transient error: detach from the socket and wait for
 		 * network-up and link-local address events ... */
 		ni_dhcp6_mcast_socket_close(dev);
 		return 1;
 	}
 
-	if (dev->mcast.sock != NULL) {
-		if (dev->mcast.sock->active && !dev->mcast.sock->error)
-			return 0;
-
-		/* there were a receive error, close and open again  */
-		ni_dhcp6_mcast_socket_close(dev);
-	}
+	if (dev->mcast.sock != NULL && dev->mcast.sock == ni_dhcp6_mcast.sock &&
+	    dev->mcast.sock->active && !dev->mcast.sock->error)
+		return 0;
 
 	/* prepare the all servers and relay agents multicast address */
 	if (ni_sockaddr_parse(&dev->mcast.dest, NI_DHCP6_ALL_RAGENTS, AF_INET6) < 0) {
@@ -201,42 +263,40 @@ ni_dhcp6_mcast_socket_open(ni_dhcp6_device_t *dev)
 	dev->mcast.dest.six.sin6_port = htons(NI_DHCP6_SERVER_PORT);
 	dev->mcast.dest.six.sin6_scope_id = dev->link.ifindex;
 
-	/* open the socket an bind to the link-local address */
-	if ((fd = __ni_dhcp6_mcast_socket_open(&dev->link, dev->ifname)) == -1)
+	if (!(sock = ni_dhcp6_mcast_socket_get()))
 		return -1;
 
-	/* finally wrap it and allocate receive buffer */
-	if ((dev->mcast.sock = ni_socket_wrap(fd, SOCK_DGRAM)) != NULL) {
-		dev->mcast.sock->user_data = dev;
-		dev->mcast.sock->receive = ni_dhcp6_socket_recv;
-		dev->mcast.sock->get_timeout = ni_dhcp6_socket_get_timeout;
-		dev->mcast.sock->check_timeout = ni_dhcp6_socket_check_timeout;
-
-		/* See rfc2460#section-5, Packet Size Issues. Allocate max buffer */
-		ni_buffer_init_dynamic(&dev->mcast.sock->rbuf, NI_DHCP6_RBUF_SIZE);
+	if (dev->mcast.sock == NULL)
+		ni_dhcp6_mcast.users++;
+	dev->mcast.sock = sock;
 
-		ni_socket_activate(dev->mcast.sock);
-		return 0;
-	} else {
-		ni_error("%s: Unable to prepare DHCPv6 multicast socket",
-			dev->ifname);
-		close(fd);
-		return -1;
-	}
+	ni_debug_dhcp("%s: using DHCPv6 socket with link-local address %s",
+			dev->ifname, ni_sockaddr_print(&dev->link.addr));
+	return 0;
 }
 
 void
 ni_dhcp6_mcast_socket_close(ni_dhcp6_device_t *dev)
 {
-	if (dev->mcast.sock)
-		ni_socket_close(dev->mcast.sock);
+	if (dev->mcast.sock && ni_dhcp6_mcast.users && --ni_dhcp6_mcast.users == 0) {
+		/* the last device is gone */
+		if (ni_dhcp6_mcast.sock)
+			ni_socket_close(ni_dhcp6_mcast.sock);
+		ni_dhcp6_mcast.sock = NULL;
+	}
 	dev->mcast.sock = NULL;
 	memset(&dev->mcast.dest, 0, sizeof(dev->mcast.dest));
 }
 
 ssize_t
-ni_dhcp6_socket_send(ni_socket_t *sock, const ni_buffer_t *mesg, const ni_sockaddr_t *dest)
+ni_dhcp6_socket_send(ni_socket_t *sock, const ni_buffer_t *mesg, const ni_sockaddr_t *dest,
+			const ni_sockaddr_t *source)
 {
+	unsigned char cbuf[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+	struct in6_pktinfo *pinfo;
+	struct cmsghdr *cm;
+	struct iovec iov;
+	struct msghdr msg;
 	int flags = 0;
 	size_t cnt;
 
@@ -255,18 +315,42 @@ ni_dhcp6_socket_send(ni_socket_t *sock, const ni_buffer_t *mesg, const ni_sockad
 		return -1;
 	}
 
+	if (!source || !ni_sockaddr_is_ipv6_linklocal(source)) {
+		errno = EADDRNOTAVAIL;
+		return -1;
+	}
+
 	if (ni_sockaddr_is_ipv6_multicast(dest) ||
 	    ni_sockaddr_is_ipv6_linklocal(dest))
 		flags |= MSG_DONTROUTE;
 
-	return sendto(sock->__fd, ni_buffer_head(mesg), cnt,
-			flags, &dest->sa, sizeof(dest->six));
+	memset(cbuf, 0, sizeof(cbuf));
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = ni_buffer_head(mesg);
+	iov.iov_len = cnt;
+	msg.msg_name = (void *)&dest->sa;
+	msg.msg_namelen = sizeof(dest->six);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+
+	/* send from the link-local address of the interface */
+	cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = IPPROTO_IPV6;
+	cm->cmsg_type = IPV6_PKTINFO;
+	cm->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
+	pinfo = (struct in6_pktinfo *)CMSG_DATA(cm);
+	pinfo->ipi6_addr = source->six.sin6_addr;
+	pinfo->ipi6_ifindex = source->six.sin6_scope_id;
+
+	return sendmsg(sock->__fd, &msg, flags);
 }
 
 
 /*
  * This callback is invoked from the socket code when we
- * detect an incoming DHCP6 packet on the raw socket.
+ * detect incoming DHCP6 packets on the socket.
  */
 static const char *
 __ni_dhcp6_hexdump(ni_stringbuf_t *sbuf, const ni_buffer_t *packet)
@@ -277,50 +361,22 @@ __ni_dhcp6_hexdump(ni_stringbuf_t *sbuf, const ni_buffer_t *packet)
 }
 
 static void
-ni_dhcp6_socket_recv(ni_socket_t *sock)
+ni_dhcp6_socket_recv_packet(ni_socket_t *sock, struct msghdr *msg, size_t bytes, ni_buffer_t *rbuf)
 {
 #ifdef	NI_DHCP6_HEXDUMP_LEVEL
 	ni_stringbuf_t hexbuf = NI_STRINGBUF_INIT_DYNAMIC;
 #endif
-	ni_dhcp6_device_t * dev = sock->user_data;
-	ni_buffer_t * rbuf = &sock->rbuf;
-	unsigned char cbuf[CMSG_SPACE(sizeof(struct in6_pktinfo))];
-	ni_sockaddr_t saddr;
-	struct iovec iov = {
-		.iov_base = ni_buffer_tail(rbuf),
-		.iov_len = ni_buffer_tailroom(rbuf),
-	};
-	struct msghdr msg = {
-		.msg_name = &saddr,
-		.msg_namelen = sizeof(saddr),
-		.msg_iov = &iov,
-		.msg_iovlen = 1,
-		.msg_control = cbuf,
-		.msg_controllen = sizeof(cbuf),
-		.msg_flags = 0,
-	};
 	struct in6_pktinfo *pinfo = NULL;
+	ni_dhcp6_device_t *dev;
 	struct cmsghdr *cm;
-	ssize_t bytes;
-
-	memset(&saddr, 0, sizeof(saddr));
-	memset(&cbuf, 0, sizeof(cbuf));
 
-	bytes = recvmsg(sock->__fd, &msg, 0);
-	if(bytes < 0) {
-		if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
-			ni_error("%s: recvmsg error on socket %d: %m",
-				dev->ifname, sock->__fd);
-			ni_socket_deactivate(sock);
-		}
-		return;
-	} else if (bytes == 0) {
-		ni_error("%s: recvmsg didn't returned any data on socket %d",
-			dev->ifname, sock->__fd);
+	if (bytes == 0) {
+		ni_error("recvmmsg didn't returned any data on DHCPv6 socket %d",
+			sock->__fd);
 		return;
 	}
 
-	for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+	for (cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm)) {
 		if (cm->cmsg_level == IPPROTO_IPV6 &&
 		    cm->cmsg_type == IPV6_PKTINFO &&
 		    cm->cmsg_len == CMSG_LEN(sizeof(struct in6_pktinfo))) {
@@ -329,13 +385,21 @@ ni_dhcp6_socket_recv(ni_socket_t *sock)
 	}
 
 	if (pinfo == NULL) {
-		ni_error("%s: discarding packet without packet info on socket %d",
-			dev->ifname, sock->__fd);
+		ni_error("discarding packet without packet info on DHCPv6 socket %d",
+			sock->__fd);
+		return;
+	}
+
+	dev = ni_dhcp6_device_by_index(pinfo->ipi6_ifindex);
+	if (!dev || dev->mcast.sock != sock) {
+		ni_debug_verbose(NI_LOG_DEBUG2, NI_TRACE_DHCP,
+			"discarding packet for interface index %u without DHCPv6 device",
+			pinfo->ipi6_ifindex);
 		return;
 	}
-	if(dev->link.ifindex != pinfo->ipi6_ifindex) {
-		ni_error("%s: discarding packet with interface index %u instead %u",
-			dev->ifname, pinfo->ipi6_ifindex, dev->link.ifindex);
+	if (msg->msg_flags & MSG_TRUNC) {
+		ni_error("%s: discarding truncated packet on socket %d",
+			dev->ifname, sock->__fd);
 		return;
 	}
 
@@ -350,7 +414,86 @@ ni_dhcp6_socket_recv(ni_socket_t *sock)
 #endif
 
 	ni_dhcp6_process_packet(dev, rbuf, &pinfo->ipi6_addr);
-	ni_buffer_reset(rbuf);
+}
+
+/*
+ * One socket serves all links, so it must not stay deactivated after
+ * an error: reopen it right away or, when this fails, keep using it,
+ * so the device timers it drives keep running.
+ */
+static void
+ni_dhcp6_mcast_socket_recover(ni_socket_t *sock)
+{
+	socklen_t len;
+	int err = 0;
+
+	if (sock != ni_dhcp6_mcast.sock) {
+		ni_socket_deactivate(sock);
+		return;
+	}
+
+	sock->error = 1;
+	if (ni_dhcp6_mcast_socket_get())
+		return;
+
+	/* consume the pending error and continue */
+	len = sizeof(err);
+	getsockopt(sock->__fd, SOL_SOCKET, SO_ERROR, &err, &len);
+	sock->error = 0;
+	ni_socket_activate(sock);
+}
+
+static void
+ni_dhcp6_socket_error(ni_socket_t *sock)
+{
+	ni_error("error on DHCPv6 socket %d, reopening it", sock->__fd);
+	ni_dhcp6_mcast_socket_recover(sock);
+}
+
+static void
+ni_dhcp6_socket_recv(ni_socket_t *sock)
+{
+	ni_dhcp6_recv_batch_t *batch = sock->user_data;
+	unsigned char cbuf[NI_DHCP6_RECV_BATCH][CMSG_SPACE(sizeof(struct in6_pktinfo))];
+	ni_sockaddr_t saddr[NI_DHCP6_RECV_BATCH];
+	struct iovec iov[NI_DHCP6_RECV_BATCH];
+	struct mmsghdr msgs[NI_DHCP6_RECV_BATCH];
+	int i, count;
+
+	memset(saddr, 0, sizeof(saddr));
+	memset(cbuf, 0, sizeof(cbuf));
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < NI_DHCP6_RECV_BATCH; ++i) {
+		ni_buffer_t *rbuf = &batch->rbuf[i];
+
+		ni_buffer_reset(rbuf);
+		iov[i].iov_base = ni_buffer_tail(rbuf);
+		iov[i].iov_len = ni_buffer_tailroom(rbuf);
+		msgs[i].msg_hdr.msg_name = &saddr[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(saddr[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = cbuf[i];
+		msgs[i].msg_hdr.msg_controllen = sizeof(cbuf[i]);
+	}
+
+	/* drain what arrived for all links at once */
+	count = recvmmsg(sock->__fd, msgs, NI_DHCP6_RECV_BATCH, MSG_DONTWAIT, NULL);
+	if (count < 0) {
+		if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+			ni_error("recvmmsg error on DHCPv6 socket %d: %m",
+				sock->__fd);
+			ni_dhcp6_mcast_socket_recover(sock);
+		}
+		return;
+	}
+
+	for (i = 0; i < count; ++i) {
+		ni_dhcp6_socket_recv_packet(sock, &msgs[i].msg_hdr, msgs[i].msg_len,
+				&batch->rbuf[i]);
+		if (sock != ni_dhcp6_mcast.sock)
+			break;
+	}
 }
 
 static int
@@ -436,25 +579,20 @@ ni_dhcp6_address_print(const struct in6_addr *ipv6)
 	return ni_sockaddr_print(&addr);
 }
 
+/*
+ * The retransmission deadlines of all devices using the socket
+ */
 static int
 ni_dhcp6_socket_get_timeout(const ni_socket_t *sock, struct timeval *tv)
 {
-	ni_dhcp6_device_t * dev = sock->user_data;
-	if( !(dev = sock->user_data)) {
-		ni_error("check_timeout: socket without capture object?!");
-		return -1;
-	}
+	ni_dhcp6_device_t *dev;
 
 	timerclear(tv);
-	if (timerisset(&dev->retrans.deadline)) {
-		*tv = dev->retrans.deadline;
-#if 0
-		ni_trace("%s: get socket timeout for socket [fd=%d]: %s",
-				dev->ifname, sock->__fd, ni_dhcp6_print_timeval(tv));
-	} else {
-		ni_trace("%s: get socket timeout for socket [fd=%d]: unset",
-				dev->ifname, sock->__fd);
-#endif
+	for (dev = ni_dhcp6_active; dev; dev = dev->next) {
+		if (dev->mcast.sock != sock || !timerisset(&dev->retrans.deadline))
+			continue;
+		if (!timerisset(tv) || timercmp(&dev->retrans.deadline, tv, <))
+			*tv = dev->retrans.deadline;
 	}
 	return timerisset(tv) ? 0 : -1;
 }
@@ -462,26 +600,15 @@ ni_dhcp6_socket_get_timeout(const ni_socket_t *sock, struct timeval *tv)
 static void
 ni_dhcp6_socket_check_timeout(ni_socket_t *sock, const struct timeval *now)
 {
-	ni_dhcp6_device_t * dev;
-	struct tm;
+	ni_dhcp6_device_t *dev, *next;
 
-	if (!(dev = sock->user_data)) {
-		ni_error("check_timeout: socket without device object?!");
-		return;
-	}
+	for (dev = ni_dhcp6_active; dev; dev = next) {
+		next = dev->next;
+		if (dev->mcast.sock != sock)
+			continue;
 
-	if (timerisset(&dev->retrans.deadline) && timercmp(&dev->retrans.deadline, now, <)) {
-#if 0
-		ni_trace("%s: check socket timeout for socket [fd=%d]: %s",
-				dev->ifname, sock->__fd,
-				ni_dhcp6_print_timeval(&dev->retrans.deadline));
-#endif
-		ni_dhcp6_device_retransmit(dev);
-#if 0
-	} else {
-		ni_trace("%s: check socket timeout for socket [fd=%d]: unset",
-				dev->ifname, sock->__fd);
-#endif
+		if (timerisset(&dev->retrans.deadline) && timercmp(&dev->retrans.deadline, now, <))
+			ni_dhcp6_device_retransmit(dev);
 	}
 }
 
@@ -1270,6 +1397,7 @@ ni_dhcp6_build_client_header(ni_buffer_t *bp, unsigned int msg_type, unsigned in
 static int
 ni_dhcp6_build_reparse(ni_dhcp6_device_t *dev, void *data, size_t len)
 {
+	ni_dhcp6_option_index_t index;
 	ni_addrconf_lease_t *lease;
 	unsigned int         type;
 	unsigned int         xid;
@@ -1281,13 +1409,15 @@ ni_dhcp6_build_reparse(ni_dhcp6_device_t *dev, void *data, size_t len)
 	ni_buffer_init_reader(&buf, data, len);
 	if ((rv = ni_dhcp6_parse_client_header(&buf, &type, &xid)) < 0)
 		return rv;
+	if ((rv = ni_dhcp6_option_index_build(&index, &buf)) < 0)
+		return rv;
 
 	lease = ni_addrconf_lease_new(NI_ADDRCONF_DHCP, AF_INET6);
 	lease->state = NI_ADDRCONF_STATE_GRANTED;
 	lease->type = NI_ADDRCONF_DHCP;
 	lease->time_acquired = time(NULL);
 
-	rv = __ni_dhcp6_parse_client_options(dev, &buf, lease, TRUE);
+	rv = __ni_dhcp6_parse_client_options(dev, &index, lease, TRUE);
 	ni_addrconf_lease_free(lease);
 
 	return rv;
@@ -1810,9 +1940,7 @@ ni_dhcp6_init_message(ni_dhcp6_device_t *dev, unsigned int msg_code, const ni_ad
 
 	/* Assign a new XID to this message */
 	ni_timer_get_time(&dev->retrans.start);
-	do {
-		dev->dhcp6.xid = random() & NI_DHCP6_XID_MASK;
-	} while (dev->dhcp6.xid == 0);
+	ni_dhcp6_device_new_xid(dev);
 
 	ni_debug_dhcp("%s: building %s with xid 0x%x", dev->ifname,
 		ni_dhcp6_message_name(msg_code), dev->dhcp6.xid);
@@ -2599,8 +2727,118 @@ __copy_ia_na_to_lease_addrs(const ni_dhcp6_device_t *dev, ni_addrconf_lease_t *l
 	return count;
 }
 
+/*
+ * Index the top level options of a message, so they can be looked at
+ * in place (e.g. to reject an offer) before the lease is parsed.
+ */
+int
+ni_dhcp6_option_index_build(ni_dhcp6_option_index_t *index, const ni_buffer_t *buffer)
+{
+	ni_buffer_t options = *buffer;
+
+	index->count = 0;
+	while (ni_buffer_count(&options) && !options.underflow) {
+		ni_dhcp6_option_span_t *span;
+		ni_buffer_t optbuf;
+		int option;
+
+		option = ni_dhcp6_option_next(&options, &optbuf);
+		if (option < 0)
+			return -1;
+
+		if (option == 0)
+			break;
+
+		if (index->count >= NI_DHCP6_OPTION_SPAN_MAX) {
+			ni_debug_dhcp("too many options in dhcp6 message");
+			return -1;
+		}
+
+		span = &index->span[index->count++];
+		span->code = option;
+		span->len = ni_buffer_count(&optbuf);
+		span->data = span->len ? ni_buffer_head(&optbuf) : NULL;
+	}
+	return options.underflow ? -1 : 0;
+}
+
+ni_bool_t
+ni_dhcp6_option_index_get(const ni_dhcp6_option_index_t *index, unsigned int code, ni_buffer_t *optbuf)
+{
+	unsigned int n;
+
+	for (n = 0; n < index->count; ++n) {
+		const ni_dhcp6_option_span_t *span = &index->span[n];
+
+		if (span->code == code) {
+			ni_buffer_init_reader(optbuf, (void *) span->data, span->len);
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static unsigned int
+ni_dhcp6_option_count_ia_addrs(ni_buffer_t *bp)
+{
+	unsigned int count = 0;
+	ni_buffer_t optbuf;
+	int option;
+
+	while (ni_buffer_count(bp) && !bp->underflow) {
+		option = ni_dhcp6_option_next(bp, &optbuf);
+		if (option <= 0)
+			break;
+		if (option == NI_DHCP6_OPTION_IA_ADDRESS)
+			count++;
+	}
+	return count;
+}
+
+int
+ni_dhcp6_parse_offer_info(const ni_dhcp6_option_index_t *index, ni_dhcp6_offer_info_t *info)
+{
+	unsigned int n;
+
+	memset(info, 0, sizeof(*info));
+	for (n = 0; n < index->count; ++n) {
+		const ni_dhcp6_option_span_t *span = &index->span[n];
+		ni_buffer_t optbuf;
+
+		ni_buffer_init_reader(&optbuf, (void *) span->data, span->len);
+		switch (span->code) {
+		case NI_DHCP6_OPTION_SERVERID:
+			if (ni_dhcp6_option_get_duid(&optbuf, &info->server_id) < 0)
+				return -1;
+		break;
+		case NI_DHCP6_OPTION_PREFERENCE:
+			if (ni_dhcp6_option_get8(&optbuf, &info->server_pref) < 0)
+				return -1;
+		break;
+		case NI_DHCP6_OPTION_STATUS_CODE:
+			if (ni_dhcp6_option_get16(&optbuf, &info->status) < 0)
+				return -1;
+		break;
+		case NI_DHCP6_OPTION_RAPID_COMMIT:
+			if (span->len == 0)
+				info->rapid_commit = TRUE;
+		break;
+		case NI_DHCP6_OPTION_IA_NA:
+			/* skip iaid, T1 and T2 */
+			if (!ni_buffer_pull_head(&optbuf, 3 * sizeof(uint32_t)))
+				break;
+			info->addrs += ni_dhcp6_option_count_ia_addrs(&optbuf);
+		break;
+		default:
+		break;
+		}
+	}
+	return 0;
+}
+
 static int
-__ni_dhcp6_parse_client_options(ni_dhcp6_device_t *dev, ni_buffer_t *buffer, ni_addrconf_lease_t *lease, ni_bool_t request)
+__ni_dhcp6_parse_client_options(ni_dhcp6_device_t *dev, const ni_dhcp6_option_index_t *index,
+				ni_addrconf_lease_t *lease, ni_bool_t request)
 {
 	ni_stringbuf_t hexbuf = NI_STRINGBUF_INIT_DYNAMIC;
 	ni_string_array_t temp = NI_STRING_ARRAY_INIT;
@@ -2608,20 +2846,14 @@ __ni_dhcp6_parse_client_options(ni_dhcp6_device_t *dev, ni_buffer_t *buffer, ni_
 	ni_string_array_t nis_domains = NI_STRING_ARRAY_INIT;
 	char *str = NULL;
 	struct timeval elapsed;
-	unsigned int i;
+	unsigned int i, n;
 
-	while( ni_buffer_count(buffer) && !buffer->underflow) {
+	for (n = 0; n < index->count; ++n) {
+		const ni_dhcp6_option_span_t *span = &index->span[n];
 		ni_buffer_t	optbuf;
-		int		option;
-
-		ni_buffer_init(&optbuf, NULL, 0);
-		option = ni_dhcp6_option_next(buffer, &optbuf);
-		if (option < 0)
-			goto failure;
-
-		if (option == 0)
-			break;
+		int		option = span->code;
 
+		ni_buffer_init_reader(&optbuf, (void *) span->data, span->len);
 		switch(option) {
 		case NI_DHCP6_OPTION_CLIENTID:
 			if (ni_dhcp6_option_get_duid(&optbuf, &lease->dhcp6.client_id) == 0) {
@@ -2927,7 +3159,19 @@ failure:
 int
 ni_dhcp6_parse_client_options(ni_dhcp6_device_t *dev, ni_buffer_t *buffer, ni_addrconf_lease_t *lease)
 {
-	return __ni_dhcp6_parse_client_options(dev, buffer, lease, FALSE);
+	ni_dhcp6_option_index_t index;
+
+	if (ni_dhcp6_option_index_build(&index, buffer) < 0)
+		return -1;
+
+	return __ni_dhcp6_parse_client_options(dev, &index, lease, FALSE);
+}
+
+int
+ni_dhcp6_parse_indexed_options(ni_dhcp6_device_t *dev, const ni_dhcp6_option_index_t *index,
+				ni_addrconf_lease_t *lease)
+{
+	return __ni_dhcp6_parse_client_options(dev, index, lease, FALSE);
 }
 
 int
@@ -196,6 +196,35 @@ typedef struct ni_dhcp6_option_request {
 
 #define NI_DHCP6_OPTION_REQUEST_INIT	{ .count = 0, .options = NULL }
 
+/*
+ * Index of the top level options in a received message, in order of
+ * appearance; the spans point into the message buffer.
+ */
+#define NI_DHCP6_OPTION_SPAN_MAX	128
+
+typedef struct ni_dhcp6_option_span {
+	uint16_t			code;
+	uint16_t			len;
+	const unsigned char *		data;
+} ni_dhcp6_option_span_t;
+
+typedef struct ni_dhcp6_option_index {
+	unsigned int			count;
+	ni_dhcp6_option_span_t		span[NI_DHCP6_OPTION_SPAN_MAX];
+} ni_dhcp6_option_index_t;
+
+/*
+ * What an offer is judged by, read in place from the option index
+ * before the lease gets parsed.
+ */
+typedef struct ni_dhcp6_offer_info {
+	ni_opaque_t			server_id;
+	uint8_t				server_pref;
+	uint16_t			status;
+	ni_bool_t			rapid_commit;
+	unsigned int			addrs;		/* IA_NA addresses, upper bound */
+} ni_dhcp6_offer_info_t;
+
 
 /*
  * functions used in device.c and fsm.c
@@ -216,15 +245,25 @@ extern ni_bool_t	ni_dhcp6_set_message_timing(ni_dhcp6_device_t *dev, unsigned in
 extern int		ni_dhcp6_parse_client_header(ni_buffer_t *msgbuf,
 							unsigned int *msg_type, unsigned int *msg_xid);
 
+extern int		ni_dhcp6_option_index_build(ni_dhcp6_option_index_t *, const ni_buffer_t *);
+extern ni_bool_t	ni_dhcp6_option_index_get(const ni_dhcp6_option_index_t *, unsigned int,
+							ni_buffer_t *);
+extern int		ni_dhcp6_parse_offer_info(const ni_dhcp6_option_index_t *,
+							ni_dhcp6_offer_info_t *);
+
 extern int		ni_dhcp6_parse_client_options(ni_dhcp6_device_t *dev, ni_buffer_t *buffer,
 							ni_addrconf_lease_t *lease);
+extern int		ni_dhcp6_parse_indexed_options(ni_dhcp6_device_t *dev,
+							const ni_dhcp6_option_index_t *index,
+							ni_addrconf_lease_t *lease);
 
 extern int		ni_dhcp6_check_client_header(ni_dhcp6_device_t *dev, const struct in6_addr *sender,
 							unsigned int msg_type, unsigned int msg_xid);
 
 extern int		ni_dhcp6_mcast_socket_open(ni_dhcp6_device_t *);
 extern void		ni_dhcp6_mcast_socket_close(ni_dhcp6_device_t *);
-extern ssize_t		ni_dhcp6_socket_send(ni_socket_t *, const ni_buffer_t *, const ni_sockaddr_t *);
+extern ssize_t		ni_dhcp6_socket_send(ni_socket_t *, const ni_buffer_t *, const ni_sockaddr_t *,
+						const ni_sockaddr_t *);
 
 
 /* FIXME: cleanup */
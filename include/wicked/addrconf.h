@@ -99,6 +99,16 @@ typedef struct ni_dhcp4_user_class {
 
 typedef struct ni_addrconf_updater	ni_addrconf_updater_t;
 
+#define NI_ADDRCONF_UPDATER_STAGES_MAX	8
+
+typedef struct ni_addrconf_update_timing {
+	unsigned int		count;
+	struct {
+		const char *	name;
+		unsigned int	usec;
+	}			stage[NI_ADDRCONF_UPDATER_STAGES_MAX];
+} ni_addrconf_update_timing_t;
+
 struct ni_addrconf_lease {
 	ni_addrconf_lease_t *	next;
 
@@ -117,6 +127,7 @@ struct ni_addrconf_lease {
 	unsigned int		time_acquired;
 
 	unsigned int		update;
+	ni_addrconf_update_timing_t timing;	/* of the last system update */
 
 	char *			hostname;
 	ni_address_t *		addrs;
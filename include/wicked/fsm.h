@@ -144,6 +144,7 @@ struct ni_ifworker {
 	struct {
 		ni_client_state_config_t	meta;
 		xml_node_t *		node;
+		ni_string_array_t	changed;	/* apply these nodes only */
 	} config;
 
 	ni_bool_t		use_default_policies;
@@ -273,6 +274,7 @@ extern ni_bool_t		ni_fsm_policies_changed_since(const ni_fsm_t *, unsigned int *
 
 extern ni_dbus_client_t *	ni_fsm_create_client(ni_fsm_t *);
 extern ni_bool_t		ni_fsm_refresh_state(ni_fsm_t *);
+extern ni_bool_t		ni_fsm_refresh_state_snapshot(ni_fsm_t *);
 extern unsigned int		ni_fsm_schedule(ni_fsm_t *);
 extern ni_bool_t		ni_fsm_do(ni_fsm_t *fsm, long *timeout_p);
 extern void			ni_fsm_mainloop(ni_fsm_t *);
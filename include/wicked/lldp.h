@@ -92,11 +92,34 @@ struct ni_lldp_ieee_802_1 {
 	 */
 };
 
+/*
+ * Neighbors learned by the agent of a device, keyed by chassis and
+ * port id. The changes of a neighbor are reported as a mask of the
+ * NI_LLDP_NEIGHBOR_* flags.
+ */
+typedef enum ni_lldp_neighbor_event {
+	NI_LLDP_NEIGHBOR_ADDED,
+	NI_LLDP_NEIGHBOR_CHANGED,
+	NI_LLDP_NEIGHBOR_REMOVED,
+} ni_lldp_neighbor_event_t;
+
+#define NI_LLDP_NEIGHBOR_TTL		0x0001
+#define NI_LLDP_NEIGHBOR_PORT_DESC	0x0002
+#define NI_LLDP_NEIGHBOR_SYSTEM		0x0004
+#define NI_LLDP_NEIGHBOR_IEEE_802_1	0x0008
+#define NI_LLDP_NEIGHBOR_ALL		0x000f
+
+typedef void		ni_lldp_neighbor_handler_t(ni_netdev_t *, ni_lldp_neighbor_event_t,
+					const ni_lldp_t *, unsigned int);
+typedef void		ni_lldp_neighbor_func_t(const ni_lldp_t *, unsigned int, void *);
+
 extern ni_lldp_t *	ni_lldp_new(void);
 extern void		ni_lldp_free(ni_lldp_t *);
 extern ni_bool_t	ni_system_lldp_available(ni_netdev_t *);
 extern int		ni_system_lldp_up(ni_netdev_t *, const ni_lldp_t *);
 extern int		ni_system_lldp_down(ni_netdev_t *);
+extern unsigned int	ni_system_lldp_neighbors(const ni_netdev_t *, ni_lldp_neighbor_func_t *, void *);
+extern void		ni_server_listen_lldp_events(ni_lldp_neighbor_handler_t *);
 
 extern const char *	ni_lldp_destination_type_to_name(ni_lldp_destination_t);
 extern const char *	ni_lldp_system_capability_type_to_name(ni_lldp_destination_t);
@@ -9,6 +9,7 @@
 
 #include <wicked/secret.h>
 #include <wicked/dbus.h>
+#include <wicked/lldp.h>
 
 #include "client/client_state.h"
 
@@ -141,6 +142,8 @@ extern ni_netdev_t *		ni_objectmodel_unwrap_netif(const ni_dbus_object_t *, DBus
 extern ni_dbus_object_t *	ni_objectmodel_get_netif_object(ni_dbus_server_t *, const ni_netdev_t *);
 extern dbus_bool_t		ni_objectmodel_send_netif_event(ni_dbus_server_t *, ni_dbus_object_t *,
 					ni_event_t, const ni_uuid_t *);
+extern dbus_bool_t		ni_objectmodel_send_lldp_neighbor_event(ni_dbus_server_t *, ni_dbus_object_t *,
+					ni_lldp_neighbor_event_t, const ni_lldp_t *, unsigned int);
 
 extern ni_modem_t *		ni_objectmodel_unwrap_modem(const ni_dbus_object_t *, DBusError *);
 extern ni_dbus_object_t *	ni_objectmodel_get_modem_object(ni_dbus_server_t *, const ni_modem_t *);
@@ -12,6 +12,7 @@
 
 #include <wicked/types.h>
 #include <sys/types.h>
+#include <sys/time.h>
 
 typedef struct ni_timeout_param {
 	int			nretries;	/* limit the number of retries; < 0 means unlimited */
@@ -31,7 +32,20 @@ typedef struct ni_timeout_param {
 	void			*timeout_data;
 } ni_timeout_param_t;
 
+/*
+ * Rate limit shared by many senders; tokens are reserved in advance
+ * or taken when available
+ */
+typedef struct ni_token_bucket {
+	unsigned int		rate;		/* tokens per second, 0 means unlimited */
+	unsigned int		burst;		/* bucket size */
+	struct timeval		tat;		/* arrival time of the next token */
+} ni_token_bucket_t;
+
+#define NI_TOKEN_BUCKET_MAX_QUEUE	65536
+
 typedef struct ni_timer	ni_timer_t;
+typedef struct ni_timer_align ni_timer_align_t;
 typedef void		ni_timeout_callback_t(void *, const ni_timer_t *);
 
 extern const ni_timer_t *ni_timer_register(unsigned long, ni_timeout_callback_t *, void *);
@@ -39,6 +53,9 @@ extern void *		ni_timer_cancel(const ni_timer_t *);
 extern const ni_timer_t *ni_timer_rearm(const ni_timer_t *, unsigned long);
 extern long		ni_timer_next_timeout(void);
 extern int		ni_timer_get_time(struct timeval *tv);
+extern unsigned long	ni_timer_align(ni_timer_align_t **, const void *, size_t,
+					unsigned long, unsigned long);
+extern void		ni_timer_align_destroy(ni_timer_align_t **);
 
 extern ni_socket_t *	ni_socket_hold(ni_socket_t *);
 extern void		ni_socket_release(ni_socket_t *);
@@ -55,5 +72,9 @@ extern unsigned long	ni_timeout_arm_msec(struct timeval *, const ni_timeout_para
 extern unsigned long	ni_timeout_randomize(unsigned long timeout, const ni_int_range_t *jitter);
 extern ni_bool_t	ni_timeout_recompute(ni_timeout_param_t *);
 
+extern void		ni_token_bucket_init(ni_token_bucket_t *, unsigned int, unsigned int);
+extern unsigned long	ni_token_bucket_reserve(ni_token_bucket_t *, unsigned long);
+extern ni_bool_t	ni_token_bucket_take(ni_token_bucket_t *);
+
 #endif /* __WICKED_SOCKET_H__ */
 
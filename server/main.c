@@ -29,6 +29,8 @@
 #include <wicked/wireless.h>
 #include <wicked/modem.h>
 #include "udev-utils.h"
+#include "client/client_state.h"
+#include "client/status_snapshot.h"
 
 enum {
 	OPT_HELP,
@@ -90,6 +92,8 @@ static void		handle_interface_prefix_events(ni_netdev_t *, ni_event_t, const ni_
 static void		handle_interface_nduseropt_events(ni_netdev_t *, ni_event_t);
 static void		handle_rfkill_event(ni_rfkill_type_t, ni_bool_t, void *);
 static void		handle_other_event(ni_event_t);
+static void		handle_lldp_neighbor_event(ni_netdev_t *, ni_lldp_neighbor_event_t,
+					const ni_lldp_t *, unsigned int);
 #ifdef MODEM
 static void		handle_modem_event(ni_modem_t *, ni_event_t);
 #endif
@@ -262,6 +266,9 @@ run_interface_server(void)
 	/* Listen for other events, such as RESOLVER_UPDATED */
 	ni_server_listen_other_events(handle_other_event);
 
+	/* Forward changes in the neighbors learned by LLDP agents */
+	ni_server_listen_lldp_events(handle_lldp_neighbor_event);
+
 	if (!opt_foreground) {
 		ni_daemon_close_t close_flags = NI_DAEMON_CLOSE_STD;
 
@@ -284,9 +291,13 @@ run_interface_server(void)
 			timeout = ni_timer_next_timeout();
 		} while (ni_dbus_objects_garbage_collect());
 
+		/* publish changes made while processing the last events */
+		ni_status_snapshot_update(ni_global_state_handle(0));
+
 		if (ni_socket_wait(timeout) != 0)
 			ni_fatal("ni_socket_wait failed");
 	}
+	ni_status_snapshot_close();
 
 	if (opt_recover_state)
 		ni_objectmodel_save_state(opt_state_file);
@@ -312,6 +323,26 @@ discover_udev_netdev_state(ni_netdev_t *dev)
 		dev->link.ifflags |= NI_IFF_DEVICE_READY;
 }
 
+static ni_bool_t
+discover_client_state(unsigned int ifindex, const ni_client_state_t *cs, void *user_data)
+{
+	ni_netconfig_t *nc = user_data;
+	ni_netdev_t *dev;
+
+	if (!(dev = ni_netdev_by_index(nc, ifindex))) {
+		/* the device is gone, e.g. deleted while we were not running */
+		ni_client_state_drop(ifindex);
+		return FALSE;
+	}
+
+	if (!ni_client_state_is_valid(dev->client_state)) {
+		ni_netdev_set_client_state(dev, ni_client_state_clone((ni_client_state_t *)cs));
+		ni_debug_ifconfig("loading %s structure from a file for %s",
+				NI_CLIENT_STATE_XML_NODE, dev->name);
+	}
+	return TRUE;
+}
+
 void
 discover_state(ni_dbus_server_t *server)
 {
@@ -326,13 +357,14 @@ discover_state(ni_dbus_server_t *server)
 		ni_fatal("failed to discover interface state");
 
 	if (server) {
+		ni_client_state_load_all(discover_client_state, nc);
+		ni_client_state_config_cleanup();
+
 		for (ifp = ni_netconfig_devlist(nc); ifp; ifp = ifp->next) {
 			discover_udev_netdev_state(ifp);
 			ni_objectmodel_register_netif(server, ifp, NULL);
-			if (!ni_client_state_is_valid(ifp->client_state)) {
-				if (!ni_netdev_load_client_state(ifp))
-					ni_netdev_discover_client_state(ifp);
-			}
+			if (!ni_client_state_is_valid(ifp->client_state))
+				ni_netdev_discover_client_state(ifp);
 		}
 #ifdef MODEM
 		for (modem = ni_netconfig_modem_list(nc); modem; modem = modem->list.next)
@@ -379,6 +411,7 @@ handle_interface_event(ni_netdev_t *dev, ni_event_t event)
 {
 	const ni_uuid_t *event_uuid = NULL;
 
+	ni_status_snapshot_invalidate();
 	if (dbus_server) {
 		ni_dbus_object_t *object;
 
@@ -441,6 +474,7 @@ handle_interface_event(ni_netdev_t *dev, ni_event_t event)
 static void
 handle_interface_addr_events(ni_netdev_t *dev, ni_event_t event, const ni_address_t *ap)
 {
+	ni_status_snapshot_invalidate();
 	ni_server_trace_interface_addr_events(dev, event, ap);
 }
 
@@ -464,6 +498,16 @@ handle_other_event(ni_event_t event)
 		ni_objectmodel_other_event(dbus_server, event, NULL);
 }
 
+static void
+handle_lldp_neighbor_event(ni_netdev_t *dev, ni_lldp_neighbor_event_t event,
+				const ni_lldp_t *lldp, unsigned int changes)
+{
+	ni_dbus_object_t *object;
+
+	if (dbus_server && (object = ni_objectmodel_get_netif_object(dbus_server, dev)))
+		ni_objectmodel_send_lldp_neighbor_event(dbus_server, object, event, lldp, changes);
+}
+
 /*
  * Modem event - device was plugged
  */
@@ -643,7 +643,7 @@ ni_sockaddr_format(const ni_sockaddr_t *ss, char *abuf, size_t buflen)
 const char *
 ni_sockaddr_print(const ni_sockaddr_t *ss)
 {
-	static char abuf[128];
+	static __thread char abuf[128];
 
 	return ni_sockaddr_format(ss, abuf, sizeof(abuf));
 }
@@ -651,7 +651,7 @@ ni_sockaddr_print(const ni_sockaddr_t *ss)
 const char *
 ni_sockaddr_prefix_print(const ni_sockaddr_t *ss, unsigned int pfxlen)
 {
-	static char abuf[128];
+	static __thread char abuf[128];
 	const char *s;
 
 	if (!(s = ni_sockaddr_print(ss)))
@@ -1049,7 +1049,7 @@ ni_link_address_parse(ni_hwaddr_t *hwa, unsigned short arp_type, const char *str
 const char *
 ni_link_address_print(const ni_hwaddr_t *hwa)
 {
-	static char abuf[128];
+	static __thread char abuf[128];
 
 	if (ni_link_address_format(hwa, abuf, sizeof(abuf)) < 0)
 		return NULL;
@@ -43,6 +43,9 @@ struct ni_extension {
 	/* Format type. Only in use by system-updater. */
 	char *			format;
 
+	/* Backend type, "builtin" or scripts. Only in use by system-updater. */
+	char *			backend;
+
 	/* Shell commands */
 	ni_script_action_t *	actions;
 
@@ -74,6 +77,32 @@ typedef struct ni_config_rtnl_event {
 	unsigned int	mesg_buff_length;
 } ni_config_rtnl_event_t;
 
+typedef struct ni_config_packet_capture {
+	/*
+	 * raw packet (arp, dhcp4, lldp) capture tunables
+	 */
+	ni_bool_t	mmap_ring;
+	unsigned int	ring_block_size;
+	unsigned int	ring_block_count;
+} ni_config_packet_capture_t;
+
+typedef struct ni_config_extension_scripts {
+	/*
+	 * dbus extension script execution limits
+	 */
+	unsigned int	max_running;
+	unsigned int	timeout;
+} ni_config_extension_scripts_t;
+
+/*
+ * Limit of the initial DHCP messages sent per second by all devices;
+ * retransmissions are not limited. A rate of 0 means unlimited.
+ */
+typedef struct ni_config_transmit_rate {
+	unsigned int	rate;
+	unsigned int	burst;
+} ni_config_transmit_rate_t;
+
 typedef struct ni_config {
 	ni_config_fslocation_t	piddir;
 	ni_config_fslocation_t	storedir;
@@ -86,6 +115,10 @@ typedef struct ni_config {
 
 	    struct ni_config_dhcp4 {
 	        unsigned int		allow_update;
+		ni_bool_t		shared_capture;
+		ni_config_transmit_rate_t transmit_rate;
+		unsigned int		start_jitter;
+		unsigned int		renewal_window;
 		char *			vendor_class;
 		unsigned int		lease_time;
 		ni_string_array_t	ignore_servers;
@@ -98,6 +131,8 @@ typedef struct ni_config {
 		char *			default_duid;
 	        unsigned int		allow_update;
 		unsigned int		lease_time;
+		ni_config_transmit_rate_t transmit_rate;
+		unsigned int		renewal_window;
 
 		ni_string_array_t 	user_class_data;
 		unsigned int		vendor_class_en;
@@ -129,6 +164,8 @@ typedef struct ni_config {
 	char *			dbus_type;
 
 	ni_config_rtnl_event_t	rtnl_event;
+	ni_config_packet_capture_t packet_capture;
+	ni_config_extension_scripts_t extension_scripts;
 
 } ni_config_t;
 
@@ -9,12 +9,16 @@
 
 #include <net/if_arp.h>
 #include <netinet/if_ether.h>
+#include <arpa/inet.h>
+#include <sys/time.h>
 #include <stdlib.h>
 
 #include <wicked/netinfo.h>
 #include <wicked/socket.h>
+#include <wicked/logging.h>
 #include "netinfo_priv.h"
 #include "socket_priv.h"
+#include "util_priv.h"
 #include "buffer.h"
 
 static void	ni_arp_socket_recv(ni_socket_t *);
@@ -54,6 +58,26 @@ ni_arp_socket_close(ni_arp_socket_t *arph)
 	free(arph);
 }
 
+/*
+ * Receive only ARP packets about the addresses (as sender, or as target
+ * of a probe); an empty address list removes the filter.
+ */
+int
+ni_arp_socket_set_filter(ni_arp_socket_t *arph, const struct in_addr *addrs, unsigned int count)
+{
+	ni_capture_protinfo_t prot_info;
+
+	if (!arph || !arph->capture)
+		return -1;
+
+	memset(&prot_info, 0, sizeof(prot_info));
+	prot_info.eth_protocol = ETHERTYPE_ARP;
+	prot_info.arp_addrs = addrs;
+	prot_info.arp_count = count;
+
+	return ni_capture_set_filter(arph->capture, &prot_info);
+}
+
 /*
  * This callback is invoked from the socket code when we
  * detect an incoming ARP packet on the raw socket.
@@ -198,3 +222,421 @@ ni_arp_parse(ni_arp_socket_t *arph, ni_buffer_t *bp, ni_arp_packet_t *p)
 	return 0;
 }
 
+
+/*
+ * ARP engine
+ *
+ * There is one engine per interface, which owns the ARP socket and
+ * dispatches the received packets to the subscriptions by address.
+ * Probes and announcements are sent in rounds: each round sends the
+ * packets of all subscriptions due (within a small slack) and all of
+ * them use the same random wait, so subscriptions started together
+ * stay in the same rounds.
+ */
+#define NI_ARP_ROUND_SLACK_MSEC		20
+
+typedef struct ni_arp_engine	ni_arp_engine_t;
+
+struct ni_arp_subscription {
+	ni_arp_subscription_t *	next;
+	ni_arp_engine_t *	engine;
+
+	struct in_addr		addr;
+	ni_arp_notify_t *	notify;
+	void *			user_data;
+	ni_bool_t		released;
+
+	ni_bool_t		probing;
+	struct timeval		due;
+	struct {
+		unsigned int	count;
+		unsigned int	wait_min;
+		unsigned int	wait_max;
+	} probe, announce;
+};
+
+struct ni_arp_engine {
+	ni_arp_engine_t *	next;
+	ni_capture_devinfo_t	dev_info;
+	ni_arp_socket_t *	sock;
+
+	ni_arp_subscription_t *	subscriptions;
+	const ni_timer_t *	timer;
+
+	/* set while calling the subscribers; changes are applied after */
+	unsigned int		busy;
+	ni_bool_t		refilter;
+};
+
+static ni_arp_engine_t *	ni_arp_engines;
+
+static void	ni_arp_engine_update(ni_arp_engine_t *);
+
+static inline ni_bool_t
+ni_arp_subscription_pending(const ni_arp_subscription_t *sub)
+{
+	return !sub->released && (sub->probing || sub->announce.count);
+}
+
+static void
+ni_arp_engine_recv(ni_arp_socket_t *arph, const ni_arp_packet_t *pkt, void *user_data)
+{
+	ni_arp_engine_t *engine = user_data;
+	ni_arp_subscription_t *sub;
+
+	/* Ignore packets from our own MAC address, some switches
+	 * seem to send them back to us. */
+	if (ni_link_address_equal(&engine->dev_info.hwaddr, &pkt->sha))
+		return;
+
+	engine->busy++;
+	for (sub = engine->subscriptions; sub; sub = sub->next) {
+		if (sub->released || !sub->notify)
+			continue;
+
+		/*
+		 * RFC 5227, 2.1.1: the address is used by another host, or
+		 * another host is probing for it while we do the same.
+		 */
+		if (pkt->sip.s_addr == sub->addr.s_addr ||
+		    (sub->probing && pkt->op == ARPOP_REQUEST && !pkt->sip.s_addr &&
+		     pkt->tip.s_addr == sub->addr.s_addr))
+			sub->notify(sub, NI_ARP_EVENT_CONFLICT, pkt, sub->user_data);
+	}
+	engine->busy--;
+
+	ni_arp_engine_update(engine);
+}
+
+static ni_arp_engine_t *
+ni_arp_engine_get(const ni_capture_devinfo_t *dev_info)
+{
+	ni_arp_engine_t *engine;
+
+	for (engine = ni_arp_engines; engine; engine = engine->next) {
+		if (engine->dev_info.ifindex != dev_info->ifindex)
+			continue;
+
+		if (!ni_link_address_equal(&engine->dev_info.hwaddr, &dev_info->hwaddr)) {
+			engine->dev_info.hwaddr = dev_info->hwaddr;
+			engine->sock->dev_info.hwaddr = dev_info->hwaddr;
+		}
+		return engine;
+	}
+
+	engine = xcalloc(1, sizeof(*engine));
+	engine->dev_info = *dev_info;
+	engine->dev_info.ifname = NULL;
+	ni_string_dup(&engine->dev_info.ifname, dev_info->ifname);
+
+	engine->sock = ni_arp_socket_open(&engine->dev_info, ni_arp_engine_recv, engine);
+	if (!engine->sock) {
+		ni_string_free(&engine->dev_info.ifname);
+		free(engine);
+		return NULL;
+	}
+
+	engine->next = ni_arp_engines;
+	ni_arp_engines = engine;
+	ni_debug_socket("%s: opened arp engine", engine->dev_info.ifname);
+	return engine;
+}
+
+static void
+ni_arp_engine_free(ni_arp_engine_t *engine)
+{
+	ni_arp_engine_t **pos;
+
+	for (pos = &ni_arp_engines; *pos; pos = &(*pos)->next) {
+		if (*pos == engine) {
+			*pos = engine->next;
+			break;
+		}
+	}
+
+	ni_debug_socket("%s: closing arp engine", engine->dev_info.ifname);
+	if (engine->timer)
+		ni_timer_cancel(engine->timer);
+	ni_arp_socket_close(engine->sock);
+	ni_string_free(&engine->dev_info.ifname);
+	free(engine);
+}
+
+static void
+ni_arp_engine_set_filter(ni_arp_engine_t *engine)
+{
+	ni_arp_subscription_t *sub, *cur;
+	struct in_addr *addrs = NULL;
+	unsigned int count = 0;
+
+	for (sub = engine->subscriptions; sub; sub = sub->next) {
+		for (cur = engine->subscriptions; cur != sub; cur = cur->next) {
+			if (cur->addr.s_addr == sub->addr.s_addr)
+				break;
+		}
+		if (cur != sub)
+			continue;
+
+		addrs = xrealloc(addrs, (count + 1) * sizeof(addrs[0]));
+		addrs[count++] = sub->addr;
+	}
+
+	ni_arp_socket_set_filter(engine->sock, addrs, count);
+	free(addrs);
+	engine->refilter = FALSE;
+}
+
+static unsigned int
+ni_arp_round_wait(unsigned int wait_min, unsigned int wait_max, unsigned int jitter)
+{
+	if (wait_min < wait_max)
+		return wait_min + jitter % (wait_max - wait_min);
+	return wait_max;
+}
+
+static void
+ni_arp_set_due(ni_arp_subscription_t *sub, const struct timeval *now, unsigned int msec)
+{
+	struct timeval delta;
+
+	delta.tv_sec = msec / 1000;
+	delta.tv_usec = (msec % 1000) * 1000;
+	timeradd(now, &delta, &sub->due);
+}
+
+/*
+ * Send the next probe or announcement of the subscription. After the
+ * last probe, we wait the maximum time for replies (ANNOUNCE_WAIT is
+ * PROBE_MAX in RFC 5227 and RFC 3927), then the announcements follow.
+ */
+static void
+ni_arp_round_step(ni_arp_subscription_t *sub, const struct timeval *now, unsigned int jitter)
+{
+	ni_arp_engine_t *engine = sub->engine;
+	struct in_addr null = { 0 };
+
+	if (sub->probe.count) {
+		ni_arp_send_request(engine->sock, null, sub->addr);
+		sub->probe.count--;
+		ni_arp_set_due(sub, now, sub->probe.count ?
+				ni_arp_round_wait(sub->probe.wait_min, sub->probe.wait_max, jitter) :
+				sub->probe.wait_max);
+		return;
+	}
+
+	if (sub->probing) {
+		sub->probing = FALSE;
+		if (sub->notify)
+			sub->notify(sub, NI_ARP_EVENT_VERIFIED, NULL, sub->user_data);
+		if (sub->released || sub->probing || !sub->announce.count)
+			return;
+	}
+
+	if (sub->announce.count) {
+		ni_arp_send_grat_request(engine->sock, sub->addr);
+		sub->announce.count--;
+		if (sub->announce.count) {
+			ni_arp_set_due(sub, now, ni_arp_round_wait(sub->announce.wait_min,
+						sub->announce.wait_max, jitter));
+		} else if (sub->notify) {
+			sub->notify(sub, NI_ARP_EVENT_ANNOUNCED, NULL, sub->user_data);
+		}
+	}
+}
+
+static void
+ni_arp_round_timeout(void *user_data, const ni_timer_t *timer)
+{
+	ni_arp_engine_t *engine = user_data;
+	ni_arp_subscription_t *sub;
+	struct timeval now, slack, deadline;
+	unsigned int jitter, count = 0;
+
+	if (engine->timer != timer)
+		return;
+	engine->timer = NULL;
+
+	ni_timer_get_time(&now);
+	slack.tv_sec = 0;
+	slack.tv_usec = NI_ARP_ROUND_SLACK_MSEC * 1000;
+	timeradd(&now, &slack, &deadline);
+	jitter = (unsigned int) random();
+
+	engine->busy++;
+	for (sub = engine->subscriptions; sub; sub = sub->next) {
+		if (!ni_arp_subscription_pending(sub) || timercmp(&sub->due, &deadline, >))
+			continue;
+
+		ni_arp_round_step(sub, &now, jitter);
+		count++;
+	}
+	engine->busy--;
+
+	ni_debug_socket("%s: arp round for %u address%s", engine->dev_info.ifname,
+			count, count == 1 ? "" : "es");
+	ni_arp_engine_update(engine);
+}
+
+static void
+ni_arp_engine_schedule(ni_arp_engine_t *engine)
+{
+	const ni_arp_subscription_t *sub;
+	const struct timeval *due = NULL;
+	struct timeval now, delta;
+	unsigned long msec = 0;
+
+	for (sub = engine->subscriptions; sub; sub = sub->next) {
+		if (!ni_arp_subscription_pending(sub))
+			continue;
+		if (!due || timercmp(&sub->due, due, <))
+			due = &sub->due;
+	}
+
+	if (!due) {
+		if (engine->timer)
+			ni_timer_cancel(engine->timer);
+		engine->timer = NULL;
+		return;
+	}
+
+	ni_timer_get_time(&now);
+	if (timercmp(due, &now, >)) {
+		timersub(due, &now, &delta);
+		msec = delta.tv_sec * 1000 + delta.tv_usec / 1000;
+	}
+
+	if (engine->timer)
+		ni_timer_rearm(engine->timer, msec);
+	else
+		engine->timer = ni_timer_register(msec, ni_arp_round_timeout, engine);
+}
+
+/*
+ * Apply the changes the subscribers made: free released subscriptions,
+ * update the filter and the round timer. The engine goes away with the
+ * last subscription.
+ */
+static void
+ni_arp_engine_update(ni_arp_engine_t *engine)
+{
+	ni_arp_subscription_t **pos, *sub;
+
+	if (engine->busy)
+		return;
+
+	for (pos = &engine->subscriptions; (sub = *pos); ) {
+		if (sub->released) {
+			*pos = sub->next;
+			free(sub);
+			engine->refilter = TRUE;
+		} else {
+			pos = &sub->next;
+		}
+	}
+
+	if (!engine->subscriptions) {
+		ni_arp_engine_free(engine);
+		return;
+	}
+
+	if (engine->refilter)
+		ni_arp_engine_set_filter(engine);
+	ni_arp_engine_schedule(engine);
+}
+
+ni_arp_subscription_t *
+ni_arp_subscribe(const ni_capture_devinfo_t *dev_info, struct in_addr addr,
+		ni_arp_notify_t *notify, void *user_data)
+{
+	ni_arp_subscription_t *sub;
+	ni_arp_engine_t *engine;
+
+	if (!dev_info || !addr.s_addr)
+		return NULL;
+
+	if (!(engine = ni_arp_engine_get(dev_info)))
+		return NULL;
+
+	sub = xcalloc(1, sizeof(*sub));
+	sub->engine = engine;
+	sub->addr = addr;
+	sub->notify = notify;
+	sub->user_data = user_data;
+
+	sub->next = engine->subscriptions;
+	engine->subscriptions = sub;
+	engine->refilter = TRUE;
+
+	ni_arp_engine_update(engine);
+	return sub;
+}
+
+void
+ni_arp_unsubscribe(ni_arp_subscription_t *sub)
+{
+	if (!sub || sub->released)
+		return;
+
+	sub->released = TRUE;
+	sub->notify = NULL;
+	sub->user_data = NULL;
+	ni_arp_engine_update(sub->engine);
+}
+
+/*
+ * Probe for the address with count requests; conflicts are reported
+ * as they are seen, NI_ARP_EVENT_VERIFIED after the last probe.
+ * The first probe goes out with the next round.
+ */
+int
+ni_arp_probe(ni_arp_subscription_t *sub, unsigned int count,
+		unsigned int wait_min, unsigned int wait_max)
+{
+	if (!sub || sub->released)
+		return -1;
+
+	sub->probing = count > 0;
+	sub->probe.count = count;
+	sub->probe.wait_min = wait_min;
+	sub->probe.wait_max = wait_max;
+	ni_timer_get_time(&sub->due);
+
+	ni_debug_socket("%s: arp probing for %s", sub->engine->dev_info.ifname,
+			inet_ntoa(sub->addr));
+	ni_arp_engine_update(sub->engine);
+	return 0;
+}
+
+/*
+ * Announce the address with count gratuitous requests, after the
+ * probing if there is one pending; NI_ARP_EVENT_ANNOUNCED is sent
+ * with the last one.
+ */
+int
+ni_arp_announce(ni_arp_subscription_t *sub, unsigned int count,
+		unsigned int wait_min, unsigned int wait_max)
+{
+	if (!sub || sub->released)
+		return -1;
+
+	sub->announce.count = count;
+	sub->announce.wait_min = wait_min;
+	sub->announce.wait_max = wait_max;
+	if (!sub->probing)
+		ni_timer_get_time(&sub->due);
+
+	ni_arp_engine_update(sub->engine);
+	return 0;
+}
+
+/*
+ * Defend the address with a single reply to the host claiming it
+ */
+int
+ni_arp_defend(ni_arp_subscription_t *sub, const ni_hwaddr_t *tha)
+{
+	if (!sub || sub->released)
+		return -1;
+
+	return ni_arp_send_reply(sub->engine->sock, sub->addr, tha, sub->addr);
+}
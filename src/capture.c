@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -44,6 +45,7 @@
 #include <wicked/socket.h>
 #include "netinfo_priv.h"
 #include "socket_priv.h"
+#include "appconfig.h"
 #include "buffer.h"
 
 #define MTU_MAX			1500
@@ -53,6 +55,22 @@
 # define ETHERTYPE_LLDP		0x88CC
 #endif
 
+#define NI_CAPTURE_SHARED_BUCKETS	256
+#define NI_CAPTURE_SHARED_MTU		16384
+#define NI_CAPTURE_SHARED_SCALE		4	/* ring blocks */
+#define NI_CAPTURE_SHARED_BATCH		64	/* packets per wakeup */
+#define NI_CAPTURE_SEND_BATCH		64	/* packets per sendmmsg */
+#define NI_CAPTURE_SHARED_RCVBUF	131072	/* per child */
+#define NI_CAPTURE_SHARED_RCVBUF_MAX	(8U << 20)	/* for all children */
+
+#if defined(PACKET_RX_RING) && defined(HAVE_STRUCT_TPACKET_REQ3)
+# define NI_CAPTURE_RING	1
+# define NI_CAPTURE_RING_BLOCK_SIZE	(1 << 16)
+# define NI_CAPTURE_RING_BLOCK_COUNT	4
+# define NI_CAPTURE_RING_FRAME_SIZE	2048
+# define NI_CAPTURE_RING_RETIRE_TMO	4	/* msec */
+#endif
+
 /* in case we have old headers files */
 #if defined(PACKET_AUXDATA) && !defined(HAVE_STRUCT_TPACKET_AUXDATA)
 struct tpacket_auxdata {
@@ -67,31 +85,96 @@ struct tpacket_auxdata {
 #endif
 
 /*
- * Credit where credit is due :)
- * The below BPF filter is taken from ISC DHCP
+ * Capture filters are generated per capture from the protocol info
+ * and replaced by the kernel atomically when they change. The jumps
+ * are to the next instruction or one of the accept and reject return
+ * statements appended at the end of the program.
  */
-static struct bpf_insn std_ipv4_bpf_filter [] = {
-	/* Make sure it's a UDP packet... */
-	BPF_STMT(BPF_LD + BPF_B + BPF_ABS, 9),
-	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_UDP, 0, 6),
+#define NI_CAPTURE_BPF_MAX		64
+#define NI_CAPTURE_BPF_ACCEPT		0xfe
+#define NI_CAPTURE_BPF_REJECT		0xff
 
-	/* Make sure this isn't a fragment... */
-	BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 6),
-	BPF_JUMP(BPF_JMP + BPF_JSET + BPF_K, 0x1fff, 4, 0),
+typedef struct ni_capture_bpf {
+	unsigned int		len;
+	struct sock_filter	ins[NI_CAPTURE_BPF_MAX];
+} ni_capture_bpf_t;
 
-	/* Get the IP header length... */
-	BPF_STMT(BPF_LDX + BPF_B + BPF_MSH, 0),
+static inline void
+ni_capture_bpf_stmt(ni_capture_bpf_t *bpf, unsigned short code, unsigned int k)
+{
+	if (bpf->len < NI_CAPTURE_BPF_MAX - 2) {
+		struct sock_filter ins = BPF_STMT(code, k);
+		bpf->ins[bpf->len] = ins;
+	}
+	bpf->len++;
+}
 
-	/* Make sure it's to the right port... */
-	BPF_STMT(BPF_LD + BPF_H + BPF_IND, 2),
-	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, DHCP_CLIENT_PORT, 0, 1),
+static inline void
+ni_capture_bpf_jump(ni_capture_bpf_t *bpf, unsigned short code, unsigned int k,
+			unsigned char jt, unsigned char jf)
+{
+	if (bpf->len < NI_CAPTURE_BPF_MAX - 2) {
+		struct sock_filter ins = BPF_JUMP(code, k, jt, jf);
+		bpf->ins[bpf->len] = ins;
+	}
+	bpf->len++;
+}
 
-	/* If we passed all the tests, ask for the whole packet. */
-	BPF_STMT(BPF_RET + BPF_K, ~0U),
+/* reject the packet unless the loaded value matches */
+static inline void
+ni_capture_bpf_match(ni_capture_bpf_t *bpf, unsigned short code, unsigned int off, unsigned int k)
+{
+	ni_capture_bpf_stmt(bpf, BPF_LD + code, off);
+	ni_capture_bpf_jump(bpf, BPF_JMP + BPF_JEQ + BPF_K, k, 0, NI_CAPTURE_BPF_REJECT);
+}
 
-	/* Otherwise, drop it. */
-	BPF_STMT(BPF_RET + BPF_K, 0),
-};
+static void
+ni_capture_bpf_match_bytes(ni_capture_bpf_t *bpf, unsigned short mode, unsigned int off,
+				const unsigned char *data, unsigned int len)
+{
+	while (len >= 4) {
+		ni_capture_bpf_match(bpf, BPF_W + mode, off, ((uint32_t)data[0] << 24) |
+				(data[1] << 16) | (data[2] << 8) | data[3]);
+		data += 4; off += 4; len -= 4;
+	}
+	if (len >= 2) {
+		ni_capture_bpf_match(bpf, BPF_H + mode, off, (data[0] << 8) | data[1]);
+		data += 2; off += 2; len -= 2;
+	}
+	if (len)
+		ni_capture_bpf_match(bpf, BPF_B + mode, off, data[0]);
+}
+
+static int
+ni_capture_bpf_finish(ni_capture_bpf_t *bpf)
+{
+	unsigned int accept, reject, i;
+
+	if (bpf->len > NI_CAPTURE_BPF_MAX - 2)
+		return -1;
+
+	accept = bpf->len;
+	reject = bpf->len + 1;
+	for (i = 0; i < bpf->len; ++i) {
+		struct sock_filter *ins = &bpf->ins[i];
+
+		if (BPF_CLASS(ins->code) != BPF_JMP || BPF_OP(ins->code) == BPF_JA)
+			continue;
+		if (ins->jt == NI_CAPTURE_BPF_ACCEPT)
+			ins->jt = accept - i - 1;
+		else if (ins->jt == NI_CAPTURE_BPF_REJECT)
+			ins->jt = reject - i - 1;
+		if (ins->jf == NI_CAPTURE_BPF_ACCEPT)
+			ins->jf = accept - i - 1;
+		else if (ins->jf == NI_CAPTURE_BPF_REJECT)
+			ins->jf = reject - i - 1;
+	}
+	bpf->ins[bpf->len].code = BPF_RET + BPF_K;
+	bpf->ins[bpf->len++].k = ~0U;
+	bpf->ins[bpf->len].code = BPF_RET + BPF_K;
+	bpf->ins[bpf->len++].k = 0;
+	return 0;
+}
 
 /*
  * Wrap sockaddr_ll same to ni_sockaddr_t,
@@ -126,9 +209,56 @@ struct ni_capture {
 	} retrans;
 
 	void *			user_data;
+
+	ni_capture_stats_t	stats;
+	ni_capture_bpf_t *	filter;
+
+	/* set while dispatching received packets, a free is deferred */
+	ni_bool_t		busy;
+	ni_bool_t		release;
+
+	/*
+	 * A shared capture is an unbound socket receiving packets for all
+	 * child captures, which are hashed by ifindex. The children do not
+	 * have an own packet socket, but send via the shared one and get
+	 * the packets received on their ifindex (matching the DHCP xid and
+	 * chaddr of the child). The child socket is used for timers only.
+	 */
+	struct {
+		ni_capture_t *		parent;
+		ni_capture_t *		next;
+		ni_capture_t **		children;
+		unsigned int		count;
+
+		unsigned int		ifindex;
+		uint32_t		dhcp_xid;
+		ni_hwaddr_t		dhcp_chaddr;
+		void			(*receive)(ni_socket_t *);
+
+		void *			packet;
+		size_t			bytes;
+		ni_bool_t		partial_checksum;
+	} shared;
+
+#ifdef NI_CAPTURE_RING
+	/*
+	 * TPACKET_V3 receive ring: the kernel fills blocks of frames and
+	 * passes a block to us by setting TP_STATUS_USER in its header.
+	 * We call the receive callback for each frame and hand the block
+	 * back. ni_capture_recv() returns a view to the current frame.
+	 */
+	struct {
+		unsigned char *		map;
+		size_t			size;
+		unsigned int		block_size;
+		unsigned int		block_count;
+		unsigned int		block;
+		struct tpacket3_hdr *	frame;
+		void			(*receive)(ni_socket_t *);
+	} ring;
+#endif
 };
 
-static int		ni_capture_set_filter(ni_capture_t *, const ni_capture_protinfo_t *);
 static ssize_t		__ni_capture_send(const ni_capture_t *, const ni_buffer_t *);
 
 static uint32_t
@@ -412,9 +542,10 @@ __ni_capture_socket_check_timeout(ni_socket_t *sock, const struct timeval *now)
 /*
  * Capture receive handling
  */
-int
-__ni_capture_recv(int fd, void *buf, size_t len, ni_bool_t *partial_csum)
+static ssize_t
+__ni_capture_recv(int fd, void *buf, size_t len, ni_bool_t *partial_csum, unsigned int *ifindex)
 {
+	struct sockaddr_ll from;
 #if defined(PACKET_AUXDATA)
 	/* use 2 times bigger buffer to catch possible additions... */
 	unsigned char cbuf[CMSG_SPACE(sizeof(struct tpacket_auxdata)*2)];
@@ -423,6 +554,8 @@ __ni_capture_recv(int fd, void *buf, size_t len, ni_bool_t *partial_csum)
 		.iov_len  = len,
 	};
 	struct msghdr msg = {
+		.msg_name = &from,
+		.msg_namelen = sizeof(from),
 		.msg_iov = &iov,
 		.msg_iovlen = 1,
 		.msg_control = cbuf,
@@ -434,9 +567,11 @@ __ni_capture_recv(int fd, void *buf, size_t len, ni_bool_t *partial_csum)
 
 	*partial_csum = FALSE;
 	memset(cbuf, 0, sizeof(cbuf));
+	memset(&from, 0, sizeof(from));
 
 	if ((bytes = recvmsg (fd, &msg, 0)) < 0)
 		return bytes;
+	*ifindex = from.sll_ifindex;
 
 	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
 		if (cmsg->cmsg_level == SOL_PACKET &&
@@ -451,23 +586,65 @@ __ni_capture_recv(int fd, void *buf, size_t len, ni_bool_t *partial_csum)
 
 	return bytes;
 #else
+	socklen_t alen = sizeof(from);
+	ssize_t bytes;
+
 	*partial_csum = FALSE;
+	memset(&from, 0, sizeof(from));
+
+	bytes = recvfrom(fd, buf, len, 0, (struct sockaddr *)&from, &alen);
+	*ifindex = from.sll_ifindex;
+	return bytes;
+#endif
+}
+
+static ssize_t
+__ni_capture_recv_packet(ni_capture_t *capture, void **packet, ni_bool_t *partial_checksum,
+			unsigned int *ifindex)
+{
+	if (capture->shared.parent) {
+		if (!capture->shared.packet) {
+			ni_error("%s: no packet received on shared capture", __FUNCTION__);
+			return -1;
+		}
+		*packet = capture->shared.packet;
+		*partial_checksum = capture->shared.partial_checksum;
+		*ifindex = capture->shared.ifindex;
+		return capture->shared.bytes;
+	}
 
-	return read(fd, buf, len);
+#ifdef NI_CAPTURE_RING
+	if (capture->ring.map) {
+		struct tpacket3_hdr *frame = capture->ring.frame;
+		const struct sockaddr_ll *from;
+
+		if (!frame) {
+			ni_error("%s: no packet in capture ring", __FUNCTION__);
+			return -1;
+		}
+		from = (void *)((unsigned char *)frame + TPACKET_ALIGN(sizeof(*frame)));
+		*packet = (unsigned char *)frame + frame->tp_net;
+		*partial_checksum = !!(frame->tp_status & TP_STATUS_CSUMNOTREADY);
+		*ifindex = from->sll_ifindex;
+		return min_t(size_t, frame->tp_snaplen, capture->mtu);
+	}
 #endif
+
+	*packet = capture->buffer;
+	return __ni_capture_recv(capture->sock->__fd, capture->buffer, capture->mtu,
+				partial_checksum, ifindex);
 }
 
 int
 ni_capture_recv(ni_capture_t *capture, ni_buffer_t *bp)
 {
-	void *payload;
+	void *packet = NULL, *payload;
 	size_t payload_len;
 	ssize_t bytes;
 	ni_bool_t partial_checksum = FALSE;
+	unsigned int ifindex = 0;
 
-	bytes = __ni_capture_recv(capture->sock->__fd, capture->buffer,
-				  capture->mtu, &partial_checksum);
-
+	bytes = __ni_capture_recv_packet(capture, &packet, &partial_checksum, &ifindex);
 	if (bytes < 0) {
 		ni_error("%s: cannot read from socket: %m", __FUNCTION__);
 		return -1;
@@ -479,7 +656,7 @@ ni_capture_recv(ni_capture_t *capture, ni_buffer_t *bp)
 	switch (capture->protocol) {
 	case ETHERTYPE_IP:
 		/* Make sure IP and UDP header are sane */
-		payload = ni_capture_inspect_udp_header(capture->buffer, bytes,
+		payload = ni_capture_inspect_udp_header(packet, bytes,
 						&payload_len, partial_checksum);
 		if (payload == NULL) {
 			ni_debug_socket("bad IP/UDP packet header");
@@ -489,7 +666,7 @@ ni_capture_recv(ni_capture_t *capture, ni_buffer_t *bp)
 
 	case ETHERTYPE_ARP:
 	case ETHERTYPE_LLDP:
-		payload = capture->buffer;
+		payload = packet;
 		payload_len = bytes;
 		break;
 
@@ -502,6 +679,192 @@ ni_capture_recv(ni_capture_t *capture, ni_buffer_t *bp)
 	return payload_len;
 }
 
+#ifdef NI_CAPTURE_RING
+static void
+__ni_capture_ring_receive(ni_socket_t *sock)
+{
+	ni_capture_t *capture = sock->user_data;
+	struct tpacket_block_desc *block;
+	struct tpacket3_hdr *frame;
+	unsigned int i, count;
+
+	capture->busy = TRUE;
+	while (!capture->release) {
+		block = (void *)(capture->ring.map +
+			capture->ring.block * capture->ring.block_size);
+		if (!(block->hdr.bh1.block_status & TP_STATUS_USER))
+			break;
+		__sync_synchronize();
+
+		count = block->hdr.bh1.num_pkts;
+		frame = (void *)((unsigned char *)block + block->hdr.bh1.offset_to_first_pkt);
+		for (i = 0; i < count && !capture->release; ++i) {
+			capture->ring.frame = frame;
+			capture->ring.receive(sock);
+			frame = (void *)((unsigned char *)frame + frame->tp_next_offset);
+		}
+		capture->ring.frame = NULL;
+
+		__sync_synchronize();
+		block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		capture->ring.block = (capture->ring.block + 1) % capture->ring.block_count;
+	}
+	capture->busy = FALSE;
+
+	/* freed by the receive callback */
+	if (capture->release)
+		ni_capture_free(capture);
+}
+
+static void
+__ni_capture_ring_close(ni_capture_t *capture)
+{
+	if (capture->ring.map) {
+		munmap(capture->ring.map, capture->ring.size);
+		capture->ring.map = NULL;
+		capture->ring.size = 0;
+	}
+}
+
+static ni_bool_t
+__ni_capture_ring_map(ni_capture_t *capture, int fd, unsigned int size, unsigned int count)
+{
+	struct tpacket_req3 req;
+	void *map;
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = size;
+	req.tp_block_nr = count;
+	req.tp_frame_size = NI_CAPTURE_RING_FRAME_SIZE;
+	req.tp_frame_nr = (size / NI_CAPTURE_RING_FRAME_SIZE) * count;
+	req.tp_retire_blk_tov = NI_CAPTURE_RING_RETIRE_TMO;
+	if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+		ni_warn("%s: cannot setup capture ring: %m", capture->ifname);
+		return FALSE;
+	}
+
+	map = mmap(NULL, (size_t)size * count, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		ni_warn("%s: cannot map capture ring: %m", capture->ifname);
+		memset(&req, 0, sizeof(req));
+		setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+		return FALSE;
+	}
+
+	capture->ring.map = map;
+	capture->ring.size = (size_t)size * count;
+	capture->ring.block_size = size;
+	capture->ring.block_count = count;
+	capture->ring.block = 0;
+	ni_debug_socket("%s: using %u x %u bytes capture ring",
+			capture->ifname, count, size);
+	return TRUE;
+}
+
+static ni_bool_t
+__ni_capture_ring_open(ni_capture_t *capture, int fd, unsigned int scale)
+{
+	const ni_config_packet_capture_t *conf;
+	int version = TPACKET_V3;
+	unsigned int size, count;
+
+	if (!ni_global.config || !(conf = &ni_global.config->packet_capture)->mmap_ring)
+		return FALSE;
+
+	size = conf->ring_block_size ? conf->ring_block_size : NI_CAPTURE_RING_BLOCK_SIZE;
+	count = conf->ring_block_count ? conf->ring_block_count : NI_CAPTURE_RING_BLOCK_COUNT * scale;
+	size = (size + getpagesize() - 1) & ~(getpagesize() - 1);
+	if (size < NI_CAPTURE_RING_FRAME_SIZE * 2 || size < capture->mtu * 2)
+		size = (NI_CAPTURE_RING_FRAME_SIZE + capture->mtu) * 2;
+	size = (size + getpagesize() - 1) & ~(getpagesize() - 1);
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+		ni_debug_socket("%s: cannot use TPACKET_V3 capture ring: %m", capture->ifname);
+		return FALSE;
+	}
+
+	if (__ni_capture_ring_map(capture, fd, size, count))
+		return TRUE;
+
+	/* back to the default, the ring can't be setup any more later */
+	version = TPACKET_V1;
+	setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version));
+	return FALSE;
+}
+
+/*
+ * Replace the ring by a larger one. The kernel refuses to change
+ * a ring in place, so it is torn down first -- packets still in
+ * the old ring are lost and have to be retransmitted.
+ */
+static void
+__ni_capture_ring_resize(ni_capture_t *capture, unsigned int count)
+{
+	unsigned int size = capture->ring.block_size;
+	unsigned int old = capture->ring.block_count;
+	struct tpacket_req3 req;
+	int fd = capture->sock->__fd;
+
+	if (!capture->ring.map || capture->busy || count <= old)
+		return;
+
+	__ni_capture_ring_close(capture);
+	memset(&req, 0, sizeof(req));
+	if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+		ni_warn("%s: cannot release capture ring: %m", capture->ifname);
+		return;
+	}
+	if (!__ni_capture_ring_map(capture, fd, size, count))
+		__ni_capture_ring_map(capture, fd, size, old);
+}
+#endif
+
+/*
+ * Get the packet and drop counters of the capture socket since it
+ * has been opened.
+ */
+int
+ni_capture_get_stats(ni_capture_t *capture, ni_capture_stats_t *stats)
+{
+#if defined(PACKET_STATISTICS)
+	union {
+		struct tpacket_stats		v2;
+#ifdef NI_CAPTURE_RING
+		struct tpacket_stats_v3		v3;
+#endif
+	} st;
+	socklen_t len = sizeof(st);
+
+	if (!capture || !stats)
+		return -1;
+
+	if (capture->shared.parent)
+		capture = capture->shared.parent;
+
+	/* the kernel resets the counters on each query */
+	memset(&st, 0, sizeof(st));
+	if (capture->sock && capture->sock->__fd >= 0 &&
+	    getsockopt(capture->sock->__fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) == 0) {
+		capture->stats.packets += st.v2.tp_packets;
+		capture->stats.drops += st.v2.tp_drops;
+#ifdef NI_CAPTURE_RING
+		if (capture->ring.map)
+			capture->stats.freezes += st.v3.tp_freeze_q_cnt;
+#endif
+	}
+	*stats = capture->stats;
+	return 0;
+#else
+	if (!capture || !stats)
+		return -1;
+
+	if (capture->shared.parent)
+		capture = capture->shared.parent;
+	*stats = capture->stats;
+	return 0;
+#endif
+}
+
 /*
  * Get/set user data
  */
@@ -525,6 +888,9 @@ ni_capture_is_valid(const ni_capture_t *capture, int protocol)
 {
 	ni_socket_t *sock = capture->sock;
 
+	if (capture->shared.parent)
+		sock = capture->shared.parent->sock;
+
 	return (sock && !sock->error && capture->protocol == protocol);
 }
 
@@ -614,15 +980,16 @@ __ni_capture_enable_packet_auxdata(int fd)
 #endif
 }
 
+static ni_capture_t *	__ni_capture_open(const ni_capture_devinfo_t *, const ni_capture_protinfo_t *,
+				const ni_hwaddr_t *, void (*)(ni_socket_t *), unsigned int);
+static ni_capture_t *	ni_capture_shared_open(const ni_capture_devinfo_t *, const ni_capture_protinfo_t *,
+				const ni_hwaddr_t *, void (*)(ni_socket_t *));
+
 ni_capture_t *
 ni_capture_open(const ni_capture_devinfo_t *devinfo, const ni_capture_protinfo_t *protinfo, void (*receive)(ni_socket_t *))
 {
-	ni_packetaddr_t	addr;
-	ni_capture_t *capture = NULL;
 	ni_hwaddr_t destaddr;
 
-	int fd = -1;
-
 	if (devinfo->ifindex == 0) {
 		ni_error("no ifindex for interface `%s'", devinfo->ifname);
 		return NULL;
@@ -641,6 +1008,43 @@ ni_capture_open(const ni_capture_devinfo_t *devinfo, const ni_capture_protinfo_t
 		return NULL;
 	}
 
+	if (protinfo->shared)
+		return ni_capture_shared_open(devinfo, protinfo, &destaddr, receive);
+
+	return __ni_capture_open(devinfo, protinfo, &destaddr, receive, devinfo->ifindex);
+}
+
+static void
+__ni_capture_init_addr(ni_capture_t *capture, const ni_capture_devinfo_t *devinfo,
+			const ni_capture_protinfo_t *protinfo, const ni_hwaddr_t *destaddr)
+{
+	ni_string_dup(&capture->ifname, devinfo->ifname);
+	capture->protocol = protinfo->eth_protocol;
+
+	capture->addr.sll.sll_family = AF_PACKET;
+	capture->addr.sll.sll_protocol = htons(protinfo->eth_protocol);
+	capture->addr.sll.sll_ifindex = devinfo->ifindex;
+	capture->addr.sll.sll_hatype = htons(devinfo->hwaddr.type);
+	capture->addr.sll.sll_halen = destaddr->len;
+	memcpy(&capture->addr.sll.sll_addr, destaddr->data, destaddr->len);
+
+	capture->mtu = devinfo->mtu;
+	if (capture->mtu == 0)
+		capture->mtu = MTU_MAX;
+}
+
+/*
+ * Open a packet socket bound to the interface with bind_ifindex or,
+ * when 0, to all interfaces.
+ */
+static ni_capture_t *
+__ni_capture_open(const ni_capture_devinfo_t *devinfo, const ni_capture_protinfo_t *protinfo,
+		const ni_hwaddr_t *destaddr, void (*receive)(ni_socket_t *), unsigned int bind_ifindex)
+{
+	ni_packetaddr_t	addr;
+	ni_capture_t *capture = NULL;
+	int fd = -1;
+
 	if ((fd = socket (PF_PACKET, SOCK_DGRAM, htons(protinfo->eth_protocol))) < 0) {
 		ni_error("socket: %m");
 		return NULL;
@@ -650,16 +1054,8 @@ ni_capture_open(const ni_capture_devinfo_t *devinfo, const ni_capture_protinfo_t
 	capture = calloc(1, sizeof(*capture));
 	if (!capture)
 		goto failed;
-	ni_string_dup(&capture->ifname, devinfo->ifname);
 	capture->sock = ni_socket_wrap(fd, SOCK_DGRAM);
-	capture->protocol = protinfo->eth_protocol;
-
-	capture->addr.sll.sll_family = AF_PACKET;
-	capture->addr.sll.sll_protocol = htons(protinfo->eth_protocol);
-	capture->addr.sll.sll_ifindex = devinfo->ifindex;
-	capture->addr.sll.sll_hatype = htons(devinfo->hwaddr.type);
-	capture->addr.sll.sll_halen = destaddr.len;
-	memcpy(&capture->addr.sll.sll_addr, destaddr.data, destaddr.len);
+	__ni_capture_init_addr(capture, devinfo, protinfo, destaddr);
 
 	if (ni_capture_set_filter(capture, protinfo) < 0)
 		goto failed;
@@ -667,7 +1063,7 @@ ni_capture_open(const ni_capture_devinfo_t *devinfo, const ni_capture_protinfo_t
 	memset(&addr, 0, sizeof(addr));
 	addr.sll.sll_family = PF_PACKET;
 	addr.sll.sll_protocol = htons(protinfo->eth_protocol);
-	addr.sll.sll_ifindex = devinfo->ifindex;
+	addr.sll.sll_ifindex = bind_ifindex;
 
 	if (bind(fd, &addr.sa, sizeof(addr)) == -1) {
 		ni_error("bind: %m");
@@ -676,12 +1072,19 @@ ni_capture_open(const ni_capture_devinfo_t *devinfo, const ni_capture_protinfo_t
 
 	__ni_capture_enable_packet_auxdata(fd);
 
-	capture->mtu = devinfo->mtu;
-	if (capture->mtu == 0)
-		capture->mtu = MTU_MAX;
+	capture->sock->receive = receive;
+#ifdef NI_CAPTURE_RING
+	/* an unbound (shared) socket receives for many interfaces */
+	if (__ni_capture_ring_open(capture, fd, bind_ifindex ? 1 : NI_CAPTURE_SHARED_SCALE)) {
+		capture->ring.receive = receive;
+		capture->sock->receive = __ni_capture_ring_receive;
+	} else
+#endif
 	capture->buffer = xmalloc(capture->mtu);
 
-	capture->sock->receive = receive;
+	if (!bind_ifindex)
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
 	capture->sock->get_timeout = __ni_capture_socket_get_timeout;
 	capture->sock->check_timeout = __ni_capture_socket_check_timeout;
 	capture->sock->user_data = capture;
@@ -695,34 +1098,381 @@ failed:
 	return NULL;
 }
 
+/*
+ * Shared captures
+ */
+
+/* the shared parent captures, linked via shared.next */
+static ni_capture_t *		ni_capture_shared_parents;
+
+static inline unsigned int
+ni_capture_shared_key(const ni_capture_protinfo_t *protinfo)
+{
+	const ni_hwaddr_t *dest = &protinfo->eth_destaddr;
+
+	/* the LLDP destinations differ in the last octet only and
+	 * need a parent with an own filter each */
+	if (protinfo->eth_protocol == ETHERTYPE_LLDP && dest->len)
+		return (protinfo->eth_protocol << 24) | dest->data[dest->len - 1];
+
+	return (protinfo->eth_protocol << 24) | (protinfo->ip_protocol << 16) | protinfo->ip_port;
+}
+
+static ni_bool_t
+ni_capture_shared_match(const ni_capture_t *child, const unsigned char *packet, size_t bytes)
+{
+	const unsigned char *bootp;
+	unsigned int ihl;
+
+	if (!child->shared.dhcp_xid && !child->shared.dhcp_chaddr.len)
+		return TRUE;
+
+	/* as in the per-capture BPF filter, see ni_capture_build_udp_filter */
+	if (bytes < 20)
+		return FALSE;
+	ihl = (packet[0] & 0x0f) << 2;
+	if (bytes < ihl + 8 + 28 + 16)
+		return FALSE;
+
+	bootp = packet + ihl + 8;
+	if (child->shared.dhcp_xid && (bootp[0] != 2 /* BOOTREPLY */ ||
+	    memcmp(bootp + 4, &child->shared.dhcp_xid, sizeof(child->shared.dhcp_xid))))
+		return FALSE;
+	if (child->shared.dhcp_chaddr.len && child->shared.dhcp_chaddr.len <= 16 &&
+	    memcmp(bootp + 28, child->shared.dhcp_chaddr.data, child->shared.dhcp_chaddr.len))
+		return FALSE;
+	return TRUE;
+}
+
+static void
+__ni_capture_shared_dispatch(ni_capture_t *parent, void *packet, size_t bytes,
+				ni_bool_t partial_checksum, unsigned int ifindex)
+{
+	ni_capture_t *child;
+
+	child = parent->shared.children[ifindex % NI_CAPTURE_SHARED_BUCKETS];
+	for ( ; child; child = child->shared.next) {
+		if (child->shared.ifindex == ifindex &&
+		    ni_capture_shared_match(child, packet, bytes))
+			break;
+	}
+	if (!child)
+		return;
+
+	child->shared.packet = packet;
+	child->shared.bytes = bytes;
+	child->shared.partial_checksum = partial_checksum;
+
+	child->busy = TRUE;
+	child->shared.receive(child->sock);
+	child->busy = FALSE;
+	child->shared.packet = NULL;
+	if (child->release)
+		ni_capture_free(child);
+}
+
+static void
+__ni_capture_shared_receive(ni_socket_t *sock)
+{
+	ni_capture_t *parent = sock->user_data;
+	ni_bool_t partial_checksum;
+	ni_bool_t busy = parent->busy;
+	unsigned int ifindex, n;
+	void *packet;
+	ssize_t bytes;
+
+	/*
+	 * The ring calls us for each frame, otherwise read as many
+	 * packets as available (up to a limit) from the non-blocking
+	 * socket for all children at once.
+	 */
+	parent->busy = TRUE;
+	for (n = 0; n < NI_CAPTURE_SHARED_BATCH && !parent->release; ++n) {
+		packet = NULL;
+		ifindex = 0;
+		partial_checksum = FALSE;
+
+		bytes = __ni_capture_recv_packet(parent, &packet, &partial_checksum, &ifindex);
+		if (bytes < 0) {
+			if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+				ni_error("%s: cannot read from socket: %m", __FUNCTION__);
+			break;
+		}
+		__ni_capture_shared_dispatch(parent, packet, bytes, partial_checksum, ifindex);
+#ifdef NI_CAPTURE_RING
+		if (parent->ring.map)
+			break;
+#endif
+	}
+	parent->busy = busy;
+	if (!busy && parent->release)
+		ni_capture_free(parent);
+}
+
+static ni_capture_t *
+ni_capture_shared_parent(const ni_capture_devinfo_t *devinfo, const ni_capture_protinfo_t *protinfo)
+{
+	ni_capture_t *parent, **pos;
+	ni_capture_devinfo_t pdevinfo;
+	ni_capture_protinfo_t pprotinfo;
+	unsigned int key = ni_capture_shared_key(protinfo);
+
+	for (pos = &ni_capture_shared_parents; (parent = *pos); ) {
+		if (parent->sock->error) {
+			/* broken, its children will reopen via a new one;
+			 * the last one unlinked frees it */
+			*pos = parent->shared.next;
+			parent->shared.next = NULL;
+			if (!parent->shared.count)
+				ni_capture_free(parent);
+			continue;
+		}
+		if (parent->shared.ifindex == key)
+			return parent;
+		pos = &parent->shared.next;
+	}
+
+	memset(&pdevinfo, 0, sizeof(pdevinfo));
+	pdevinfo.ifname = "shared";
+	pdevinfo.hwaddr = devinfo->hwaddr;
+	pdevinfo.mtu = NI_CAPTURE_SHARED_MTU;
+
+	pprotinfo = *protinfo;
+	pprotinfo.dhcp_xid = 0;
+	memset(&pprotinfo.dhcp_chaddr, 0, sizeof(pprotinfo.dhcp_chaddr));
+	pprotinfo.arp_addrs = NULL;
+	pprotinfo.arp_count = 0;
+
+	parent = __ni_capture_open(&pdevinfo, &pprotinfo, &devinfo->hwaddr,
+				__ni_capture_shared_receive, 0);
+	if (!parent)
+		return NULL;
+
+	parent->shared.ifindex = key;
+	parent->shared.children = xcalloc(NI_CAPTURE_SHARED_BUCKETS,
+					sizeof(parent->shared.children[0]));
+	parent->shared.next = ni_capture_shared_parents;
+	ni_capture_shared_parents = parent;
+	ni_debug_socket("opened shared capture socket for ether type 0x%04x",
+			protinfo->eth_protocol);
+	return parent;
+}
+
+/*
+ * Grow the receive buffer or ring with the number of children, as
+ * it has to take the bursts of all of them -- up to a limit
+ */
+static void
+ni_capture_shared_set_rcvbuf(ni_capture_t *parent)
+{
+	size_t need = (size_t)NI_CAPTURE_SHARED_RCVBUF * parent->shared.count;
+	int size, cur = 0, fd = parent->sock->__fd;
+	socklen_t len = sizeof(cur);
+
+	if (need > NI_CAPTURE_SHARED_RCVBUF_MAX)
+		need = NI_CAPTURE_SHARED_RCVBUF_MAX;
+	size = need;
+
+#ifdef NI_CAPTURE_RING
+	if (parent->ring.map) {
+		unsigned int count = parent->ring.block_count;
+
+		/* grow in steps, a resize drops the queued packets */
+		if (ni_global.config->packet_capture.ring_block_count ||
+		    (size_t)count * parent->ring.block_size >= need)
+			return;
+		while ((size_t)count * parent->ring.block_size < need)
+			count *= 2;
+		__ni_capture_ring_resize(parent, count);
+		return;
+	}
+#endif
+	if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &cur, &len) == 0 && cur >= size)
+		return;
+
+#if defined(SO_RCVBUFFORCE)
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == 0)
+		return;
+#endif
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0)
+		ni_debug_socket("cannot set shared capture receive buffer size: %m");
+}
+
+static ni_capture_t *
+ni_capture_shared_open(const ni_capture_devinfo_t *devinfo, const ni_capture_protinfo_t *protinfo,
+			const ni_hwaddr_t *destaddr, void (*receive)(ni_socket_t *))
+{
+	ni_capture_t *parent, *capture, **bucket;
+
+	if (!(parent = ni_capture_shared_parent(devinfo, protinfo)))
+		return NULL;
+
+	capture = xcalloc(1, sizeof(*capture));
+	__ni_capture_init_addr(capture, devinfo, protinfo, destaddr);
+
+	capture->shared.parent = parent;
+	capture->shared.ifindex = devinfo->ifindex;
+	capture->shared.receive = receive;
+
+	/* without a packet socket, used for the retransmit timer only */
+	capture->sock = ni_socket_wrap(-1, SOCK_DGRAM);
+	capture->sock->get_timeout = __ni_capture_socket_get_timeout;
+	capture->sock->check_timeout = __ni_capture_socket_check_timeout;
+	capture->sock->user_data = capture;
+	ni_socket_activate(capture->sock);
+
+	ni_capture_set_filter(capture, protinfo);
+
+	bucket = &parent->shared.children[devinfo->ifindex % NI_CAPTURE_SHARED_BUCKETS];
+	capture->shared.next = *bucket;
+	*bucket = capture;
+	parent->shared.count++;
+
+	ni_capture_shared_set_rcvbuf(parent);
+	return capture;
+}
+
+static void
+ni_capture_shared_unlink(ni_capture_t *capture)
+{
+	ni_capture_t *parent = capture->shared.parent;
+	ni_capture_t **pos, *cur;
+
+	pos = &parent->shared.children[capture->shared.ifindex % NI_CAPTURE_SHARED_BUCKETS];
+	for ( ; (cur = *pos); pos = &cur->shared.next) {
+		if (cur == capture) {
+			*pos = cur->shared.next;
+			break;
+		}
+	}
+	capture->shared.parent = NULL;
+	capture->shared.next = NULL;
+
+	if (--parent->shared.count)
+		return;
+
+	/* not listed any more when it is broken */
+	for (pos = &ni_capture_shared_parents; (cur = *pos); pos = &cur->shared.next) {
+		if (cur == parent) {
+			*pos = cur->shared.next;
+			break;
+		}
+	}
+	parent->shared.next = NULL;
+	ni_capture_free(parent);
+}
+
+/*
+ * Accept ARP packets for IPv4 with one of the addresses as sender, or
+ * as target of a probe (with no sender address) -- the requests of the
+ * hosts resolving the addresses are of no interest to a conflict check.
+ * Each address costs two instructions, so the number of them is limited
+ * by the filter size.
+ */
+#define NI_CAPTURE_BPF_ARP_ADDR_MAX	24
+
+static void
+ni_capture_build_arp_filter(ni_capture_bpf_t *bpf, unsigned int hlen,
+				const ni_capture_protinfo_t *protinfo)
+{
+	unsigned int i, count = protinfo->arp_count;
+
+	if (!protinfo->arp_addrs || !count || count > NI_CAPTURE_BPF_ARP_ADDR_MAX)
+		return;
+	if (!hlen || hlen > 64)
+		return;
+
+	ni_capture_bpf_match(bpf, BPF_H + BPF_ABS, 2, ETHERTYPE_IP);
+	ni_capture_bpf_match(bpf, BPF_B + BPF_ABS, 4, hlen);
+	ni_capture_bpf_match(bpf, BPF_B + BPF_ABS, 5, 4);
+
+	ni_capture_bpf_stmt(bpf, BPF_LD + BPF_W + BPF_ABS, 8 + hlen);
+	for (i = 0; i < count; ++i) {
+		ni_capture_bpf_jump(bpf, BPF_JMP + BPF_JEQ + BPF_K,
+				ntohl(protinfo->arp_addrs[i].s_addr),
+				NI_CAPTURE_BPF_ACCEPT, 0);
+	}
+	ni_capture_bpf_jump(bpf, BPF_JMP + BPF_JEQ + BPF_K, 0, 0, NI_CAPTURE_BPF_REJECT);
+
+	ni_capture_bpf_stmt(bpf, BPF_LD + BPF_W + BPF_ABS, 8 + hlen + 4 + hlen);
+	for (i = 0; i < count; ++i) {
+		ni_capture_bpf_jump(bpf, BPF_JMP + BPF_JEQ + BPF_K,
+				ntohl(protinfo->arp_addrs[i].s_addr),
+				NI_CAPTURE_BPF_ACCEPT,
+				i + 1 < count ? 0 : NI_CAPTURE_BPF_REJECT);
+	}
+}
+
+/*
+ * Accept UDP packets to the port, which are not fragments. For DHCP,
+ * accept only BOOTREPLY messages with the xid and client hwaddr.
+ */
 static int
-ni_capture_set_filter(ni_capture_t *cap, const ni_capture_protinfo_t *protinfo)
+ni_capture_build_udp_filter(ni_capture_bpf_t *bpf, const ni_capture_protinfo_t *protinfo)
 {
-	struct sock_fprog pf;
+	if (protinfo->ip_protocol != IPPROTO_UDP && protinfo->ip_protocol != IPPROTO_TCP) {
+		ni_error("cannot build capture filter for IP proto %d, port %d: not supported",
+				protinfo->ip_protocol, protinfo->ip_port);
+		return -1;
+	}
 
-	/* Install the DHCP filter */
-	memset(&pf, 0, sizeof(pf));
+	/* Credit where credit is due: this part is taken from ISC DHCP */
+	ni_capture_bpf_match(bpf, BPF_B + BPF_ABS, 9, protinfo->ip_protocol);
+
+	ni_capture_bpf_stmt(bpf, BPF_LD + BPF_H + BPF_ABS, 6);
+	ni_capture_bpf_jump(bpf, BPF_JMP + BPF_JSET + BPF_K, 0x1fff, NI_CAPTURE_BPF_REJECT, 0);
+
+	/* X = IP header length, the loads below are relative to it */
+	ni_capture_bpf_stmt(bpf, BPF_LDX + BPF_B + BPF_MSH, 0);
+	ni_capture_bpf_match(bpf, BPF_H + BPF_IND, 2, protinfo->ip_port);
+
+	if (protinfo->ip_protocol != IPPROTO_UDP || protinfo->ip_port != DHCP_CLIENT_PORT)
+		return 0;
+
+	/* UDP header is 8 bytes, followed by op, htype, hlen, hops, xid */
+	if (protinfo->dhcp_xid) {
+		ni_capture_bpf_match(bpf, BPF_B + BPF_IND, 8 + 0, 2 /* BOOTREPLY */);
+		ni_capture_bpf_match(bpf, BPF_W + BPF_IND, 8 + 4, ntohl(protinfo->dhcp_xid));
+	}
+	if (protinfo->dhcp_chaddr.len && protinfo->dhcp_chaddr.len <= 16) {
+		ni_capture_bpf_match_bytes(bpf, BPF_IND, 8 + 28,
+				protinfo->dhcp_chaddr.data, protinfo->dhcp_chaddr.len);
+	}
+	return 0;
+}
+
+/*
+ * Accept LLDP packets sent to the (multicast) destination address.
+ * The link layer header is not part of the SOCK_DGRAM packet data.
+ */
+static void
+ni_capture_build_lldp_filter(ni_capture_bpf_t *bpf, const ni_capture_protinfo_t *protinfo)
+{
+	if (protinfo->eth_destaddr.len != ETH_ALEN)
+		return;
+
+	ni_capture_bpf_match_bytes(bpf, BPF_ABS, SKF_LL_OFF,
+			protinfo->eth_destaddr.data, ETH_ALEN);
+}
+
+static int
+ni_capture_build_filter(ni_capture_bpf_t *bpf, unsigned int hlen,
+			const ni_capture_protinfo_t *protinfo)
+{
+	memset(bpf, 0, sizeof(*bpf));
 
 	switch (protinfo->eth_protocol) {
 	case ETHERTYPE_ARP:
+		ni_capture_build_arp_filter(bpf, hlen, protinfo);
+		break;
+
 	case ETHERTYPE_LLDP:
-		/* For pure link layer protocols, we do not need to install a
-		 * filter, as we've already bound to a sll address where
-		 * sll_protocol is set to the ethertype we want to match */
-		return 0;
+		ni_capture_build_lldp_filter(bpf, protinfo);
+		break;
 
 	case ETHERTYPE_IP:
-		if (protinfo->ip_protocol != IPPROTO_UDP && protinfo->ip_protocol != IPPROTO_TCP) {
-			ni_error("cannot build capture filter for IP proto %d, port %d: not supported",
-					protinfo->ip_protocol, protinfo->ip_port);
+		if (ni_capture_build_udp_filter(bpf, protinfo) < 0)
 			return -1;
-		}
-
-		std_ipv4_bpf_filter[1].k = protinfo->ip_protocol;
-		std_ipv4_bpf_filter[6].k = protinfo->ip_port;
-
-		pf.filter = std_ipv4_bpf_filter;
-		pf.len = sizeof(std_ipv4_bpf_filter) / sizeof(std_ipv4_bpf_filter[0]);
 		break;
 
 	default:
@@ -730,25 +1480,102 @@ ni_capture_set_filter(ni_capture_t *cap, const ni_capture_protinfo_t *protinfo)
 		return -1;
 	}
 
+	/* Without any match we rely on the sll_protocol of the bind */
+	if (bpf->len == 0)
+		return 0;
+
+	if (ni_capture_bpf_finish(bpf) < 0) {
+		ni_error("capture filter for ether type 0x%04x is too long", protinfo->eth_protocol);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * (Re)place the capture filter; the kernel swaps it atomically, so
+ * there is no window where the socket receives unfiltered packets.
+ */
+int
+ni_capture_set_filter(ni_capture_t *cap, const ni_capture_protinfo_t *protinfo)
+{
+	struct sock_fprog pf;
+	ni_capture_bpf_t bpf;
+
+	if (!cap || !protinfo || !cap->sock)
+		return -1;
+
+	if (protinfo->eth_protocol != cap->protocol) {
+		ni_error("%s: cannot change capture protocol from 0x%04x to 0x%04x",
+				cap->ifname, cap->protocol, protinfo->eth_protocol);
+		return -1;
+	}
+
+	if (cap->shared.parent) {
+		/* matched when demultiplexing the shared capture packets */
+		cap->shared.dhcp_xid = protinfo->dhcp_xid;
+		cap->shared.dhcp_chaddr = protinfo->dhcp_chaddr;
+		return 0;
+	}
+
+	/* the broadcast destaddr has the length of the device hwaddr */
+	if (ni_capture_build_filter(&bpf, cap->addr.sll.sll_halen, protinfo) < 0)
+		return -1;
+
+	if (cap->filter && cap->filter->len == bpf.len &&
+	    !memcmp(cap->filter->ins, bpf.ins, bpf.len * sizeof(bpf.ins[0])))
+		return 0;
+
+	if (bpf.len == 0) {
+		int dummy = 0;
+
+		/* the option value is unused, but has to be an int */
+		if (cap->filter && setsockopt(cap->sock->__fd, SOL_SOCKET, SO_DETACH_FILTER,
+					&dummy, sizeof(dummy)) < 0 && errno != ENOENT) {
+			ni_error("SO_DETACH_FILTER: %m");
+			return -1;
+		}
+		free(cap->filter);
+		cap->filter = NULL;
+		return 0;
+	}
+
+	memset(&pf, 0, sizeof(pf));
+	pf.filter = bpf.ins;
+	pf.len = bpf.len;
 	if (setsockopt(cap->sock->__fd, SOL_SOCKET, SO_ATTACH_FILTER, &pf, sizeof(pf)) < 0) {
 		ni_error("SO_ATTACH_FILTER: %m");
 		return -1;
 	}
 
+	if (!cap->filter)
+		cap->filter = xmalloc(sizeof(*cap->filter));
+	*cap->filter = bpf;
 	return 0;
 }
 
+static inline int
+__ni_capture_send_fd(const ni_capture_t *capture)
+{
+	if (capture == NULL)
+		return -1;
+	if (capture->shared.parent)
+		return capture->shared.parent->sock->__fd;
+	return capture->sock->__fd;
+}
+
 ssize_t
 __ni_capture_send(const ni_capture_t *capture, const ni_buffer_t *buf)
 {
 	ssize_t rv;
+	int fd;
 
 	if (capture == NULL) {
 		ni_error("%s: no capture handle", __FUNCTION__);
 		return -1;
 	}
 
-	rv = sendto(capture->sock->__fd, ni_buffer_head(buf), ni_buffer_count(buf), 0,
+	fd = capture->shared.parent ? capture->shared.parent->sock->__fd : capture->sock->__fd;
+	rv = sendto(fd, ni_buffer_head(buf), ni_buffer_count(buf), 0,
 			&capture->addr.sa, sizeof(capture->addr));
 	if (rv < 0)
 		ni_error("unable to send dhcp packet: %m");
@@ -756,6 +1583,57 @@ __ni_capture_send(const ni_capture_t *capture, const ni_buffer_t *buf)
 	return rv;
 }
 
+/*
+ * Send one packet on each of the captures. The packets of captures
+ * sending via the same (shared) socket are passed to the kernel in
+ * one sendmmsg call. Returns the number of packets sent.
+ */
+unsigned int
+ni_capture_send_batch(ni_capture_t * const *captures, const ni_buffer_t * const *bufs,
+			unsigned int count)
+{
+	struct mmsghdr msgs[NI_CAPTURE_SEND_BATCH];
+	struct iovec iov[NI_CAPTURE_SEND_BATCH];
+	unsigned int i, n, sent = 0;
+	int fd, rv;
+
+	for (i = 0; i < count; i += n) {
+		if ((fd = __ni_capture_send_fd(captures[i])) < 0) {
+			ni_error("%s: no capture handle", __FUNCTION__);
+			n = 1;
+			continue;
+		}
+
+		memset(msgs, 0, sizeof(msgs));
+		for (n = 0; n < NI_CAPTURE_SEND_BATCH && i + n < count; ++n) {
+			ni_capture_t *capture = captures[i + n];
+
+			if (__ni_capture_send_fd(capture) != fd)
+				break;
+
+			ni_capture_disarm_retransmit(capture);
+			iov[n].iov_base = ni_buffer_head(bufs[i + n]);
+			iov[n].iov_len = ni_buffer_count(bufs[i + n]);
+			msgs[n].msg_hdr.msg_iov = &iov[n];
+			msgs[n].msg_hdr.msg_iovlen = 1;
+			msgs[n].msg_hdr.msg_name = &capture->addr.sa;
+			msgs[n].msg_hdr.msg_namelen = sizeof(capture->addr);
+		}
+
+		rv = sendmmsg(fd, msgs, n, 0);
+		if (rv < 0) {
+			/* the first one failed, retry the others */
+			ni_error("unable to send %s packet: %m", captures[i]->ifname);
+			n = 1;
+		} else if (rv > 0) {
+			/* a partial send stops at a failing one */
+			sent += rv;
+			n = rv;
+		}
+	}
+	return sent;
+}
+
 ssize_t
 ni_capture_send(ni_capture_t *capture, const ni_buffer_t *buf, const ni_timeout_param_t *tmo)
 {
@@ -775,12 +1653,31 @@ ni_capture_send(ni_capture_t *capture, const ni_buffer_t *buf, const ni_timeout_
 void
 ni_capture_free(ni_capture_t *capture)
 {
+	ni_capture_stats_t stats;
+
 	if (!capture)
 		return;
+	if (capture->busy) {
+		/* called from the receive callback, receive frees it */
+		capture->release = TRUE;
+		return;
+	}
+	if (capture->shared.parent) {
+		ni_capture_shared_unlink(capture);
+	} else
+	if (capture->sock && ni_capture_get_stats(capture, &stats) == 0 && stats.drops) {
+		ni_debug_socket("%s: capture received %lu packets, dropped %lu",
+				capture->ifname, stats.packets, stats.drops);
+	}
 	if (capture->sock)
 		ni_socket_close(capture->sock);
+#ifdef NI_CAPTURE_RING
+	__ni_capture_ring_close(capture);
+#endif
 	if (capture->buffer)
 		free(capture->buffer);
+	free(capture->filter);
+	free(capture->shared.children);
 	ni_string_free(&capture->ifname);
 	free(capture);
 }
@@ -15,6 +15,9 @@
 #include <limits.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/file.h>
 
 #include <wicked/fsm.h>
 #include <wicked/xml.h>
@@ -24,15 +27,17 @@
 #include <wicked/logging.h>
 
 #include "client/client_state.h"
+#include "client/ifconfig.h"
+#include "buffer.h"
 #include "util_priv.h"
 
 /*
  * Internal utilities
  */
 static void
-ni_client_state_filename(unsigned int ifindex, char *path, size_t size)
+ni_client_state_config_filename(unsigned int ifindex, char *path, size_t size)
 {
-	snprintf(path, size, "%s/state-%u.xml",
+	snprintf(path, size, "%s/config-%u.xml",
 			ni_config_statedir(),
 			ifindex);
 }
@@ -363,16 +368,13 @@ ni_client_state_control_copy(ni_client_state_control_t *dst,
 		*dst = *src;
 }
 
-ni_bool_t
-ni_client_state_save(const ni_client_state_t *client_state, unsigned int ifindex)
+static ni_bool_t
+__ni_client_state_write_node(const xml_node_t *node, const char *path)
 {
-	char path[PATH_MAX] = {'\0'};
 	char temp[PATH_MAX] = {'\0'};
-	xml_node_t *node;
 	FILE *fp = NULL;
 	int fd;
 
-	ni_client_state_filename(ifindex, path, sizeof(path));
 	snprintf(temp, sizeof(temp), "%s.XXXXXX", path);
 
 	if ((fd = mkstemp(temp)) < 0) {
@@ -385,23 +387,10 @@ ni_client_state_save(const ni_client_state_t *client_state, unsigned int ifindex
 		goto failure;
 	}
 
-	if (!(node = xml_node_new(NI_CLIENT_STATE_XML_NODE, NULL))) {
-		ni_error("Cannot create %s node for %s", NI_CLIENT_STATE_XML_NODE, path);
-		goto failure;
-	}
-
-	if (!ni_client_state_print_xml(client_state, node)) {
-		ni_error("Cannot format state into xml for %s", path);
-		xml_node_free(node);
-		goto failure;
-	}
-
 	if (xml_node_print(node, fp) < 0) {
 		ni_error("Cannot write into %s state temp file", path);
-		xml_node_free(node);
 		goto failure;
 	}
-	xml_node_free(node);
 
 	if (rename(temp, path) < 0) {
 		ni_error("Cannot move temp file to state file %s", path);
@@ -420,90 +409,843 @@ failure:
 	return FALSE;
 }
 
-ni_bool_t
-ni_client_state_load(ni_client_state_t *client_state, unsigned int ifindex)
+static xml_node_t *
+__ni_client_state_read_node(const char *path, const char *name)
 {
-	char path[PATH_MAX] = {'\0'};
 	xml_node_t *xml;
 	xml_node_t *node;
 	FILE *fp;
 
-	if (!client_state)
-		return FALSE;
-
-	ni_client_state_filename(ifindex, path, sizeof(path));
 	if (!(fp = fopen(path, "re"))) {
 		if (errno != ENOENT)
 			ni_error("Cannot open state file '%s': %m", path);
-		return FALSE;
+		return NULL;
 	}
 
 	if (!(xml = xml_node_scan(fp, path))) {
 		fclose(fp);
 		ni_error("Cannot parse xml from state file '%s", path);
-		return FALSE;
+		return NULL;
 	}
 	fclose(fp);
 
 	node = xml->name ? xml : xml->children;
-	if (!node || !ni_string_eq(node->name, NI_CLIENT_STATE_XML_NODE)) {
+	if (!node || !ni_string_eq(node->name, name)) {
 		ni_error("State file '%s' does not contain %s node",
-			path, NI_CLIENT_STATE_XML_NODE);
+			path, name);
 		xml_node_free(xml);
-		return FALSE;
+		return NULL;
 	}
 
-	ni_client_state_reset(client_state);
-	if (!ni_client_state_parse_xml(node, client_state)) {
-		ni_error("Cannot parse state from file '%s'", path);
+	if (node != xml) {
+		xml_node_detach(node);
 		xml_node_free(xml);
+	}
+	return node;
+}
+
+static ni_bool_t
+__ni_client_state_unlink(const char *path)
+{
+	if (unlink(path) < 0) {
+		if (errno == ENOENT)
+			return TRUE;
+
+		ni_error("Cannot remove state file '%s': %m", path);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static ni_bool_t
+__ni_client_state_rename(const char *path_old, const char *path_new)
+{
+	if (rename(path_old, path_new) < 0) {
+		if (errno == ENOENT && !ni_file_exists(path_old)) {
+			ni_debug_verbose(NI_LOG_DEBUG3, NI_TRACE_READWRITE,
+				"%s does not exists, not renamed to %s", path_old, path_new);
+			return TRUE;
+		}
+		ni_error("Cannot rename state %s to %s", path_old, path_new);
 		return FALSE;
 	}
+	return TRUE;
+}
+
+/*
+ * The client states of all interfaces are kept in a single append-only
+ * record log. A record is written using one write(2) and consists of a
+ * header with a checksum and the binary encoded state; a drop record
+ * without payload removes the state of an ifindex. A truncated or not
+ * matching record at the end of the log (e.g. after a crash) ends it
+ * and is cut off before the next append.
+ *
+ * The log is parsed incrementally into an index sorted by ifindex and
+ * compacted by writing the live records into a new file renamed over
+ * the log, when it grows much bigger than the live records need.
+ *
+ * The processes writing it (wickedd, the supplicants, nanny and the
+ * client) serialize via an flock on a separate lock file, which is not
+ * replaced by a compaction; readers do not need the lock.
+ */
+#define NI_CLIENT_STATE_STORE_FILE	"client-state.db"
+#define NI_CLIENT_STATE_STORE_LOCK	"client-state.lock"
+#define NI_CLIENT_STATE_STORE_MAGIC	0x57435331	/* "WCS1" */
+#define NI_CLIENT_STATE_STORE_COMPACT	65536
+
+enum {
+	NI_CLIENT_STATE_RECORD_SET = 1,
+	NI_CLIENT_STATE_RECORD_DROP,
+};
+
+typedef struct ni_client_state_record {
+	uint32_t		magic;
+	uint16_t		type;
+	uint16_t		len;
+	uint32_t		ifindex;
+	uint32_t		csum;
+} ni_client_state_record_t;
+
+typedef struct ni_client_state_record_data {
+	uint8_t			persistent;
+	uint8_t			usercontrol;
+	int8_t			require_link;
+	uint8_t			unused;
+	uint32_t		owner;
+	ni_uuid_t		uuid;
+} ni_client_state_record_data_t;
+
+typedef struct ni_client_state_entry {
+	unsigned int		ifindex;
+	ni_client_state_t	state;
+} ni_client_state_entry_t;
+
+static struct ni_client_state_store {
+	dev_t			dev;
+	ino_t			ino;
+	off_t			offset;
+	size_t			partial;	/* incomplete record at offset */
+	ni_bool_t		migrated;
+	unsigned int		count;
+	ni_client_state_entry_t *entries;
+} ni_client_state_store;
+
+static ni_bool_t
+__ni_client_state_store_path(char *path, size_t size, const char *name)
+{
+	int len;
+
+	len = snprintf(path, size, "%s/%s", ni_config_statedir(), name);
+	if (len < 0 || (size_t)len >= size) {
+		ni_error("Client state store path name too long");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static ni_bool_t
+ni_client_state_store_filename(char *path, size_t size)
+{
+	return __ni_client_state_store_path(path, size, NI_CLIENT_STATE_STORE_FILE);
+}
+
+static int
+ni_client_state_store_lock(void)
+{
+	char path[PATH_MAX];
+	int fd;
+
+	if (!__ni_client_state_store_path(path, sizeof(path), NI_CLIENT_STATE_STORE_LOCK))
+		return -1;
+	if ((fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0) {
+		ni_error("Cannot open client state store lock '%s': %m", path);
+		return -1;
+	}
+	while (flock(fd, LOCK_EX) < 0) {
+		if (errno == EINTR)
+			continue;
+		ni_error("Cannot lock client state store lock '%s': %m", path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void
+ni_client_state_store_unlock(int fd)
+{
+	if (fd >= 0)
+		close(fd);
+}
+
+static uint32_t
+ni_client_state_record_csum(const ni_client_state_record_t *rec, const void *data)
+{
+	const unsigned char *ptr;
+	uint32_t hash = 2166136261U;
+	unsigned int i;
+
+	ptr = (const unsigned char *)&rec->type;
+	for (i = 0; i < sizeof(rec->type) + sizeof(rec->len) + sizeof(rec->ifindex); ++i)
+		hash = (hash ^ ptr[i]) * 16777619U;
+	for (ptr = data, i = 0; i < rec->len; ++i)
+		hash = (hash ^ ptr[i]) * 16777619U;
+	return hash;
+}
+
+static size_t
+ni_client_state_record_size(const ni_client_state_t *cs)
+{
+	size_t len = sizeof(ni_client_state_record_t);
+
+	if (cs) {
+		len += sizeof(ni_client_state_record_data_t);
+		len += ni_string_len(cs->config.origin);
+	}
+	return len;
+}
 
-	xml_node_free(xml);
+static size_t
+ni_client_state_record_format(ni_buffer_t *bp, unsigned int ifindex, const ni_client_state_t *cs)
+{
+	ni_client_state_record_data_t data;
+	ni_client_state_record_t rec;
+	size_t olen = 0;
+	void *ptr;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.magic = NI_CLIENT_STATE_STORE_MAGIC;
+	rec.ifindex = ifindex;
+	rec.type = NI_CLIENT_STATE_RECORD_DROP;
+
+	ni_buffer_ensure_tailroom(bp, ni_client_state_record_size(cs));
+	ptr = ni_buffer_tail(bp);
+	ni_buffer_put(bp, &rec, sizeof(rec));
+	if (cs) {
+		olen = min_t(size_t, ni_string_len(cs->config.origin), 0xffff - sizeof(data));
+
+		memset(&data, 0, sizeof(data));
+		data.persistent = cs->control.persistent;
+		data.usercontrol = cs->control.usercontrol;
+		data.require_link = cs->control.require_link;
+		data.owner = cs->config.owner;
+		data.uuid = cs->config.uuid;
+		ni_buffer_put(bp, &data, sizeof(data));
+		ni_buffer_put(bp, cs->config.origin, olen);
+
+		rec.type = NI_CLIENT_STATE_RECORD_SET;
+		rec.len = sizeof(data) + olen;
+	}
+	rec.csum = ni_client_state_record_csum(&rec, (char *)ptr + sizeof(rec));
+	memcpy(ptr, &rec, sizeof(rec));
+
+	return sizeof(rec) + rec.len;
+}
+
+static ni_bool_t
+ni_client_state_record_parse(const void *ptr, ni_client_state_t *cs)
+{
+	ni_client_state_record_data_t data;
+	ni_client_state_record_t rec;
+
+	memcpy(&rec, ptr, sizeof(rec));
+	if (rec.len < sizeof(data))
+		return FALSE;
+
+	memcpy(&data, (const char *)ptr + sizeof(rec), sizeof(data));
+	cs->control.persistent = !!data.persistent;
+	cs->control.usercontrol = !!data.usercontrol;
+	cs->control.require_link = data.require_link;
+	cs->config.owner = data.owner;
+	cs->config.uuid = data.uuid;
+
+	ni_string_free(&cs->config.origin);
+	if (rec.len > sizeof(data)) {
+		size_t olen = rec.len - sizeof(data);
+
+		cs->config.origin = xcalloc(1, olen + 1);
+		memcpy(cs->config.origin, (const char *)ptr + sizeof(rec) + sizeof(data), olen);
+	}
 	return TRUE;
 }
 
+static ni_client_state_entry_t *
+ni_client_state_store_find(struct ni_client_state_store *store, unsigned int ifindex, unsigned int *pos)
+{
+	unsigned int lo = 0, hi = store->count;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (store->entries[mid].ifindex < ifindex)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (pos)
+		*pos = lo;
+	if (lo < store->count && store->entries[lo].ifindex == ifindex)
+		return &store->entries[lo];
+	return NULL;
+}
+
+static void
+ni_client_state_store_set(struct ni_client_state_store *store, unsigned int ifindex,
+				const ni_client_state_t *cs)
+{
+	ni_client_state_entry_t *entry;
+	unsigned int pos;
+
+	if (!(entry = ni_client_state_store_find(store, ifindex, &pos))) {
+		if ((store->count % 64) == 0) {
+			store->entries = xrealloc(store->entries,
+					(store->count + 64) * sizeof(*entry));
+		}
+		entry = &store->entries[pos];
+		memmove(entry + 1, entry, (store->count - pos) * sizeof(*entry));
+		store->count++;
+
+		entry->ifindex = ifindex;
+		ni_client_state_init(&entry->state);
+	}
+	ni_client_state_control_copy(&entry->state.control, &cs->control);
+	ni_client_state_config_copy(&entry->state.config, &cs->config);
+}
+
+static void
+ni_client_state_store_unset(struct ni_client_state_store *store, unsigned int ifindex)
+{
+	ni_client_state_entry_t *entry;
+	unsigned int pos;
+
+	if (!(entry = ni_client_state_store_find(store, ifindex, &pos)))
+		return;
+
+	ni_client_state_reset(&entry->state);
+	store->count--;
+	memmove(entry, entry + 1, (store->count - pos) * sizeof(*entry));
+}
+
+static void
+ni_client_state_store_clear(struct ni_client_state_store *store)
+{
+	while (store->count)
+		ni_client_state_reset(&store->entries[--store->count].state);
+	free(store->entries);
+	store->entries = NULL;
+	store->offset = 0;
+	store->partial = 0;
+	store->dev = 0;
+	store->ino = 0;
+}
+
+static void
+ni_client_state_store_apply(struct ni_client_state_store *store, const unsigned char *base, size_t size)
+{
+	ni_client_state_record_t rec;
+	ni_client_state_t cs;
+	size_t pos = 0;
+
+	ni_client_state_init(&cs);
+	while (size - pos >= sizeof(rec)) {
+		memcpy(&rec, base + pos, sizeof(rec));
+		if (rec.magic != NI_CLIENT_STATE_STORE_MAGIC ||
+		    size - pos - sizeof(rec) < rec.len ||
+		    rec.csum != ni_client_state_record_csum(&rec, base + pos + sizeof(rec)))
+			break;
+
+		if (rec.type == NI_CLIENT_STATE_RECORD_SET) {
+			if (!ni_client_state_record_parse(base + pos, &cs))
+				break;
+			ni_client_state_store_set(store, rec.ifindex, &cs);
+		} else
+		if (rec.type == NI_CLIENT_STATE_RECORD_DROP) {
+			ni_client_state_store_unset(store, rec.ifindex);
+		}
+		pos += sizeof(rec) + rec.len;
+	}
+	ni_client_state_reset(&cs);
+
+	if (pos < size) {
+		ni_warn("Ignoring %zu bytes of an incomplete client state record",
+			size - pos);
+	}
+	store->offset += pos;
+	store->partial = size - pos;
+}
+
+static ni_bool_t	ni_client_state_store_append(struct ni_client_state_store *, ni_buffer_t *);
+
+/*
+ * Import and remove the per-ifindex xml state files used before.
+ * Called with the lock held, when there is no store yet.
+ */
+static void
+ni_client_state_store_migrate(struct ni_client_state_store *store)
+{
+	ni_string_array_t files = NI_STRING_ARRAY_INIT;
+	ni_buffer_t buf = { .base = NULL };
+	char path[PATH_MAX];
+	ni_client_state_t cs;
+	unsigned int i, ifindex;
+	xml_node_t *node;
+
+	if (!ni_scandir(ni_config_statedir(), "state-*.xml", &files))
+		return;
+
+	ni_client_state_init(&cs);
+	for (i = 0; i < files.count; ++i) {
+		snprintf(path, sizeof(path), "%s/%s", ni_config_statedir(), files.data[i]);
+		if (sscanf(files.data[i], "state-%u.xml", &ifindex) != 1 || !ifindex)
+			continue;
+
+		if ((node = __ni_client_state_read_node(path, NI_CLIENT_STATE_XML_NODE))) {
+			ni_client_state_reset(&cs);
+			if (ni_client_state_parse_xml(node, &cs))
+				ni_client_state_record_format(&buf, ifindex, &cs);
+			xml_node_free(node);
+		}
+	}
+	ni_client_state_reset(&cs);
+
+	/* remove the files once their states are in the store */
+	if (!ni_buffer_count(&buf) || ni_client_state_store_append(store, &buf)) {
+		for (i = 0; i < files.count; ++i) {
+			snprintf(path, sizeof(path), "%s/%s", ni_config_statedir(), files.data[i]);
+			__ni_client_state_unlink(path);
+		}
+	}
+	ni_buffer_destroy(&buf);
+	ni_string_array_destroy(&files);
+}
+
+/*
+ * Bring the index up to date with records appended to the log.
+ */
+static ni_bool_t
+ni_client_state_store_sync(struct ni_client_state_store *store)
+{
+	char path[PATH_MAX];
+	unsigned char *data;
+	struct stat st;
+	ssize_t len;
+	size_t size;
+	int fd;
+
+	if (!ni_client_state_store_filename(path, sizeof(path)))
+		return FALSE;
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+		ni_client_state_store_clear(store);
+		if (errno == ENOENT)
+			return TRUE;
+		ni_error("Cannot open client state store '%s': %m", path);
+		return FALSE;
+	}
+	if (fstat(fd, &st) < 0) {
+		ni_error("Cannot stat client state store '%s': %m", path);
+		close(fd);
+		return FALSE;
+	}
+
+	if (st.st_dev != store->dev || st.st_ino != store->ino || st.st_size < store->offset) {
+		ni_client_state_store_clear(store);
+		store->dev = st.st_dev;
+		store->ino = st.st_ino;
+	}
+
+	store->partial = 0;
+	if (st.st_size > store->offset) {
+		size = st.st_size - store->offset;
+		data = xmalloc(size);
+		len = pread(fd, data, size, store->offset);
+		if (len > 0)
+			ni_client_state_store_apply(store, data, len);
+		free(data);
+	}
+	close(fd);
+	return TRUE;
+}
+
+/*
+ * Lock the store for an update and bring the index up to date; the
+ * first one also imports the state files of older versions.
+ */
+static int
+ni_client_state_store_begin(struct ni_client_state_store *store)
+{
+	int lock;
+
+	if ((lock = ni_client_state_store_lock()) < 0)
+		return -1;
+
+	if (!ni_client_state_store_sync(store)) {
+		ni_client_state_store_unlock(lock);
+		return -1;
+	}
+
+	if (!store->migrated) {
+		store->migrated = TRUE;
+		if (!store->ino)
+			ni_client_state_store_migrate(store);
+	}
+	return lock;
+}
+
+/*
+ * Bring the index up to date for reading
+ */
+static ni_bool_t
+ni_client_state_store_read(struct ni_client_state_store *store)
+{
+	int lock;
+
+	if (!ni_client_state_store_sync(store))
+		return FALSE;
+
+	if (!store->migrated && !store->ino) {
+		if ((lock = ni_client_state_store_begin(store)) < 0)
+			return FALSE;
+		ni_client_state_store_unlock(lock);
+	}
+	store->migrated = TRUE;
+	return TRUE;
+}
+
+static ni_bool_t
+ni_client_state_store_compact(struct ni_client_state_store *store)
+{
+	ni_buffer_t buf = { .base = NULL };
+	char path[PATH_MAX], *temp = NULL;
+	struct stat st;
+	unsigned int i;
+	int fd;
+
+	if (!ni_client_state_store_filename(path, sizeof(path)))
+		return FALSE;
+	if (!ni_string_printf(&temp, "%s.XXXXXX", path)) {
+		ni_error("Cannot format %s temp file name", path);
+		return FALSE;
+	}
+	if ((fd = mkstemp(temp)) < 0) {
+		ni_error("Cannot create %s temp file", path);
+		ni_string_free(&temp);
+		return FALSE;
+	}
+
+	for (i = 0; i < store->count; ++i) {
+		const ni_client_state_entry_t *entry = &store->entries[i];
+
+		ni_client_state_record_format(&buf, entry->ifindex, &entry->state);
+	}
+
+	if (write(fd, ni_buffer_head(&buf), ni_buffer_count(&buf)) != (ssize_t)ni_buffer_count(&buf) ||
+	    fsync(fd) < 0 || fstat(fd, &st) < 0) {
+		ni_error("Cannot write into %s temp file", path);
+		goto failure;
+	}
+	if (rename(temp, path) < 0) {
+		ni_error("Cannot move temp file to client state store %s", path);
+		goto failure;
+	}
+
+	store->dev = st.st_dev;
+	store->ino = st.st_ino;
+	store->offset = st.st_size;
+	ni_buffer_destroy(&buf);
+	ni_string_free(&temp);
+	close(fd);
+	return TRUE;
+
+failure:
+	ni_buffer_destroy(&buf);
+	unlink(temp);
+	ni_string_free(&temp);
+	close(fd);
+	return FALSE;
+}
+
+static ni_bool_t
+ni_client_state_store_append(struct ni_client_state_store *store, ni_buffer_t *bp)
+{
+	char path[PATH_MAX];
+	size_t live = 0;
+	unsigned int i;
+	ssize_t len;
+	struct stat st;
+	int fd;
+
+	if (!ni_client_state_store_filename(path, sizeof(path)))
+		return FALSE;
+	if ((fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644)) < 0) {
+		ni_error("Cannot open client state store '%s': %m", path);
+		return FALSE;
+	}
+	if (fstat(fd, &st) < 0) {
+		ni_error("Cannot stat client state store '%s': %m", path);
+		close(fd);
+		return FALSE;
+	}
+	if (st.st_dev != store->dev || st.st_ino != store->ino) {
+		/* created or replaced since the last sync */
+		if (!ni_client_state_store_sync(store) ||
+		    st.st_dev != store->dev || st.st_ino != store->ino) {
+			ni_error("Client state store '%s' replaced while in use", path);
+			close(fd);
+			return FALSE;
+		}
+	}
+
+	/* cut off an incomplete record, it would hide the new ones; with
+	 * the lock held, it is one the last sync found, not being written */
+	if (st.st_size > store->offset) {
+		if ((size_t)(st.st_size - store->offset) != store->partial) {
+			ni_error("Client state store '%s' changed while locked", path);
+			close(fd);
+			return FALSE;
+		}
+		if (ftruncate(fd, store->offset) < 0) {
+			ni_error("Cannot truncate client state store '%s': %m", path);
+			close(fd);
+			return FALSE;
+		}
+		store->partial = 0;
+	}
+
+	len = write(fd, ni_buffer_head(bp), ni_buffer_count(bp));
+	if (len < 0 || (size_t)len != ni_buffer_count(bp)) {
+		ni_error("Cannot write into client state store '%s': %m", path);
+		if (len > 0 && ftruncate(fd, store->offset) < 0)
+			ni_error("Cannot truncate client state store '%s': %m", path);
+		close(fd);
+		return FALSE;
+	}
+	close(fd);
+
+	ni_client_state_store_apply(store, ni_buffer_head(bp), ni_buffer_count(bp));
+
+	for (i = 0; i < store->count; ++i)
+		live += ni_client_state_record_size(&store->entries[i].state);
+	if (store->offset > NI_CLIENT_STATE_STORE_COMPACT && (size_t)store->offset > 4 * live)
+		ni_client_state_store_compact(store);
+
+	return TRUE;
+}
+
+ni_bool_t
+ni_client_state_save(const ni_client_state_t *client_state, unsigned int ifindex)
+{
+	struct ni_client_state_store *store = &ni_client_state_store;
+	ni_buffer_t buf = { .base = NULL };
+	ni_bool_t ret;
+	int lock;
+
+	if (!client_state || !ifindex)
+		return FALSE;
+	if ((lock = ni_client_state_store_begin(store)) < 0)
+		return FALSE;
+
+	ni_client_state_record_format(&buf, ifindex, client_state);
+	ret = ni_client_state_store_append(store, &buf);
+	ni_buffer_destroy(&buf);
+	ni_client_state_store_unlock(lock);
+	return ret;
+}
+
+ni_bool_t
+ni_client_state_load(ni_client_state_t *client_state, unsigned int ifindex)
+{
+	struct ni_client_state_store *store = &ni_client_state_store;
+	ni_client_state_entry_t *entry;
+
+	if (!client_state || !ni_client_state_store_read(store))
+		return FALSE;
+
+	if (!(entry = ni_client_state_store_find(store, ifindex, NULL)))
+		return FALSE;
+
+	ni_client_state_reset(client_state);
+	ni_client_state_control_copy(&client_state->control, &entry->state.control);
+	ni_client_state_config_copy(&client_state->config, &entry->state.config);
+	return TRUE;
+}
+
+/*
+ * Call @func for the state of each ifindex in the store using one
+ * read of the store; the state passed to @func is valid during the
+ * call only.
+ */
+unsigned int
+ni_client_state_load_all(ni_client_state_load_fn_t *func, void *user_data)
+{
+	struct ni_client_state_store *store = &ni_client_state_store;
+	ni_client_state_entry_t *entries;
+	unsigned int i, count, n = 0;
+
+	if (!func || !ni_client_state_store_read(store) || !store->count)
+		return 0;
+
+	/* a copy, as @func may modify the store */
+	count = store->count;
+	entries = xcalloc(count, sizeof(*entries));
+	for (i = 0; i < count; ++i) {
+		entries[i].ifindex = store->entries[i].ifindex;
+		ni_client_state_init(&entries[i].state);
+		ni_client_state_control_copy(&entries[i].state.control,
+				&store->entries[i].state.control);
+		ni_client_state_config_copy(&entries[i].state.config,
+				&store->entries[i].state.config);
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (func(entries[i].ifindex, &entries[i].state, user_data))
+			n++;
+		ni_client_state_reset(&entries[i].state);
+	}
+	free(entries);
+	return n;
+}
 
 ni_bool_t
 ni_client_state_move(unsigned int ifindex_old, unsigned int ifindex_new)
 {
+	struct ni_client_state_store *store = &ni_client_state_store;
 	char path_old[PATH_MAX] = {'\0'};
 	char path_new[PATH_MAX] = {'\0'};
+	ni_client_state_entry_t *entry;
+	ni_buffer_t buf = { .base = NULL };
+	ni_bool_t ret = TRUE;
+	int lock;
 
 	if (ifindex_old == ifindex_new)
 		return TRUE;
 
-	ni_client_state_filename(ifindex_old, path_old, sizeof(path_old));
-	ni_client_state_filename(ifindex_new, path_new, sizeof(path_new));
+	ni_client_state_config_filename(ifindex_old, path_old, sizeof(path_old));
+	ni_client_state_config_filename(ifindex_new, path_new, sizeof(path_new));
+	__ni_client_state_rename(path_old, path_new);
 
-	if (rename(path_old, path_new) < 0) {
-		if (errno == ENOENT && !ni_file_exists(path_old)) {
-			ni_debug_verbose(NI_LOG_DEBUG3, NI_TRACE_READWRITE,
-				"%s does not exists, not renamed to %s", path_old, path_new);
-			return TRUE;
-		}
-		ni_error("Cannot rename state %s to %s", path_old, path_new);
+	if ((lock = ni_client_state_store_begin(store)) < 0)
 		return FALSE;
+
+	if (!(entry = ni_client_state_store_find(store, ifindex_old, NULL))) {
+		ni_debug_verbose(NI_LOG_DEBUG3, NI_TRACE_READWRITE,
+			"no client state of ifindex %u to move to %u",
+			ifindex_old, ifindex_new);
+		ni_client_state_store_unlock(lock);
+		return TRUE;
 	}
-	return TRUE;
+
+	/* both records in one write */
+	ni_client_state_record_format(&buf, ifindex_new, &entry->state);
+	ni_client_state_record_format(&buf, ifindex_old, NULL);
+	ret = ni_client_state_store_append(store, &buf);
+	ni_buffer_destroy(&buf);
+	ni_client_state_store_unlock(lock);
+	return ret;
 }
 
 ni_bool_t
 ni_client_state_drop(unsigned int ifindex)
 {
+	struct ni_client_state_store *store = &ni_client_state_store;
 	char path[PATH_MAX] = {'\0'};
+	ni_buffer_t buf = { .base = NULL };
+	ni_bool_t ret;
+	int lock;
 
-	ni_client_state_filename(ifindex, path, sizeof(path));
+	ni_client_state_config_filename(ifindex, path, sizeof(path));
+	__ni_client_state_unlink(path);
 
-	if (unlink(path) < 0) {
-		if (errno == ENOENT)
-			return TRUE;
+	/* no lock needed to see that there is nothing to drop */
+	if (!ni_client_state_store_read(store))
+		return FALSE;
+	if (!ni_client_state_store_find(store, ifindex, NULL))
+		return TRUE;
 
-		ni_error("Cannot remove state file '%s': %m", path);
+	if ((lock = ni_client_state_store_begin(store)) < 0)
 		return FALSE;
+
+	ret = TRUE;
+	if (ni_client_state_store_find(store, ifindex, NULL)) {
+		ni_client_state_record_format(&buf, ifindex, NULL);
+		ret = ni_client_state_store_append(store, &buf);
+		ni_buffer_destroy(&buf);
 	}
-	return TRUE;
+	ni_client_state_store_unlock(lock);
+	return ret;
+}
+
+/*
+ * The interface config applied with the current client-state config
+ * uuid, kept to compute what actually changed on a later ifreload.
+ */
+ni_bool_t
+ni_client_state_config_save_node(const xml_node_t *config, unsigned int ifindex)
+{
+	char path[PATH_MAX] = {'\0'};
+	ni_uuid_t old_uuid, new_uuid;
+	xml_node_t *old;
+	ni_bool_t same;
+
+	if (!ifindex)
+		return FALSE;
+
+	ni_client_state_config_filename(ifindex, path, sizeof(path));
+	if (xml_node_is_empty(config))
+		return __ni_client_state_unlink(path);
+
+	/* not rewritten on every ifup with the same config */
+	if (access(path, F_OK) == 0 && (old = __ni_client_state_read_node(path, "interface"))) {
+		same =	ni_ifconfig_generate_uuid(old, &old_uuid) &&
+			ni_ifconfig_generate_uuid(config, &new_uuid) &&
+			ni_uuid_equal(&old_uuid, &new_uuid);
+		xml_node_free(old);
+		if (same)
+			return TRUE;
+	}
+
+	return __ni_client_state_write_node(config, path);
+}
+
+xml_node_t *
+ni_client_state_config_load_node(unsigned int ifindex)
+{
+	char path[PATH_MAX] = {'\0'};
+
+	if (!ifindex)
+		return NULL;
+
+	ni_client_state_config_filename(ifindex, path, sizeof(path));
+	return __ni_client_state_read_node(path, "interface");
+}
+
+/*
+ * Remove the applied configs of interfaces without a client state,
+ * e.g. deleted while wickedd was not running.
+ */
+void
+ni_client_state_config_cleanup(void)
+{
+	struct ni_client_state_store *store = &ni_client_state_store;
+	ni_string_array_t files = NI_STRING_ARRAY_INIT;
+	char path[PATH_MAX];
+	unsigned int i, ifindex;
+
+	if (!ni_client_state_store_read(store))
+		return;
+
+	if (!ni_scandir(ni_config_statedir(), "config-*.xml", &files))
+		return;
+
+	for (i = 0; i < files.count; ++i) {
+		if (sscanf(files.data[i], "config-%u.xml", &ifindex) != 1 || !ifindex)
+			continue;
+		if (ni_client_state_store_find(store, ifindex, NULL))
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", ni_config_statedir(), files.data[i]);
+		__ni_client_state_unlink(path);
+	}
+	ni_string_array_destroy(&files);
 }
 
 ni_bool_t
@@ -43,6 +43,8 @@ typedef struct ni_client_state {
 	ni_client_state_config_t	config;
 } ni_client_state_t;
 
+typedef ni_bool_t		ni_client_state_load_fn_t(unsigned int, const ni_client_state_t *, void *);
+
 extern ni_client_state_t *	ni_client_state_new(unsigned int);
 extern ni_client_state_t *	ni_client_state_clone(ni_client_state_t *);
 extern void		ni_client_state_init(ni_client_state_t *);
@@ -67,9 +69,13 @@ extern ni_bool_t	ni_client_state_config_parse_xml(const xml_node_t *, ni_client_
 extern ni_bool_t	ni_client_state_parse_xml(const xml_node_t *, ni_client_state_t *);
 extern ni_bool_t	ni_client_state_load(ni_client_state_t *, unsigned int);
 extern ni_bool_t	ni_client_state_save(const ni_client_state_t *, unsigned int);
+extern unsigned int	ni_client_state_load_all(ni_client_state_load_fn_t *, void *);
 extern ni_bool_t	ni_client_state_move(unsigned int, unsigned int);
 extern ni_bool_t	ni_client_state_drop(unsigned int);
 extern ni_bool_t	ni_client_state_set_persistent(xml_node_t *);
+extern ni_bool_t	ni_client_state_config_save_node(const xml_node_t *, unsigned int);
+extern xml_node_t *	ni_client_state_config_load_node(unsigned int);
+extern void		ni_client_state_config_cleanup(void);
 
 extern void		ni_client_state_control_debug(const char *, const ni_client_state_control_t *, const char *);
 extern void		ni_client_state_config_debug(const char *, const ni_client_state_config_t *, const char *);
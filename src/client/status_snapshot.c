@@ -0,0 +1,739 @@
+/*
+ * Read-only interface status snapshot published by wickedd in a memory
+ * mapped file in the state directory, so status queries do not need to
+ * fetch and deserialize the complete D-Bus object tree.
+ *
+ * Copyright (C) 2015 SUSE LINUX GmbH, Nuernberg, Germany.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <linux/rtnetlink.h>
+
+#include <wicked/netinfo.h>
+#include <wicked/address.h>
+#include <wicked/addrconf.h>
+#include <wicked/route.h>
+#include <wicked/vlan.h>
+#include <wicked/bonding.h>
+#include <wicked/logging.h>
+
+#include "client/client_state.h"
+#include "client/status_snapshot.h"
+#include "buffer.h"
+#include "util_priv.h"
+
+/*
+ * The file starts with a header followed by the payload, a sequence of
+ * records with an { uint16 type, uint16 len } header padded to 4 bytes.
+ * Each device starts with a DEVICE record, all further records until
+ * the next DEVICE record belong to it; unknown record types are skipped.
+ *
+ * The header seq is a seqlock: the writer increments it to an odd value
+ * before and to an even value after it modifies the payload; a reader
+ * retries the copy of the payload when the seq was odd or has changed.
+ * The file is never truncated while in use, only grown and replaced by
+ * rename, so a reader never accesses a page beyond the end of file.
+ */
+#define NI_STATUS_SNAPSHOT_MAGIC	0x57534e50	/* "WSNP" */
+#define NI_STATUS_SNAPSHOT_VERSION	1
+#define NI_STATUS_SNAPSHOT_CHUNK	65536
+#define NI_STATUS_SNAPSHOT_RETRIES	100
+
+typedef struct ni_status_snapshot_header {
+	uint32_t		magic;
+	uint32_t		version;
+	volatile uint32_t	seq;
+	uint32_t		pid;
+	uint32_t		size;
+	uint32_t		count;
+} ni_status_snapshot_header_t;
+
+enum {
+	NI_STATUS_SNAPSHOT_DEVICE = 1,
+	NI_STATUS_SNAPSHOT_NAME,
+	NI_STATUS_SNAPSHOT_ALIAS,
+	NI_STATUS_SNAPSHOT_MASTER,
+	NI_STATUS_SNAPSHOT_LOWER,
+	NI_STATUS_SNAPSHOT_VLAN,
+	NI_STATUS_SNAPSHOT_BOND,
+	NI_STATUS_SNAPSHOT_CONTROL,
+	NI_STATUS_SNAPSHOT_CONFIG,
+	NI_STATUS_SNAPSHOT_ORIGIN,
+	NI_STATUS_SNAPSHOT_ADDR,
+	NI_STATUS_SNAPSHOT_LEASE,
+	NI_STATUS_SNAPSHOT_ROUTE,
+};
+
+typedef struct ni_status_snapshot_record {
+	uint16_t		type;
+	uint16_t		len;
+} ni_status_snapshot_record_t;
+
+typedef struct ni_status_snapshot_device {
+	uint32_t		ifindex;
+	uint32_t		ifflags;
+	uint32_t		mtu;
+	uint32_t		type;
+	uint16_t		hwaddr_type;
+	uint16_t		hwaddr_len;
+	uint16_t		hwpeer_len;
+	uint16_t		unused;
+	unsigned char		hwaddr[NI_MAXHWADDRLEN];
+	unsigned char		hwpeer[NI_MAXHWADDRLEN];
+} ni_status_snapshot_device_t;
+
+typedef struct ni_status_snapshot_vlan {
+	uint32_t		tag;
+	uint32_t		protocol;
+} ni_status_snapshot_vlan_t;
+
+typedef struct ni_status_snapshot_control {
+	uint32_t		persistent;
+	uint32_t		usercontrol;
+	int32_t			require_link;
+} ni_status_snapshot_control_t;
+
+typedef struct ni_status_snapshot_config {
+	ni_uuid_t		uuid;
+	uint32_t		owner;
+} ni_status_snapshot_config_t;
+
+typedef struct ni_status_snapshot_addr {
+	uint32_t		family;
+	uint32_t		prefixlen;
+	uint32_t		flags;
+	uint32_t		owner;
+	unsigned char		local[16];
+} ni_status_snapshot_addr_t;
+
+typedef struct ni_status_snapshot_lease {
+	uint32_t		family;
+	uint32_t		type;
+	uint32_t		state;
+	uint32_t		flags;
+} ni_status_snapshot_lease_t;
+
+typedef struct ni_status_snapshot_route {
+	uint32_t		family;
+	uint32_t		prefixlen;
+	uint32_t		table;
+	uint32_t		type;
+	uint32_t		nexthops;
+	unsigned char		destination[16];
+	unsigned char		gateway[16];
+} ni_status_snapshot_route_t;
+
+static struct ni_status_snapshot_writer {
+	char *			path;
+	int			fd;
+	ni_bool_t		failed;
+	ni_bool_t		dirty;
+	void *			map;
+	size_t			maplen;
+	ni_buffer_t		last;
+} ni_status_snapshot_writer = { .fd = -1, .dirty = TRUE };
+
+/*
+ * Payload encoding
+ */
+static ni_bool_t
+ni_status_snapshot_put(ni_buffer_t *bp, unsigned int type, const void *data, size_t len)
+{
+	ni_status_snapshot_record_t rec;
+	size_t pad;
+
+	/* the record length does not fit, skip it instead of truncating */
+	if (len > 0xffff) {
+		ni_error("status snapshot record type %u too long: %zu bytes", type, len);
+		return FALSE;
+	}
+	pad = (4 - (len & 3)) & 3;
+
+	rec.type = type;
+	rec.len = len;
+	ni_buffer_ensure_tailroom(bp, sizeof(rec) + len + pad);
+	ni_buffer_put(bp, &rec, sizeof(rec));
+	ni_buffer_put(bp, data, len);
+	if (pad)
+		memset(ni_buffer_push_tail(bp, pad), 0, pad);
+	return TRUE;
+}
+
+static ni_bool_t
+ni_status_snapshot_put_string(ni_buffer_t *bp, unsigned int type, const char *str)
+{
+	if (ni_string_empty(str))
+		return TRUE;
+	return ni_status_snapshot_put(bp, type, str, strlen(str));
+}
+
+static void
+ni_status_snapshot_put_sockaddr(unsigned char *dst, const ni_sockaddr_t *sa)
+{
+	switch (sa->ss_family) {
+	case AF_INET:
+		memcpy(dst, &sa->sin.sin_addr, sizeof(sa->sin.sin_addr));
+		break;
+	case AF_INET6:
+		memcpy(dst, &sa->six.sin6_addr, sizeof(sa->six.sin6_addr));
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+ni_status_snapshot_get_sockaddr(ni_sockaddr_t *sa, unsigned int family, const unsigned char *src)
+{
+	struct in6_addr in6;
+	struct in_addr in;
+
+	memset(sa, 0, sizeof(*sa));
+	switch (family) {
+	case AF_INET:
+		memcpy(&in, src, sizeof(in));
+		ni_sockaddr_set_ipv4(sa, in, 0);
+		break;
+	case AF_INET6:
+		memcpy(&in6, src, sizeof(in6));
+		ni_sockaddr_set_ipv6(sa, in6, 0);
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+ni_status_snapshot_put_netdev(ni_buffer_t *bp, const ni_netdev_t *dev)
+{
+	ni_status_snapshot_device_t device;
+	const ni_client_state_t *cs;
+	const ni_addrconf_lease_t *lease;
+	const ni_route_table_t *tab;
+	const ni_address_t *ap;
+	unsigned int i;
+
+	memset(&device, 0, sizeof(device));
+	device.ifindex = dev->link.ifindex;
+	device.ifflags = dev->link.ifflags;
+	device.mtu = dev->link.mtu;
+	device.type = dev->link.type;
+	device.hwaddr_type = dev->link.hwaddr.type;
+	device.hwaddr_len = min_t(unsigned int, dev->link.hwaddr.len, NI_MAXHWADDRLEN);
+	memcpy(device.hwaddr, dev->link.hwaddr.data, device.hwaddr_len);
+	device.hwpeer_len = min_t(unsigned int, dev->link.hwpeer.len, NI_MAXHWADDRLEN);
+	memcpy(device.hwpeer, dev->link.hwpeer.data, device.hwpeer_len);
+	ni_status_snapshot_put(bp, NI_STATUS_SNAPSHOT_DEVICE, &device, sizeof(device));
+
+	ni_status_snapshot_put_string(bp, NI_STATUS_SNAPSHOT_NAME, dev->name);
+	ni_status_snapshot_put_string(bp, NI_STATUS_SNAPSHOT_ALIAS, dev->link.alias);
+	ni_status_snapshot_put_string(bp, NI_STATUS_SNAPSHOT_MASTER, dev->link.masterdev.name);
+	ni_status_snapshot_put_string(bp, NI_STATUS_SNAPSHOT_LOWER, dev->link.lowerdev.name);
+
+	if (dev->vlan) {
+		ni_status_snapshot_vlan_t vlan;
+
+		vlan.tag = dev->vlan->tag;
+		vlan.protocol = dev->vlan->protocol;
+		ni_status_snapshot_put(bp, NI_STATUS_SNAPSHOT_VLAN, &vlan, sizeof(vlan));
+	}
+	if (dev->bonding) {
+		uint32_t mode = dev->bonding->mode;
+
+		ni_status_snapshot_put(bp, NI_STATUS_SNAPSHOT_BOND, &mode, sizeof(mode));
+	}
+
+	if ((cs = dev->client_state)) {
+		ni_status_snapshot_control_t control;
+		ni_status_snapshot_config_t config;
+
+		control.persistent = cs->control.persistent;
+		control.usercontrol = cs->control.usercontrol;
+		control.require_link = cs->control.require_link;
+		ni_status_snapshot_put(bp, NI_STATUS_SNAPSHOT_CONTROL, &control, sizeof(control));
+
+		memset(&config, 0, sizeof(config));
+		config.uuid = cs->config.uuid;
+		config.owner = cs->config.owner;
+		ni_status_snapshot_put(bp, NI_STATUS_SNAPSHOT_CONFIG, &config, sizeof(config));
+		ni_status_snapshot_put_string(bp, NI_STATUS_SNAPSHOT_ORIGIN, cs->config.origin);
+	}
+
+	for (lease = dev->leases; lease; lease = lease->next) {
+		ni_status_snapshot_lease_t rec;
+
+		rec.family = lease->family;
+		rec.type = lease->type;
+		rec.state = lease->state;
+		rec.flags = lease->flags;
+		ni_status_snapshot_put(bp, NI_STATUS_SNAPSHOT_LEASE, &rec, sizeof(rec));
+	}
+
+	for (ap = dev->addrs; ap; ap = ap->next) {
+		ni_status_snapshot_addr_t rec;
+
+		if (ap->family != AF_INET && ap->family != AF_INET6)
+			continue;
+
+		memset(&rec, 0, sizeof(rec));
+		rec.family = ap->family;
+		rec.prefixlen = ap->prefixlen;
+		rec.flags = ap->flags;
+		rec.owner = ap->owner;
+		ni_status_snapshot_put_sockaddr(rec.local, &ap->local_addr);
+		ni_status_snapshot_put(bp, NI_STATUS_SNAPSHOT_ADDR, &rec, sizeof(rec));
+	}
+
+	/* the gateway routes of the main table only, as shown by ifstatus */
+	for (tab = dev->routes; tab; tab = tab->next) {
+		for (i = 0; i < tab->routes.count; ++i) {
+			const ni_route_t *rp = tab->routes.data[i];
+			const ni_route_nexthop_t *nh;
+			ni_status_snapshot_route_t rec;
+
+			if (rp->table != RT_TABLE_MAIN)
+				continue;
+			if (rp->type != RTN_UNICAST && rp->type != RTN_LOCAL)
+				continue;
+			if (!ni_sockaddr_is_specified(&rp->nh.gateway))
+				continue;
+			if (rp->family != AF_INET && rp->family != AF_INET6)
+				continue;
+
+			memset(&rec, 0, sizeof(rec));
+			rec.family = rp->family;
+			rec.prefixlen = rp->prefixlen;
+			rec.table = rp->table;
+			rec.type = rp->type;
+			for (nh = &rp->nh; nh; nh = nh->next)
+				rec.nexthops++;
+			ni_status_snapshot_put_sockaddr(rec.destination, &rp->destination);
+			ni_status_snapshot_put_sockaddr(rec.gateway, &rp->nh.gateway);
+			ni_status_snapshot_put(bp, NI_STATUS_SNAPSHOT_ROUTE, &rec, sizeof(rec));
+		}
+	}
+}
+
+/*
+ * Payload decoding into a list of netdevs
+ */
+static void
+ni_status_snapshot_get_string(char **str, const void *data, size_t len)
+{
+	ni_string_free(str);
+	*str = xcalloc(1, len + 1);
+	memcpy(*str, data, len);
+}
+
+static ni_bool_t
+ni_status_snapshot_get_netdev(ni_netdev_t *dev, unsigned int type, const void *data, size_t len)
+{
+	union {
+		ni_status_snapshot_device_t	device;
+		ni_status_snapshot_vlan_t	vlan;
+		ni_status_snapshot_control_t	control;
+		ni_status_snapshot_config_t	config;
+		ni_status_snapshot_addr_t	addr;
+		ni_status_snapshot_lease_t	lease;
+		ni_status_snapshot_route_t	route;
+		uint32_t			mode;
+	} rec;
+	ni_addrconf_lease_t *lease;
+	ni_sockaddr_t dst, gw;
+	ni_address_t *ap;
+	ni_route_t *rp;
+
+	switch (type) {
+	case NI_STATUS_SNAPSHOT_NAME:
+		ni_status_snapshot_get_string(&dev->name, data, len);
+		return TRUE;
+	case NI_STATUS_SNAPSHOT_ALIAS:
+		ni_status_snapshot_get_string(&dev->link.alias, data, len);
+		return TRUE;
+	case NI_STATUS_SNAPSHOT_MASTER:
+		ni_status_snapshot_get_string(&dev->link.masterdev.name, data, len);
+		return TRUE;
+	case NI_STATUS_SNAPSHOT_LOWER:
+		ni_status_snapshot_get_string(&dev->link.lowerdev.name, data, len);
+		return TRUE;
+	case NI_STATUS_SNAPSHOT_ORIGIN:
+		if (!dev->client_state)
+			return FALSE;
+		ni_status_snapshot_get_string(&dev->client_state->config.origin, data, len);
+		return TRUE;
+	default:
+		break;
+	}
+
+	/* fixed size records, from an older version when shorter */
+	memset(&rec, 0, sizeof(rec));
+	memcpy(&rec, data, min_t(size_t, len, sizeof(rec)));
+
+	switch (type) {
+	case NI_STATUS_SNAPSHOT_VLAN:
+		ni_netdev_get_vlan(dev);
+		dev->vlan->tag = rec.vlan.tag;
+		dev->vlan->protocol = rec.vlan.protocol;
+		break;
+
+	case NI_STATUS_SNAPSHOT_BOND:
+		ni_netdev_get_bonding(dev)->mode = rec.mode;
+		break;
+
+	case NI_STATUS_SNAPSHOT_CONTROL:
+		if (!dev->client_state)
+			dev->client_state = ni_client_state_new(0);
+		dev->client_state->control.persistent = !!rec.control.persistent;
+		dev->client_state->control.usercontrol = !!rec.control.usercontrol;
+		dev->client_state->control.require_link = rec.control.require_link;
+		break;
+
+	case NI_STATUS_SNAPSHOT_CONFIG:
+		if (!dev->client_state)
+			dev->client_state = ni_client_state_new(0);
+		dev->client_state->config.uuid = rec.config.uuid;
+		dev->client_state->config.owner = rec.config.owner;
+		break;
+
+	case NI_STATUS_SNAPSHOT_LEASE:
+		lease = ni_addrconf_lease_new(rec.lease.type, rec.lease.family);
+		lease->state = rec.lease.state;
+		lease->flags = rec.lease.flags;
+		ni_netdev_set_lease(dev, lease);
+		break;
+
+	case NI_STATUS_SNAPSHOT_ADDR:
+		ni_status_snapshot_get_sockaddr(&dst, rec.addr.family, rec.addr.local);
+		ap = ni_address_new(rec.addr.family, rec.addr.prefixlen, &dst, &dev->addrs);
+		if (!ap)
+			return FALSE;
+		ap->flags = rec.addr.flags;
+		ap->owner = rec.addr.owner;
+		break;
+
+	case NI_STATUS_SNAPSHOT_ROUTE:
+		ni_status_snapshot_get_sockaddr(&dst, rec.route.family, rec.route.destination);
+		ni_status_snapshot_get_sockaddr(&gw, rec.route.family, rec.route.gateway);
+		rp = ni_netdev_add_route(dev, rec.route.prefixlen, &dst, &gw, rec.route.table);
+		if (!rp)
+			return FALSE;
+		rp->type = rec.route.type;
+		if (rec.route.nexthops > 1)
+			rp->nh.next = ni_route_nexthop_new();
+		break;
+
+	default:
+		/* from a newer version */
+		break;
+	}
+	return TRUE;
+}
+
+static ni_bool_t
+ni_status_snapshot_parse(ni_buffer_t *bp, ni_netdev_t **list)
+{
+	ni_status_snapshot_record_t rec;
+	ni_netdev_t *dev = NULL;
+	ni_netdev_t **tail = list;
+	const void *data;
+
+	while (ni_buffer_count(bp)) {
+		if (ni_buffer_get(bp, &rec, sizeof(rec)) < 0)
+			return FALSE;
+		if (!(data = ni_buffer_pull_head(bp, rec.len)))
+			return FALSE;
+		ni_buffer_pull_head(bp, (4 - (rec.len & 3)) & 3);
+
+		if (rec.type == NI_STATUS_SNAPSHOT_DEVICE) {
+			ni_status_snapshot_device_t device;
+
+			memset(&device, 0, sizeof(device));
+			memcpy(&device, data, min_t(size_t, rec.len, sizeof(device)));
+
+			if (!(dev = ni_netdev_new(NULL, device.ifindex)))
+				return FALSE;
+			dev->link.ifflags = device.ifflags;
+			dev->link.mtu = device.mtu;
+			dev->link.type = device.type;
+			dev->link.hwaddr.type = device.hwaddr_type;
+			dev->link.hwaddr.len = min_t(unsigned int, device.hwaddr_len, NI_MAXHWADDRLEN);
+			memcpy(dev->link.hwaddr.data, device.hwaddr, dev->link.hwaddr.len);
+			dev->link.hwpeer.type = device.hwaddr_type;
+			dev->link.hwpeer.len = min_t(unsigned int, device.hwpeer_len, NI_MAXHWADDRLEN);
+			memcpy(dev->link.hwpeer.data, device.hwpeer, dev->link.hwpeer.len);
+
+			*tail = dev;
+			tail = &dev->next;
+			continue;
+		}
+
+		if (!dev || !ni_status_snapshot_get_netdev(dev, rec.type, data, rec.len))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Writer side, used by wickedd
+ */
+static ni_bool_t
+ni_status_snapshot_map(struct ni_status_snapshot_writer *sw, size_t size)
+{
+	size_t maplen;
+	void *map;
+
+	maplen = sizeof(ni_status_snapshot_header_t) + size;
+	maplen = (maplen + NI_STATUS_SNAPSHOT_CHUNK - 1) & ~(NI_STATUS_SNAPSHOT_CHUNK - 1);
+	if (sw->map && maplen <= sw->maplen)
+		return TRUE;
+
+	if (ftruncate(sw->fd, maplen) < 0) {
+		ni_error("unable to resize status snapshot %s: %m", sw->path);
+		return FALSE;
+	}
+	map = mmap(NULL, maplen, PROT_READ | PROT_WRITE, MAP_SHARED, sw->fd, 0);
+	if (map == MAP_FAILED) {
+		ni_error("unable to map status snapshot %s: %m", sw->path);
+		return FALSE;
+	}
+	if (sw->map)
+		munmap(sw->map, sw->maplen);
+	sw->map = map;
+	sw->maplen = maplen;
+	return TRUE;
+}
+
+static ni_bool_t
+ni_status_snapshot_open(struct ni_status_snapshot_writer *sw)
+{
+	ni_status_snapshot_header_t *hdr;
+	char temp[PATH_MAX];
+
+	if (sw->fd >= 0)
+		return TRUE;
+	if (sw->failed)
+		return FALSE;
+
+	ni_string_printf(&sw->path, "%s/%s", ni_config_statedir(), NI_STATUS_SNAPSHOT_FILE);
+	snprintf(temp, sizeof(temp), "%s.XXXXXX", sw->path);
+	if ((sw->fd = mkstemp(temp)) < 0) {
+		ni_error("unable to create status snapshot %s: %m", temp);
+		sw->failed = TRUE;
+		return FALSE;
+	}
+	fcntl(sw->fd, F_SETFD, FD_CLOEXEC);
+	fchmod(sw->fd, 0644);
+
+	if (!ni_status_snapshot_map(sw, 0))
+		goto failure;
+
+	hdr = sw->map;
+	hdr->magic = NI_STATUS_SNAPSHOT_MAGIC;
+	hdr->version = NI_STATUS_SNAPSHOT_VERSION;
+	hdr->pid = getpid();
+
+	/* replace, never truncate a file a reader may have mapped */
+	if (rename(temp, sw->path) < 0) {
+		ni_error("unable to move status snapshot to %s: %m", sw->path);
+		goto failure;
+	}
+	ni_buffer_init_dynamic(&sw->last, NI_STATUS_SNAPSHOT_CHUNK);
+	return TRUE;
+
+failure:
+	unlink(temp);
+	ni_status_snapshot_close();
+	sw->failed = TRUE;
+	return FALSE;
+}
+
+void
+ni_status_snapshot_close(void)
+{
+	struct ni_status_snapshot_writer *sw = &ni_status_snapshot_writer;
+
+	if (sw->fd < 0)
+		return;
+
+	if (sw->path)
+		unlink(sw->path);
+	if (sw->map)
+		munmap(sw->map, sw->maplen);
+	close(sw->fd);
+	ni_buffer_destroy(&sw->last);
+	ni_string_free(&sw->path);
+	sw->map = NULL;
+	sw->maplen = 0;
+	sw->fd = -1;
+}
+
+/*
+ * Mark the published status as outdated; called by the event
+ * handlers and the lease, address and route updates.
+ */
+void
+ni_status_snapshot_invalidate(void)
+{
+	ni_status_snapshot_writer.dirty = TRUE;
+}
+
+/*
+ * Serialize the interface status and publish it, when it has been
+ * invalidated and differs from the last published one.
+ */
+ni_bool_t
+ni_status_snapshot_update(ni_netconfig_t *nc)
+{
+	struct ni_status_snapshot_writer *sw = &ni_status_snapshot_writer;
+	ni_status_snapshot_header_t *hdr;
+	ni_buffer_t buf;
+	unsigned int count = 0;
+	ni_netdev_t *dev;
+	size_t size;
+
+	if (!nc || !ni_status_snapshot_open(sw))
+		return FALSE;
+
+	if (!sw->dirty)
+		return TRUE;
+	sw->dirty = FALSE;
+
+	ni_buffer_init_dynamic(&buf, sw->last.size);
+	for (dev = ni_netconfig_devlist(nc); dev; dev = dev->next) {
+		if (ni_string_empty(dev->name))
+			continue;
+		ni_status_snapshot_put_netdev(&buf, dev);
+		count++;
+	}
+
+	size = ni_buffer_count(&buf);
+	if (size == ni_buffer_count(&sw->last) &&
+	    !memcmp(ni_buffer_head(&buf), ni_buffer_head(&sw->last), size)) {
+		ni_buffer_destroy(&buf);
+		return TRUE;
+	}
+
+	hdr = sw->map;
+	hdr->seq++;
+	__sync_synchronize();
+
+	if (!ni_status_snapshot_map(sw, size)) {
+		hdr->seq++;
+		ni_buffer_destroy(&buf);
+		sw->dirty = TRUE;
+		return FALSE;
+	}
+
+	hdr = sw->map;
+	memcpy(hdr + 1, ni_buffer_head(&buf), size);
+	hdr->size = size;
+	hdr->count = count;
+
+	__sync_synchronize();
+	hdr->seq++;
+
+	ni_buffer_destroy(&sw->last);
+	sw->last = buf;
+	return TRUE;
+}
+
+/*
+ * Reader side, used by the client
+ */
+static ni_bool_t
+ni_status_snapshot_read(int fd, ni_buffer_t *bp)
+{
+	const ni_status_snapshot_header_t *hdr;
+	unsigned int tries, seq;
+	struct stat st;
+	void *map;
+	size_t size;
+
+	for (tries = 0; tries < NI_STATUS_SNAPSHOT_RETRIES; ++tries) {
+		if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*hdr))
+			return FALSE;
+
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED)
+			return FALSE;
+		hdr = map;
+
+		if (hdr->magic != NI_STATUS_SNAPSHOT_MAGIC ||
+		    hdr->version != NI_STATUS_SNAPSHOT_VERSION) {
+			ni_debug_readwrite("unsupported status snapshot version");
+			munmap(map, st.st_size);
+			return FALSE;
+		}
+		if (!hdr->pid || (kill(hdr->pid, 0) < 0 && errno != EPERM)) {
+			ni_debug_readwrite("stale status snapshot of pid %u", hdr->pid);
+			munmap(map, st.st_size);
+			return FALSE;
+		}
+
+		seq = hdr->seq;
+		__sync_synchronize();
+		size = hdr->size;
+		if (!(seq & 1) && sizeof(*hdr) + size <= (size_t)st.st_size) {
+			ni_buffer_clear(bp);
+			ni_buffer_ensure_tailroom(bp, size);
+			ni_buffer_put(bp, hdr + 1, size);
+			__sync_synchronize();
+			if (seq == hdr->seq) {
+				munmap(map, st.st_size);
+				return TRUE;
+			}
+		}
+		munmap(map, st.st_size);
+		usleep(1000);
+	}
+	ni_debug_readwrite("status snapshot is busy, giving up");
+	return FALSE;
+}
+
+ni_bool_t
+ni_status_snapshot_load(ni_netdev_t **list)
+{
+	char path[PATH_MAX];
+	ni_netdev_t *dev;
+	ni_buffer_t buf;
+	ni_bool_t ret;
+	int fd;
+
+	if (!list)
+		return FALSE;
+
+	snprintf(path, sizeof(path), "%s/%s", ni_config_statedir(), NI_STATUS_SNAPSHOT_FILE);
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+		if (errno != ENOENT)
+			ni_debug_readwrite("unable to open status snapshot %s: %m", path);
+		return FALSE;
+	}
+
+	ni_buffer_init_dynamic(&buf, NI_STATUS_SNAPSHOT_CHUNK);
+	ret = ni_status_snapshot_read(fd, &buf) &&
+		ni_status_snapshot_parse(&buf, list);
+	ni_buffer_destroy(&buf);
+	close(fd);
+
+	if (!ret) {
+		while ((dev = *list)) {
+			*list = dev->next;
+			dev->next = NULL;
+			ni_netdev_put(dev);
+		}
+	}
+	return ret;
+}
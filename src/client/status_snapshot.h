@@ -0,0 +1,21 @@
+/*
+ * Read-only interface status snapshot published by wickedd in a memory
+ * mapped file in the state directory, so status queries do not need to
+ * fetch and deserialize the complete D-Bus object tree.
+ *
+ * Copyright (C) 2015 SUSE LINUX GmbH, Nuernberg, Germany.
+ *
+ */
+#ifndef __WICKED_CLIENT_STATUS_SNAPSHOT_H__
+#define __WICKED_CLIENT_STATUS_SNAPSHOT_H__
+
+#include <wicked/types.h>
+
+#define NI_STATUS_SNAPSHOT_FILE		"status-snapshot"
+
+extern ni_bool_t	ni_status_snapshot_update(ni_netconfig_t *);
+extern void		ni_status_snapshot_invalidate(void);
+extern void		ni_status_snapshot_close(void);
+extern ni_bool_t	ni_status_snapshot_load(ni_netdev_t **);
+
+#endif /* __WICKED_CLIENT_STATUS_SNAPSHOT_H__ */
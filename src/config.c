@@ -23,6 +23,7 @@
 #include "netinfo_priv.h"
 #include "util_priv.h"
 #include "appconfig.h"
+#include "process.h"
 #include "xml-schema.h"
 
 static const char *__ni_ifconfig_source_types[] = {
@@ -34,6 +35,7 @@ static const char *__ni_ifconfig_source_types[] = {
 
 static ni_bool_t	ni_config_parse_addrconf_dhcp4(struct ni_config_dhcp4 *, xml_node_t *);
 static ni_bool_t	ni_config_parse_addrconf_dhcp6(struct ni_config_dhcp6 *, xml_node_t *);
+static ni_bool_t	ni_config_parse_transmit_rate(ni_config_transmit_rate_t *, xml_node_t *);
 static void		ni_config_parse_update_targets(unsigned int *, const xml_node_t *);
 static void		ni_config_parse_fslocation(ni_config_fslocation_t *, xml_node_t *);
 static ni_bool_t	ni_config_parse_objectmodel_extension(ni_extension_t **, xml_node_t *);
@@ -43,6 +45,8 @@ static ni_bool_t	ni_config_parse_system_updater(ni_extension_t **, xml_node_t *)
 static ni_bool_t	ni_config_parse_extension(ni_extension_t *, xml_node_t *);
 static ni_bool_t	ni_config_parse_sources(ni_config_t *, xml_node_t *);
 static ni_bool_t	ni_config_parse_rtnl_event(ni_config_rtnl_event_t *, xml_node_t *);
+static ni_bool_t	ni_config_parse_packet_capture(ni_config_packet_capture_t *, xml_node_t *);
+static ni_bool_t	ni_config_parse_extension_scripts(ni_config_extension_scripts_t *, xml_node_t *);
 static ni_c_binding_t *	ni_c_binding_new(ni_c_binding_t **, const char *name, const char *lib, const char *symbol);
 static const char *	ni_config_build_include(const char *, const char *);
 static unsigned int	ni_config_addrconf_update_mask_all(void);
@@ -64,6 +68,7 @@ ni_config_new()
 	conf->addrconf.dhcp4.allow_update   = ni_config_addrconf_update_mask_dhcp4();
 	conf->addrconf.dhcp6.allow_update   = ni_config_addrconf_update_mask_dhcp6();
 	conf->addrconf.autoip.allow_update  = ni_config_addrconf_update_mask_auto4();
+	conf->addrconf.dhcp4.start_jitter   = 500; /* msec */
 
 	ni_config_fslocation_init(&conf->piddir,   WICKED_PIDDIR,   0755);
 	ni_config_fslocation_init(&conf->statedir, WICKED_STATEDIR, 0755);
@@ -74,6 +79,13 @@ ni_config_new()
 	conf->rtnl_event.recv_buff_length = 1024 * 1024;
 	conf->rtnl_event.mesg_buff_length = 0;
 
+	conf->packet_capture.mmap_ring = FALSE;
+	conf->packet_capture.ring_block_size = 0;
+	conf->packet_capture.ring_block_count = 0;
+
+	conf->extension_scripts.max_running = 4;
+	conf->extension_scripts.timeout = 0; /* sec */
+
 	return conf;
 }
 
@@ -239,6 +251,14 @@ __ni_config_parse(ni_config_t *conf, const char *filename, ni_init_appdata_callb
 			if (!ni_config_parse_rtnl_event(&conf->rtnl_event, child))
 				goto failed;
 		} else
+		if (strcmp(child->name, "packet-capture") == 0) {
+			if (!ni_config_parse_packet_capture(&conf->packet_capture, child))
+				goto failed;
+		} else
+		if (strcmp(child->name, "extension-scripts") == 0) {
+			if (!ni_config_parse_extension_scripts(&conf->extension_scripts, child))
+				goto failed;
+		} else
 		if (cb != NULL) {
 			if (!cb(appdata, child))
 				goto failed;
@@ -316,6 +336,27 @@ ni_config_parse_addrconf_dhcp4(struct ni_config_dhcp4 *dhcp4, xml_node_t *node)
 			ni_string_dup(&dhcp4->vendor_class, child->cdata);
 		if (!strcmp(child->name, "lease-time") && child->cdata)
 			dhcp4->lease_time = strtoul(child->cdata, NULL, 0);
+		if (!strcmp(child->name, "shared-capture")
+		 && ni_parse_boolean(child->cdata, &dhcp4->shared_capture)) {
+			ni_error("config: unable to parse <shared-capture>%s</shared-capture>",
+					child->cdata);
+			return FALSE;
+		}
+		if (!strcmp(child->name, "transmit-rate")
+		 && !ni_config_parse_transmit_rate(&dhcp4->transmit_rate, child))
+			return FALSE;
+		if (!strcmp(child->name, "start-jitter")
+		 && ni_parse_uint(child->cdata, &dhcp4->start_jitter, 10) < 0) {
+			ni_error("config: unable to parse <start-jitter>%s</start-jitter>",
+					child->cdata);
+			return FALSE;
+		}
+		if (!strcmp(child->name, "renewal-window")
+		 && ni_parse_uint(child->cdata, &dhcp4->renewal_window, 10) < 0) {
+			ni_error("config: unable to parse <renewal-window>%s</renewal-window>",
+					child->cdata);
+			return FALSE;
+		}
 		if (!strcmp(child->name, "ignore-server")
 		 && (attrval = xml_node_get_attr(child, "ip")) != NULL)
 			ni_string_array_append(&dhcp4->ignore_servers, attrval);
@@ -360,6 +401,30 @@ ni_config_parse_addrconf_dhcp4(struct ni_config_dhcp4 *dhcp4, xml_node_t *node)
 	return TRUE;
 }
 
+/*
+ * <transmit-rate burst="10">50</transmit-rate>
+ */
+static ni_bool_t
+ni_config_parse_transmit_rate(ni_config_transmit_rate_t *tr, xml_node_t *node)
+{
+	const char *attrval;
+
+	if (ni_parse_uint(node->cdata, &tr->rate, 10) < 0) {
+		ni_error("config: unable to parse <transmit-rate>%s</transmit-rate>",
+				node->cdata);
+		return FALSE;
+	}
+
+	tr->burst = 0;
+	if ((attrval = xml_node_get_attr(node, "burst")) != NULL
+	 && ni_parse_uint(attrval, &tr->burst, 10) < 0) {
+		ni_error("config: unable to parse <transmit-rate burst=\"%s\">",
+				attrval);
+		return FALSE;
+	}
+	return TRUE;
+}
+
 static int
 __ni_config_parse_dhcp6_class_data(xml_node_t *node, ni_string_array_t *data, const char *parent)
 {
@@ -604,6 +669,17 @@ ni_config_parse_addrconf_dhcp6(struct ni_config_dhcp6 *dhcp6, xml_node_t *node)
 		if (!strcmp(child->name, "lease-time") && child->cdata) {
 			dhcp6->lease_time = strtoul(child->cdata, NULL, 0);
 		} else
+		if (!strcmp(child->name, "transmit-rate")) {
+			if (!ni_config_parse_transmit_rate(&dhcp6->transmit_rate, child))
+				return FALSE;
+		} else
+		if (!strcmp(child->name, "renewal-window")) {
+			if (ni_parse_uint(child->cdata, &dhcp6->renewal_window, 10) < 0) {
+				ni_error("config: unable to parse <renewal-window>%s</renewal-window>",
+						child->cdata);
+				return FALSE;
+			}
+		} else
 		if (!strcmp(child->name, "ignore-server")
 		 && (attrval = xml_node_get_attr(child, "ip")) != NULL) {
 			ni_string_array_append(&dhcp6->ignore_servers, attrval);
@@ -746,7 +822,8 @@ ni_config_parse_extension(ni_extension_t *ex, xml_node_t *node)
 
 	for (child = node->children; child; child = child->next) {
 		if (!strcmp(child->name, "action") || !strcmp(child->name, "script")) {
-			const char *name, *command;
+			const char *name, *command, *timeout;
+			ni_shellcmd_t *cmd;
 
 			if (!(name = xml_node_get_attr(child, "name"))) {
 				ni_error("action element without name attribute");
@@ -757,8 +834,15 @@ ni_config_parse_extension(ni_extension_t *ex, xml_node_t *node)
 				return FALSE;
 			}
 
-			if (!ni_extension_script_new(ex, name, command))
+			if (!(cmd = ni_extension_script_new(ex, name, command)))
+				return FALSE;
+
+			if ((timeout = xml_node_get_attr(child, "timeout")) &&
+			    ni_parse_uint(timeout, &cmd->timeout, 0) < 0) {
+				ni_error("%s: invalid action timeout \"%s\"",
+						xml_node_location(child), timeout);
 				return FALSE;
+			}
 		} else
 		if (!strcmp(child->name, "builtin")) {
 			const char *name, *library, *symbol;
@@ -858,6 +942,9 @@ ni_config_parse_system_updater(ni_extension_t **list, xml_node_t *node)
 	/* If the updater has a format type, extract. */
 	ni_string_dup(&ex->format, xml_node_get_attr(node, "format"));
 
+	/* Whether to use the builtin updater, with the scripts as fallback. */
+	ni_string_dup(&ex->backend, xml_node_get_attr(node, "backend"));
+
 	return ni_config_parse_extension(ex, node);
 }
 
@@ -946,6 +1033,52 @@ ni_config_parse_rtnl_event(ni_config_rtnl_event_t *conf, xml_node_t *node)
 	return TRUE;
 }
 
+ni_bool_t
+ni_config_parse_packet_capture(ni_config_packet_capture_t *conf, xml_node_t *node)
+{
+	xml_node_t *child;
+
+	if (!conf || !node)
+		return FALSE;
+
+	for (child = node->children; child; child = child->next) {
+		if (ni_string_eq(child->name, "mmap-ring")) {
+			if (ni_parse_boolean(child->cdata, &conf->mmap_ring))
+				return FALSE;
+		} else
+		if (ni_string_eq(child->name, "ring-block-size")) {
+			if (ni_parse_uint(child->cdata, &conf->ring_block_size, 0))
+				return FALSE;
+		} else
+		if (ni_string_eq(child->name, "ring-block-count")) {
+			if (ni_parse_uint(child->cdata, &conf->ring_block_count, 0))
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+ni_bool_t
+ni_config_parse_extension_scripts(ni_config_extension_scripts_t *conf, xml_node_t *node)
+{
+	xml_node_t *child;
+
+	if (!conf || !node)
+		return FALSE;
+
+	for (child = node->children; child; child = child->next) {
+		if (ni_string_eq(child->name, "max-running")) {
+			if (ni_parse_uint(child->cdata, &conf->max_running, 0))
+				return FALSE;
+		} else
+		if (ni_string_eq(child->name, "timeout")) {
+			if (ni_parse_uint(child->cdata, &conf->timeout, 0))
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
+
 /*
  * Extension handling
  */
@@ -9,13 +9,17 @@
 
 #include <sys/poll.h>
 #include <errno.h>
+#include <signal.h>
 
 #include <wicked/util.h>
 #include <wicked/logging.h>
 #include <wicked/dbus-errors.h>
+#include <wicked/socket.h>
 #include "socket_priv.h"
 #include "dbus-connection.h"
 #include "dbus-dict.h"
+#include "netinfo_priv.h"
+#include "appconfig.h"
 #include "process.h"
 #include "debug.h"
 
@@ -34,11 +38,29 @@ typedef struct ni_dbus_async_server_call ni_dbus_async_server_call_t;
 struct ni_dbus_async_server_call {
 	ni_dbus_async_server_call_t *next;
 
+	ni_dbus_connection_t *	conn;
 	const ni_dbus_method_t *method;
 	DBusMessage *		call_message;
 	ni_process_t *		sub_process;
+
+	const ni_timer_t *	timer;
+	ni_bool_t		timed_out;
+	struct timeval		queued;
+	struct timeval		started;
 };
 
+/* msec a timed out script gets to exit after SIGTERM */
+#define NI_DBUS_ASYNC_SERVER_CALL_KILL_GRACE	2000
+
+typedef struct ni_dbus_async_server_stats {
+	unsigned int		calls;
+	unsigned int		timeouts;
+	unsigned long		wait_total;	/* msec in queue */
+	unsigned long		wait_max;
+	unsigned long		run_total;	/* msec running */
+	unsigned long		run_max;
+} ni_dbus_async_server_stats_t;
+
 typedef struct ni_dbus_sigaction ni_dbus_sigaction_t;
 struct ni_dbus_sigaction {
 	ni_dbus_sigaction_t *	next;
@@ -55,6 +77,9 @@ struct ni_dbus_connection {
 
 	ni_dbus_async_client_call_t *async_client_calls;
 	ni_dbus_async_server_call_t *async_server_calls;
+	ni_dbus_async_server_call_t *async_server_queue;
+	unsigned int		async_server_running;
+	ni_dbus_async_server_stats_t async_server_stats;
 	ni_dbus_sigaction_t *	sighandlers;
 
 	ni_bool_t		dispatching;
@@ -81,6 +106,9 @@ static ni_dbus_watch_data_t *	ni_dbus_watches;
 
 static void			__ni_dbus_sigaction_free(ni_dbus_sigaction_t *);
 static void			__ni_dbus_async_server_call_free(ni_dbus_async_server_call_t *);
+static void			__ni_dbus_async_server_call_callback(ni_process_t *);
+static void			__ni_dbus_async_server_call_finish(ni_dbus_connection_t *,
+					ni_dbus_async_server_call_t *, ni_process_t *);
 static void			__ni_dbus_async_client_call_free(ni_dbus_async_client_call_t *);
 static void			__ni_dbus_notify_async(DBusPendingCall *, void *);
 static dbus_bool_t		__ni_dbus_add_watch(DBusWatch *, void *);
@@ -237,6 +265,14 @@ ni_dbus_connection_free(ni_dbus_connection_t *dbc)
 		dbc->async_server_calls = async->next;
 		__ni_dbus_async_server_call_free(async);
 	}
+	dbc->async_server_running = 0;
+
+	while (dbc->async_server_queue) {
+		ni_dbus_async_server_call_t *async = dbc->async_server_queue;
+
+		dbc->async_server_queue = async->next;
+		__ni_dbus_async_server_call_free(async);
+	}
 
 	while ((sig = dbc->sighandlers) != NULL) {
 		dbc->sighandlers = sig->next;
@@ -536,30 +572,200 @@ ni_dbus_connection_unregister_object(ni_dbus_connection_t *connection, ni_dbus_o
 
 /*
  * Server side: process calls asynchronously
+ *
+ * At most <extension-scripts><max-running> calls run at the same time,
+ * further calls wait in a queue. A call running longer than its timeout
+ * is terminated and answered with an error.
  */
-void
-__ni_dbus_async_server_call_callback(ni_process_t *proc)
+static unsigned int
+__ni_dbus_async_server_call_max_running(void)
 {
-	ni_dbus_connection_t *conn = proc->user_data;
-	ni_dbus_async_server_call_t **pos, *async;
+	return ni_global.config ? ni_global.config->extension_scripts.max_running : 0;
+}
 
-	for (pos = &conn->async_server_calls; (async = *pos) != NULL; pos = &async->next) {
-		if (async->sub_process == proc) {
-			*pos = async->next;
+static unsigned int
+__ni_dbus_async_server_call_timeout(const ni_process_t *proc)
+{
+	if (proc->process && proc->process->timeout)
+		return proc->process->timeout;
+	return ni_global.config ? ni_global.config->extension_scripts.timeout : 0;
+}
+
+static unsigned long
+__ni_dbus_async_server_call_msec(const struct timeval *since, const struct timeval *until)
+{
+	struct timeval delta;
+
+	if (!timerisset(since) || !timercmp(since, until, <))
+		return 0;
+
+	timersub(until, since, &delta);
+	return delta.tv_sec * 1000 + delta.tv_usec / 1000;
+}
+
+static void
+__ni_dbus_async_server_call_stats(ni_dbus_connection_t *conn, const ni_dbus_async_server_call_t *async)
+{
+	ni_dbus_async_server_stats_t *stats = &conn->async_server_stats;
+	unsigned long wait, run;
+	struct timeval now;
+
+	ni_timer_get_time(&now);
+	wait = __ni_dbus_async_server_call_msec(&async->queued, &async->started);
+	run = __ni_dbus_async_server_call_msec(&async->started, &now);
+
+	stats->calls++;
+	if (async->timed_out)
+		stats->timeouts++;
+	stats->wait_total += wait;
+	stats->run_total += run;
+	if (stats->wait_max < wait)
+		stats->wait_max = wait;
+	if (stats->run_max < run)
+		stats->run_max = run;
+
+	ni_debug_extension("%s: waited %lu ms, ran %lu ms%s "
+			"[%u calls, %u timeouts, wait avg %lu max %lu, run avg %lu max %lu ms]",
+			async->method->name, wait, run,
+			async->timed_out ? " (timed out)" : "",
+			stats->calls, stats->timeouts,
+			stats->wait_total / stats->calls, stats->wait_max,
+			stats->run_total / stats->calls, stats->run_max);
+}
+
+static void
+__ni_dbus_async_server_call_timeout_cb(void *user_data, const ni_timer_t *timer)
+{
+	ni_dbus_async_server_call_t *async = user_data;
+	ni_process_t *proc;
+
+	if (!async || async->timer != timer)
+		return;
+
+	async->timer = NULL;
+	if (!(proc = async->sub_process))
+		return;
+
+	if (!async->timed_out) {
+		ni_warn("%s: extension script \"%s\" timed out, terminating it",
+				async->method->name, proc->process->command);
+		async->timed_out = TRUE;
+		kill(proc->pid, SIGTERM);
+		async->timer = ni_timer_register(NI_DBUS_ASYNC_SERVER_CALL_KILL_GRACE,
+				__ni_dbus_async_server_call_timeout_cb, async);
+		return;
+	}
+
+	/* Children of the script may keep its output socket open, so we
+	 * don't wait for it any longer; the socket disposes the process. */
+	if (ni_process_running(proc))
+		kill(proc->pid, SIGKILL);
+	proc->notify_callback = NULL;
+	proc->user_data = NULL;
+	__ni_dbus_async_server_call_finish(async->conn, async, proc);
+}
+
+static int
+__ni_dbus_async_server_call_start(ni_dbus_connection_t *conn, ni_dbus_async_server_call_t *async)
+{
+	ni_process_t *process = async->sub_process;
+	unsigned int timeout;
+	int rv;
+
+	if ((rv = ni_process_run(process)) < 0)
+		return rv;
+
+	ni_timer_get_time(&async->started);
+	process->notify_callback = __ni_dbus_async_server_call_callback;
+	process->user_data = conn;
+
+	if ((timeout = __ni_dbus_async_server_call_timeout(process))) {
+		async->timer = ni_timer_register(timeout * 1000,
+				__ni_dbus_async_server_call_timeout_cb, async);
+	}
+
+	async->next = conn->async_server_calls;
+	conn->async_server_calls = async;
+	conn->async_server_running++;
+	return rv;
+}
+
+static void
+__ni_dbus_async_server_call_dequeue(ni_dbus_connection_t *conn)
+{
+	unsigned int max_running = __ni_dbus_async_server_call_max_running();
+	ni_dbus_async_server_call_t *async;
+
+	while ((async = conn->async_server_queue) != NULL) {
+		if (max_running && conn->async_server_running >= max_running)
 			break;
+
+		conn->async_server_queue = async->next;
+		async->next = NULL;
+
+		if (__ni_dbus_async_server_call_start(conn, async) < 0) {
+			DBusError error = DBUS_ERROR_INIT;
+
+			dbus_set_error(&error, DBUS_ERROR_FAILED, "%s: error executing method %s",
+					__func__, async->method->name);
+			ni_dbus_connection_send_error(conn, async->call_message, &error);
+			dbus_error_free(&error);
+			__ni_dbus_async_server_call_free(async);
 		}
 	}
-	if (async == NULL) {
-		ni_error("%s: unknown subprocess exited", __func__);
-		return;
+}
+
+static void
+__ni_dbus_async_server_call_finish(ni_dbus_connection_t *conn, ni_dbus_async_server_call_t *async,
+					ni_process_t *proc)
+{
+	ni_dbus_async_server_call_t **pos;
+
+	for (pos = &conn->async_server_calls; *pos; pos = &(*pos)->next) {
+		if (*pos == async) {
+			*pos = async->next;
+			break;
+		}
 	}
 
 	async->sub_process = NULL;
+	if (conn->async_server_running)
+		conn->async_server_running--;
+	__ni_dbus_async_server_call_stats(conn, async);
 
 	/* Should build response and send it out now */
-	async->method->async_completion(conn, async->method, async->call_message, proc);
+	if (async->timed_out) {
+		DBusError error = DBUS_ERROR_INIT;
+
+		dbus_set_error(&error, DBUS_ERROR_TIMEOUT, "%s: extension script timed out",
+				async->method->name);
+		ni_dbus_connection_send_error(conn, async->call_message, &error);
+		dbus_error_free(&error);
+	} else {
+		async->method->async_completion(conn, async->method, async->call_message, proc);
+	}
 
 	__ni_dbus_async_server_call_free(async);
+
+	__ni_dbus_async_server_call_dequeue(conn);
+}
+
+static void
+__ni_dbus_async_server_call_callback(ni_process_t *proc)
+{
+	ni_dbus_connection_t *conn = proc->user_data;
+	ni_dbus_async_server_call_t *async;
+
+	for (async = conn->async_server_calls; async; async = async->next) {
+		if (async->sub_process == proc)
+			break;
+	}
+	if (async == NULL) {
+		ni_error("%s: unknown subprocess exited", __func__);
+		return;
+	}
+
+	__ni_dbus_async_server_call_finish(conn, async, proc);
 }
 
 static ni_dbus_async_server_call_t *
@@ -570,11 +776,10 @@ __ni_dbus_async_server_call_new(ni_dbus_connection_t *conn,
 	ni_dbus_async_server_call_t *async;
 
 	async = xcalloc(1, sizeof(*async));
+	async->conn = conn;
 	async->method = method;
 	async->call_message = dbus_message_ref(call_message);
-
-	async->next = conn->async_server_calls;
-	conn->async_server_calls = async;
+	ni_timer_get_time(&async->queued);
 
 	return async;
 }
@@ -582,6 +787,8 @@ __ni_dbus_async_server_call_new(ni_dbus_connection_t *conn,
 void
 __ni_dbus_async_server_call_free(ni_dbus_async_server_call_t *async)
 {
+	if (async->timer)
+		ni_timer_cancel(async->timer);
 	if (async->call_message)
 		dbus_message_unref(async->call_message);
 	if (async->sub_process) {
@@ -602,21 +809,37 @@ ni_dbus_async_server_call_run_command(ni_dbus_connection_t *conn,
 					DBusMessage *call_message,
 					ni_process_t *process)
 {
-	ni_dbus_async_server_call_t *async;
+	unsigned int max_running = __ni_dbus_async_server_call_max_running();
+	ni_dbus_async_server_call_t *async, **tail;
 	int rv;
 
-	if ((rv = ni_process_run(process)) < 0) {
+	async = __ni_dbus_async_server_call_new(conn, method, call_message);
+	async->sub_process = process;
+
+	if (max_running && (conn->async_server_queue ||
+			    conn->async_server_running >= max_running)) {
+		ni_debug_dbus("%s: queueing command \"%s\", %u running",
+				ni_dbus_object_get_path(object),
+				process->process->command,
+				conn->async_server_running);
+
+		for (tail = &conn->async_server_queue; *tail; tail = &(*tail)->next)
+			;
+		*tail = async;
+		return 0;
+	}
+
+	if ((rv = __ni_dbus_async_server_call_start(conn, async)) < 0) {
 		const char *path = ni_dbus_object_get_path(object);
 
 		ni_debug_dbus("%s: unable to run command \"%s\"", path, process->process->command);
+
+		/* the caller disposes of the process */
+		async->sub_process = NULL;
+		__ni_dbus_async_server_call_free(async);
 		return rv;
 	}
 
-	async = __ni_dbus_async_server_call_new(conn, method, call_message);
-	async->sub_process = process;
-	process->notify_callback = __ni_dbus_async_server_call_callback;
-	process->user_data = conn;
-
 	return 0;
 }
 
@@ -31,6 +31,7 @@
 #include "dbus-common.h"
 #include "model.h"
 #include "debug.h"
+#include "client/status_snapshot.h"
 
 const ni_dbus_class_t		ni_objectmodel_addrconf_device_class = {
 	.name = "addrconf-device",
@@ -141,6 +142,24 @@ __ni_objectmodel_routes_bind_device_name(ni_route_table_t *routes, const char *i
 	return count > 0;
 }
 
+/*
+ * Emit the lease event, when a deferred lease update has been applied
+ */
+static void
+ni_objectmodel_addrconf_updater_notify(ni_netdev_t *dev, ni_addrconf_lease_t *lease,
+			int result, ni_event_t event, const ni_uuid_t *uuid)
+{
+	ni_dbus_object_t *object;
+
+	if (result < 0 || !__ni_objectmodel_server)
+		return;
+
+	object = ni_objectmodel_get_netif_object(__ni_objectmodel_server, dev);
+	if (object)
+		ni_objectmodel_send_netif_event(__ni_objectmodel_server, object,
+				event, ni_uuid_is_null(uuid) ? NULL : uuid);
+}
+
 /*
  * Callback from addrconf supplicant whenever it acquired, released or lost a lease.
  *
@@ -159,6 +178,7 @@ ni_objectmodel_addrconf_signal_handler(ni_dbus_connection_t *conn, ni_dbus_messa
 	ni_uuid_t uuid = NI_UUID_INIT;
 	ni_event_t ifevent;
 	int argc, optind = 0;
+	int rv;
 
 	memset(argv, 0, sizeof(argv));
 	argc = ni_dbus_message_get_args_variants(msg, argv, 16);
@@ -243,6 +263,7 @@ ni_objectmodel_addrconf_signal_handler(ni_dbus_connection_t *conn, ni_dbus_messa
 			goto done;
 
 		lease->state = _lease->state = NI_ADDRCONF_STATE_REQUESTING;
+		ni_status_snapshot_invalidate();
 		ifevent = NI_EVENT_ADDRESS_DEFERRED;
 		goto emit;
 	} else if (!strcmp(signal_name, NI_OBJECTMODEL_LEASE_RELEASED_SIGNAL)) {
@@ -267,10 +288,18 @@ ni_objectmodel_addrconf_signal_handler(ni_dbus_connection_t *conn, ni_dbus_messa
 	 * Note, lease may be NULL after this, as the interface object
 	 * takes ownership of it.
 	 *
-	 * Return code 0 is success, < 0 error where we do not emit events.
+	 * Return code 0 is success, < 0 error where we do not emit events
+	 * and > 0 when the event is emitted once the update is complete.
 	 */
-	if (__ni_system_interface_update_lease(ifp, &lease) < 0)
+	rv = __ni_system_interface_update_lease(ifp, &lease);
+	if (rv < 0)
+		goto done;
+	if (rv > 0) {
+		ni_addrconf_updater_set_notify(ni_netdev_get_lease(ifp,
+					forwarder->addrfamily, forwarder->addrconf),
+				ni_objectmodel_addrconf_updater_notify, ifevent, &uuid);
 		goto done;
+	}
 
 	/* Potentially, there's a client somewhere waiting for that event.
 	 * We use the UUID that's passed back and forth to make sure we
@@ -296,6 +325,15 @@ done:
 /*
  * Generic functions for static address configuration
  */
+static void
+ni_objectmodel_addrconf_static_notify(ni_netdev_t *dev, ni_addrconf_lease_t *lease,
+			int result, ni_event_t event, const ni_uuid_t *uuid)
+{
+	if (result < 0)
+		event = NI_EVENT_ADDRESS_LOST;
+	ni_objectmodel_addrconf_updater_notify(dev, lease, 0, event, uuid);
+}
+
 static dbus_bool_t
 ni_objectmodel_addrconf_static_request(ni_dbus_object_t *object, unsigned int addrfamily,
 			unsigned int argc, const ni_dbus_variant_t *argv,
@@ -304,6 +342,7 @@ ni_objectmodel_addrconf_static_request(ni_dbus_object_t *object, unsigned int ad
 	ni_addrconf_lease_t *lease = NULL;
 	const ni_dbus_variant_t *dict;
 	const char *string_value;
+	ni_uuid_t uuid;
 	ni_netdev_t *dev;
 	ni_address_t *ap;
 	int rv;
@@ -338,6 +377,7 @@ ni_objectmodel_addrconf_static_request(ni_dbus_object_t *object, unsigned int ad
 	for (ap = lease->addrs; ap; ap = ap->next)
 		ni_address_set_tentative(ap, TRUE);
 
+	uuid = lease->uuid;
 	rv = __ni_system_interface_update_lease(dev, &lease);
 	if (lease)
 		ni_addrconf_lease_free(lease);
@@ -351,6 +391,19 @@ ni_objectmodel_addrconf_static_request(ni_dbus_object_t *object, unsigned int ad
 		return FALSE;
 	}
 
+	if (rv > 0) {
+		ni_objectmodel_callback_data_t data = { .lease = NULL };
+
+		/* Addresses are still verified, tell the client to wait
+		 * for an addressAcquired event with the lease uuid */
+		data.lease = ni_netdev_get_lease(dev, addrfamily, NI_ADDRCONF_STATIC);
+		ni_addrconf_updater_set_notify(data.lease,
+				ni_objectmodel_addrconf_static_notify,
+				NI_EVENT_ADDRESS_ACQUIRED, &uuid);
+		return __ni_objectmodel_return_callback_info(reply,
+				NI_EVENT_ADDRESS_ACQUIRED, &uuid, &data, error);
+	}
+
 	/* Don't return anything. */
 	return TRUE;
 }
@@ -472,6 +525,7 @@ ni_objectmodel_addrconf_forward_request(ni_dbus_addrconf_forwarder_t *forwarder,
 	lease->uuid = req_uuid;
 	lease->state = NI_ADDRCONF_STATE_REQUESTING;
 	lease->flags = flags;
+	ni_status_snapshot_invalidate();
 
 	rv = ni_objectmodel_addrconf_forwarder_call(forwarder, dev, "acquire", &req_uuid, dict, error);
 	if (rv) {
@@ -773,6 +827,20 @@ __ni_objectmodel_addrconf_generic_get_lease(const ni_dbus_object_t *object,
 		ni_dbus_dict_add_uint32(dict, "flags", lease->flags);
 	if (!ni_uuid_is_null(&lease->uuid))
 		ni_dbus_dict_add_uuid(dict,   "uuid", &lease->uuid);
+	if (lease->timing.count) {
+		ni_dbus_variant_t *list, *entry;
+		unsigned int i;
+
+		if (!(list = ni_dbus_dict_add(dict, "update-timing")))
+			return FALSE;
+		ni_dbus_dict_array_init(list);
+		for (i = 0; i < lease->timing.count; ++i) {
+			if (!(entry = ni_dbus_dict_array_add(list)))
+				return FALSE;
+			ni_dbus_dict_add_string(entry, "stage", lease->timing.stage[i].name);
+			ni_dbus_dict_add_uint32(entry, "usec", lease->timing.stage[i].usec);
+		}
+	}
 	return TRUE;
 }
 
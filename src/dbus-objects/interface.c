@@ -27,6 +27,7 @@
 #include "dbus-common.h"
 #include "model.h"
 #include "debug.h"
+#include "client/status_snapshot.h"
 
 extern dbus_bool_t	ni_objectmodel_netif_list_refresh(ni_dbus_object_t *);
 static void		ni_objectmodel_register_netif_factory_service(ni_dbus_service_t *);
@@ -936,6 +937,7 @@ static void
 __ni_objectmodel_netif_set_client_state_save_trigger(ni_netdev_t *dev)
 {
 	if (dev && dev->client_state) {
+		ni_status_snapshot_invalidate();
 		ni_client_state_save(dev->client_state, dev->link.ifindex);
 		ni_debug_dbus("saving %s structure into a file for %s",
 			NI_CLIENT_STATE_XML_NODE, dev->name);
@@ -1344,6 +1346,7 @@ __ni_objectmodel_netif_set_client_state(ni_dbus_object_t *object,
 		ni_netdev_set_client_state(dev, NULL);
 		return FALSE;
 	}
+	ni_status_snapshot_invalidate();
 
 	return TRUE;
 }
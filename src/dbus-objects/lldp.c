@@ -335,6 +335,7 @@ static ni_intmap_t	__ni_objectmodel_chassis_id_kind[] = {
 	{ "port-component",	NI_LLDP_CHASSIS_ID_PORT_COMPONENT	},
 	{ "mac-address",	NI_LLDP_CHASSIS_ID_MAC_ADDRESS		},
 	{ "net-address",	NI_LLDP_CHASSIS_ID_NETWORK_ADDRESS	},
+	{ "locally-assigned",	NI_LLDP_CHASSIS_ID_LOCALLY_ASSIGNED	},
 
 	{ NULL }
 };
@@ -362,6 +363,7 @@ static ni_intmap_t	__ni_objectmodel_port_id_kind[] = {
 	{ "mac-address",	NI_LLDP_PORT_ID_MAC_ADDRESS	},
 	{ "net-address",	NI_LLDP_PORT_ID_NETWORK_ADDRESS	},
 	{ "agent-circuit-id",	NI_LLDP_PORT_ID_AGENT_CIRCUIT_ID },
+	{ "locally-assigned",	NI_LLDP_PORT_ID_LOCALLY_ASSIGNED },
 
 	{ NULL }
 };
@@ -383,26 +385,17 @@ __ni_objectmodel_port_id_type_to_name(unsigned int type)
 }
 
 
+/*
+ * Encode the chassis-id of an LLDP config or neighbor as a struct
+ */
 static dbus_bool_t
-__ni_objectmodel_netif_get_chassis_id(const ni_dbus_object_t *object, const ni_dbus_property_t *property,
-		                                        ni_dbus_variant_t *strct, DBusError *error)
+__ni_objectmodel_lldp_get_chassis_id(const ni_lldp_t *lldp, ni_dbus_variant_t *strct)
 {
-	const ni_lldp_t *lldp;
 	const char *kind;
 	char default_kind[64];
 
-	if (!(lldp = __ni_objectmodel_lldp_read_handle(object, error)))
+	if (!(kind = __ni_objectmodel_chassis_id_type_to_name(lldp->chassis_id.type)))
 		return FALSE;
-
-	if (lldp->chassis_id.type == NI_LLDP_CHASSIS_ID_INVALID)
-		return ni_dbus_error_property_not_present(error, object->path, property->name);
-
-	kind = __ni_objectmodel_chassis_id_type_to_name(lldp->chassis_id.type);
-	if (kind == NULL) {
-		dbus_set_error(error, DBUS_ERROR_INVALID_ARGS,
-				"bad property %s; unsupported subtype %u", property->name, lldp->chassis_id.type);
-		return FALSE;
-	}
 	snprintf(default_kind, sizeof(default_kind), "default-%s", kind);
 
 	ni_dbus_variant_init_struct(strct);
@@ -412,6 +405,7 @@ __ni_objectmodel_netif_get_chassis_id(const ni_dbus_object_t *object, const ni_d
 	case NI_LLDP_CHASSIS_ID_INTERFACE_NAME:
 	case NI_LLDP_CHASSIS_ID_INTERFACE_ALIAS:
 	case NI_LLDP_CHASSIS_ID_PORT_COMPONENT:
+	case NI_LLDP_CHASSIS_ID_LOCALLY_ASSIGNED:
 		if (lldp->chassis_id.string_value) {
 			ni_dbus_struct_add_string(strct, kind);
 			ni_dbus_struct_add_string(strct, lldp->chassis_id.string_value);
@@ -439,7 +433,27 @@ __ni_objectmodel_netif_get_chassis_id(const ni_dbus_object_t *object, const ni_d
 		break;
 
 	default:
-		ni_error("LLDP chassis-id: unsupported subtype %u", lldp->chassis_id.type);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static dbus_bool_t
+__ni_objectmodel_netif_get_chassis_id(const ni_dbus_object_t *object, const ni_dbus_property_t *property,
+		                                        ni_dbus_variant_t *strct, DBusError *error)
+{
+	const ni_lldp_t *lldp;
+
+	if (!(lldp = __ni_objectmodel_lldp_read_handle(object, error)))
+		return FALSE;
+
+	if (lldp->chassis_id.type == NI_LLDP_CHASSIS_ID_INVALID)
+		return ni_dbus_error_property_not_present(error, object->path, property->name);
+
+	if (!__ni_objectmodel_lldp_get_chassis_id(lldp, strct)) {
+		dbus_set_error(error, DBUS_ERROR_INVALID_ARGS,
+				"bad property %s; unsupported subtype %u", property->name, lldp->chassis_id.type);
 		return FALSE;
 	}
 
@@ -484,6 +498,7 @@ __ni_objectmodel_netif_set_chassis_id(ni_dbus_object_t *object, const ni_dbus_pr
 	case NI_LLDP_CHASSIS_ID_INTERFACE_ALIAS:
 	case NI_LLDP_CHASSIS_ID_CHASSIS_COMPONENT:
 	case NI_LLDP_CHASSIS_ID_PORT_COMPONENT:
+	case NI_LLDP_CHASSIS_ID_LOCALLY_ASSIGNED:
 		if (!try_set_string(member, &lldp->chassis_id.string_value))
 			return FALSE;
 		break;
@@ -506,26 +521,17 @@ __ni_objectmodel_netif_set_chassis_id(ni_dbus_object_t *object, const ni_dbus_pr
 	return TRUE;
 }
 
+/*
+ * Encode the port-id of an LLDP config or neighbor as a struct
+ */
 static dbus_bool_t
-__ni_objectmodel_netif_get_port_id(const ni_dbus_object_t *object, const ni_dbus_property_t *property,
-		                                        ni_dbus_variant_t *strct, DBusError *error)
+__ni_objectmodel_lldp_get_port_id(const ni_lldp_t *lldp, ni_dbus_variant_t *strct)
 {
-	const ni_lldp_t *lldp;
 	const char *kind;
 	char default_kind[64];
 
-	if (!(lldp = __ni_objectmodel_lldp_read_handle(object, error)))
-		return FALSE;
-
-	if (lldp->port_id.type == NI_LLDP_PORT_ID_INVALID)
-		return ni_dbus_error_property_not_present(error, object->path, property->name);
-
-	kind = __ni_objectmodel_port_id_type_to_name(lldp->port_id.type);
-	if (kind == NULL) {
-		dbus_set_error(error, DBUS_ERROR_INVALID_ARGS,
-				"bad property %s; unsupported subtype %u", property->name, lldp->port_id.type);
+	if (!(kind = __ni_objectmodel_port_id_type_to_name(lldp->port_id.type)))
 		return FALSE;
-	}
 	snprintf(default_kind, sizeof(default_kind), "default-%s", kind);
 
 	ni_dbus_variant_init_struct(strct);
@@ -535,9 +541,10 @@ __ni_objectmodel_netif_get_port_id(const ni_dbus_object_t *object, const ni_dbus
 	case NI_LLDP_PORT_ID_INTERFACE_NAME:
 	case NI_LLDP_PORT_ID_INTERFACE_ALIAS:
 	case NI_LLDP_PORT_ID_AGENT_CIRCUIT_ID:
-		if (lldp->chassis_id.string_value) {
+	case NI_LLDP_PORT_ID_LOCALLY_ASSIGNED:
+		if (lldp->port_id.string_value) {
 			ni_dbus_struct_add_string(strct, kind);
-			ni_dbus_struct_add_string(strct, lldp->chassis_id.string_value);
+			ni_dbus_struct_add_string(strct, lldp->port_id.string_value);
 		} else {
 			ni_dbus_struct_add_string(strct, default_kind);
 		}
@@ -562,7 +569,27 @@ __ni_objectmodel_netif_get_port_id(const ni_dbus_object_t *object, const ni_dbus
 		break;
 
 	default:
-		ni_error("LLDP port-id: unsupported subtype %u", lldp->port_id.type);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static dbus_bool_t
+__ni_objectmodel_netif_get_port_id(const ni_dbus_object_t *object, const ni_dbus_property_t *property,
+		                                        ni_dbus_variant_t *strct, DBusError *error)
+{
+	const ni_lldp_t *lldp;
+
+	if (!(lldp = __ni_objectmodel_lldp_read_handle(object, error)))
+		return FALSE;
+
+	if (lldp->port_id.type == NI_LLDP_PORT_ID_INVALID)
+		return ni_dbus_error_property_not_present(error, object->path, property->name);
+
+	if (!__ni_objectmodel_lldp_get_port_id(lldp, strct)) {
+		dbus_set_error(error, DBUS_ERROR_INVALID_ARGS,
+				"bad property %s; unsupported subtype %u", property->name, lldp->port_id.type);
 		return FALSE;
 	}
 
@@ -603,6 +630,8 @@ __ni_objectmodel_netif_set_port_id(ni_dbus_object_t *object, const ni_dbus_prope
 	case NI_LLDP_PORT_ID_INTERFACE_NAME:
 	case NI_LLDP_PORT_ID_INTERFACE_ALIAS:
 	case NI_LLDP_PORT_ID_PORT_COMPONENT:
+	case NI_LLDP_PORT_ID_AGENT_CIRCUIT_ID:
+	case NI_LLDP_PORT_ID_LOCALLY_ASSIGNED:
 		if (!try_set_string(member, &lldp->port_id.string_value))
 			return FALSE;
 		break;
@@ -625,6 +654,136 @@ __ni_objectmodel_netif_set_port_id(ni_dbus_object_t *object, const ni_dbus_prope
 	return TRUE;
 }
 
+/*
+ * Encode an LLDP neighbor as a dict. The chassis and port id are always
+ * present; of the other data, only the fields set in the changes mask.
+ */
+static dbus_bool_t
+__ni_objectmodel_lldp_neighbor_to_dict(const ni_lldp_t *lldp, unsigned int changes, ni_dbus_variant_t *dict)
+{
+	const ni_lldp_ieee_802_1_t *ieee;
+	ni_dbus_variant_t *var;
+
+	var = ni_dbus_dict_add(dict, "chassis-id");
+	if (!__ni_objectmodel_lldp_get_chassis_id(lldp, var))
+		return FALSE;
+
+	var = ni_dbus_dict_add(dict, "port-id");
+	if (!__ni_objectmodel_lldp_get_port_id(lldp, var))
+		return FALSE;
+
+	if (changes & NI_LLDP_NEIGHBOR_TTL)
+		ni_dbus_dict_add_uint32(dict, "ttl", lldp->ttl);
+
+	/* An empty string or dict tells that a changed field was removed */
+	if (changes & NI_LLDP_NEIGHBOR_PORT_DESC)
+		ni_dbus_dict_add_string(dict, "port-description",
+				lldp->port_description ? lldp->port_description : "");
+
+	if (changes & NI_LLDP_NEIGHBOR_SYSTEM) {
+		var = ni_dbus_dict_add(dict, "system");
+		ni_dbus_variant_init_dict(var);
+		if (lldp->system.name)
+			ni_dbus_dict_add_string(var, "name", lldp->system.name);
+		if (lldp->system.description)
+			ni_dbus_dict_add_string(var, "descr", lldp->system.description);
+		ni_dbus_dict_add_uint32(var, "capabilities", lldp->system.capabilities);
+	}
+
+	if (changes & NI_LLDP_NEIGHBOR_IEEE_802_1) {
+		var = ni_dbus_dict_add(dict, "ieee-802-1");
+		ni_dbus_variant_init_dict(var);
+		if ((ieee = lldp->ieee_802_1) != NULL) {
+			ni_dbus_dict_add_uint16(var, "pvid", ieee->pvid);
+			ni_dbus_dict_add_uint16(var, "ppvid", ieee->ppvid);
+			ni_dbus_dict_add_uint32(var, "ppvlan-flags", ieee->ppvlan_flags);
+			if (ieee->vlan_name)
+				ni_dbus_dict_add_string(var, "vlan-name", ieee->vlan_name);
+			ni_dbus_dict_add_uint16(var, "mgmt-vid", ieee->mgmt_vid);
+		}
+	}
+
+	return TRUE;
+}
+
+static void
+__ni_objectmodel_lldp_neighbor_add(const ni_lldp_t *lldp, unsigned int expires, void *user_data)
+{
+	ni_dbus_variant_t *dict;
+
+	if (!(dict = ni_dbus_dict_array_add(user_data)))
+		return;
+
+	__ni_objectmodel_lldp_neighbor_to_dict(lldp, NI_LLDP_NEIGHBOR_ALL, dict);
+	ni_dbus_dict_add_uint32(dict, "expires", expires);
+}
+
+/*
+ * LLDP.lldpNeighbors
+ */
+static dbus_bool_t
+ni_objectmodel_lldp_neighbors(ni_dbus_object_t *object, const ni_dbus_method_t *method,
+			unsigned int argc, const ni_dbus_variant_t *argv,
+			ni_dbus_message_t *reply, DBusError *error)
+{
+	ni_dbus_variant_t result = NI_DBUS_VARIANT_INIT;
+	ni_netdev_t *dev;
+	dbus_bool_t rv;
+
+	if (!(dev = ni_objectmodel_unwrap_netif(object, error)))
+		return FALSE;
+
+	ni_dbus_dict_array_init(&result);
+	ni_system_lldp_neighbors(dev, __ni_objectmodel_lldp_neighbor_add, &result);
+
+	rv = ni_dbus_message_serialize_variants(reply, 1, &result, error);
+	ni_dbus_variant_destroy(&result);
+	return rv;
+}
+
+/*
+ * Signal a change in the LLDP neighbors of a device
+ */
+static ni_intmap_t	__ni_objectmodel_lldp_neighbor_signals[] = {
+	{ "lldpNeighborAdded",		NI_LLDP_NEIGHBOR_ADDED		},
+	{ "lldpNeighborChanged",	NI_LLDP_NEIGHBOR_CHANGED	},
+	{ "lldpNeighborRemoved",	NI_LLDP_NEIGHBOR_REMOVED	},
+
+	{ NULL }
+};
+
+dbus_bool_t
+ni_objectmodel_send_lldp_neighbor_event(ni_dbus_server_t *server, ni_dbus_object_t *object,
+			ni_lldp_neighbor_event_t event, const ni_lldp_t *lldp, unsigned int changes)
+{
+	ni_dbus_variant_t arg = NI_DBUS_VARIANT_INIT;
+	const char *signal_name;
+
+	if (!(signal_name = ni_format_uint_mapped(event, __ni_objectmodel_lldp_neighbor_signals)))
+		return FALSE;
+
+	if (!server && !(server = ni_dbus_object_get_server(object))) {
+		ni_error("%s: no dbus server handle, cannot send signal", __func__);
+		return FALSE;
+	}
+
+	/* a removed neighbor is identified by its chassis and port id only */
+	if (event == NI_LLDP_NEIGHBOR_REMOVED)
+		changes = 0;
+
+	ni_dbus_variant_init_dict(&arg);
+	if (!__ni_objectmodel_lldp_neighbor_to_dict(lldp, changes, &arg)) {
+		ni_dbus_variant_destroy(&arg);
+		return FALSE;
+	}
+
+	ni_debug_dbus("sending LLDP event \"%s\" for %s", signal_name, ni_dbus_object_get_path(object));
+	ni_dbus_server_send_signal(server, object, NI_OBJECTMODEL_LLDP_INTERFACE, signal_name, 1, &arg);
+
+	ni_dbus_variant_destroy(&arg);
+	return TRUE;
+}
+
 #define LLDP_STRING_PROPERTY(dbus_type, type, rw) \
 	NI_DBUS_GENERIC_STRING_PROPERTY(lldp, dbus_type, type, rw)
 #define LLDP_UINT_PROPERTY(dbus_type, type, rw) \
@@ -656,6 +815,7 @@ const ni_dbus_property_t	ni_objectmodel_lldp_property_table[] = {
 static ni_dbus_method_t		ni_objectmodel_lldp_methods[] = {
 	{ "lldpUp",	"a{sv}",	ni_objectmodel_lldp_up },
 	{ "lldpDown",	"",		ni_objectmodel_lldp_down },
+	{ "lldpNeighbors", "",		ni_objectmodel_lldp_neighbors },
 
 	{ NULL }
 };
@@ -27,6 +27,7 @@
 #include <wicked/bridge.h>
 
 #include "client/ifconfig.h"
+#include "client/status_snapshot.h"
 #include "appconfig.h"
 #include "util_priv.h"
 
@@ -38,6 +39,7 @@ static ni_ifworker_t *		__ni_ifworker_identify_device(ni_fsm_t *, const char *,
 static void			ni_ifworker_set_dependencies_xml(ni_ifworker_t *, xml_node_t *);
 static int			ni_fsm_schedule_init(ni_fsm_t *fsm, ni_ifworker_t *, unsigned int, unsigned int);
 static int			ni_fsm_schedule_bind_methods(ni_fsm_t *, ni_ifworker_t *);
+static void			ni_fsm_schedule_changed_only(ni_ifworker_t *);
 static ni_fsm_require_t *	ni_ifworker_netif_resolver_new(xml_node_t *);
 static ni_fsm_require_t *	ni_ifworker_modem_resolver_new(xml_node_t *);
 static void			ni_fsm_require_list_destroy(ni_fsm_require_t **);
@@ -208,6 +210,7 @@ ni_ifworker_reset(ni_ifworker_t *w)
 
 	/* Clear config and stats*/
 	ni_client_state_config_init(&w->config.meta);
+	ni_string_array_destroy(&w->config.changed);
 
 	__ni_ifworker_reset_fsm(w);
 	memset(&w->device_api, 0, sizeof(w->device_api));
@@ -1380,20 +1383,25 @@ ni_ifworker_update_client_state_control(ni_ifworker_t *w)
 	}
 }
 
+static inline ni_bool_t
+ni_ifworker_empty_config(ni_ifworker_t *w)
+{
+	ni_assert(w);
+	return ni_string_empty(w->config.meta.origin);
+}
+
 static inline void
 ni_ifworker_update_client_state_config(ni_ifworker_t *w)
 {
 	if (w && w->object && !w->readonly) {
 		ni_call_set_client_state_config(w->object, &w->config.meta);
 		ni_client_state_config_debug(w->name, &w->config.meta, "update");
-	}
-}
 
-static inline ni_bool_t
-ni_ifworker_empty_config(ni_ifworker_t *w)
-{
-	ni_assert(w);
-	return ni_string_empty(w->config.meta.origin);
+		/* Keep the applied config to diff against on ifreload */
+		ni_client_state_config_save_node(
+			ni_ifworker_empty_config(w) ? NULL : w->config.node,
+			w->device ? w->device->link.ifindex : w->ifindex);
+	}
 }
 
 static void
@@ -3192,6 +3200,68 @@ ni_fsm_refresh_state(ni_fsm_t *fsm)
 	return TRUE;
 }
 
+/*
+ * Refresh a read-only fsm from the status snapshot published by wickedd
+ * instead of fetching all objects via D-Bus. The workers have no object
+ * and can be used to query the status only.
+ */
+ni_bool_t
+ni_fsm_refresh_state_snapshot(ni_fsm_t *fsm)
+{
+	ni_netdev_t *devs = NULL, *dev;
+	ni_ifworker_t *w;
+	unsigned int i;
+
+	if (!fsm || !fsm->readonly)
+		return FALSE;
+
+	if (!ni_status_snapshot_load(&devs))
+		return FALSE;
+
+	for (i = 0; i < fsm->workers.count; ++i) {
+		w = fsm->workers.data[i];
+
+		w->object = NULL;
+		if (w->device) {
+			ni_netdev_put(w->device);
+			w->device = NULL;
+		}
+		w->readonly = TRUE;
+	}
+
+	while ((dev = devs)) {
+		devs = dev->next;
+		dev->next = NULL;
+
+		w = ni_fsm_ifworker_by_name(fsm, NI_IFWORKER_TYPE_NETDEV, dev->name);
+		if (!w)
+			w = ni_fsm_ifworker_by_ifindex(fsm, dev->link.ifindex);
+		if (!w) {
+			w = ni_ifworker_new(fsm, NI_IFWORKER_TYPE_NETDEV, dev->name);
+			w->readonly = TRUE;
+			if (dev->client_state)
+				ni_ifworker_refresh_client_state(w, dev->client_state);
+		}
+
+		if (w->device)
+			ni_netdev_put(w->device);
+		w->device = dev;
+		if (!ni_string_eq(w->name, dev->name))
+			ni_string_dup(&w->name, dev->name);
+		w->ifindex = dev->link.ifindex;
+	}
+
+	for (i = 0; i < fsm->workers.count; ++i) {
+		w = fsm->workers.data[i];
+
+		ni_fsm_refresh_master_dev(fsm, w);
+		ni_fsm_refresh_lower_dev(fsm, w);
+	}
+	ni_debug_application("refreshed %u workers from status snapshot",
+			fsm->workers.count);
+	return TRUE;
+}
+
 static ni_bool_t
 __ni_ifworker_refresh_netdevs(ni_fsm_t *fsm)
 {
@@ -4200,11 +4270,57 @@ do_it_again:
 	if ((rv = ni_fsm_schedule_bind_methods(fsm, w)) < 0)
 		return rv;
 
+	if (w->config.changed.count && increment > 0)
+		ni_fsm_schedule_changed_only(w);
+
 	/* FIXME: Add <require> targets from the interface document */
 
 	return 0;
 }
 
+/*
+ * Reduce the bound up transitions of a device, which is up already, to
+ * the calls applying the changed config nodes (e.g. on ifreload), and
+ * update the client state config here, as the device setup is skipped.
+ */
+static void
+ni_fsm_schedule_changed_only(ni_ifworker_t *w)
+{
+	ni_fsm_transition_t *action, *keep;
+	unsigned int i, calls;
+
+	keep = w->fsm.action_table;
+	for (action = w->fsm.action_table; action->call_func; ++action) {
+		for (calls = i = 0; i < action->num_bindings; ++i) {
+			struct ni_fsm_transition_binding *bind = &action->binding[i];
+
+			if (!bind->method || bind->skip_call)
+				continue;
+			if (bind->config && ni_string_array_index(&w->config.changed,
+						bind->config->name) >= 0)
+				calls++;
+			else
+				bind->skip_call = TRUE;
+		}
+
+		if (calls) {
+			ni_debug_application("%s: %s() applies changed config",
+					w->name, action->common.method_name);
+			*keep++ = *action;
+		} else {
+			ni_fsm_require_list_destroy(&action->require.list);
+		}
+	}
+	memset(keep, 0, (action - keep) * sizeof(*keep));
+
+	w->fsm.next_action = w->fsm.action_table;
+	if (w->fsm.action_table->call_func)
+		w->fsm.state = w->fsm.action_table->from_state;
+
+	ni_ifworker_update_client_state_control(w);
+	ni_ifworker_update_client_state_config(w);
+}
+
 /*
  * After we have mapped out the transitions the ifworker needs to go through, we
  * need to bind each of them to a dbus call.
@@ -73,9 +73,9 @@
 #include "sysfs.h"
 #include "kernel.h"
 #include "appconfig.h"
-#include "process.h"
 #include "debug.h"
 #include "modprobe.h"
+#include "client/status_snapshot.h"
 
 #ifndef SIT_TUNNEL_MODULE_NAME
 #define SIT_TUNNEL_MODULE_NAME "sit"
@@ -105,6 +105,7 @@ static int	__ni_netdev_update_routes(ni_netconfig_t *nc, ni_netdev_t *dev,
 static int	__ni_netdev_update_mtu(ni_netconfig_t *nc, ni_netdev_t *dev,
 				const ni_addrconf_lease_t *old_lease,
 				ni_addrconf_lease_t       *new_lease);
+static ni_address_t *	__ni_netdev_address_in_list(ni_address_t *, const ni_address_t *);
 
 static int	__ni_rtnl_link_create(const ni_netdev_t *cfg);
 static int	__ni_rtnl_link_change(ni_netdev_t *dev, const ni_netdev_t *cfg);
@@ -311,6 +312,56 @@ ni_system_interface_link_monitor(ni_netdev_t *dev)
 /*
  * system interface lease updater actions
  */
+#define NI_ADDRCONF_UPDATER_VERIFY_TIMEOUT	12500	/* msec */
+
+/* IPv4 duplicate address detection, as "wicked arp" did it */
+#define NI_ADDRCONF_ARP_PROBE_COUNT		3
+#define NI_ADDRCONF_ARP_PROBE_WAIT		200	/* msec */
+#define NI_ADDRCONF_ARP_ANNOUNCE_COUNT		1
+
+typedef struct ni_addrconf_action ni_addrconf_action_t;
+typedef struct ni_addrconf_dad	ni_addrconf_dad_t;
+
+struct ni_addrconf_action {
+	int		(*func)(ni_netdev_t *dev, ni_addrconf_lease_t *lease);
+	const char *	info;
+};
+
+struct ni_addrconf_updater {
+	const ni_addrconf_action_t *actions;
+	const ni_addrconf_action_t *action;
+
+	unsigned int		ifindex;
+	ni_bool_t		background;	/* yield between stages	*/
+	ni_bool_t		waiting;	/* for address events	*/
+	const ni_timer_t *	timer;		/* resume timer		*/
+	struct timeval		deadline;
+
+	struct timeval		started;	/* current stage start	*/
+	unsigned long		elapsed[NI_ADDRCONF_UPDATER_STAGES_MAX]; /* usec */
+
+	ni_addrconf_updater_notify_t *notify;	/* on completion	*/
+	ni_event_t		event;
+	ni_uuid_t		uuid;
+
+	struct {
+		ni_bool_t		started;
+		ni_addrconf_dad_t *	list;	/* addresses in probing	*/
+	} dad;
+};
+
+struct ni_addrconf_dad {
+	ni_addrconf_dad_t *	next;
+	ni_addrconf_lease_t *	lease;
+	ni_address_t *		ap;
+	ni_arp_subscription_t *	arp;
+	ni_bool_t		done;
+};
+
+static unsigned long	ni_addrconf_updater_remaining(const ni_addrconf_updater_t *);
+static ni_bool_t	ni_addrconf_updater_arm(ni_addrconf_lease_t *, unsigned long);
+static void		ni_addrconf_updater_background(ni_netdev_t *, ni_addrconf_lease_t *);
+
 static int
 __ni_addrconf_action_mtu_apply(ni_netdev_t *dev, ni_addrconf_lease_t *lease)
 {
@@ -325,12 +376,224 @@ __ni_addrconf_action_mtu_apply(ni_netdev_t *dev, ni_addrconf_lease_t *lease)
 
 }
 
+/*
+ * Whether we can probe for and announce IPv4 addresses via ARP.
+ * In case the client is configured to ignore link-up and sets
+ * IPs already at device-up [without waiting for link detection],
+ * we cannot detect duplicate IPs or anounce them.
+ */
+static ni_bool_t
+__ni_netdev_arp_usable(const ni_netdev_t *dev)
+{
+	if (dev->link.hwaddr.type != ARPHRD_ETHER)
+		return FALSE;
+
+	if (!ni_netdev_link_is_up(dev))
+		return FALSE;
+
+	if (dev->link.ifflags & NI_IFF_POINT_TO_POINT)
+		return FALSE;
+
+	if (!(dev->link.ifflags & (NI_IFF_ARP_ENABLED|NI_IFF_BROADCAST_ENABLED)))
+		return FALSE;
+
+	return TRUE;
+}
+
+/*
+ * A reply from another interface of this host connected to the
+ * same broadcast domain is a false alarm, except the interface
+ * really has the address assigned.
+ */
+static ni_bool_t
+__ni_netdev_arp_conflict_is_local(const ni_netdev_t *dev, const ni_arp_packet_t *pkt)
+{
+	ni_netconfig_t *nc = ni_global_state_handle(0);
+	ni_bool_t false_alarm = FALSE;
+	const ni_netdev_t *ifp;
+	const ni_address_t *ap;
+
+	for (ifp = ni_netconfig_devlist(nc); ifp; ifp = ifp->next) {
+		if (ifp->link.ifindex == dev->link.ifindex)
+			continue;
+
+		if (!ni_netdev_link_is_up(ifp))
+			continue;
+
+		if (!ni_link_address_equal(&ifp->link.hwaddr, &pkt->sha))
+			continue;
+
+		false_alarm = TRUE;
+		for (ap = ifp->addrs; ap; ap = ap->next) {
+			if (ap->family == AF_INET &&
+			    ap->local_addr.sin.sin_addr.s_addr == pkt->sip.s_addr)
+				return FALSE;
+		}
+	}
+	return false_alarm;
+}
+
+static ni_bool_t
+ni_addrconf_updater_dad_pending(const ni_addrconf_updater_t *updater)
+{
+	const ni_addrconf_dad_t *dad;
+
+	for (dad = updater->dad.list; dad; dad = dad->next) {
+		if (!dad->done)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static void
+ni_addrconf_updater_dad_done(ni_addrconf_dad_t *dad)
+{
+	/* all addresses have a result, continue to apply them */
+	dad->done = TRUE;
+	if (!ni_addrconf_updater_dad_pending(dad->lease->updater))
+		ni_addrconf_updater_arm(dad->lease, 0);
+}
+
+static void
+ni_addrconf_updater_dad_stop(ni_addrconf_updater_t *updater)
+{
+	ni_addrconf_dad_t *dad;
+
+	while ((dad = updater->dad.list)) {
+		updater->dad.list = dad->next;
+		ni_arp_unsubscribe(dad->arp);
+		free(dad);
+	}
+}
+
+static void
+ni_addrconf_updater_dad_event(ni_arp_subscription_t *sub, ni_arp_event_t event,
+				const ni_arp_packet_t *pkt, void *user_data)
+{
+	ni_netconfig_t *nc = ni_global_state_handle(0);
+	ni_addrconf_dad_t *dad = user_data;
+	ni_address_t *ap = dad->ap;
+	ni_netdev_t *dev;
+
+	if (dad->done)
+		return;
+
+	dev = ni_netdev_by_index(nc, dad->lease->updater->ifindex);
+	switch (event) {
+	case NI_ARP_EVENT_VERIFIED:
+		ni_info("%s: successfully verified address '%s'",
+				dev ? dev->name : "?", ni_sockaddr_print(&ap->local_addr));
+		ni_address_set_tentative(ap, FALSE);
+		ni_addrconf_updater_dad_done(dad);
+		break;
+
+	case NI_ARP_EVENT_CONFLICT:
+		if (dev && __ni_netdev_arp_conflict_is_local(dev, pkt))
+			break;
+
+		ni_warn("%s: address '%s' is already in use by %s",
+				dev ? dev->name : "?", ni_sockaddr_print(&ap->local_addr),
+				ni_link_address_print(&pkt->sha));
+		ni_address_set_duplicate(ap, TRUE);
+		ni_arp_unsubscribe(dad->arp);
+		dad->arp = NULL;
+		ni_addrconf_updater_dad_done(dad);
+		break;
+
+	default:
+		break;
+	}
+}
+
+/*
+ * RFC 5227 duplicate detection of the new IPv4 addresses of a lease.
+ * The probes for all addresses on the link are sent in the same rounds
+ * by the arp engine, so it takes about one probe window for any number
+ * of them. The result is in the address flags: verified addresses are
+ * not tentative any more, conflicting ones are duplicate and skipped.
+ */
+static int
+__ni_addrconf_action_addrs_dad(ni_netdev_t *dev, ni_addrconf_lease_t *lease)
+{
+	ni_addrconf_updater_t *updater = lease->updater;
+	ni_capture_devinfo_t devinfo;
+	ni_ipv4_devinfo_t *ipv4;
+	ni_addrconf_dad_t *dad;
+	ni_bool_t verify;
+	unsigned int count = 0;
+	ni_address_t *ap;
+
+	if (updater->dad.started) {
+		if (!ni_addrconf_updater_dad_pending(updater))
+			return 0;
+		if (updater->background)
+			return 1;
+
+		/* the lease gets replaced, skip the addresses in probing */
+		ni_addrconf_updater_dad_stop(updater);
+		return 0;
+	}
+	updater->dad.started = TRUE;
+
+	/* replaced before probing: skip the tentative addresses, too */
+	if (!updater->background)
+		return 0;
+
+	ipv4 = ni_netdev_get_ipv4(dev);
+	verify = (!ipv4 || ni_tristate_is_enabled(ipv4->conf.arp_verify)) &&
+		__ni_netdev_arp_usable(dev);
+	if (verify && ni_capture_devinfo_init(&devinfo, dev->name, &dev->link) < 0)
+		verify = FALSE;
+
+	for (ap = lease->addrs; ap; ap = ap->next) {
+		if (ap->family != AF_INET || !ni_address_is_tentative(ap))
+			continue;
+		if (ni_address_is_duplicate(ap))
+			continue;
+		if (__ni_netdev_address_in_list(dev->addrs, ap))
+			continue;
+
+		dad = verify ? xcalloc(1, sizeof(*dad)) : NULL;
+		if (dad && (dad->arp = ni_arp_subscribe(&devinfo, ap->local_addr.sin.sin_addr,
+						ni_addrconf_updater_dad_event, dad))) {
+			dad->lease = lease;
+			dad->ap = ap;
+			dad->next = updater->dad.list;
+			updater->dad.list = dad;
+
+			ni_arp_probe(dad->arp, NI_ADDRCONF_ARP_PROBE_COUNT,
+					NI_ADDRCONF_ARP_PROBE_WAIT, NI_ADDRCONF_ARP_PROBE_WAIT);
+			count++;
+		} else {
+			free(dad);
+			ni_address_set_tentative(ap, FALSE);
+		}
+	}
+	if (verify)
+		ni_string_free(&devinfo.ifname);
+
+	if (!count)
+		return 0;
+
+	ni_debug_ifconfig("%s: verifying %u new %s:%s lease address%s", dev->name, count,
+			ni_addrfamily_type_to_name(lease->family),
+			ni_addrconf_type_to_name(lease->type),
+			count == 1 ? "" : "es");
+	return 1;
+}
+
 static int
 __ni_addrconf_action_addrs_apply(ni_netdev_t *dev, ni_addrconf_lease_t *lease)
 {
 	int res;
 
-	if ((res = __ni_netdev_update_addrs(dev, lease->old, lease)) < 0)
+	if ((res = __ni_addrconf_action_addrs_dad(dev, lease)) != 0)
+		return res;
+
+	/* the probing subscriptions keep the arp engine for the announcements */
+	res = __ni_netdev_update_addrs(dev, lease->old, lease);
+	ni_addrconf_updater_dad_stop(lease->updater);
+	if (res < 0)
 		return res;
 
 	return 0;
@@ -396,35 +659,57 @@ static int
 __ni_addrconf_action_addrs_verify(ni_netdev_t *dev, ni_addrconf_lease_t *lease)
 {
 	ni_netconfig_t *nc = ni_global_state_handle(0);
-	unsigned int loops = 50;
+	ni_addrconf_updater_t *updater = lease->updater;
+	unsigned long timeout;
 	int res;
 
 	/*
-	 * TODO: instead to loop here, return 1 to go into background
-	 *       and continue to apply when address update event with
-	 *       the final tentative/dadfailed flags arrived.
+	 * Instead to wait here, we return 1 to go into background and
+	 * continue to apply when an address update event with the final
+	 * tentative/dadfailed flags arrived or the verify timeout hit.
+	 * In the events, the addresses are up to date already.
 	 */
-	do {
+	if (!updater->waiting || !updater->timer) {
 		if ((res = __ni_system_refresh_interface_addrs(nc, dev)) < 0)
 			return res;
+	}
 
-		if ((res = __ni_addrconf_action_addrs_verify_check(dev, lease)) <= 0)
-			return res;
+	if ((res = __ni_addrconf_action_addrs_verify_check(dev, lease)) <= 0)
+		return res;
 
-		/* In case the client is configured to ignore link-up
-		 * and sets IPs already at device-up [without waiting
-		 * for link detection], we detect dadfailed above, but
-		 * do not wait util the kernel verified the addresses:
-		 * kernel will not even set link local or start dad
-		 * without link-up [detected carrier / lower UP] ...
-		 */
-		if (!ni_netdev_link_is_up(dev))
-			break;
+	/* In case the client is configured to ignore link-up
+	 * and sets IPs already at device-up [without waiting
+	 * for link detection], we detect dadfailed above, but
+	 * do not wait util the kernel verified the addresses:
+	 * kernel will not even set link local or start dad
+	 * without link-up [detected carrier / lower UP] ...
+	 */
+	if (!ni_netdev_link_is_up(dev))
+		return 0;
 
-		usleep(250000);
-	} while (res && loops-- > 0);
+	if (!updater->waiting) {
+		updater->waiting = TRUE;
+		timeout = NI_ADDRCONF_UPDATER_VERIFY_TIMEOUT;
+		ni_timer_get_time(&updater->deadline);
+		updater->deadline.tv_sec  += timeout / 1000;
+		updater->deadline.tv_usec += (timeout % 1000) * 1000;
+		if (updater->deadline.tv_usec >= 1000000) {
+			updater->deadline.tv_sec++;
+			updater->deadline.tv_usec -= 1000000;
+		}
+	} else
+	if (!(timeout = ni_addrconf_updater_remaining(updater))) {
+		ni_debug_verbose(NI_LOG_DEBUG, NI_TRACE_IFCONFIG,
+			"%s: lease %s:%s addresses still tentative, continuing",
+				dev->name,
+				ni_addrfamily_type_to_name(lease->family),
+				ni_addrconf_type_to_name(lease->type));
+		return 0;
+	}
 
-	return 0;
+	if (!ni_addrconf_updater_arm(lease, timeout))
+		return -1;
+	return 1;
 }
 
 static int
@@ -500,19 +785,6 @@ __ni_addrconf_action_mtu_restore(ni_netdev_t *dev, ni_addrconf_lease_t *lease)
 
 }
 
-typedef struct ni_addrconf_action ni_addrconf_action_t;
-
-struct ni_addrconf_action {
-	int		(*func)(ni_netdev_t *dev, ni_addrconf_lease_t *lease);
-	const char *	info;
-};
-
-struct ni_addrconf_updater {
-	/* do we need some data here ? */
-	const ni_addrconf_action_t *action;
-};
-
-
 static const ni_addrconf_action_t	__applying_actions[] = {
 	{ __ni_addrconf_action_mtu_apply,	"adjusting mtu"		},
 	{ __ni_addrconf_action_addrs_apply,	"applying addresses"	},
@@ -531,12 +803,14 @@ static const ni_addrconf_action_t	__removing_actions[] = {
 };
 
 static ni_addrconf_updater_t *
-ni_addrconf_updater_new(const ni_addrconf_action_t *action)
+ni_addrconf_updater_new(const ni_addrconf_action_t *action, const ni_netdev_t *dev)
 {
 	ni_addrconf_updater_t *updater;
 
 	updater = xcalloc(1, sizeof(*updater));
+	updater->actions = action;
 	updater->action = action;
+	updater->ifindex = dev->link.ifindex;
 	return updater;
 }
 
@@ -544,11 +818,146 @@ void
 ni_addrconf_updater_free(ni_addrconf_updater_t **updater)
 {
 	if (updater && *updater) {
+		if ((*updater)->timer)
+			ni_timer_cancel((*updater)->timer);
+		ni_addrconf_updater_dad_stop(*updater);
 		free(*updater);
 		*updater = NULL;
 	}
 }
 
+ni_bool_t
+ni_addrconf_updater_set_notify(ni_addrconf_lease_t *lease, ni_addrconf_updater_notify_t *notify,
+				ni_event_t event, const ni_uuid_t *uuid)
+{
+	ni_addrconf_updater_t *updater;
+
+	if (!lease || !(updater = lease->updater))
+		return FALSE;
+
+	updater->notify = notify;
+	updater->event = event;
+	if (uuid)
+		updater->uuid = *uuid;
+	else
+		memset(&updater->uuid, 0, sizeof(updater->uuid));
+	return TRUE;
+}
+
+static unsigned long
+ni_addrconf_updater_remaining(const ni_addrconf_updater_t *updater)
+{
+	struct timeval now, delta;
+
+	ni_timer_get_time(&now);
+	if (!timercmp(&now, &updater->deadline, <))
+		return 0;
+
+	timersub(&updater->deadline, &now, &delta);
+	return delta.tv_sec * 1000 + delta.tv_usec / 1000 + 1;
+}
+
+static void
+ni_addrconf_updater_timeout(void *user_data, const ni_timer_t *timer)
+{
+	ni_netconfig_t *nc = ni_global_state_handle(0);
+	ni_addrconf_lease_t *lease = user_data;
+	ni_addrconf_updater_t *updater;
+	ni_netdev_t *dev;
+
+	if (!lease || !(updater = lease->updater) || updater->timer != timer)
+		return;
+
+	updater->timer = NULL;
+	if (!(dev = ni_netdev_by_index(nc, updater->ifindex)) ||
+	    ni_netdev_get_lease(dev, lease->family, lease->type) != lease)
+		return;
+
+	ni_addrconf_updater_background(dev, lease);
+}
+
+static ni_bool_t
+ni_addrconf_updater_arm(ni_addrconf_lease_t *lease, unsigned long timeout)
+{
+	ni_addrconf_updater_t *updater = lease->updater;
+
+	if (updater->timer)
+		updater->timer = ni_timer_rearm(updater->timer, timeout);
+	if (!updater->timer)
+		updater->timer = ni_timer_register(timeout,
+				ni_addrconf_updater_timeout, lease);
+	return updater->timer != NULL;
+}
+
+/*
+ * Record the wall time of the finished stage and advance
+ */
+static void
+ni_addrconf_updater_advance(ni_addrconf_updater_t *updater)
+{
+	unsigned int stage = updater->action - updater->actions;
+	struct timeval now, delta;
+
+	if (stage < NI_ADDRCONF_UPDATER_STAGES_MAX && timerisset(&updater->started)) {
+		ni_timer_get_time(&now);
+		timersub(&now, &updater->started, &delta);
+		updater->elapsed[stage] = delta.tv_sec * 1000000 + delta.tv_usec;
+	}
+	timerclear(&updater->started);
+
+	if (updater->timer) {
+		ni_timer_cancel(updater->timer);
+		updater->timer = NULL;
+	}
+	updater->waiting = FALSE;
+	updater->action++;
+}
+
+static void
+ni_addrconf_updater_report(const ni_netdev_t *dev, ni_addrconf_lease_t *lease,
+				const ni_addrconf_updater_t *updater, int res)
+{
+	ni_stringbuf_t buf = NI_STRINGBUF_INIT_DYNAMIC;
+	ni_addrconf_update_timing_t *timing = &lease->timing;
+	const ni_addrconf_action_t *action;
+	unsigned long total = 0;
+	unsigned int stage;
+
+	/* keep the stage times of the last update in the lease */
+	memset(timing, 0, sizeof(*timing));
+	for (action = updater->actions; action < updater->action; ++action) {
+		stage = action - updater->actions;
+		if (stage >= NI_ADDRCONF_UPDATER_STAGES_MAX)
+			break;
+
+		timing->stage[stage].name = action->info;
+		timing->stage[stage].usec = updater->elapsed[stage];
+		timing->count = stage + 1;
+	}
+
+	if (!ni_debug_guard(NI_LOG_DEBUG, NI_TRACE_IFCONFIG))
+		return;
+
+	for (action = updater->actions; action < updater->action; ++action) {
+		stage = action - updater->actions;
+		if (stage >= NI_ADDRCONF_UPDATER_STAGES_MAX)
+			break;
+
+		total += updater->elapsed[stage];
+		ni_stringbuf_printf(&buf, "%s%s %lu.%03lums", buf.len ? ", " : "",
+				action->info ? action->info : "?",
+				updater->elapsed[stage] / 1000,
+				updater->elapsed[stage] % 1000);
+	}
+	ni_debug_ifconfig("%s: %s:%s lease update %s after %lu.%03lums [%s]",
+			dev->name,
+			ni_addrfamily_type_to_name(lease->family),
+			ni_addrconf_type_to_name(lease->type),
+			res < 0 ? "failed" : "done",
+			total / 1000, total % 1000, buf.string ? buf.string : "");
+	ni_stringbuf_destroy(&buf);
+}
+
 int
 ni_addrconf_updater_execute(ni_netdev_t *dev, ni_addrconf_lease_t *lease)
 {
@@ -559,32 +968,139 @@ ni_addrconf_updater_execute(ni_netdev_t *dev, ni_addrconf_lease_t *lease)
 		return 0;
 
 	while ((updater = lease->updater) != NULL) {
-		if (!updater->action || !updater->action->func) {
-			ni_addrconf_updater_free(&lease->updater);
+		if (!updater->action || !updater->action->func)
 			break;
-		}
+
 		/*
-		 * res > 1 could be used to defer into bg,
-		 * but currently we just wait for addrs
-		 * and use success/failure codes only.
+		 * res > 0 defers the action into background,
+		 * it is resumed by a timer or address event.
 		 */
+		if (!timerisset(&updater->started))
+			ni_timer_get_time(&updater->started);
 		res = updater->action->func(dev, lease);
 		if (updater->action->info) {
 			ni_debug_verbose(NI_LOG_DEBUG, NI_TRACE_IFCONFIG,
-					"%s: %s for %s:%s lease in state %s: %s [%u]",
+					"%s: %s for %s:%s lease in state %s: %s [%d]",
 					dev->name, updater->action->info,
 					ni_addrfamily_type_to_name(lease->family),
 					ni_addrconf_type_to_name(lease->type),
 					ni_addrconf_state_to_name(lease->state),
-					(res < 0 ? "failed" : "success"), res);
+					(res < 0 ? "failed" : res > 0 ? "deferred" :
+					 "success"), res);
 		}
 		if (res)
 			break;
-		updater->action++;
+
+		ni_addrconf_updater_advance(updater);
+
+		/*
+		 * Return to the main loop between the stages, so the
+		 * updates of other leases and devices can interleave.
+		 */
+		if (updater->background && updater->action->func &&
+		    ni_addrconf_updater_arm(lease, 0)) {
+			res = 1;
+			break;
+		}
+	}
+	return res;
+}
+
+/*
+ * Finish the lease apply when the updater is done
+ */
+static int
+ni_addrconf_updater_applied(ni_netdev_t *dev, ni_addrconf_lease_t *lease, int res)
+{
+	ni_addrconf_updater_t *updater = lease->updater;
+
+	ni_status_snapshot_invalidate();
+	lease->updater = NULL;
+	if (updater)
+		ni_addrconf_updater_report(dev, lease, updater, res);
+
+	/* we do not need the old lease any more */
+	if (lease->old) {
+		ni_addrconf_lease_free(lease->old);
+		lease->old = NULL;
+	}
+	if (res == 0 && lease->state == NI_ADDRCONF_STATE_APPLYING)
+		lease->state = NI_ADDRCONF_STATE_GRANTED;
+
+	if (res < 0) {
+		ni_error("%s: error updating interface config from %s:%s lease",
+				dev->name,
+				ni_addrfamily_type_to_name(lease->family),
+				ni_addrconf_type_to_name(lease->type));
 	}
+
+	if (updater && updater->notify)
+		updater->notify(dev, lease, res, updater->event, &updater->uuid);
+	ni_addrconf_updater_free(&updater);
 	return res;
 }
 
+/*
+ * Continue a deferred lease apply
+ */
+static void
+ni_addrconf_updater_background(ni_netdev_t *dev, ni_addrconf_lease_t *lease)
+{
+	int res;
+
+	if (!dev || !lease || !lease->updater)
+		return;
+
+	if ((res = ni_addrconf_updater_execute(dev, lease)) > 0)
+		return;
+
+	ni_addrconf_updater_applied(dev, lease, res);
+}
+
+/*
+ * Address events resume the leases waiting for address verification
+ */
+void
+ni_addrconf_updater_resume(ni_netdev_t *dev)
+{
+	ni_addrconf_lease_t *lease, *next;
+
+	if (!dev)
+		return;
+
+	for (lease = dev->leases; lease; lease = next) {
+		next = lease->next;
+		if (lease->updater && lease->updater->waiting)
+			ni_addrconf_updater_background(dev, lease);
+	}
+}
+
+/*
+ * Complete a deferred apply of a lease which gets replaced:
+ * no more waiting, its remaining actions are run right away.
+ */
+static void
+ni_addrconf_updater_flush(ni_netdev_t *dev, ni_addrconf_lease_t *lease)
+{
+	ni_addrconf_updater_t *updater;
+	int res;
+
+	if (!(updater = lease->updater) || !updater->action)
+		return;
+
+	ni_debug_ifconfig("%s: completing deferred %s:%s lease update",
+			dev->name,
+			ni_addrfamily_type_to_name(lease->family),
+			ni_addrconf_type_to_name(lease->type));
+
+	updater->background = FALSE;
+	if (updater->waiting)
+		ni_timer_get_time(&updater->deadline);
+	if ((res = ni_addrconf_updater_execute(dev, lease)) > 0)
+		res = -1;
+	ni_addrconf_updater_applied(dev, lease, res);
+}
+
 /*
  * An address configuration agent sends a lease update.
  */
@@ -594,6 +1110,7 @@ __ni_system_interface_update_lease(ni_netdev_t *dev, ni_addrconf_lease_t **lease
 	ni_addrconf_lease_t *lease = *lease_p;
 	int res;
 
+	ni_status_snapshot_invalidate();
 	ni_debug_ifconfig("%s: received %s:%s lease update in state %s",
 			dev->name,
 			ni_addrfamily_type_to_name(lease->family),
@@ -607,6 +1124,7 @@ __ni_system_interface_update_lease(ni_netdev_t *dev, ni_addrconf_lease_t **lease
 	 */
 	lease->old = __ni_netdev_find_lease(dev, lease->family, lease->type, 1);
 	if (lease->old) {
+		ni_addrconf_updater_flush(dev, lease->old);
 		ni_addrconf_updater_free(&lease->old->updater);
 	}
 	if (lease->state == NI_ADDRCONF_STATE_GRANTED) {
@@ -615,16 +1133,18 @@ __ni_system_interface_update_lease(ni_netdev_t *dev, ni_addrconf_lease_t **lease
 		ni_netdev_set_lease(dev, lease);
 		*lease_p = NULL;
 
-		lease->updater = ni_addrconf_updater_new(__applying_actions);
+		lease->updater = ni_addrconf_updater_new(__applying_actions, dev);
+		lease->updater->background = TRUE;
 		res = ni_addrconf_updater_execute(dev, lease);
-
-		/* we do not need the old lease any more */
-		if (lease->old) {
-			ni_addrconf_lease_free(lease->old);
-			lease->old = NULL;
+		if (res > 0) {
+			/* continued by address events or timer */
+			ni_debug_ifconfig("%s: deferred %s:%s lease update",
+					dev->name,
+					ni_addrfamily_type_to_name(lease->family),
+					ni_addrconf_type_to_name(lease->type));
+			return res;
 		}
-		if (res == 0 && lease->state == NI_ADDRCONF_STATE_APPLYING)
-			lease->state = NI_ADDRCONF_STATE_GRANTED;
+		return ni_addrconf_updater_applied(dev, lease, res);
 	} else
 	if (lease->state == NI_ADDRCONF_STATE_FAILED) {
 		/* lease drop on ifup failure */
@@ -636,7 +1156,7 @@ __ni_system_interface_update_lease(ni_netdev_t *dev, ni_addrconf_lease_t **lease
 		 * if not, we have nothing what we could revert.
 		 */
 		if (lease->old) {
-			lease->updater = ni_addrconf_updater_new(__removing_actions);
+			lease->updater = ni_addrconf_updater_new(__removing_actions, dev);
 			res = ni_addrconf_updater_execute(dev, lease);
 
 			/* we do not need the old lease any more */
@@ -648,7 +1168,7 @@ __ni_system_interface_update_lease(ni_netdev_t *dev, ni_addrconf_lease_t **lease
 	} else {
 		/* lease drop on ifdown */
 		if (lease->old) {
-			lease->updater = ni_addrconf_updater_new(__removing_actions);
+			lease->updater = ni_addrconf_updater_new(__removing_actions, dev);
 			ni_addrconf_updater_execute(dev, lease);
 		}
 		/*
@@ -657,7 +1177,7 @@ __ni_system_interface_update_lease(ni_netdev_t *dev, ni_addrconf_lease_t **lease
 		 */
 		res = 0;
 	}
-	/* we do not defer updater into background yet */
+	/* removals are not deferred into background */
 	ni_addrconf_updater_free(&lease->updater);
 
 	if (res < 0) {
@@ -3134,130 +3654,33 @@ __ni_netdev_addr_can_replace(ni_address_t *o, ni_address_t *n)
 	return TRUE;
 }
 
-/*
- * Update the addresses and routes assigned to an interface
- * for a given addrconf method
- */
-static ni_bool_t
-__ni_netdev_call_arp_util(ni_netdev_t *dev, ni_address_t *ap, ni_bool_t verify)
-{
-	ni_shellcmd_t *cmd;
-	ni_process_t *pi;
-	ni_bool_t rv;
-	int ret;
-
-	if (dev->link.hwaddr.type != ARPHRD_ETHER)
-		return TRUE;
-
-	/* In case the client is configured to ignore link-up
-	 * and sets IPs already at device-up [without waiting
-	 * for link detection], we cannot detect duplicate IPs
-	 * or anounce them.
-	 */
-	if (!ni_netdev_link_is_up(dev))
-		return TRUE;
-
-	if (dev->link.ifflags & NI_IFF_POINT_TO_POINT)
-		return TRUE;
-
-	if (!(dev->link.ifflags & (NI_IFF_ARP_ENABLED|NI_IFF_BROADCAST_ENABLED)))
-		return TRUE;
-
-	/*
-	 * This is a hack to validate it this way...
-	 */
-	cmd = ni_shellcmd_parse(WICKED_SBINDIR"/wicked");
-	if (!cmd) {
-		ni_warn("%s: cannot construct command to %s address '%s'",
-			dev->name, verify ? "verify address" : "notify about",
-			ni_sockaddr_print(&ap->local_addr));
-		return TRUE;
-	}
-	ni_shellcmd_add_arg(cmd, "arp");
-	if (verify) {
-		ni_shellcmd_add_arg(cmd, "--verify");
-		ni_shellcmd_add_arg(cmd, "3");
-		ni_shellcmd_add_arg(cmd, "--notify");
-		ni_shellcmd_add_arg(cmd, "0");
-	} else {
-		ni_shellcmd_add_arg(cmd, "--verify");
-		ni_shellcmd_add_arg(cmd, "0");
-		ni_shellcmd_add_arg(cmd, "--notify");
-		ni_shellcmd_add_arg(cmd, "1");
-	}
-	ni_shellcmd_add_arg(cmd, dev->name);
-	ni_shellcmd_add_arg(cmd, ni_sockaddr_print(&ap->local_addr));
-
-	ni_debug_verbose(NI_LOG_DEBUG2, NI_TRACE_IFCONFIG,
-			"%s: using new address %s cmd: %s",
-			dev->name, verify ? "verify" : "notify", cmd->command);
-
-	if ((pi = ni_process_new(cmd)) == NULL) {
-		ni_warn("%s: cannot prepare process to %s address '%s'",
-			dev->name, verify ? "verify" : "notify about",
-			ni_sockaddr_print(&ap->local_addr));
-		ni_shellcmd_release(cmd);
-		return TRUE;
-	}
-	ni_shellcmd_release(cmd);
-
-	rv  = FALSE;
-	ret = ni_process_run_and_wait(pi);
-	if (ret >= 0) {
-		if (ret == NI_WICKED_RC_NOT_ALLOWED) {
-			ni_warn("%s: address '%s' is already in use",
-				dev->name, ni_sockaddr_print(&ap->local_addr));
-		} else
-		if (ret != NI_WICKED_RC_SUCCESS) {
-			ni_warn("%s: address %s returned with status %d",
-				dev->name, verify ? "verify" : "notify", ret);
-		} else {
-			ni_info("%s: successfully %s address '%s'",
-				dev->name, verify ? "verified" : "notified about",
-				ni_sockaddr_print(&ap->local_addr));
-			rv = TRUE;
-		}
-	} else if(ret) {
-		ni_warn("%s: address %s execution failed",
-			dev->name, verify ? "verify" : "notify");
-	}
-	ni_process_free(pi);
-	return rv;
-}
-
 static ni_bool_t
 __ni_netdev_new_addr_verify(ni_netdev_t *dev, ni_address_t *ap)
 {
-	ni_ipv4_devinfo_t *ipv4;
-
 	if (ap->family != AF_INET)
 		return TRUE;
 
 	if (ni_address_is_duplicate(ap))
 		return FALSE;
 
-	if (!ni_address_is_tentative(ap))
-		return TRUE;
-
-	ipv4 = ni_netdev_get_ipv4(dev);
-	if (ipv4 && !ni_tristate_is_enabled(ipv4->conf.arp_verify)) {
-		ni_address_set_tentative(ap, FALSE);
-		return TRUE;
-	}
+	/* still tentative when the lease got replaced while probing */
+	return !ni_address_is_tentative(ap);
+}
 
-	if (__ni_netdev_call_arp_util(dev, ap, TRUE)) {
-		ni_address_set_tentative(ap, FALSE);
-		return TRUE;
-	} else {
-		ni_address_set_duplicate(ap, TRUE);
-		return FALSE;
-	}
+static void
+__ni_netdev_new_addr_announced(ni_arp_subscription_t *sub, ni_arp_event_t event,
+				const ni_arp_packet_t *pkt, void *user_data)
+{
+	if (event == NI_ARP_EVENT_ANNOUNCED)
+		ni_arp_unsubscribe(sub);
 }
 
 static ni_bool_t
 __ni_netdev_new_addr_notify(ni_netdev_t *dev, ni_address_t *ap)
 {
 #if !defined(NI_IPV4_ARP_NOTIFY_IN_KERNEL)
+	ni_capture_devinfo_t devinfo;
+	ni_arp_subscription_t *sub;
 	ni_ipv4_devinfo_t *ipv4;
 
 	if (ap->family != AF_INET)
@@ -3282,12 +3705,31 @@ __ni_netdev_new_addr_notify(ni_netdev_t *dev, ni_address_t *ap)
 	    !ni_tristate_is_enabled(ipv4->conf.arp_verify))
 		return TRUE;
 
-	return __ni_netdev_call_arp_util(dev, ap, FALSE);
+	if (!__ni_netdev_arp_usable(dev))
+		return TRUE;
+
+	/* sent by the arp engine with the next round */
+	if (ni_capture_devinfo_init(&devinfo, dev->name, &dev->link) < 0)
+		return FALSE;
+	sub = ni_arp_subscribe(&devinfo, ap->local_addr.sin.sin_addr,
+			__ni_netdev_new_addr_announced, NULL);
+	ni_string_free(&devinfo.ifname);
+	if (!sub) {
+		ni_warn("%s: cannot notify about address '%s'",
+			dev->name, ni_sockaddr_print(&ap->local_addr));
+		return FALSE;
+	}
+	ni_arp_announce(sub, NI_ADDRCONF_ARP_ANNOUNCE_COUNT, 0, 0);
+	return TRUE;
 #else
 	return TRUE;
 #endif
 }
 
+/*
+ * Update the addresses and routes assigned to an interface
+ * for a given addrconf method
+ */
 static int
 __ni_netdev_update_addrs(ni_netdev_t *dev,
 				const ni_addrconf_lease_t *old_lease,
@@ -3308,8 +3750,10 @@ __ni_netdev_update_addrs(ni_netdev_t *dev,
 	} else
 	if (old_lease) {
 		family = old_lease->family;
-		old_type = old_lease->type;
 	}
+	/* on update, drop what the replaced lease had and the new has not */
+	if (old_lease)
+		old_type = old_lease->type;
 
 	for (ap = dev->addrs; ap; ap = next) {
 		ni_address_t *new_addr;
@@ -3498,8 +3942,10 @@ __ni_netdev_update_routes(ni_netconfig_t *nc, ni_netdev_t *dev,
 	} else
 	if (old_lease) {
 		family = old_lease->family;
-		old_type = old_lease->type;
 	}
+	/* on update, drop what the replaced lease had and the new has not */
+	if (old_lease)
+		old_type = old_lease->type;
 
 	/* Loop over all tables and routes currently assigned to the interface.
 	 * If the configuration no longer specifies it, delete it.
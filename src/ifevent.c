@@ -416,6 +416,7 @@ __ni_rtevent_newaddr(ni_netconfig_t *nc, const struct sockaddr_nl *nladdr, struc
 		return -1;
 
 	__ni_netdev_addr_event(dev, NI_EVENT_ADDRESS_UPDATE, ap);
+	ni_addrconf_updater_resume(dev);
 	return 0;
 }
 
@@ -442,6 +443,7 @@ __ni_rtevent_deladdr(ni_netconfig_t *nc, const struct sockaddr_nl *nladdr, struc
 		__ni_netdev_addr_event(dev, NI_EVENT_ADDRESS_DELETE, ap);
 
 		__ni_address_list_remove(&dev->addrs, ap);
+		ni_addrconf_updater_resume(dev);
 	}
 	ni_string_free(&tmp.label);
 
@@ -53,6 +53,7 @@
 #include "sysfs.h"
 #include "kernel.h"
 #include "appconfig.h"
+#include "client/status_snapshot.h"
 
 
 static int		__ni_process_ifinfomsg(ni_linkinfo_t *link, struct nlmsghdr *h,
@@ -503,6 +504,7 @@ __ni_system_refresh_interface(ni_netconfig_t *nc, ni_netdev_t *dev)
 	ni_debug_verbose(NI_LOG_DEBUG1, NI_TRACE_EVENTS,
 			"Full refresh of %s interface",
 			dev->name);
+	ni_status_snapshot_invalidate();
 
 	do {
 		__ni_global_seqno++;
@@ -579,6 +581,7 @@ __ni_system_refresh_interface_addrs(ni_netconfig_t *nc, ni_netdev_t *dev)
 	ni_debug_verbose(NI_LOG_DEBUG1, NI_TRACE_EVENTS,
 			"Refresh of %s interface address",
 			dev->name);
+	ni_status_snapshot_invalidate();
 
 	do {
 		dev->seq = ++__ni_global_seqno;
@@ -619,6 +622,7 @@ __ni_system_refresh_interface_routes(ni_netconfig_t *nc, ni_netdev_t *dev)
 	ni_debug_verbose(NI_LOG_DEBUG1, NI_TRACE_EVENTS,
 			"Refresh of %s interface routes",
 			dev->name);
+	ni_status_snapshot_invalidate();
 
 	__ni_global_seqno++;
 	if (ni_rtnl_query_route_info(&query, dev->link.ifindex) < 0)
@@ -30,9 +30,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <limits.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include <wicked/netinfo.h>
 #include <wicked/addrconf.h>
@@ -1057,14 +1060,280 @@ static const char *		__ni_addrconf_lease_file_path(char **,
 static void			__ni_addrconf_lease_file_remove(
 				const char *, const char *, int, int);
 
+/*
+ * The lease file is a complete xml snapshot of the lease. A renewal
+ * usually changes the "acquired" timestamps in it only; these are
+ * appended as a small binary record to a journal next to the snapshot
+ * instead of rewriting it. The snapshot is rewritten (compacting the
+ * journal) when anything else changed or the journal is full.
+ */
+#define NI_ADDRCONF_LEASE_JOURNAL_SUFFIX	".journal"
+#define NI_ADDRCONF_LEASE_JOURNAL_MAGIC		0x4c4a494eU	/* "NIJL" */
+#define NI_ADDRCONF_LEASE_JOURNAL_RECORDS	64
+#define NI_ADDRCONF_LEASE_JOURNAL_STAMPS	14
+#define NI_ADDRCONF_LEASE_JOURNAL_DIGEST	20		/* sha1 */
+
+typedef struct ni_addrconf_lease_journal_head {
+	uint32_t		magic;
+	uint32_t		reserved;
+	uint64_t		inode;		/* of the xml snapshot	*/
+	unsigned char		digest[NI_ADDRCONF_LEASE_JOURNAL_DIGEST];
+	uint32_t		padding;
+} ni_addrconf_lease_journal_head_t;
+
+typedef struct ni_addrconf_lease_journal_rec {
+	uint32_t		magic;
+	uint32_t		count;
+	uint32_t		stamp[NI_ADDRCONF_LEASE_JOURNAL_STAMPS];
+	uint32_t		check;
+	uint32_t		padding;
+} ni_addrconf_lease_journal_rec_t;
+
+typedef struct ni_addrconf_lease_stamps {
+	unsigned int		count;
+	xml_node_t *		node[NI_ADDRCONF_LEASE_JOURNAL_STAMPS];
+} ni_addrconf_lease_stamps_t;
+
+static ni_bool_t
+__ni_addrconf_lease_stamps_collect(xml_node_t *node, ni_addrconf_lease_stamps_t *stamps)
+{
+	xml_node_t *child;
+
+	for (child = node->children; child; child = child->next) {
+		if (ni_string_eq(child->name, "acquired")) {
+			if (stamps->count >= NI_ADDRCONF_LEASE_JOURNAL_STAMPS)
+				return FALSE;
+			stamps->node[stamps->count++] = child;
+		} else
+		if (!__ni_addrconf_lease_stamps_collect(child, stamps))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static uint32_t
+__ni_addrconf_lease_journal_check(const ni_addrconf_lease_journal_rec_t *rec)
+{
+	uint32_t check = rec->magic ^ rec->count;
+	unsigned int i;
+
+	for (i = 0; i < rec->count && i < NI_ADDRCONF_LEASE_JOURNAL_STAMPS; ++i)
+		check = check * 31 + rec->stamp[i];
+	return check;
+}
+
+/*
+ * Digest of the xml snapshot with the timestamps left out
+ */
+static int
+__ni_addrconf_lease_journal_digest(xml_node_t *xml, ni_addrconf_lease_stamps_t *stamps,
+				unsigned char *digest)
+{
+	char *cdata[NI_ADDRCONF_LEASE_JOURNAL_STAMPS];
+	unsigned int i;
+	int ret;
+
+	memset(stamps, 0, sizeof(*stamps));
+	if (!__ni_addrconf_lease_stamps_collect(xml, stamps))
+		return -1;
+
+	for (i = 0; i < stamps->count; ++i) {
+		cdata[i] = stamps->node[i]->cdata;
+		stamps->node[i]->cdata = NULL;
+	}
+	ret = xml_node_hash(xml, NI_HASHCTX_SHA1, digest, NI_ADDRCONF_LEASE_JOURNAL_DIGEST);
+	for (i = 0; i < stamps->count; ++i)
+		stamps->node[i]->cdata = cdata[i];
+
+	return ret < 0 ? -1 : 0;
+}
+
+static int
+__ni_addrconf_lease_journal_rec_init(ni_addrconf_lease_journal_rec_t *rec,
+				const ni_addrconf_lease_stamps_t *stamps)
+{
+	unsigned int i;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->magic = NI_ADDRCONF_LEASE_JOURNAL_MAGIC;
+	rec->count = stamps->count;
+	for (i = 0; i < stamps->count; ++i) {
+		if (ni_parse_uint(stamps->node[i]->cdata, &rec->stamp[i], 10) < 0)
+			return -1;
+	}
+	rec->check = __ni_addrconf_lease_journal_check(rec);
+	return 0;
+}
+
+static int
+__ni_addrconf_lease_journal_open(const char *filename, ino_t inode, int flags,
+				ni_addrconf_lease_journal_head_t *head, off_t *size)
+{
+	char *journal = NULL;
+	struct stat stb;
+	int fd;
+
+	if (!ni_string_printf(&journal, "%s%s", filename, NI_ADDRCONF_LEASE_JOURNAL_SUFFIX))
+		return -1;
+	fd = open(journal, flags | O_CLOEXEC);
+	ni_string_free(&journal);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &stb) < 0 || stb.st_size < (off_t)sizeof(*head) ||
+	    read(fd, head, sizeof(*head)) != sizeof(*head) ||
+	    head->magic != NI_ADDRCONF_LEASE_JOURNAL_MAGIC ||
+	    head->inode != (uint64_t)inode) {
+		close(fd);
+		return -1;
+	}
+	*size = stb.st_size;
+	return fd;
+}
+
+/*
+ * Append the timestamps to the journal of an unchanged lease snapshot.
+ * Returns 0 on success, 1 when the snapshot needs to be (re)written.
+ */
+static int
+__ni_addrconf_lease_journal_append(const char *filename, const unsigned char *digest,
+				const ni_addrconf_lease_stamps_t *stamps)
+{
+	ni_addrconf_lease_journal_head_t head;
+	ni_addrconf_lease_journal_rec_t rec;
+	struct stat stb;
+	off_t size, used;
+	int fd;
+
+	if (stat(filename, &stb) < 0)
+		return 1;
+
+	fd = __ni_addrconf_lease_journal_open(filename, stb.st_ino, O_RDWR, &head, &size);
+	if (fd < 0)
+		return 1;
+
+	used = size - sizeof(head);
+	if (memcmp(head.digest, digest, sizeof(head.digest)) ||
+	    used % sizeof(rec) || used / sizeof(rec) >= NI_ADDRCONF_LEASE_JOURNAL_RECORDS ||
+	    __ni_addrconf_lease_journal_rec_init(&rec, stamps) < 0) {
+		close(fd);
+		return 1;
+	}
+
+	if (pwrite(fd, &rec, sizeof(rec), size) != sizeof(rec)) {
+		if (ftruncate(fd, size) < 0)
+			ni_warn("Unable to truncate lease journal of '%s': %m", filename);
+		close(fd);
+		return 1;
+	}
+
+	close(fd);
+	return 0;
+}
+
+/*
+ * Start an empty journal for a new lease snapshot
+ */
+static int
+__ni_addrconf_lease_journal_create(const char *filename, ino_t inode,
+				const unsigned char *digest)
+{
+	ni_addrconf_lease_journal_head_t head;
+	char tempname[PATH_MAX] = {'\0'};
+	char *journal = NULL;
+	int fd, ret = -1;
+
+	if (!ni_string_printf(&journal, "%s%s", filename, NI_ADDRCONF_LEASE_JOURNAL_SUFFIX))
+		return -1;
+
+	memset(&head, 0, sizeof(head));
+	head.magic = NI_ADDRCONF_LEASE_JOURNAL_MAGIC;
+	head.inode = inode;
+	memcpy(head.digest, digest, sizeof(head.digest));
+
+	snprintf(tempname, sizeof(tempname), "%s.XXXXXX", journal);
+	if ((fd = mkstemp(tempname)) >= 0) {
+		if (write(fd, &head, sizeof(head)) == sizeof(head))
+			ret = 0;
+		if (close(fd) < 0)
+			ret = -1;
+		if (ret == 0)
+			ret = rename(tempname, journal);
+		if (ret)
+			unlink(tempname);
+	}
+	if (ret)
+		unlink(journal);
+	ni_string_free(&journal);
+	return ret;
+}
+
+/*
+ * Apply the latest complete journal record to the snapshot
+ */
+static void
+__ni_addrconf_lease_journal_apply(const char *filename, ino_t inode, xml_node_t *xml)
+{
+	ni_addrconf_lease_journal_head_t head;
+	ni_addrconf_lease_journal_rec_t rec;
+	ni_addrconf_lease_stamps_t stamps;
+	unsigned int i, n;
+	off_t size;
+	char buf[32];
+	int fd;
+
+	fd = __ni_addrconf_lease_journal_open(filename, inode, O_RDONLY, &head, &size);
+	if (fd < 0)
+		return;
+
+	memset(&stamps, 0, sizeof(stamps));
+	if (!__ni_addrconf_lease_stamps_collect(xml, &stamps)) {
+		close(fd);
+		return;
+	}
+
+	for (n = (size - sizeof(head)) / sizeof(rec); n > 0; --n) {
+		if (pread(fd, &rec, sizeof(rec), sizeof(head) + (n - 1) * sizeof(rec)) != sizeof(rec))
+			continue;
+		if (rec.magic != NI_ADDRCONF_LEASE_JOURNAL_MAGIC ||
+		    rec.count != stamps.count ||
+		    rec.check != __ni_addrconf_lease_journal_check(&rec))
+			continue;
+
+		for (i = 0; i < stamps.count; ++i) {
+			snprintf(buf, sizeof(buf), "%u", rec.stamp[i]);
+			xml_node_set_cdata(stamps.node[i], buf);
+		}
+		ni_debug_dhcp("Applied lease journal record %u to '%s'", n, filename);
+		break;
+	}
+	close(fd);
+}
+
+static void
+__ni_addrconf_lease_journal_remove(const char *filename)
+{
+	char *journal = NULL;
+
+	if (ni_string_printf(&journal, "%s%s", filename, NI_ADDRCONF_LEASE_JOURNAL_SUFFIX)) {
+		if (ni_file_exists(journal) && unlink(journal) == 0)
+			ni_debug_dhcp("removed %s", journal);
+		ni_string_free(&journal);
+	}
+}
+
 /*
  * Write a lease to a file
  */
 int
 ni_addrconf_lease_file_write(const char *ifname, ni_addrconf_lease_t *lease)
 {
+	unsigned char digest[NI_ADDRCONF_LEASE_JOURNAL_DIGEST];
+	ni_addrconf_lease_stamps_t stamps;
 	char tempname[PATH_MAX] = {'\0'};
+	ni_bool_t journal = FALSE;
 	ni_bool_t fallback = FALSE;
+	struct stat stb;
 	char *filename = NULL;
 	xml_node_t *xml = NULL;
 	FILE *fp = NULL;
@@ -1096,6 +1365,24 @@ ni_addrconf_lease_file_write(const char *ifname, ni_addrconf_lease_t *lease)
 		goto failed;
 	}
 
+	if (__ni_addrconf_lease_journal_digest(xml, &stamps, digest) == 0) {
+		char *statefile = NULL;
+
+		journal = TRUE;
+		if (__ni_addrconf_lease_file_path(&statefile, ni_config_statedir(),
+					ifname, lease->type, lease->family) &&
+		    __ni_addrconf_lease_journal_append(statefile, digest, &stamps) == 0) {
+			ni_debug_dhcp("Lease timestamps appended to '%s' journal", statefile);
+			ni_string_free(&statefile);
+			goto done;
+		}
+		ni_string_free(&statefile);
+		if (__ni_addrconf_lease_journal_append(filename, digest, &stamps) == 0) {
+			ni_debug_dhcp("Lease timestamps appended to '%s' journal", filename);
+			goto done;
+		}
+	}
+
 	snprintf(tempname, sizeof(tempname), "%s.XXXXXX", filename);
 	if ((fd = mkstemp(tempname)) < 0) {
 		if (errno == EROFS && __ni_addrconf_lease_file_path(&filename,
@@ -1124,8 +1411,10 @@ ni_addrconf_lease_file_write(const char *ifname, ni_addrconf_lease_t *lease)
 
 	ni_debug_dhcp("Writing lease to temporary file for '%s'", filename);
 	xml_node_print(xml, fp);
+	if (fstat(fd, &stb) < 0)
+		journal = FALSE;
 	fclose(fp);
-	xml_node_free(xml);
+	fp = NULL;
 
 	if ((ret = rename(tempname, filename)) != 0) {
 		ni_error("Unable to rename temporary lease file '%s' to '%s': %m",
@@ -1135,8 +1424,13 @@ ni_addrconf_lease_file_write(const char *ifname, ni_addrconf_lease_t *lease)
 		__ni_addrconf_lease_file_remove(ni_config_statedir(),
 				ifname, lease->type, lease->family);
 	}
-
 	ni_debug_dhcp("Lease written to file '%s'", filename);
+
+	if (!journal || __ni_addrconf_lease_journal_create(filename, stb.st_ino, digest) < 0)
+		__ni_addrconf_lease_journal_remove(filename);
+
+done:
+	xml_node_free(xml);
 	ni_string_free(&filename);
 	return 0;
 
@@ -1160,6 +1454,7 @@ ni_addrconf_lease_file_read(const char *ifname, int type, int family)
 	ni_addrconf_lease_t *lease = NULL;
 	xml_node_t *xml = NULL, *lnode;
 	char *filename = NULL;
+	struct stat stb;
 	FILE *fp;
 
 	if (!__ni_addrconf_lease_file_path(&filename,
@@ -1188,6 +1483,8 @@ ni_addrconf_lease_file_read(const char *ifname, int type, int family)
 
 	ni_debug_dhcp("Reading lease from %s", filename);
 	xml = xml_node_scan(fp, filename);
+	if (xml && fstat(fileno(fp), &stb) == 0)
+		__ni_addrconf_lease_journal_apply(filename, stb.st_ino, xml);
 	fclose(fp);
 
 	if (xml == NULL) {
@@ -1234,6 +1531,7 @@ __ni_addrconf_lease_file_remove(const char *dir, const char *ifname,
 
 	if (ni_file_exists(filename) && unlink(filename) == 0)
 		ni_debug_dhcp("removed %s", filename);
+	__ni_addrconf_lease_journal_remove(filename);
 	ni_string_free(&filename);
 }
 
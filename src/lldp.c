@@ -41,14 +41,23 @@
  */
 #define NI_LLDP_MAX_PEERS	256
 
+/*
+ * The agents are hashed by ifindex. Their tx timers are served by
+ * a single timer, which sends the PDUs of all agents due within the
+ * tx jitter in one batch.
+ */
+#define NI_LLDP_AGENT_HASH_SIZE	64
+#define NI_LLDP_TX_BATCH	64
+#define NI_LLDP_TX_JITTER	400	/* msec */
+
 typedef struct ni_lldp_agent ni_lldp_agent_t;
 typedef struct ni_lldp_peer ni_lldp_peer_t;
 
 struct ni_lldp_agent {
-	ni_lldp_agent_t *	next;
+	ni_lldp_agent_t *	next;		/* ifindex hash chain */
 	unsigned int		ifindex;
 
-	const ni_timer_t *	txTTR;
+	struct timeval		txTTR;		/* when the tx timer expires */
 	uint16_t		msgFastTx;
 	uint16_t		msgTxHold;
 	uint16_t		msgTxInterval;
@@ -62,24 +71,37 @@ struct ni_lldp_agent {
 	struct timeval		tx_timestamp;
 
 	ni_netdev_t *		dev;
-	ni_lldp_t *		config;
+	ni_lldp_t *		request;	/* the config as requested */
+	ni_lldp_t *		config;		/* with the device data filled in */
 	ni_dcbx_state_t *	dcbx;
 
+	/* the device data the config has been resolved with */
+	struct {
+		char *		name;
+		char *		alias;
+		ni_hwaddr_t	hwaddr;
+	} sysdata;
+
 	ni_lldp_peer_t *	peers;
 
 	ni_capture_t *		capture;
-	ni_buffer_t		sendbuf;
+	ni_buffer_t		sendbuf;	/* the PDU, rebuilt when empty */
 };
 
 struct ni_lldp_peer {
 	ni_lldp_peer_t *	next;
 	time_t			expires;
+	uint32_t		pdu_hash;	/* of the PDU the data was parsed from */
+	unsigned int		pdu_len;
 	ni_lldp_t *		data;
 	unsigned int		raw_id_len;
 	unsigned char		raw_id[0];
 };
 
-static ni_lldp_agent_t *	ni_lldp_agents;
+static ni_lldp_agent_t *	ni_lldp_agents[NI_LLDP_AGENT_HASH_SIZE];
+static const ni_timer_t *	ni_lldp_tx_timer;
+static struct timeval		ni_lldp_tx_timer_due;
+static ni_lldp_neighbor_handler_t *ni_lldp_neighbor_handler;
 
 static ni_hwaddr_t		ni_lldp_destaddr[__NI_LLDP_DEST_MAX] = {
 [NI_LLDP_DEST_NEAREST_BRIDGE] = {
@@ -102,17 +124,20 @@ static ni_hwaddr_t		ni_lldp_destaddr[__NI_LLDP_DEST_MAX] = {
 typedef int		ni_lldp_get_fn_t(ni_lldp_t *, ni_buffer_t *);
 
 
-static int		ni_lldp_agent_start(ni_netdev_t *, ni_lldp_t *, ni_dcbx_state_t *);
+static int		ni_lldp_agent_start(ni_netdev_t *, const ni_lldp_t *, ni_dcbx_state_t *);
 static void		ni_lldp_agent_stop(ni_netdev_t *);
-static ni_bool_t	ni_lldp_agent_send(ni_lldp_agent_t *);
+static void		ni_lldp_agent_send(ni_lldp_agent_t *);
 static int		ni_lldp_agent_send_shutdown(ni_lldp_agent_t *);
 static void		ni_lldp_agent_free(ni_lldp_agent_t *);
-static int		ni_lldp_agent_update(ni_lldp_agent_t *, ni_lldp_t *, const void *, unsigned int);
+static int		ni_lldp_agent_update(ni_lldp_agent_t *, ni_buffer_t *, const void *, unsigned int);
+static void		ni_lldp_agent_expire_peers(ni_lldp_agent_t *, time_t);
+static void		ni_lldp_agent_neighbor_event(ni_lldp_agent_t *, ni_lldp_neighbor_event_t,
+					const ni_lldp_t *, unsigned int);
 static void		ni_lldp_tx_timer_arm(ni_lldp_agent_t *);
 static void		ni_lldp_tx_timer_arm_quick(ni_lldp_agent_t *);
+static void		ni_lldp_tx_timer_schedule(const struct timeval *);
 static void		ni_lldp_receive(ni_socket_t *);
 static ni_lldp_peer_t *	ni_lldp_peer_new(const void *raw_id, unsigned int raw_id_len);
-static void		ni_lldp_peer_unlink_and_free(ni_lldp_peer_t **);
 static int		ni_lldp_pdu_build(const ni_lldp_t *, ni_dcbx_state_t *, ni_buffer_t *);
 static int		ni_lldp_pdu_parse(ni_lldp_t *, ni_buffer_t *);
 static int		ni_lldp_pdu_get_raw_id(ni_buffer_t *, const void **, unsigned int *);
@@ -215,16 +240,6 @@ ni_lldp_peer_free(ni_lldp_peer_t *peer)
 	ni_lldp_free(peer->data);
 	free(peer);
 }
-static void
-ni_lldp_peer_unlink_and_free(ni_lldp_peer_t **pos)
-{
-	ni_lldp_peer_t *peer = *pos;
-
-	if (peer) {
-		*pos = peer->next;
-		ni_lldp_peer_free(peer);
-	}
-}
 
 static inline ni_bool_t
 ni_lldp_check_interface_alias(char **valuep, ni_netdev_t *dev, const char *what)
@@ -291,8 +306,10 @@ ni_system_lldp_up(ni_netdev_t *dev, const ni_lldp_t *config)
 	if (config || dcbx) {
 		ni_lldp_t *lldp = config? ni_lldp_clone(config) : ni_lldp_new();
 
-		if (ni_lldp_agent_start(dev, lldp, dcbx) < 0)
+		if (ni_lldp_agent_start(dev, lldp, dcbx) < 0) {
+			ni_lldp_free(lldp);
 			return -1;
+		}
 
 		/* Record the LLDP config requested by the user */
 		ni_netdev_set_lldp(dev, lldp);
@@ -326,6 +343,7 @@ ni_lldp_agent_new(ni_netdev_t *dev, unsigned int mtu)
 	ni_buffer_init(&agent->sendbuf, (void *) (agent + 1), mtu);
 
 	agent->dev = ni_netdev_get(dev);
+	agent->ifindex = dev->link.ifindex;
 
 	/* init tx state machine variables with recommended defaults */
 	agent->msgFastTx = 1;
@@ -346,26 +364,34 @@ ni_lldp_agent_new(ni_netdev_t *dev, unsigned int mtu)
 void
 ni_lldp_agent_free(ni_lldp_agent_t *agent)
 {
+	ni_lldp_peer_t *peer;
+
 	ni_capture_free(agent->capture);
+	ni_lldp_free(agent->request);
 	ni_lldp_free(agent->config);
-	if (agent->txTTR)
-		ni_timer_cancel(agent->txTTR);
-	if (agent->dev)
-		ni_netdev_put(agent->dev);
+	ni_string_free(&agent->sysdata.name);
+	ni_string_free(&agent->sysdata.alias);
 	if (agent->dcbx)
 		ni_dcbx_free(agent->dcbx);
 	ni_buffer_destroy(&agent->sendbuf);
-	while (agent->peers)
-		ni_lldp_peer_unlink_and_free(&agent->peers);
+	while ((peer = agent->peers) != NULL) {
+		agent->peers = peer->next;
+		ni_lldp_agent_neighbor_event(agent, NI_LLDP_NEIGHBOR_REMOVED,
+				peer->data, NI_LLDP_NEIGHBOR_ALL);
+		ni_lldp_peer_free(peer);
+	}
+	if (agent->dev)
+		ni_netdev_put(agent->dev);
 	free(agent);
 }
 
 static ni_lldp_agent_t *
-__ni_lldp_take_agent(unsigned int ifindex, ni_lldp_agent_t ***pos_ret)
+__ni_lldp_take_agent(unsigned int ifindex)
 {
 	ni_lldp_agent_t *agent, **pos;
 
-	for (pos = &ni_lldp_agents; (agent = *pos) != NULL; pos = &agent->next) {
+	pos = &ni_lldp_agents[ifindex % NI_LLDP_AGENT_HASH_SIZE];
+	for ( ; (agent = *pos) != NULL; pos = &agent->next) {
 		if (agent->ifindex == ifindex) {
 			*pos = agent->next;
 			agent->next = NULL;
@@ -373,10 +399,19 @@ __ni_lldp_take_agent(unsigned int ifindex, ni_lldp_agent_t ***pos_ret)
 		}
 	}
 
-	*pos_ret = pos;
 	return agent;
 }
 
+static void
+__ni_lldp_hash_agent(ni_lldp_agent_t *agent)
+{
+	ni_lldp_agent_t **pos;
+
+	pos = &ni_lldp_agents[agent->ifindex % NI_LLDP_AGENT_HASH_SIZE];
+	agent->next = *pos;
+	*pos = agent;
+}
+
 static int
 __ni_lldp_agent_configure(ni_netdev_t *dev, ni_lldp_t *lldp)
 {
@@ -415,26 +450,56 @@ __ni_lldp_agent_configure(ni_netdev_t *dev, ni_lldp_t *lldp)
 	return 0;
 }
 
+/*
+ * Fill in the chassis and port id defaults from the current name, alias
+ * and mac address of the device; the PDU is rebuilt on the next transmit.
+ */
 static int
-ni_lldp_agent_configure(ni_lldp_agent_t *agent, ni_netdev_t *dev, ni_lldp_t *lldp, ni_dcbx_state_t *dcbx)
+ni_lldp_agent_resolve(ni_lldp_agent_t *agent)
 {
-	if (lldp->ttl == 0)
-		lldp->ttl = agent->txTTL;
+	ni_netdev_t *dev = agent->dev;
+	ni_lldp_t *lldp;
 
+	ni_string_dup(&agent->sysdata.name, dev->name);
+	ni_string_dup(&agent->sysdata.alias, dev->link.alias);
+	agent->sysdata.hwaddr = dev->link.hwaddr;
+
+	lldp = ni_lldp_clone(agent->request);
 	if (__ni_lldp_agent_configure(dev, lldp) < 0) {
 		ni_lldp_free(lldp);
 		return -1;
 	}
 
+	ni_lldp_free(agent->config);
+	agent->config = lldp;
+	ni_buffer_reset(&agent->sendbuf);
+	return 0;
+}
+
+static ni_bool_t
+ni_lldp_agent_sysdata_changed(const ni_lldp_agent_t *agent)
+{
+	const ni_netdev_t *dev = agent->dev;
+
+	return !ni_string_eq(agent->sysdata.name, dev->name)
+	    || !ni_string_eq(agent->sysdata.alias, dev->link.alias)
+	    || !ni_link_address_equal(&agent->sysdata.hwaddr, &dev->link.hwaddr);
+}
+
+static int
+ni_lldp_agent_configure(ni_lldp_agent_t *agent, const ni_lldp_t *lldp, ni_dcbx_state_t *dcbx)
+{
 	/* DCBX should only be active if the destination is nearest-bridge */
 	if (dcbx) {
 		dcbx->running = (lldp->destination == NI_LLDP_DEST_NEAREST_BRIDGE);
 	}
-
-	ni_lldp_free(agent->config);
-	agent->config = lldp;
 	agent->dcbx = dcbx;
-	return 0;
+
+	agent->request = ni_lldp_clone(lldp);
+	if (agent->request->ttl == 0)
+		agent->request->ttl = agent->txTTL;
+
+	return ni_lldp_agent_resolve(agent);
 }
 
 /*
@@ -444,43 +509,52 @@ ni_lldp_agent_configure(ni_lldp_agent_t *agent, ni_netdev_t *dev, ni_lldp_t *lld
  * FIXME: we should allow administrative control over LLDP tx and rx.
  */
 static int
-ni_lldp_agent_start(ni_netdev_t *dev, ni_lldp_t *lldp, ni_dcbx_state_t *dcbx)
+ni_lldp_agent_start(ni_netdev_t *dev, const ni_lldp_t *lldp, ni_dcbx_state_t *dcbx)
 {
-	ni_lldp_agent_t *agent, **pos;
+	ni_lldp_agent_t *agent;
 	ni_capture_t *capture = NULL;
-
-	if ((agent = __ni_lldp_take_agent(dev->link.ifindex, &pos)) != NULL) {
-		capture = agent->capture;
-		agent->capture = NULL;
+	ni_lldp_peer_t *peers = NULL;
+
+	if ((agent = __ni_lldp_take_agent(dev->link.ifindex)) != NULL) {
+		/* the capture receives one destination only; keep it
+		 * and the neighbors learned from it */
+		if (agent->config && agent->config->destination == lldp->destination) {
+			capture = agent->capture;
+			peers = agent->peers;
+			agent->capture = NULL;
+			agent->peers = NULL;
+		}
 		ni_lldp_agent_free(agent);
 	}
 
 	agent = ni_lldp_agent_new(dev, 1500);
-	agent->next = *pos;
-	*pos = agent;
+	agent->capture = capture;
+	agent->peers = peers;
 
-	if (ni_lldp_agent_configure(agent, dev, lldp, dcbx) < 0)
+	if (ni_lldp_agent_configure(agent, lldp, dcbx) < 0
+	 || agent->config->destination >= __NI_LLDP_DEST_MAX) {
+		ni_lldp_agent_free(agent);
 		return -1;
+	}
 
-	if (capture == NULL) {
+	if (agent->capture == NULL) {
 		ni_capture_devinfo_t devinfo;
 		ni_capture_protinfo_t protinfo;
 
+		/* all agents of a destination receive and send via one socket */
 		memset(&protinfo, 0, sizeof(protinfo));
 		protinfo.eth_protocol = ETHERTYPE_LLDP;
-
-		if (agent->config->destination >= __NI_LLDP_DEST_MAX)
-			return -1;
 		protinfo.eth_destaddr = ni_lldp_destaddr[agent->config->destination];
+		protinfo.shared = TRUE;
 
-		if (ni_capture_devinfo_init(&devinfo, dev->name, &dev->link) < 0)
+		if (ni_capture_devinfo_init(&devinfo, dev->name, &dev->link) < 0
+		 || !(agent->capture = ni_capture_open(&devinfo, &protinfo, ni_lldp_receive))) {
+			ni_lldp_agent_free(agent);
 			return -1;
-
-		capture = ni_capture_open(&devinfo, &protinfo, ni_lldp_receive);
+		}
 	}
-	agent->capture = capture;
-
-	ni_capture_set_user_data(capture, agent);
+	ni_capture_set_user_data(agent->capture, agent);
+	__ni_lldp_hash_agent(agent);
 
 	ni_lldp_agent_send(agent);
 	return 0;
@@ -489,9 +563,9 @@ ni_lldp_agent_start(ni_netdev_t *dev, ni_lldp_t *lldp, ni_dcbx_state_t *dcbx)
 void
 ni_lldp_agent_stop(ni_netdev_t *dev)
 {
-	ni_lldp_agent_t *agent, **pos;
+	ni_lldp_agent_t *agent;
 
-	if ((agent = __ni_lldp_take_agent(dev->link.ifindex, &pos)) != NULL) {
+	if ((agent = __ni_lldp_take_agent(dev->link.ifindex)) != NULL) {
 		/* While the device is still up, try to send a shutdown PDU */
 		if (ni_netdev_device_is_up(dev))
 			ni_lldp_agent_send_shutdown(agent);
@@ -499,32 +573,37 @@ ni_lldp_agent_stop(ni_netdev_t *dev)
 	}
 }
 
+/*
+ * Called when the tx timer of the agent expired: check the credits
+ * and prepare the PDU, which the caller sends in a batch.
+ */
 static ni_bool_t
-ni_lldp_agent_send(ni_lldp_agent_t *agent)
+ni_lldp_agent_tx_prepare(ni_lldp_agent_t *agent, const struct timeval *now)
 {
-	struct timeval now;
-	ni_bool_t rv = FALSE;
+	/* the PDU is cached until the config or the device data changes */
+	if (ni_lldp_agent_sysdata_changed(agent) && ni_lldp_agent_resolve(agent) < 0)
+		ni_error("%s: cannot update LLDP PDU to changed device data", agent->dev->name);
 
-	/* build packet and prime sender */
 	if (ni_buffer_count(&agent->sendbuf) == 0
 	 && ni_lldp_pdu_build(agent->config, agent->dcbx, &agent->sendbuf) < 0) {
 		ni_error("%s: error building LLDP PDU", agent->dev->name);
-		return -1;
+		ni_buffer_reset(&agent->sendbuf);
+		ni_lldp_tx_timer_arm(agent);
+		return FALSE;
 	}
 
-	ni_timer_get_time(&now);
 	if (!timerisset(&agent->tx_timestamp)) {
 		/* Never sent anything - init txCredits to max */
 		agent->txCredit = agent->txCreditMax;
-		agent->tx_timestamp = now;
+		agent->tx_timestamp = *now;
 	} else
-	if (timercmp(&now, &agent->tx_timestamp, <=)) {
+	if (timercmp(now, &agent->tx_timestamp, <=)) {
 		/* Clock warped back */
-		agent->tx_timestamp = now;
+		agent->tx_timestamp = *now;
 	} else {
 		struct timeval delta;
 
-		timersub(&now, &agent->tx_timestamp, &delta);
+		timersub(now, &agent->tx_timestamp, &delta);
 		if (delta.tv_sec > 0) {
 			agent->txCredit += delta.tv_sec;
 			if (agent->txCredit > agent->txCreditMax)
@@ -533,27 +612,33 @@ ni_lldp_agent_send(ni_lldp_agent_t *agent)
 		}
 	}
 
-	if (agent->txCredit > 0) {
-		ni_buffer_t *bp = &agent->sendbuf;
-
-		ni_debug_lldp("%s: sending LLDP packet (PDU len=%u)", agent->dev->name, ni_buffer_count(bp));
-		/* ni_debug_lldp(PDU=%s", ni_print_hex(ni_buffer_head(bp), ni_buffer_count(bp))); */
-		ni_capture_send(agent->capture, &agent->sendbuf, NULL);
-		agent->txCredit--;
-
-		/* Decrement txFast if we're in a fast retrans cycle */
-		if (agent->txFast)
-			agent->txFast--;
-
-		/* Regular timer (re-)arm */
-		ni_lldp_tx_timer_arm(agent);
-		rv = TRUE;
-	} else {
+	if (agent->txCredit == 0) {
 		ni_debug_lldp("%s: cannot send LLDP packet (no credits)", agent->dev->name);
 		ni_lldp_tx_timer_arm_quick(agent);
+		return FALSE;
 	}
 
-	return rv;
+	ni_debug_lldp("%s: sending LLDP packet (PDU len=%u)", agent->dev->name,
+			ni_buffer_count(&agent->sendbuf));
+	agent->txCredit--;
+
+	/* Decrement txFast if we're in a fast retrans cycle */
+	if (agent->txFast)
+		agent->txFast--;
+
+	/* Regular timer (re-)arm */
+	ni_lldp_tx_timer_arm(agent);
+	return TRUE;
+}
+
+/*
+ * Send a PDU with the next batch, as soon as possible
+ */
+static void
+ni_lldp_agent_send(ni_lldp_agent_t *agent)
+{
+	ni_timer_get_time(&agent->txTTR);
+	ni_lldp_tx_timer_schedule(&agent->txTTR);
 }
 
 int
@@ -591,31 +676,101 @@ ni_lldp_agent_enter_fast_rx(ni_lldp_agent_t *agent)
 static void
 ni_lldp_tx_timer_expires(void *user_data, const ni_timer_t *timer)
 {
-	ni_lldp_agent_t *agent = (ni_lldp_agent_t *) user_data;
+	ni_capture_t *captures[NI_LLDP_TX_BATCH];
+	const ni_buffer_t *bufs[NI_LLDP_TX_BATCH];
+	struct timeval now, until, next;
+	ni_lldp_agent_t *agent;
+	unsigned int i, count = 0, sent = 0;
+	time_t expire = time(NULL);
 
-	if (agent->txTTR != timer) {
+	if (ni_lldp_tx_timer != timer) {
 		ni_error("ni_lldp_tx_timer_expires: bad timer handle");
 		return;
 	}
-	agent->txTTR = NULL;
+	ni_lldp_tx_timer = NULL;
 
-	/* FIXME: rebuild the packet? */
-	ni_lldp_agent_send(agent);
+	ni_timer_get_time(&now);
+	until = now;
+	until.tv_usec += NI_LLDP_TX_JITTER * 1000;
+	if (until.tv_usec >= 1000000) {
+		until.tv_sec += until.tv_usec / 1000000;
+		until.tv_usec %= 1000000;
+	}
+	timerclear(&next);
+
+	for (i = 0; i < NI_LLDP_AGENT_HASH_SIZE; ++i) {
+		for (agent = ni_lldp_agents[i]; agent; agent = agent->next) {
+			ni_lldp_agent_expire_peers(agent, expire);
+
+			if (!timerisset(&agent->txTTR))
+				continue;
+
+			if (!timercmp(&agent->txTTR, &until, >)) {
+				timerclear(&agent->txTTR);
+				if (ni_lldp_agent_tx_prepare(agent, &now)) {
+					captures[count] = agent->capture;
+					bufs[count] = &agent->sendbuf;
+					if (++count == NI_LLDP_TX_BATCH) {
+						sent += ni_capture_send_batch(captures, bufs, count);
+						count = 0;
+					}
+				}
+			}
+
+			if (!timerisset(&next) || timercmp(&agent->txTTR, &next, <))
+				next = agent->txTTR;
+		}
+	}
+	sent += ni_capture_send_batch(captures, bufs, count);
+	if (sent > 1)
+		ni_debug_lldp("sent %u LLDP PDUs in one batch", sent);
+
+	if (timerisset(&next))
+		ni_lldp_tx_timer_schedule(&next);
 }
 
+/*
+ * Arm the tx timer to expire at @due, unless it expires earlier already
+ */
+static void
+ni_lldp_tx_timer_schedule(const struct timeval *due)
+{
+	struct timeval now, delta;
+	unsigned long timeout = 0;
+
+	if (ni_lldp_tx_timer && !timercmp(due, &ni_lldp_tx_timer_due, <))
+		return;
+
+	ni_timer_get_time(&now);
+	if (timercmp(due, &now, >)) {
+		timersub(due, &now, &delta);
+		timeout = delta.tv_sec * 1000 + delta.tv_usec / 1000;
+	}
+
+	if (ni_lldp_tx_timer)
+		ni_timer_cancel(ni_lldp_tx_timer);
+	ni_lldp_tx_timer_due = *due;
+	ni_lldp_tx_timer = ni_timer_register(timeout, ni_lldp_tx_timer_expires, NULL);
+	if (ni_lldp_tx_timer == NULL)
+		ni_error("failed to arm LLDP timer");
+}
+
+/*
+ * Called while sending a batch, which arms the timer for the next agent due
+ */
 static void
 __ni_lldp_tx_timer_arm(ni_lldp_agent_t *agent, unsigned int timeout)
 {
-	static const ni_int_range_t jitter = { .min = 0, .max = 400 };
+	static const ni_int_range_t jitter = { .min = 0, .max = NI_LLDP_TX_JITTER };
+	struct timeval delta;
 
 	/* Apply a jitter between 0 and 0.4 sec */
 	timeout = ni_timeout_randomize(timeout, &jitter);
 
-	if (agent->txTTR)
-		ni_timer_cancel(agent->txTTR);
-	agent->txTTR = ni_timer_register(timeout, ni_lldp_tx_timer_expires, agent);
-	if (agent->txTTR == NULL)
-		ni_error("%s: failed to arm LLDP timer", agent->dev->name);
+	ni_timer_get_time(&agent->txTTR);
+	delta.tv_sec = timeout / 1000;
+	delta.tv_usec = (timeout % 1000) * 1000;
+	timeradd(&agent->txTTR, &delta, &agent->txTTR);
 }
 
 void
@@ -634,43 +789,162 @@ ni_lldp_tx_timer_arm_quick(ni_lldp_agent_t *agent)
 /*
  * LLDP rx agent
  */
+void
+ni_server_listen_lldp_events(ni_lldp_neighbor_handler_t *handler)
+{
+	ni_lldp_neighbor_handler = handler;
+}
+
+static void
+ni_lldp_agent_neighbor_event(ni_lldp_agent_t *agent, ni_lldp_neighbor_event_t event,
+				const ni_lldp_t *lldp, unsigned int changes)
+{
+	if (ni_lldp_neighbor_handler && changes)
+		ni_lldp_neighbor_handler(agent->dev, event, lldp, changes);
+}
+
+static inline uint32_t
+ni_lldp_pdu_hash(const unsigned char *data, unsigned int len)
+{
+	uint32_t hash = 2166136261U;
+
+	while (len--) {
+		hash ^= *data++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static ni_bool_t
+ni_lldp_ieee_802_1_equal(const ni_lldp_ieee_802_1_t *a, const ni_lldp_ieee_802_1_t *b)
+{
+	if (!a || !b)
+		return a == b;
+
+	return a->pvid == b->pvid
+	    && a->ppvid == b->ppvid
+	    && a->ppvlan_flags == b->ppvlan_flags
+	    && a->mgmt_vid == b->mgmt_vid
+	    && ni_string_eq(a->vlan_name, b->vlan_name);
+}
+
+/*
+ * Which of the neighbor data (except the chassis and port id it is
+ * keyed by) changed between two PDUs
+ */
+static unsigned int
+ni_lldp_neighbor_changes(const ni_lldp_t *o, const ni_lldp_t *n)
+{
+	unsigned int changes = 0;
+
+	if (o->ttl != n->ttl)
+		changes |= NI_LLDP_NEIGHBOR_TTL;
+
+	if (!ni_string_eq(o->port_description, n->port_description))
+		changes |= NI_LLDP_NEIGHBOR_PORT_DESC;
+
+	if (!ni_string_eq(o->system.name, n->system.name)
+	 || !ni_string_eq(o->system.description, n->system.description)
+	 || o->system.capabilities != n->system.capabilities)
+		changes |= NI_LLDP_NEIGHBOR_SYSTEM;
+
+	if (!ni_lldp_ieee_802_1_equal(o->ieee_802_1, n->ieee_802_1))
+		changes |= NI_LLDP_NEIGHBOR_IEEE_802_1;
+
+	return changes;
+}
+
+static void
+ni_lldp_agent_insert_peer(ni_lldp_agent_t *agent, ni_lldp_peer_t *found)
+{
+	ni_lldp_peer_t **pos, *peer;
+
+	/* Insert in order of increasing timeout */
+	pos = &agent->peers;
+	while ((peer = *pos) != NULL && peer->expires < found->expires)
+		pos = &peer->next;
+
+	found->next = *pos;
+	*pos = found;
+}
+
+/*
+ * Drop the neighbors we did not hear from within their ttl. Note that
+ * peers are sorted by order of increasing expiry timeout.
+ */
+static void
+ni_lldp_agent_expire_peers(ni_lldp_agent_t *agent, time_t now)
+{
+	ni_lldp_peer_t *peer;
+
+	while ((peer = agent->peers) != NULL && peer->expires <= now) {
+		agent->peers = peer->next;
+		ni_lldp_agent_neighbor_event(agent, NI_LLDP_NEIGHBOR_REMOVED,
+				peer->data, NI_LLDP_NEIGHBOR_ALL);
+		ni_lldp_peer_free(peer);
+	}
+}
+
+/*
+ * Update the neighbor table with a received PDU. A neighbor usually
+ * repeats an identical PDU, which only refreshes its ttl; the PDU is
+ * parsed when it is new or differs from the last one.
+ */
 static int
-ni_lldp_agent_update(ni_lldp_agent_t *agent, ni_lldp_t *lldp, const void *raw_id, unsigned int raw_id_len)
+ni_lldp_agent_update(ni_lldp_agent_t *agent, ni_buffer_t *bp, const void *raw_id, unsigned int raw_id_len)
 {
 	ni_lldp_peer_t **pos, *peer, *found = NULL;
-	unsigned int npeers = 0;
+	ni_lldp_neighbor_event_t event;
+	unsigned int npeers = 0, changes;
+	unsigned int pdu_len;
+	uint32_t pdu_hash;
+	ni_lldp_t *lldp;
 	time_t now;
 
 	now = time(NULL);
+	ni_lldp_agent_expire_peers(agent, now);
 
-	pos = &agent->peers;
-
-	/* First, expire any old entries. Note that peers are sorted by order
-	 * of increasing expiry timeout. */
-	while ((peer = *pos) != NULL && peer->expires <= now)
-		ni_lldp_peer_unlink_and_free(pos);
-
-	while ((peer = *pos) != NULL) {
+	for (pos = &agent->peers; (peer = *pos) != NULL; ) {
 		if (peer->raw_id_len == raw_id_len
 		 && !memcmp(peer->raw_id, raw_id, raw_id_len)) {
 			found = peer;
 			*pos = peer->next;
 			peer->next = NULL;
 		} else {
-			*pos = peer->next;
+			pos = &peer->next;
 			npeers++;
 		}
 	}
 
+	pdu_len = ni_buffer_count(bp);
+	pdu_hash = ni_lldp_pdu_hash(ni_buffer_head(bp), pdu_len);
+	if (found && found->pdu_len == pdu_len && found->pdu_hash == pdu_hash) {
+		found->expires = now + found->data->ttl;
+		ni_lldp_agent_insert_peer(agent, found);
+		return 0;
+	}
+
+	lldp = ni_lldp_new();
+	if (ni_lldp_pdu_parse(lldp, bp) < 0) {
+		ni_debug_lldp("%s: failed to parse LLDP PDU", agent->dev->name);
+		ni_lldp_free(lldp);
+		if (found)
+			ni_lldp_agent_insert_peer(agent, found);
+		return -1;
+	}
+
 	if (found != NULL) {
-		ni_lldp_free(found->data);
-		found->data = NULL;
+		event = NI_LLDP_NEIGHBOR_CHANGED;
+		changes = ni_lldp_neighbor_changes(found->data, lldp);
 	} else {
 		if (npeers >= NI_LLDP_MAX_PEERS) {
 			ni_debug_lldp("%s: too many LLDP peers, ignoring this PDU", __func__);
+			ni_lldp_free(lldp);
 			return -1;
 		}
 		found = ni_lldp_peer_new(raw_id, raw_id_len);
+		event = NI_LLDP_NEIGHBOR_ADDED;
+		changes = NI_LLDP_NEIGHBOR_ALL;
 
 		/* A new agent was found. Enter fast transmission mode */
 		ni_lldp_agent_enter_fast_rx(agent);
@@ -678,30 +952,38 @@ ni_lldp_agent_update(ni_lldp_agent_t *agent, ni_lldp_t *lldp, const void *raw_id
 
 	if (lldp->ttl == 0) {
 		/* The peer agent wanted to say bye */
+		if (found->data)
+			ni_lldp_agent_neighbor_event(agent, NI_LLDP_NEIGHBOR_REMOVED,
+					found->data, NI_LLDP_NEIGHBOR_ALL);
+		ni_lldp_free(lldp);
 		ni_lldp_peer_free(found);
 		return 0;
 	}
 
 	/* Update/init the peer info */
-	found->expires = now + lldp->ttl;
+	ni_lldp_free(found->data);
 	found->data = lldp;
-
-	/* Insert in order of increasing timeout */
-	pos = &agent->peers;
-	while ((peer = *pos) != NULL && peer->expires < found->expires)
-		*pos = peer->next;
-
-	found->next = *pos;
-	*pos = found;
+	found->expires = now + lldp->ttl;
+	found->pdu_len = pdu_len;
+	found->pdu_hash = pdu_hash;
+	ni_lldp_agent_insert_peer(agent, found);
 	npeers++;
 
+	ni_lldp_agent_neighbor_event(agent, event, lldp, changes);
+
 	/* If there is exactly one peer on the link, and that peer
 	 * announces its DCB configuration via DCBX, we should invoke
 	 * the DCBX finite state machinery.
 	 */
 	if (agent->dcbx) {
+		/* The PDU carries the DCBX TLVs only while it is running,
+		 * so it has to be rebuilt whenever that state changes.
+		 */
 		if (lldp->dcb_attributes != NULL && npeers == 1) {
-			agent->dcbx->running = TRUE;
+			if (!agent->dcbx->running) {
+				agent->dcbx->running = TRUE;
+				ni_buffer_reset(&agent->sendbuf);
+			}
 
 			/* Pass the received DCBX attributes to the DCB driver.
 			 * If the function returns TRUE, the configuration changed
@@ -713,12 +995,44 @@ ni_lldp_agent_update(ni_lldp_agent_t *agent, ni_lldp_t *lldp, const void *raw_id
 			ni_debug_lldp("%s: more than one LLDP agent on the link, disabling DCBX",
 					agent->dev->name);
 			agent->dcbx->running = FALSE;
+			ni_buffer_reset(&agent->sendbuf);
 		}
 	}
 
 	return 0;
 }
 
+/*
+ * Call @func for each current neighbor of the device with the
+ * remaining seconds of its ttl
+ */
+unsigned int
+ni_system_lldp_neighbors(const ni_netdev_t *dev, ni_lldp_neighbor_func_t *func, void *user_data)
+{
+	ni_lldp_agent_t *agent;
+	ni_lldp_peer_t *peer;
+	unsigned int count = 0;
+	time_t now;
+
+	agent = ni_lldp_agents[dev->link.ifindex % NI_LLDP_AGENT_HASH_SIZE];
+	for ( ; agent; agent = agent->next) {
+		if (agent->ifindex == dev->link.ifindex)
+			break;
+	}
+	if (!agent)
+		return 0;
+
+	now = time(NULL);
+	for (peer = agent->peers; peer; peer = peer->next) {
+		if (peer->expires <= now)
+			continue;
+		if (func)
+			func(peer->data, peer->expires - now, user_data);
+		count++;
+	}
+	return count;
+}
+
 /*
  * LLDP receive handling
  */
@@ -735,7 +1049,6 @@ ni_lldp_receive(ni_socket_t *sock)
 		ni_buffer_t raw_id_buf;
 		const void *raw_id;
 		unsigned int raw_id_len;
-		ni_lldp_t *lldp;
 
 		/* Get the chassis and port ID TLVs as a raw string
 		 * of bytes. */
@@ -743,14 +1056,7 @@ ni_lldp_receive(ni_socket_t *sock)
 		if (ni_lldp_pdu_get_raw_id(&raw_id_buf, &raw_id, &raw_id_len) < 0)
 			return;
 
-		lldp = ni_lldp_new();
-		if (ni_lldp_pdu_parse(lldp, &buf) < 0) {
-			ni_debug_lldp("%s: failed to parse LLDP PDU", agent->dev->name);
-			ni_lldp_free(lldp);
-			return;
-		}
-
-		ni_lldp_agent_update(agent, lldp, raw_id, raw_id_len);
+		ni_lldp_agent_update(agent, &buf, raw_id, raw_id_len);
 	}
 
 }
@@ -1231,7 +1537,7 @@ ni_lldp_tlv_get_port_id(ni_lldp_t *lldp, ni_buffer_t *bp)
 	if ((subtype = ni_buffer_getc(bp)) < 0)
 		return -1;
 
-	lldp->chassis_id.type = subtype;
+	lldp->port_id.type = subtype;
 	switch (lldp->port_id.type) {
 	case NI_LLDP_PORT_ID_INTERFACE_ALIAS:
 	case NI_LLDP_PORT_ID_PORT_COMPONENT:
@@ -1282,6 +1588,39 @@ ni_lldp_tlv_put_syscaps(const ni_lldp_t *lldp, ni_buffer_t *bp)
 	return ni_lldp_tlv_put(bp, NI_LLDP_TLV_SYSTEM_CAPS, syscaps, 4);
 }
 
+static int
+ni_lldp_tlv_get_syscaps(ni_lldp_t *lldp, ni_buffer_t *bp)
+{
+	uint16_t syscaps[2];
+
+	/* the system and the enabled capabilities */
+	if (ni_buffer_get(bp, syscaps, 4) < 0)
+		return -1;
+	lldp->system.capabilities = ntohs(syscaps[1]);
+	return 0;
+}
+
+static int
+ni_lldp_tlv_get_port_description(ni_lldp_t *lldp, ni_buffer_t *bp)
+{
+	ni_string_free(&lldp->port_description);
+	return ni_lldp_tlv_get_string(bp, &lldp->port_description);
+}
+
+static int
+ni_lldp_tlv_get_system_name(ni_lldp_t *lldp, ni_buffer_t *bp)
+{
+	ni_string_free(&lldp->system.name);
+	return ni_lldp_tlv_get_string(bp, &lldp->system.name);
+}
+
+static int
+ni_lldp_tlv_get_system_description(ni_lldp_t *lldp, ni_buffer_t *bp)
+{
+	ni_string_free(&lldp->system.description);
+	return ni_lldp_tlv_get_string(bp, &lldp->system.description);
+}
+
 static int
 ni_lldp_tlv_put_ieee_802_1(ni_lldp_ieee_802_1_t *ieee, ni_buffer_t *bp)
 {
@@ -1580,8 +1919,9 @@ ni_lldp_pdu_build(const ni_lldp_t *lldp, ni_dcbx_state_t *dcbx, ni_buffer_t *bp)
 	 || ni_lldp_tlv_put_ttl(lldp, bp) < 0)
 		return -1;
 
+	/* A shutdown PDU carries no optional TLVs */
 	if (lldp->ttl == 0)
-		return 0;
+		return ni_lldp_tlv_put_end(bp);
 
 	/* Optional parts */
 	ni_debug_lldp("port_description=%s", lldp->port_description);
@@ -1693,6 +2033,10 @@ ni_lldp_pdu_parse(ni_lldp_t *lldp, ni_buffer_t *bp)
 	[NI_LLDP_TLV_CHASSIS_ID]	= ni_lldp_tlv_get_chassis_id,
 	[NI_LLDP_TLV_PORT_ID]		= ni_lldp_tlv_get_port_id,
 	[NI_LLDP_TLV_TTL]		= ni_lldp_tlv_get_ttl,
+	[NI_LLDP_TLV_PORT_DESC]		= ni_lldp_tlv_get_port_description,
+	[NI_LLDP_TLV_SYSTEM_NAME]	= ni_lldp_tlv_get_system_name,
+	[NI_LLDP_TLV_SYSTEM_DESC]	= ni_lldp_tlv_get_system_description,
+	[NI_LLDP_TLV_SYSTEM_CAPS]	= ni_lldp_tlv_get_syscaps,
 	[NI_LLDP_TLV_ORGSPEC]		= ni_lldp_tlv_get_orgspec,
 	};
 
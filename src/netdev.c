@@ -36,6 +36,7 @@
 #include "netinfo_priv.h"
 #include "util_priv.h"
 #include "appconfig.h"
+#include "client/status_snapshot.h"
 
 /*
  * Constructor for network interface.
@@ -545,6 +546,8 @@ ni_netdev_set_client_state(ni_netdev_t *dev, ni_client_state_t *client_state)
 {
 	if (dev->client_state == client_state)
 		return;
+
+	ni_status_snapshot_invalidate();
 	if (dev->client_state)
 		ni_client_state_free(dev->client_state);
 
@@ -709,6 +712,7 @@ ni_netdev_set_lease(ni_netdev_t *dev, ni_addrconf_lease_t *lease)
 {
 	ni_addrconf_lease_t **pos;
 
+	ni_status_snapshot_invalidate();
 	ni_netdev_unset_lease(dev, lease->family, lease->type);
 	for (pos = &dev->leases; *pos != NULL; pos = &(*pos)->next)
 		;
@@ -722,8 +726,10 @@ ni_netdev_unset_lease(ni_netdev_t *dev, unsigned int family, ni_addrconf_mode_t
 {
 	ni_addrconf_lease_t *lease;
 
-	if ((lease = __ni_netdev_find_lease(dev, family, type, 1)) != NULL)
+	if ((lease = __ni_netdev_find_lease(dev, family, type, 1)) != NULL) {
 		ni_addrconf_lease_free(lease);
+		ni_status_snapshot_invalidate();
+	}
 	return 0;
 }
 
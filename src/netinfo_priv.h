@@ -75,7 +75,14 @@ extern void		__ni_system_ethernet_refresh(ni_netdev_t *);
 extern void		__ni_system_ethernet_update(ni_netdev_t *, ni_ethernet_t *);
 
 /* FIXME: These should go elsewhere, maybe runtime.h */
+typedef void		ni_addrconf_updater_notify_t(ni_netdev_t *, ni_addrconf_lease_t *,
+						int, ni_event_t, const ni_uuid_t *);
+
 extern int		__ni_system_interface_update_lease(ni_netdev_t *, ni_addrconf_lease_t **);
+extern ni_bool_t	ni_addrconf_updater_set_notify(ni_addrconf_lease_t *,
+						ni_addrconf_updater_notify_t *,
+						ni_event_t, const ni_uuid_t *);
+extern void		ni_addrconf_updater_resume(ni_netdev_t *);
 
 /* FIXME: These should go elsewhere, maybe runtime.h */
 extern int		__ni_system_hostname_put(const char *);
@@ -123,13 +130,37 @@ typedef struct ni_capture_protinfo {
 
 	/* If ip_protocol is IPPROT_UDP or TCP */
 	uint16_t		ip_port;
+
+	/* If ip_port is the DHCP client port, match the reply to
+	 * this xid (in network byte order) and client hwaddr */
+	uint32_t		dhcp_xid;
+	ni_hwaddr_t		dhcp_chaddr;
+
+	/* If eth_protocol is ETHERTYPE_ARP, match packets with one of
+	 * these sender or target addresses; with more than fit into the
+	 * filter, all ARP packets are received */
+	const struct in_addr *	arp_addrs;
+	unsigned int		arp_count;
+
+	/* Receive via one socket shared with all captures with the
+	 * same protocol and port, demultiplexed by ifindex */
+	ni_bool_t		shared;
 } ni_capture_protinfo_t;
 
+typedef struct ni_capture_stats {
+	unsigned long		packets;
+	unsigned long		drops;
+	unsigned long		freezes;
+} ni_capture_stats_t;
+
 extern int		ni_capture_devinfo_init(ni_capture_devinfo_t *, const char *, const ni_linkinfo_t *);
 extern int		ni_capture_devinfo_refresh(ni_capture_devinfo_t *, const char *, const ni_linkinfo_t *);
 extern ni_capture_t *	ni_capture_open(const ni_capture_devinfo_t *, const ni_capture_protinfo_t *, void (*)(ni_socket_t *));
+extern int		ni_capture_set_filter(ni_capture_t *, const ni_capture_protinfo_t *);
 extern int		ni_capture_recv(ni_capture_t *, ni_buffer_t *);
 extern ssize_t		ni_capture_send(ni_capture_t *, const ni_buffer_t *, const ni_timeout_param_t *);
+extern unsigned int	ni_capture_send_batch(ni_capture_t * const *, const ni_buffer_t * const *,
+					unsigned int);
 extern void		ni_capture_disarm_retransmit(ni_capture_t *);
 extern void		ni_capture_force_retransmit(ni_capture_t *, unsigned int);
 extern void		ni_capture_free(ni_capture_t *);
@@ -140,6 +171,7 @@ extern int		ni_capture_build_udp_header(ni_buffer_t *,
 extern void		ni_capture_set_user_data(ni_capture_t *, void *);
 extern void *		ni_capture_get_user_data(const ni_capture_t *);
 extern int		ni_capture_is_valid(const ni_capture_t *, int protocol);
+extern int		ni_capture_get_stats(ni_capture_t *, ni_capture_stats_t *);
 
 typedef struct ni_arp_socket ni_arp_socket_t;
 
@@ -164,6 +196,7 @@ struct ni_arp_socket {
 extern ni_arp_socket_t *ni_arp_socket_open(const ni_capture_devinfo_t *,
 					ni_arp_callback_t *, void *);
 extern void		ni_arp_socket_close(ni_arp_socket_t *);
+extern int		ni_arp_socket_set_filter(ni_arp_socket_t *, const struct in_addr *, unsigned int);
 extern int		ni_arp_send_request(ni_arp_socket_t *, struct in_addr, struct in_addr);
 extern int		ni_arp_send_reply(ni_arp_socket_t *, struct in_addr,
 				const ni_hwaddr_t *, struct in_addr);
@@ -171,4 +204,30 @@ extern int		ni_arp_send_grat_reply(ni_arp_socket_t *, struct in_addr);
 extern int		ni_arp_send_grat_request(ni_arp_socket_t *, struct in_addr);
 extern int		ni_arp_send(ni_arp_socket_t *, const ni_arp_packet_t *);
 
+/*
+ * The ARP engine shares one ARP socket per interface between all users
+ * in the process, filtered to the addresses they subscribed to. Probes
+ * and announcements of all subscriptions on an interface are sent in
+ * common timer rounds.
+ */
+typedef struct ni_arp_subscription ni_arp_subscription_t;
+
+typedef enum ni_arp_event {
+	NI_ARP_EVENT_VERIFIED,		/* probing done, no conflict seen */
+	NI_ARP_EVENT_ANNOUNCED,		/* all announcements sent */
+	NI_ARP_EVENT_CONFLICT,		/* another host uses (or probes for) the address */
+} ni_arp_event_t;
+
+typedef void		ni_arp_notify_t(ni_arp_subscription_t *, ni_arp_event_t,
+					const ni_arp_packet_t *, void *);
+
+extern ni_arp_subscription_t *ni_arp_subscribe(const ni_capture_devinfo_t *, struct in_addr,
+					ni_arp_notify_t *, void *);
+extern void		ni_arp_unsubscribe(ni_arp_subscription_t *);
+extern int		ni_arp_probe(ni_arp_subscription_t *, unsigned int,
+					unsigned int, unsigned int);
+extern int		ni_arp_announce(ni_arp_subscription_t *, unsigned int,
+					unsigned int, unsigned int);
+extern int		ni_arp_defend(ni_arp_subscription_t *, const ni_hwaddr_t *);
+
 #endif /* __NETINFO_PRIV_H__ */
@@ -14,6 +14,12 @@
 #include <errno.h>
 #include <signal.h>
 
+#if defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP) && \
+    defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP)
+#define NI_PROCESS_USE_POSIX_SPAWN
+#include <spawn.h>
+#endif
+
 #include <wicked/logging.h>
 #include <wicked/socket.h>
 #include "socket_priv.h"
@@ -467,6 +473,54 @@ ni_process_run_and_capture_output(ni_process_t *pi, ni_buffer_t *out_buffer)
 	return __ni_process_run_info(pi);
 }
 
+#ifdef NI_PROCESS_USE_POSIX_SPAWN
+/*
+ * posix_spawn does not copy the page tables of the daemon like fork,
+ * which dominates the cost of running short scripts with a large heap.
+ * The argv and environ arrays are always NULL terminated and passed as
+ * they are.
+ */
+static pid_t
+__ni_process_spawn(ni_process_t *pi, int *pfd)
+{
+	static char *noenv[] = { NULL };
+	posix_spawn_file_actions_t actions;
+	const char *arg0 = pi->argv.data[0];
+	char **envp;
+	pid_t pid = -1;
+	int err;
+
+	if ((err = posix_spawn_file_actions_init(&actions))) {
+		errno = err;
+		return -1;
+	}
+
+	if ((err = posix_spawn_file_actions_addchdir_np(&actions, "/")) ||
+	    (err = posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0)))
+		goto done;
+
+	if (pfd) {
+		if ((err = posix_spawn_file_actions_adddup2(&actions, pfd[1], 1)) ||
+		    (err = posix_spawn_file_actions_adddup2(&actions, pfd[1], 2)))
+			goto done;
+	}
+
+	if ((err = posix_spawn_file_actions_addclosefrom_np(&actions, 3)))
+		goto done;
+
+	envp = pi->environ.data ? pi->environ.data : noenv;
+	err = posix_spawn(&pid, arg0, &actions, NULL, pi->argv.data, envp);
+
+done:
+	posix_spawn_file_actions_destroy(&actions);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return pid;
+}
+#endif
+
 int
 __ni_process_run(ni_process_t *pi, int *pfd)
 {
@@ -485,6 +539,18 @@ __ni_process_run(ni_process_t *pi, int *pfd)
 
 	signal(SIGCHLD, ni_process_sigchild);
 
+#ifdef NI_PROCESS_USE_POSIX_SPAWN
+	if ((pid = __ni_process_spawn(pi, pfd)) < 0) {
+		int err = errno;
+
+		ni_error("%s: unable to spawn %s: %m", __func__, arg0);
+		if (err == ENOENT || err == EACCES || err == ENOEXEC)
+			return NI_PROCESS_COMMAND;
+		return NI_PROCESS_FAILURE;
+	}
+	pi->pid = pid;
+	pi->status = -1;
+#else
 	if ((pid = fork()) < 0) {
 		ni_error("%s: unable to fork child process: %m", __func__);
 		return NI_PROCESS_FAILURE;
@@ -524,6 +590,7 @@ __ni_process_run(ni_process_t *pi, int *pfd)
 		ni_error("%s: cannot execute %s: %m", __func__, arg0);
 		exit(127);
 	}
+#endif
 
 	return NI_PROCESS_SUCCESS;
 }
@@ -66,6 +66,7 @@ __ni_sysconfig_read(const char *filename, const char **varnames)
 	}
 
 	sc = ni_sysconfig_new(filename);
+	ni_var_array_index(&sc->vars);
 	while (fgets(linebuf, sizeof(linebuf), fp) != NULL) {
 		char *name, *value;
 		char *sp = linebuf;
@@ -106,6 +107,7 @@ __ni_sysconfig_read(const char *filename, const char **varnames)
 
 		ni_sysconfig_set(sc, name, value);
 	}
+	ni_var_array_index_prefixes(&sc->vars);
 
 	fclose(fp);
 	return sc;
@@ -297,6 +299,7 @@ ni_sysconfig_merge_defaults(const ni_sysconfig_t *config, const ni_sysconfig_t *
 
 	if (!config || !(merged =  ni_sysconfig_new(config->pathname)))
 		return NULL;
+	ni_var_array_index(&merged->vars);
 
 	/* apply global defaults first  */
 	if (defaults)
@@ -307,6 +310,7 @@ ni_sysconfig_merge_defaults(const ni_sysconfig_t *config, const ni_sysconfig_t *
 		const ni_var_t *var = &config->vars.data[i];
 		ni_var_array_set(&merged->vars, var->name, var->value);
 	}
+	ni_var_array_index_prefixes(&merged->vars);
 	return merged;
 }
 
@@ -393,16 +397,18 @@ int
 ni_sysconfig_find_matching(const ni_sysconfig_t *sc, const char *prefix,
 		ni_string_array_t *res)
 {
-	unsigned int i, pfxlen;
+	ni_uint_array_t pos = NI_UINT_ARRAY_INIT;
+	unsigned int i;
 	ni_var_t *var;
 
-	pfxlen = strlen(prefix);
-	for (i = 0, var = sc->vars.data; i < sc->vars.count; ++i, ++var) {
-		const char *value = var->value;
+	ni_var_array_find_prefixed(&sc->vars, prefix, &pos);
+	for (i = 0; i < pos.count; ++i) {
+		var = &sc->vars.data[pos.data[i]];
 
-		if (value && *value && !strncmp(var->name, prefix, pfxlen))
+		if (var->value && *var->value)
 			ni_string_array_append(res, var->name);
 	}
+	ni_uint_array_destroy(&pos);
 	return res->count;
 }
 
@@ -8,6 +8,9 @@
 #endif
 
 #include <sys/time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wicked/util.h>
 #include <wicked/socket.h>
 #include "netinfo_priv.h"
 #include "util_priv.h"
@@ -229,3 +232,162 @@ ni_timeout_arm(struct timeval *deadline, const ni_timeout_param_t *tp)
 	return __ni_timeout_arm_msec(deadline, tp->timeout * 1000, &jitter);
 }
 
+
+/*
+ * Token bucket used to limit the rate of (initial) transmissions
+ * of many devices. Instead of counting tokens, we keep the time the
+ * next token would arrive with an empty bucket (GCRA); a reservation
+ * never fails, but returns how long to wait for the token, while a
+ * take fails when no token is available right now.
+ */
+void
+ni_token_bucket_init(ni_token_bucket_t *tb, unsigned int rate, unsigned int burst)
+{
+	memset(tb, 0, sizeof(*tb));
+	tb->rate = rate;
+	tb->burst = burst ? burst : 1;
+}
+
+/*
+ * Returns when (usec) a token used at @when conforms and sets @tat
+ * to the arrival time of the next token after it.
+ */
+static uint64_t
+__ni_token_bucket_next(const ni_token_bucket_t *tb, uint64_t when, uint64_t *tat)
+{
+	uint64_t allow, interval, tolerance;
+
+	interval = 1000000 / tb->rate ? 1000000 / tb->rate : 1;
+	tolerance = (uint64_t)(tb->burst - 1) * interval;
+
+	/* the clock went back (far) -- start over */
+	*tat = (uint64_t)tb->tat.tv_sec * 1000000 + tb->tat.tv_usec;
+	if (*tat > when + tolerance + interval * NI_TOKEN_BUCKET_MAX_QUEUE)
+		*tat = when;
+	if (*tat < when)
+		*tat = when;
+
+	allow = *tat > tolerance ? *tat - tolerance : 0;
+	*tat += interval;
+	return allow;
+}
+
+unsigned long
+ni_token_bucket_reserve(ni_token_bucket_t *tb, unsigned long delay)
+{
+	struct timeval now;
+	uint64_t when, tat, allow;
+
+	if (!tb || !tb->rate)
+		return 0;
+
+	ni_timer_get_time(&now);
+	when = (uint64_t)now.tv_sec * 1000000 + now.tv_usec + (uint64_t)delay * 1000;
+	allow = __ni_token_bucket_next(tb, when, &tat);
+	tb->tat.tv_sec = tat / 1000000;
+	tb->tat.tv_usec = tat % 1000000;
+
+	if (allow <= when)
+		return 0;
+	return (allow - when + 999) / 1000;
+}
+
+ni_bool_t
+ni_token_bucket_take(ni_token_bucket_t *tb)
+{
+	struct timeval now;
+	uint64_t when, tat;
+
+	if (!tb || !tb->rate)
+		return TRUE;
+
+	ni_timer_get_time(&now);
+	when = (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+	if (__ni_token_bucket_next(tb, when, &tat) > when)
+		return FALSE;
+
+	tb->tat.tv_sec = tat / 1000000;
+	tb->tat.tv_usec = tat % 1000000;
+	return TRUE;
+}
+
+/*
+ * Align the deadlines of timers sharing a key (e.g. the lease renewals
+ * for one server), so they expire together and can be handled in one
+ * wakeup. A timeout is shortened by at most window msec to expire at
+ * the deadline of the group; otherwise it starts a new group.
+ */
+static void
+__ni_timer_deadline(struct timeval *deadline, const struct timeval *now, unsigned long msec)
+{
+	struct timeval delta;
+
+	delta.tv_sec = msec / 1000;
+	delta.tv_usec = (msec % 1000) * 1000;
+	timeradd(now, &delta, deadline);
+}
+
+struct ni_timer_align {
+	ni_timer_align_t *	next;
+	ni_opaque_t		key;
+	struct timeval		deadline;
+};
+
+unsigned long
+ni_timer_align(ni_timer_align_t **list, const void *key, size_t len,
+		unsigned long timeout, unsigned long window)
+{
+	ni_timer_align_t *group, **pos;
+	struct timeval now, target, earliest;
+	ni_opaque_t okey;
+
+	if (!list || !key || !len || !window || !timeout)
+		return timeout;
+
+	ni_opaque_set(&okey, key, len);
+	ni_timer_get_time(&now);
+	__ni_timer_deadline(&target, &now, timeout);
+	__ni_timer_deadline(&earliest, &now, timeout > window ? timeout - window : 0);
+
+	for (pos = list; (group = *pos) != NULL; ) {
+		if (timercmp(&group->deadline, &now, <)) {
+			*pos = group->next;
+			free(group);
+			continue;
+		}
+		if (ni_opaque_eq(&group->key, &okey))
+			break;
+		pos = &group->next;
+	}
+
+	if (group && !timercmp(&group->deadline, &earliest, <)
+		   && !timercmp(&group->deadline, &target, >)) {
+		struct timeval delta;
+
+		timersub(&group->deadline, &now, &delta);
+		ni_debug_timer("timeout %lu aligned to %ld.%06ld",
+				timeout, (long)delta.tv_sec, (long)delta.tv_usec);
+		return delta.tv_sec * 1000 + delta.tv_usec / 1000;
+	}
+
+	if (!group) {
+		group = xcalloc(1, sizeof(*group));
+		group->key = okey;
+		group->next = *list;
+		*list = group;
+	}
+	if (timercmp(&group->deadline, &target, <))
+		group->deadline = target;
+	return timeout;
+}
+
+void
+ni_timer_align_destroy(ni_timer_align_t **list)
+{
+	ni_timer_align_t *group;
+
+	while (list && (group = *list) != NULL) {
+		*list = group->next;
+		free(group);
+	}
+}
@@ -8,6 +8,8 @@
 #endif
 
 #include <unistd.h>
+#include <errno.h>
+#include <resolv.h>
 
 #include <wicked/netinfo.h>
 #include <wicked/logging.h>
@@ -15,6 +17,7 @@
 #include <wicked/system.h>
 #include <wicked/resolver.h>
 #include <wicked/leaseinfo.h>
+#include <wicked/socket.h>
 
 #include "netinfo_priv.h"
 #include "util_priv.h"
@@ -31,6 +34,13 @@
 #define NI_UPDATER_REVERSE_MAX_CNT	1
 #endif
 
+/* msecs the builtin backend collects changes before applying them */
+#ifndef NI_UPDATER_DEBOUNCE_MSEC
+#define NI_UPDATER_DEBOUNCE_MSEC	250
+#endif
+
+#define	NI_UPDATER_DEFAULT_HOSTNAME	"/etc/HOSTNAME"
+
 #define	NI_UPDATER_SOURCE_ARRAY_CHUNK	4
 #define	NI_UPDATER_SOURCE_ARRAY_INIT	{ 0, NULL }
 
@@ -41,6 +51,12 @@ struct ni_updater_source {
 	unsigned int			seqno;		/* sequence number of lease */
 	ni_netdev_ref_t			d_ref;
 	const ni_addrconf_lease_t *	lease;
+
+	/* copy of the lease data, used after the lease is gone */
+	unsigned int			type;
+	unsigned int			family;
+	char *				hostname;
+	ni_resolver_info_t *		resolver;
 };
 
 typedef struct ni_updater_source_array	ni_updater_source_array_t;
@@ -55,15 +71,26 @@ typedef struct ni_updater {
 	unsigned int			kind;
 	int				format;
 	ni_bool_t			enabled;
+	ni_bool_t			builtin;
+	ni_bool_t			pending;
 	unsigned int			have_backup;
 
+	char *				applied;	/* last builtin update */
+	struct {
+		unsigned int		ifindex;
+		unsigned int		type;
+		unsigned int		family;
+	} owner;					/* lease the hostname is from */
+
 	ni_shellcmd_t *			proc_backup;
 	ni_shellcmd_t *			proc_restore;
 	ni_shellcmd_t *			proc_install;
 	ni_shellcmd_t *			proc_remove;
+	ni_shellcmd_t *			proc_reload;
 } ni_updater_t;
 
 static ni_updater_t			updaters[__NI_ADDRCONF_UPDATER_MAX];
+static const ni_timer_t *		ni_updater_timer;
 
 static const ni_intmap_t		__ni_updater_format_names[] = {
 	{ "info",		NI_ADDRCONF_UPDATER_FORMAT_INFO	},
@@ -80,6 +107,7 @@ static const ni_intmap_t		__ni_updater_kind_names[] = {
 static const char *			ni_updater_name(unsigned int kind);
 static unsigned int			ni_updater_format_type(const char * format);
 static const char *			ni_updater_format_name(unsigned int format);
+static ni_bool_t			ni_system_updater_has_builtin(unsigned int kind);
 
 static ni_updater_source_t *
 ni_updater_source_new(void)
@@ -114,6 +142,9 @@ ni_updater_source_free(ni_updater_source_t *src)
 			src->seqno = 0;
 			src->lease = NULL;
 			ni_netdev_ref_destroy(&src->d_ref);
+			ni_string_free(&src->hostname);
+			if (src->resolver)
+				ni_resolver_info_free(src->resolver);
 			free(src);
 		}
 	}
@@ -227,11 +258,24 @@ ni_system_updaters_init(void)
 		updater->proc_restore = ni_extension_script_find(ex, "restore");
 		updater->proc_install = ni_extension_script_find(ex, "install");
 		updater->proc_remove = ni_extension_script_find(ex, "remove");
+		updater->proc_reload = ni_extension_script_find(ex, "reload");
+
+		/* the builtin backend is the default, where there is one */
+		if (!ni_string_eq(ex->backend, "script")) {
+			updater->builtin = ni_system_updater_has_builtin(kind);
+			if (!updater->builtin && ex->backend)
+				ni_warn("system-updater %s has no builtin backend, using scripts", name);
+		}
 
 		/* Create runtime directories for resolver and hostname extensions. */
 		if (!(ni_extension_statedir(name))) {
 			updater->enabled = 0;
 		} else
+		if (updater->builtin) {
+			/* the scripts are an optional fallback only */
+			if (updater->proc_install == NULL || updater->proc_remove == NULL)
+				updater->proc_install = updater->proc_remove = NULL;
+		} else
 		if (updater->proc_install == NULL) {
 			ni_warn("system-updater %s configured, but no install script defined", name);
 			updater->enabled = 0;
@@ -318,7 +362,7 @@ can_update_type(const ni_addrconf_lease_t *lease, unsigned int kind)
  * Add this lease to the given updater, to record that we can use the
  * information from this lease.
  */
-static void
+static ni_updater_source_t *
 ni_objectmodel_updater_add_source(unsigned int kind, const ni_addrconf_lease_t *lease,
 				const unsigned int ifindex, const char *ifname)
 {
@@ -327,10 +371,13 @@ ni_objectmodel_updater_add_source(unsigned int kind, const ni_addrconf_lease_t *
 	up = ni_updater_source_new();
 	up->seqno = lease->seqno;
 	up->lease = lease;
+	up->type = lease->type;
+	up->family = lease->family;
 	up->d_ref.index = ifindex;
 	ni_string_dup(&(up->d_ref.name), ifname);
 
 	ni_updater_source_array_append(&updaters[kind].sources, up);
+	return up;
 }
 
 /*
@@ -353,6 +400,33 @@ ni_objectmodel_updater_select_sources(ni_updater_t *updater, ni_updater_source_a
 	return sources->count - cnt;
 }
 
+/*
+ * Emit the event telling that we've updated the system settings
+ */
+static void
+ni_system_updater_notify(const ni_updater_t *updater)
+{
+	if (!ni_global.other_event)
+		return;
+
+	switch (updater->kind) {
+	case NI_ADDRCONF_UPDATER_RESOLVER:
+		ni_global.other_event(NI_EVENT_RESOLVER_UPDATED);
+		break;
+
+	case NI_ADDRCONF_UPDATER_HOSTNAME:
+		ni_global.other_event(NI_EVENT_HOSTNAME_UPDATED);
+		break;
+
+	case NI_ADDRCONF_UPDATER_GENERIC:
+		ni_global.other_event(NI_EVENT_GENERIC_UPDATED);
+		break;
+
+	default:
+		break;
+	}
+}
+
 /*
  * Run an extension script to update resolver, hostname etc.
  */
@@ -381,6 +455,416 @@ ni_system_updater_run(ni_shellcmd_t *shellcmd, ni_string_array_t *args)
 	return rv >= 0;
 }
 
+/*
+ * The builtin backend applies the merged data of all sources in one go,
+ * at most once per NI_UPDATER_DEBOUNCE_MSEC.
+ */
+static ni_bool_t
+ni_system_updater_has_builtin(unsigned int kind)
+{
+	switch (kind) {
+	case NI_ADDRCONF_UPDATER_RESOLVER:
+	case NI_ADDRCONF_UPDATER_HOSTNAME:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+/*
+ * Same preference as the resolver script: static, dhcp ipv4, dhcp ipv6
+ * and then everything else.
+ */
+static unsigned int
+ni_updater_source_preference(const ni_updater_source_t *src)
+{
+	switch (src->type) {
+	case NI_ADDRCONF_STATIC:
+		return 3;
+	case NI_ADDRCONF_DHCP:
+		return src->family == AF_INET ? 2 : 1;
+	default:
+		return 0;
+	}
+}
+
+static void
+ni_updater_source_array_sort(ni_updater_source_array_t *usa, const ni_updater_source_array_t *sources)
+{
+	unsigned int pref, i;
+
+	for (pref = 4; pref-- > 0; ) {
+		for (i = 0; i < sources->count; ++i) {
+			ni_updater_source_t *src = sources->data[i];
+
+			if (ni_updater_source_preference(src) == pref)
+				ni_updater_source_array_append(usa, ni_updater_source_ref(src));
+		}
+	}
+}
+
+static ni_resolver_info_t *
+ni_system_updater_merge_resolver(const ni_updater_t *updater)
+{
+	ni_updater_source_array_t sorted = NI_UPDATER_SOURCE_ARRAY_INIT;
+	ni_resolver_info_t *resolv;
+	unsigned int i, n;
+
+	resolv = ni_resolver_info_new();
+	ni_updater_source_array_sort(&sorted, &updater->sources);
+	for (i = 0; i < sorted.count; ++i) {
+		const ni_resolver_info_t *info = sorted.data[i]->resolver;
+
+		if (info == NULL)
+			continue;
+
+		if (!resolv->default_domain)
+			ni_string_dup(&resolv->default_domain, info->default_domain);
+
+		for (n = 0; n < info->dns_servers.count; ++n) {
+			const char *server = info->dns_servers.data[n];
+
+			if (resolv->dns_servers.count >= MAXNS)
+				break;
+			if (ni_string_array_index(&resolv->dns_servers, server) < 0)
+				ni_string_array_append(&resolv->dns_servers, server);
+		}
+
+		for (n = 0; n < info->dns_search.count; ++n) {
+			const char *domain = info->dns_search.data[n];
+
+			if (resolv->dns_search.count >= MAXDNSRCH)
+				break;
+			if (ni_string_array_index(&resolv->dns_search, domain) < 0)
+				ni_string_array_append(&resolv->dns_search, domain);
+		}
+	}
+	ni_updater_source_array_destroy(&sorted);
+
+	if (!resolv->default_domain && !resolv->dns_servers.count && !resolv->dns_search.count) {
+		ni_resolver_info_free(resolv);
+		return NULL;
+	}
+	return resolv;
+}
+
+static char *
+ni_system_updater_format_resolver(const ni_resolver_info_t *resolv)
+{
+	char *text = NULL;
+	unsigned int i;
+
+	ni_string_printf(&text, "domain=%s", resolv->default_domain ?: "");
+	for (i = 0; i < resolv->dns_servers.count; ++i)
+		ni_string_printf(&text, "%s nameserver=%s", text, resolv->dns_servers.data[i]);
+	for (i = 0; i < resolv->dns_search.count; ++i)
+		ni_string_printf(&text, "%s search=%s", text, resolv->dns_search.data[i]);
+	return text;
+}
+
+static int
+ni_system_updater_builtin_resolver(ni_updater_t *updater)
+{
+	ni_resolver_info_t *resolv;
+	char *text;
+
+	if (!(resolv = ni_system_updater_merge_resolver(updater))) {
+		if (!updater->have_backup)
+			return 0;
+
+		ni_debug_ifconfig("Restoring system resolver settings");
+		if (updater->have_backup > 1) {
+			if (__ni_system_resolver_restore() < 0) {
+				ni_error("failed to restore %s", _PATH_RESOLV_CONF);
+				return -1;
+			}
+		} else
+		if (unlink(_PATH_RESOLV_CONF) < 0 && errno != ENOENT) {
+			ni_error("cannot remove %s: %m", _PATH_RESOLV_CONF);
+			return -1;
+		}
+		updater->have_backup = 0;
+		ni_string_free(&updater->applied);
+		return 1;
+	}
+
+	text = ni_system_updater_format_resolver(resolv);
+	if (ni_string_eq(text, updater->applied)) {
+		ni_resolver_info_free(resolv);
+		free(text);
+		return 0;
+	}
+
+	/* have_backup is 2 when there was a file to back up, 1 when not */
+	if (!updater->have_backup) {
+		if (access(_PATH_RESOLV_CONF, F_OK) < 0) {
+			updater->have_backup = 1;
+		} else
+		if (__ni_system_resolver_backup() < 0) {
+			ni_error("failed to back up current %s settings",
+					ni_updater_name(updater->kind));
+		} else {
+			updater->have_backup = 2;
+		}
+	}
+
+	ni_debug_ifconfig("Updating system resolver settings: %s", text);
+	if (!updater->have_backup || __ni_system_resolver_put(resolv) < 0) {
+		ni_resolver_info_free(resolv);
+		free(text);
+		return -1;
+	}
+	ni_resolver_info_free(resolv);
+
+	ni_string_free(&updater->applied);
+	updater->applied = text;
+	return 1;
+}
+
+static char *
+ni_system_updater_default_hostname(void)
+{
+	char buffer[256], *name = NULL;
+	FILE *fp;
+
+	if (!(fp = fopen(NI_UPDATER_DEFAULT_HOSTNAME, "r")))
+		return NULL;
+
+	if (fgets(buffer, sizeof(buffer), fp)) {
+		buffer[strcspn(buffer, ". \t\r\n")] = '\0';
+		if (*buffer)
+			ni_string_dup(&name, buffer);
+	}
+	fclose(fp);
+	return name;
+}
+
+static ni_bool_t
+ni_system_updater_is_owner(const ni_updater_t *updater, const ni_updater_source_t *src)
+{
+	return	updater->owner.ifindex == src->d_ref.index &&
+		updater->owner.type == src->type &&
+		updater->owner.family == src->family;
+}
+
+/*
+ * As the hostname script, keep the hostname of the lease setting it
+ * first while it provides one; then use the preferred other lease.
+ */
+static int
+ni_system_updater_builtin_hostname(ni_updater_t *updater)
+{
+	ni_updater_source_array_t sorted = NI_UPDATER_SOURCE_ARRAY_INIT;
+	const ni_updater_source_t *src, *owner = NULL;
+	char current[256], *name = NULL;
+	unsigned int i;
+	int rv = 0;
+
+	ni_updater_source_array_sort(&sorted, &updater->sources);
+	for (i = 0; i < sorted.count; ++i) {
+		src = sorted.data[i];
+		if (ni_string_empty(src->hostname))
+			continue;
+		if (!owner || ni_system_updater_is_owner(updater, src))
+			owner = src;
+	}
+	if (owner) {
+		updater->owner.ifindex = owner->d_ref.index;
+		updater->owner.type = owner->type;
+		updater->owner.family = owner->family;
+		ni_string_dup(&name, owner->hostname);
+		name[strcspn(name, ".")] = '\0';
+	} else {
+		memset(&updater->owner, 0, sizeof(updater->owner));
+	}
+	ni_updater_source_array_destroy(&sorted);
+
+	/* applied is the hostname we've set, restore the default once unused */
+	if (ni_string_empty(name)) {
+		ni_string_free(&name);
+		if (!updater->applied)
+			return 0;
+		ni_string_free(&updater->applied);
+		if (!(name = ni_system_updater_default_hostname()))
+			return 0;
+	} else {
+		ni_string_dup(&updater->applied, name);
+	}
+
+	if (__ni_system_hostname_get(current, sizeof(current)) < 0)
+		current[0] = '\0';
+	current[strcspn(current, ".")] = '\0';
+
+	if (!ni_string_eq(current, name)) {
+		ni_debug_ifconfig("Updating system hostname: %s", name);
+		if (__ni_system_hostname_put(name) < 0) {
+			ni_error("cannot set hostname to %s: %m", name);
+			ni_string_free(&name);
+			return -1;
+		}
+		rv = 1;
+
+		/* e.g. syslog needs to pick up the new name */
+		if (updater->proc_reload && !ni_system_updater_run(updater->proc_reload, NULL))
+			ni_warn("failed to reload services after hostname change");
+	}
+	ni_string_free(&name);
+	return rv;
+}
+
+/*
+ * Run an install script using the lease data recorded in the source
+ */
+static ni_bool_t
+ni_system_updater_script_install(ni_updater_t *updater, const ni_updater_source_t *src)
+{
+	ni_string_array_t arguments = NI_STRING_ARRAY_INIT;
+	const char *ifname = src->d_ref.name;
+	const char *statedir;
+	char *file = NULL;
+	ni_bool_t result = FALSE;
+
+	ni_string_array_append(&arguments, "-i");
+	ni_string_array_append(&arguments, ifname);
+
+	ni_string_array_append(&arguments, "-t");
+	ni_string_array_append(&arguments, ni_addrconf_type_to_name(src->type));
+
+	ni_string_array_append(&arguments, "-f");
+	ni_string_array_append(&arguments, ni_addrfamily_type_to_name(src->family));
+
+	switch (updater->kind) {
+	case NI_ADDRCONF_UPDATER_GENERIC:
+		if (!(file = ni_leaseinfo_path(ifname, src->type, src->family))) {
+			ni_error("Unable to determine leaseinfo file path.");
+			goto done;
+		}
+		ni_string_array_append(&arguments, file);
+		ni_string_array_append(&arguments,
+				ni_updater_format_name(updater->format));
+		break;
+
+	case NI_ADDRCONF_UPDATER_RESOLVER:
+		statedir = ni_extension_statedir(ni_updater_name(updater->kind));
+		if (!statedir) {
+			ni_error("failed to get %s statedir", ni_updater_name(updater->kind));
+			goto done;
+		}
+		ni_string_printf(&file, "%s/resolv.conf.%s.%s.%s",
+				statedir, ifname,
+				ni_addrconf_type_to_name(src->type),
+				ni_addrfamily_type_to_name(src->family));
+		ni_string_array_append(&arguments, file);
+		break;
+
+	case NI_ADDRCONF_UPDATER_HOSTNAME:
+		if (ni_string_empty(src->hostname))
+			goto done;
+		ni_string_array_append(&arguments, src->hostname);
+		break;
+
+	default:
+		ni_error("cannot install new %s settings - file format not understood",
+				ni_updater_name(updater->kind));
+		goto done;
+	}
+
+	if (!ni_system_updater_run(updater->proc_install, &arguments)) {
+		ni_error("failed to install %s settings", ni_updater_name(updater->kind));
+		goto done;
+	}
+
+	result = TRUE;
+	ni_system_updater_notify(updater);
+
+done:
+	if (file)
+		free(file);
+	ni_string_array_destroy(&arguments);
+
+	return result;
+}
+
+/*
+ * When the builtin backend fails, hand the current sources over to the
+ * scripts and keep using them.
+ */
+static void
+ni_system_updater_fallback(ni_updater_t *updater)
+{
+	unsigned int i;
+
+	updater->builtin = FALSE;
+	if (!updater->proc_install) {
+		ni_error("failed to update system %s settings",
+				ni_updater_name(updater->kind));
+		return;
+	}
+
+	ni_warn("builtin %s updater failed, falling back to scripts",
+			ni_updater_name(updater->kind));
+
+	updater->have_backup = 0;
+	ni_string_free(&updater->applied);
+	if (updater->proc_backup) {
+		if (!ni_system_updater_run(updater->proc_backup, NULL))
+			ni_error("failed to back up current %s settings",
+					ni_updater_name(updater->kind));
+		else
+			updater->have_backup = 1;
+	}
+
+	for (i = 0; i < updater->sources.count; ++i)
+		ni_system_updater_script_install(updater, updater->sources.data[i]);
+}
+
+static void
+ni_system_updater_flush(void *user_data, const ni_timer_t *timer)
+{
+	unsigned int kind;
+	int rv;
+
+	if (ni_updater_timer != timer)
+		return;
+	ni_updater_timer = NULL;
+
+	for (kind = 0; kind < __NI_ADDRCONF_UPDATER_MAX; ++kind) {
+		ni_updater_t *updater = &updaters[kind];
+
+		if (!updater->pending)
+			continue;
+		updater->pending = FALSE;
+
+		switch (kind) {
+		case NI_ADDRCONF_UPDATER_RESOLVER:
+			rv = ni_system_updater_builtin_resolver(updater);
+			break;
+		case NI_ADDRCONF_UPDATER_HOSTNAME:
+			rv = ni_system_updater_builtin_hostname(updater);
+			break;
+		default:
+			rv = 0;
+			break;
+		}
+
+		if (rv < 0)
+			ni_system_updater_fallback(updater);
+		else
+		if (rv > 0)
+			ni_system_updater_notify(updater);
+	}
+}
+
+static void
+ni_system_updater_schedule(ni_updater_t *updater)
+{
+	updater->pending = TRUE;
+	if (!ni_updater_timer) {
+		ni_updater_timer = ni_timer_register(NI_UPDATER_DEBOUNCE_MSEC,
+					ni_system_updater_flush, NULL);
+	}
+}
+
 /*
  * Back up current configuration
  */
@@ -409,6 +893,11 @@ ni_system_updater_backup(ni_updater_t *updater, const char *ifname)
 static ni_bool_t
 ni_system_updater_restore(ni_updater_t *updater, const char *ifname)
 {
+	if (updater->builtin) {
+		ni_system_updater_schedule(updater);
+		return TRUE;
+	}
+
 	if (!updater->have_backup)
 		return TRUE;
 
@@ -429,9 +918,9 @@ ni_system_updater_restore(ni_updater_t *updater, const char *ifname)
  * Install information from a lease, and remember that we did
  */
 static ni_bool_t
-ni_system_updater_install(ni_updater_t *updater, const ni_addrconf_lease_t *lease, const char *ifname)
+ni_system_updater_install(ni_updater_t *updater, const ni_addrconf_lease_t *lease, ni_updater_source_t *src)
 {
-	ni_string_array_t arguments = NI_STRING_ARRAY_INIT;
+	const char *ifname = src->d_ref.name;
 	const char *statedir = NULL;
 	char *file = NULL;
 	ni_bool_t result = FALSE;
@@ -442,31 +931,17 @@ ni_system_updater_install(ni_updater_t *updater, const ni_addrconf_lease_t *leas
 					ni_addrconf_type_to_name(lease->type),
 					ni_addrfamily_type_to_name(lease->family));
 
-	if (!updater->proc_install)
+	if (!updater->builtin && !updater->proc_install)
 		return TRUE;
 
-	if (!ifname || (!updater->have_backup && !ni_system_updater_backup(updater, ifname)))
+	if (!ifname)
 		return FALSE;
 
-	ni_string_array_append(&arguments, "-i");
-	ni_string_array_append(&arguments, ifname);
-
-	ni_string_array_append(&arguments, "-t");
-	ni_string_array_append(&arguments, ni_addrconf_type_to_name(lease->type));
-
-	ni_string_array_append(&arguments, "-f");
-	ni_string_array_append(&arguments, ni_addrfamily_type_to_name(lease->family));
-
 	switch (updater->kind) {
 	case NI_ADDRCONF_UPDATER_GENERIC:
 		switch (updater->format) {
 		case NI_ADDRCONF_UPDATER_FORMAT_INFO:
 			ni_leaseinfo_dump(NULL, lease, ifname, NULL);
-			if (!(file = ni_leaseinfo_path(ifname, lease->type, lease->family))) {
-				ni_error("Unable to determine leaseinfo file path.");
-				goto done;
-			}
-			ni_string_array_append(&arguments, file);
 			break;
 
 		default:
@@ -474,9 +949,6 @@ ni_system_updater_install(ni_updater_t *updater, const ni_addrconf_lease_t *leas
 				ni_updater_name(updater->kind));
 			goto done;
 		}
-
-		ni_string_array_append(&arguments,
-				ni_updater_format_name(updater->format));
 		break;
 
 	case NI_ADDRCONF_UPDATER_RESOLVER:
@@ -489,18 +961,22 @@ ni_system_updater_install(ni_updater_t *updater, const ni_addrconf_lease_t *leas
 				statedir, ifname,
 				ni_addrconf_type_to_name(lease->type),
 				ni_addrfamily_type_to_name(lease->family));
-		ni_string_array_append(&arguments, file);
 
 		if ((rv = ni_resolver_write_resolv_conf(file, lease->resolver, NULL)) < 0) {
 			ni_error("failed to write resolver info to file: %s",
 					ni_strerror(rv));
 			goto done;
 		}
+
+		src->resolver = ni_resolver_info_new();
+		ni_string_dup(&src->resolver->default_domain, lease->resolver->default_domain);
+		ni_string_array_copy(&src->resolver->dns_servers, &lease->resolver->dns_servers);
+		ni_string_array_copy(&src->resolver->dns_search, &lease->resolver->dns_search);
 		break;
 
 	case NI_ADDRCONF_UPDATER_HOSTNAME:
 		if (!ni_string_empty(lease->hostname)) {
-			ni_string_array_append(&arguments, lease->hostname);
+			ni_string_dup(&src->hostname, lease->hostname);
 		} else {
 			const ni_address_t *ap;
 			char *name = NULL;
@@ -529,8 +1005,7 @@ ni_system_updater_install(ni_updater_t *updater, const ni_addrconf_lease_t *leas
 				ni_note("Skipping hostname update, none available");
 				goto done;
 			}
-			ni_string_array_append(&arguments, name);
-			ni_string_free(&name);
+			src->hostname = name;
 		}
 		break;
 
@@ -540,37 +1015,20 @@ ni_system_updater_install(ni_updater_t *updater, const ni_addrconf_lease_t *leas
 		goto done;
 	}
 
-	if (!ni_system_updater_run(updater->proc_install, &arguments)) {
-		ni_error("failed to install %s settings", ni_updater_name(updater->kind));
+	if (updater->builtin) {
+		ni_system_updater_schedule(updater);
+		result = TRUE;
 		goto done;
 	}
 
-	result = TRUE;
-
-	switch (updater->kind) {
-	case NI_ADDRCONF_UPDATER_RESOLVER:
-		if (ni_global.other_event)
-			ni_global.other_event(NI_EVENT_RESOLVER_UPDATED);
-		break;
-
-	case NI_ADDRCONF_UPDATER_HOSTNAME:
-		if (ni_global.other_event)
-			ni_global.other_event(NI_EVENT_HOSTNAME_UPDATED);
-		break;
-
-	case NI_ADDRCONF_UPDATER_GENERIC:
-		if (ni_global.other_event)
-			ni_global.other_event(NI_EVENT_GENERIC_UPDATED);
-		break;
+	if (!updater->have_backup && !ni_system_updater_backup(updater, ifname))
+		goto done;
 
-	default:
-		break;
-	}
+	result = ni_system_updater_script_install(updater, src);
 
 done:
 	if (file)
 		free(file);
-	ni_string_array_destroy(&arguments);
 
 	return result;
 }
@@ -580,15 +1038,32 @@ done:
  * from a device.
  */
 static ni_bool_t
-ni_system_updater_remove(ni_updater_t *updater, const ni_addrconf_lease_t *lease, const char *ifname)
+ni_system_updater_remove(ni_updater_t *updater, const ni_updater_source_t *src)
 {
 	ni_string_array_t arguments = NI_STRING_ARRAY_INIT;
+	const char *ifname = src->d_ref.name;
+	const char *statedir;
+	char *file = NULL;
 	ni_bool_t result = FALSE;
 
 	ni_debug_ifconfig("Removing system %s settings from %s %s/%s lease",
 			ni_updater_name(updater->kind), ifname,
-			ni_addrconf_type_to_name(lease->type),
-			ni_addrfamily_type_to_name(lease->family));
+			ni_addrconf_type_to_name(src->type),
+			ni_addrfamily_type_to_name(src->family));
+
+	if (updater->builtin) {
+		if (updater->kind == NI_ADDRCONF_UPDATER_RESOLVER &&
+		    (statedir = ni_extension_statedir(ni_updater_name(updater->kind)))) {
+			ni_string_printf(&file, "%s/resolv.conf.%s.%s.%s",
+					statedir, ifname,
+					ni_addrconf_type_to_name(src->type),
+					ni_addrfamily_type_to_name(src->family));
+			unlink(file);
+			free(file);
+		}
+		ni_system_updater_schedule(updater);
+		return TRUE;
+	}
 
 	if (!updater->proc_remove)
 		return TRUE;
@@ -597,16 +1072,16 @@ ni_system_updater_remove(ni_updater_t *updater, const ni_addrconf_lease_t *lease
 	ni_string_array_append(&arguments, ifname);
 
 	ni_string_array_append(&arguments, "-t");
-	ni_string_array_append(&arguments, ni_addrconf_type_to_name(lease->type));
+	ni_string_array_append(&arguments, ni_addrconf_type_to_name(src->type));
 
 	ni_string_array_append(&arguments, "-f");
-	ni_string_array_append(&arguments, ni_addrfamily_type_to_name(lease->family));
+	ni_string_array_append(&arguments, ni_addrfamily_type_to_name(src->family));
 
 	switch (updater->kind) {
 	case NI_ADDRCONF_UPDATER_GENERIC:
 		switch (updater->format) {
 		case NI_ADDRCONF_UPDATER_FORMAT_INFO:
-			ni_leaseinfo_remove(ifname, lease->type, lease->family);
+			ni_leaseinfo_remove(ifname, src->type, src->family);
 			break;
 		default:
 			ni_error("Unsupported %s updater data format.",
@@ -631,26 +1106,7 @@ ni_system_updater_remove(ni_updater_t *updater, const ni_addrconf_lease_t *lease
 	}
 
 	result = TRUE;
-
-	switch (updater->kind) {
-	case NI_ADDRCONF_UPDATER_RESOLVER:
-		if (ni_global.other_event)
-			ni_global.other_event(NI_EVENT_RESOLVER_UPDATED);
-		break;
-
-	case NI_ADDRCONF_UPDATER_HOSTNAME:
-		if (ni_global.other_event)
-			ni_global.other_event(NI_EVENT_HOSTNAME_UPDATED);
-		break;
-
-	case NI_ADDRCONF_UPDATER_GENERIC:
-		if (ni_global.other_event)
-			ni_global.other_event(NI_EVENT_GENERIC_UPDATED);
-		break;
-
-	default:
-		break;
-	}
+	ni_system_updater_notify(updater);
 
 done:
 	ni_string_array_destroy(&arguments);
@@ -686,7 +1142,7 @@ ni_system_update_remove_matching_leases(ni_updater_t *updater,
 			 */
 			if (!ni_string_eq(src->d_ref.name, ifname) ||
 			    lease->state != NI_ADDRCONF_STATE_APPLYING) {
-				ni_system_updater_remove(updater, src->lease, src->d_ref.name);
+				ni_system_updater_remove(updater, src);
 			}
 
 			if (ni_updater_source_array_delete(&updater->sources, i))
@@ -717,6 +1173,7 @@ ni_system_update_from_lease(const ni_addrconf_lease_t *lease, const unsigned int
 		if (can_update_type(lease, kind)) {
 			ni_updater_t *updater = &updaters[kind];
 			ni_updater_source_array_t sources = NI_UPDATER_SOURCE_ARRAY_INIT;
+			ni_updater_source_t *src;
 
 			if (!updater->enabled)
 				continue;
@@ -735,10 +1192,10 @@ ni_system_update_from_lease(const ni_addrconf_lease_t *lease, const unsigned int
 				 * the newly installed (or already present) hostname file
 				 * and thus restore the hostname to /etc/HOSTNAME.
 				 */
-				if(!ni_system_updater_install(updater, lease, ifname)) {
+				src = ni_objectmodel_updater_add_source(kind, lease, ifindex, ifname);
+				if(!ni_system_updater_install(updater, lease, src)) {
 					res = FALSE;
 				}
-				ni_objectmodel_updater_add_source(kind, lease, ifindex, ifname);
 				break;
 			default:
 				if(!ni_system_update_remove_matching_leases(updater, lease, ifindex, ifname)) {
@@ -29,6 +29,7 @@
 #define NI_STRING_ARRAY_CHUNK	16
 #define NI_UINT_ARRAY_CHUNK	16
 #define NI_VAR_ARRAY_CHUNK	16
+#define NI_VAR_INDEX_MIN_SIZE	64
 
 #define NI_STRINGBUF_CHUNK	64
 
@@ -398,6 +399,240 @@ ni_var_array_init(ni_var_array_t *nva)
 	memset(nva, 0, sizeof(*nva));
 }
 
+/*
+ * Optional index of the variables in an array:
+ * - an open addressing hash table mapping the variable names to
+ *   their position in the array (+1, 0 is a free slot), which is
+ *   maintained while variables are added or removed.
+ * - a by name sorted list of the variables to lookup variables with
+ *   a common prefix, built on request and dropped when a variable
+ *   is added or removed.
+ * Lookups do not modify the index, so an indexed array can be shared
+ * read-only by multiple threads.
+ */
+typedef struct ni_var_index_entry {
+	const char *		name;
+	unsigned int		pos;
+} ni_var_index_entry_t;
+
+struct ni_var_index {
+	unsigned int		size;
+	unsigned int		used;
+	unsigned int *		slots;
+
+	unsigned int		count;
+	ni_var_index_entry_t *	sorted;
+};
+
+static unsigned int
+__ni_var_index_hash(const char *name)
+{
+	unsigned int hash = 2166136261U;
+
+	while (name && *name) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static void
+__ni_var_index_drop_sorted(ni_var_index_t *idx)
+{
+	free(idx->sorted);
+	idx->sorted = NULL;
+	idx->count = 0;
+}
+
+static void
+__ni_var_index_free(ni_var_index_t *idx)
+{
+	if (idx) {
+		__ni_var_index_drop_sorted(idx);
+		free(idx->slots);
+		free(idx);
+	}
+}
+
+static void
+__ni_var_index_insert(const ni_var_array_t *nva, unsigned int pos)
+{
+	ni_var_index_t *idx = nva->index;
+	const char *name = nva->data[pos].name;
+	unsigned int h, slot;
+
+	h = __ni_var_index_hash(name) & (idx->size - 1);
+	while ((slot = idx->slots[h]) != 0) {
+		/* keep the first one, as the linear search does */
+		if (ni_string_eq(nva->data[slot - 1].name, name))
+			return;
+		h = (h + 1) & (idx->size - 1);
+	}
+	idx->slots[h] = pos + 1;
+	idx->used++;
+}
+
+static void
+__ni_var_index_rebuild(ni_var_array_t *nva)
+{
+	ni_var_index_t *idx = nva->index;
+	unsigned int i, size;
+
+	for (size = NI_VAR_INDEX_MIN_SIZE; size < 2 * nva->count; size <<= 1)
+		;
+
+	__ni_var_index_drop_sorted(idx);
+	if (idx->size != size) {
+		free(idx->slots);
+		idx->slots = xcalloc(size, sizeof(idx->slots[0]));
+		idx->size = size;
+	} else {
+		memset(idx->slots, 0, size * sizeof(idx->slots[0]));
+	}
+	idx->used = 0;
+
+	for (i = 0; i < nva->count; ++i)
+		__ni_var_index_insert(nva, i);
+}
+
+static void
+__ni_var_index_append(ni_var_array_t *nva)
+{
+	ni_var_index_t *idx = nva->index;
+
+	__ni_var_index_drop_sorted(idx);
+	if (2 * (idx->used + 1) > idx->size)
+		__ni_var_index_rebuild(nva);
+	else
+		__ni_var_index_insert(nva, nva->count - 1);
+}
+
+static ni_var_t *
+__ni_var_index_get(const ni_var_array_t *nva, const char *name)
+{
+	const ni_var_index_t *idx = nva->index;
+	unsigned int h, slot;
+
+	h = __ni_var_index_hash(name) & (idx->size - 1);
+	while ((slot = idx->slots[h]) != 0) {
+		if (ni_string_eq(nva->data[slot - 1].name, name))
+			return &nva->data[slot - 1];
+		h = (h + 1) & (idx->size - 1);
+	}
+	return NULL;
+}
+
+static int
+__ni_var_index_entry_cmp(const void *a, const void *b)
+{
+	const ni_var_index_entry_t *ea = a;
+	const ni_var_index_entry_t *eb = b;
+	int ret;
+
+	if ((ret = strcmp(ea->name, eb->name)))
+		return ret;
+	return ea->pos < eb->pos ? -1 : ea->pos > eb->pos;
+}
+
+static int
+__ni_var_index_pos_cmp(const void *a, const void *b)
+{
+	unsigned int pa = *(const unsigned int *)a;
+	unsigned int pb = *(const unsigned int *)b;
+
+	return pa < pb ? -1 : pa > pb;
+}
+
+/*
+ * Enable the hashed name index of the array
+ */
+void
+ni_var_array_index(ni_var_array_t *nva)
+{
+	if (!nva || nva->index)
+		return;
+
+	nva->index = xcalloc(1, sizeof(*nva->index));
+	__ni_var_index_rebuild(nva);
+}
+
+/*
+ * Build the by name sorted variable list used by ni_var_array_find_prefixed,
+ * to call when done with adding variables to the array.
+ */
+void
+ni_var_array_index_prefixes(ni_var_array_t *nva)
+{
+	ni_var_index_t *idx;
+	unsigned int i;
+
+	if (!nva)
+		return;
+
+	ni_var_array_index(nva);
+	idx = nva->index;
+	__ni_var_index_drop_sorted(idx);
+	if (!nva->count)
+		return;
+
+	idx->sorted = xcalloc(nva->count, sizeof(idx->sorted[0]));
+	for (i = 0; i < nva->count; ++i) {
+		idx->sorted[i].name = nva->data[i].name;
+		idx->sorted[i].pos = i;
+	}
+	qsort(idx->sorted, nva->count, sizeof(idx->sorted[0]),
+			__ni_var_index_entry_cmp);
+	idx->count = nva->count;
+}
+
+/*
+ * Find the positions of all variables with the given name prefix,
+ * returned in the order of the variables in the array.
+ */
+unsigned int
+ni_var_array_find_prefixed(const ni_var_array_t *nva, const char *prefix,
+				ni_uint_array_t *res)
+{
+	const ni_var_index_t *idx;
+	unsigned int i, lo, hi, pfxlen, count;
+
+	if (!nva || !prefix || !res)
+		return 0;
+
+	count = res->count;
+	pfxlen = strlen(prefix);
+	idx = nva->index;
+	if (!idx || !idx->sorted || idx->count != nva->count) {
+		for (i = 0; i < nva->count; ++i) {
+			if (!strncmp(nva->data[i].name, prefix, pfxlen))
+				ni_uint_array_append(res, i);
+		}
+		return res->count - count;
+	}
+
+	lo = 0;
+	hi = idx->count;
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (strcmp(idx->sorted[mid].name, prefix) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (i = lo; i < idx->count; ++i) {
+		if (strncmp(idx->sorted[i].name, prefix, pfxlen))
+			break;
+		ni_uint_array_append(res, idx->sorted[i].pos);
+	}
+
+	if (res->count - count > 1) {
+		qsort(res->data + count, res->count - count,
+			sizeof(res->data[0]), __ni_var_index_pos_cmp);
+	}
+	return res->count - count;
+}
+
 void
 ni_var_array_destroy(ni_var_array_t *nva)
 {
@@ -408,6 +643,7 @@ ni_var_array_destroy(ni_var_array_t *nva)
 		free(nva->data[i].value);
 	}
 	free(nva->data);
+	__ni_var_index_free(nva->index);
 	memset(nva, 0, sizeof(*nva));
 }
 
@@ -417,6 +653,9 @@ ni_var_array_get(const ni_var_array_t *nva, const char *name)
 	unsigned int i;
 	ni_var_t *var;
 
+	if (nva->index)
+		return __ni_var_index_get(nva, name);
+
 	for (i = 0, var = nva->data; i < nva->count; ++i, ++var) {
 		if (ni_string_eq(var->name, name))
 			return var;
@@ -457,6 +696,9 @@ ni_var_array_remove_at(ni_var_array_t *array, unsigned int index)
 	array->data[array->count].name = NULL;
 	array->data[array->count].value = NULL;
 
+	if (array->index)
+		__ni_var_index_rebuild(array);
+
 	return TRUE;
 }
 
@@ -486,6 +728,9 @@ __ni_var_array_append(ni_var_array_t *nva, const char *name, const char *value)
 	var = &nva->data[nva->count++];
 	var->name = xstrdup(name);
 	var->value = xstrdup(value);
+
+	if (nva->index)
+		__ni_var_index_append(nva);
 }
 
 void
@@ -500,6 +745,9 @@ ni_var_array_set(ni_var_array_t *nva, const char *name, const char *value)
 		var = &nva->data[nva->count++];
 		var->name = xstrdup(name);
 		var->value = NULL;
+
+		if (nva->index)
+			__ni_var_index_append(nva);
 	}
 
 	ni_string_dup(&var->value, value);
@@ -1086,7 +1334,7 @@ ni_sprint_hex(const unsigned char *data, size_t len)
 const char *
 ni_sprint_uint(unsigned int value)
 {
-	static char buffer[64];
+	static __thread char buffer[64];
 
 	snprintf(buffer, sizeof(buffer), "%u", value);
 	return buffer;
@@ -1243,7 +1491,7 @@ ni_format_uint_mapped(unsigned int value, const ni_intmap_t *map)
 const char *
 ni_format_uint_maybe_mapped(unsigned int value, const ni_intmap_t *map)
 {
-	static char buffer[20];
+	static __thread char buffer[20];
 	const char *name;
 
 	if (!map)
@@ -1410,7 +1658,7 @@ ni_format_hex(const unsigned char *data, unsigned int datalen, char *namebuf, si
 const char *
 ni_print_hex(const unsigned char *data, unsigned int datalen)
 {
-	static char addrbuf[512]; /* >= ni_opaque_t data * 3 */
+	static __thread char addrbuf[512]; /* >= ni_opaque_t data * 3 */
 
 	addrbuf[0] = '\0';
 	return ni_format_hex(data, datalen, addrbuf, sizeof(addrbuf));
@@ -2211,7 +2459,7 @@ __ni_dirname(const char *path, char *result, size_t size)
 const char *
 ni_dirname(const char *path)
 {
-	static char buffer[PATH_MAX];
+	static __thread char buffer[PATH_MAX];
 
 	if (!__ni_dirname(path, buffer, sizeof(buffer)))
 		return NULL;
@@ -2244,7 +2492,7 @@ ni_realpath(const char *path, char **resolved)
 const char *
 ni_sibling_path(const char *path, const char *file)
 {
-	static char buffer[PATH_MAX];
+	static __thread char buffer[PATH_MAX];
 	unsigned int len;
 
 	if (!__ni_dirname(path, buffer, sizeof(buffer)))
@@ -2809,7 +3057,7 @@ ni_check_printable(const char *str, size_t len)
 const char *
 ni_print_suspect(const char *str, size_t len)
 {
-	static char buf[256] = {'\0'};
+	static __thread char buf[256] = {'\0'};
 	unsigned char *ptr;
 	size_t pos, end, cnt;
 
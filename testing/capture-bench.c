@@ -0,0 +1,268 @@
+/*
+ * Benchmark of the DHCPv4 packet capture modes: one capture socket per
+ * interface vs. one shared capture socket for all interfaces.
+ *
+ * Usage: capture-bench [-s] [-r] [-n packets] ifname:peer ...
+ *
+ * For each ifname a DHCP client capture is opened; DHCP replies for its
+ * transaction id and three times as many for other transactions are
+ * sent via the peer (e.g. the other end of a veth pair) interface.
+ * See testing/scripts/capture_bench.sh for a setup.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <wicked/util.h>
+#include <wicked/socket.h>
+#include <wicked/netinfo.h>
+
+#if defined(HAVE_LINUX_IF_PACKET_H)
+#include <linux/if_packet.h>
+#else
+#include <netpacket/packet.h>
+#endif
+
+#include "netinfo_priv.h"
+#include "socket_priv.h"
+#include "appconfig.h"
+#include "buffer.h"
+
+extern ni_global_t ni_global;
+
+#define BENCH_PACKET_LEN	(14 + 20 + 8 + 300)
+#define BENCH_BATCH		32
+
+typedef struct bench_dev {
+	ni_capture_t *		capture;
+	ni_capture_devinfo_t	devinfo;
+	struct sockaddr_ll	peer;
+	uint32_t		xid;
+	unsigned int		received;
+} bench_dev_t;
+
+static unsigned int		bench_received;
+
+static void	bench_capture_receive(ni_socket_t *);
+
+static uint16_t
+bench_ip_checksum(const unsigned char *data, unsigned int len)
+{
+	uint32_t sum = 0;
+	unsigned int i;
+
+	for (i = 0; i + 1 < len; i += 2)
+		sum += (data[i] << 8) | data[i + 1];
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return htons(~sum & 0xffff);
+}
+
+static void
+bench_build_reply(unsigned char *frame, const bench_dev_t *dev, uint32_t xid)
+{
+	unsigned char *ip = frame + 14, *udp = ip + 20, *bootp = udp + 8;
+	uint16_t csum;
+
+	memset(frame, 0, BENCH_PACKET_LEN);
+	memset(frame, 0xff, ETH_ALEN);
+	frame[12] = 0x08;
+	frame[13] = 0x00;
+
+	ip[0] = 0x45;
+	ip[2] = (BENCH_PACKET_LEN - 14) >> 8;
+	ip[3] = (BENCH_PACKET_LEN - 14) & 0xff;
+	ip[8] = 64;
+	ip[9] = IPPROTO_UDP;
+	memset(ip + 12, 10, 4);
+	memset(ip + 16, 0xff, 4);
+	csum = bench_ip_checksum(ip, 20);
+	memcpy(ip + 10, &csum, sizeof(csum));
+
+	udp[1] = 67;
+	udp[3] = 68;
+	udp[4] = (BENCH_PACKET_LEN - 14 - 20) >> 8;
+	udp[5] = (BENCH_PACKET_LEN - 14 - 20) & 0xff;
+
+	bootp[0] = 2;
+	bootp[1] = ARPHRD_ETHER;
+	bootp[2] = ETH_ALEN;
+	memcpy(bootp + 4, &xid, sizeof(xid));
+	memcpy(bootp + 28, dev->devinfo.hwaddr.data, ETH_ALEN);
+}
+
+static int
+bench_dev_open(bench_dev_t *dev, const char *ifname, const char *peer, ni_bool_t shared)
+{
+	ni_capture_protinfo_t protinfo;
+	ni_linkinfo_t link;
+	struct ifreq ifr;
+	int fd;
+
+	memset(&link, 0, sizeof(link));
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name) - 1);
+	if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 || ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+		fprintf(stderr, "%s: cannot get hwaddr: %m\n", ifname);
+		return -1;
+	}
+	close(fd);
+
+	link.ifindex = if_nametoindex(ifname);
+	link.type = NI_IFTYPE_ETHERNET;
+	link.hwaddr.type = ARPHRD_ETHER;
+	link.hwaddr.len = ETH_ALEN;
+	memcpy(link.hwaddr.data, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+	if (ni_capture_devinfo_init(&dev->devinfo, ifname, &link) < 0)
+		return -1;
+
+	memset(&dev->peer, 0, sizeof(dev->peer));
+	dev->peer.sll_family = AF_PACKET;
+	dev->peer.sll_ifindex = if_nametoindex(peer);
+	dev->peer.sll_halen = ETH_ALEN;
+	if (!link.ifindex || !dev->peer.sll_ifindex) {
+		fprintf(stderr, "%s:%s: no such interface\n", ifname, peer);
+		return -1;
+	}
+
+	dev->xid = random();
+	memset(&protinfo, 0, sizeof(protinfo));
+	protinfo.eth_protocol = ETHERTYPE_IP;
+	protinfo.ip_protocol = IPPROTO_UDP;
+	protinfo.ip_port = 68;
+	protinfo.dhcp_xid = dev->xid;
+	protinfo.dhcp_chaddr = link.hwaddr;
+	protinfo.shared = shared;
+
+	if (!(dev->capture = ni_capture_open(&dev->devinfo, &protinfo, bench_capture_receive)))
+		return -1;
+	ni_capture_set_user_data(dev->capture, dev);
+	return 0;
+}
+
+static void
+bench_capture_receive(ni_socket_t *sock)
+{
+	ni_capture_t *capture = sock->user_data;
+	bench_dev_t *dev = ni_capture_get_user_data(capture);
+	ni_buffer_t buf;
+
+	if (ni_capture_recv(capture, &buf) >= 0) {
+		dev->received++;
+		bench_received++;
+	}
+}
+
+static double
+bench_cpu_time(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+		(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned char frame[BENCH_PACKET_LEN];
+	unsigned int npackets = 1000, ndevs, i, n, k, expected = 0, idle;
+	ni_bool_t shared = FALSE;
+	struct timeval start, stop;
+	double cpu;
+	bench_dev_t *devs;
+	int c, fd;
+
+	ni_global.config = ni_config_new();
+	while ((c = getopt(argc, argv, "srn:")) != -1) {
+		switch (c) {
+		case 's':
+			shared = TRUE;
+			break;
+		case 'r':
+			ni_global.config->packet_capture.mmap_ring = TRUE;
+			break;
+		case 'n':
+			npackets = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind >= argc) {
+usage:
+		fprintf(stderr, "Usage: %s [-s] [-r] [-n packets] ifname:peer ...\n", argv[0]);
+		return 1;
+	}
+
+	ndevs = argc - optind;
+	devs = xcalloc(ndevs, sizeof(*devs));
+	for (i = 0; i < ndevs; ++i) {
+		char *ifname = argv[optind + i], *peer;
+
+		if (!(peer = strchr(ifname, ':')))
+			goto usage;
+		*peer++ = '\0';
+		if (bench_dev_open(&devs[i], ifname, peer, shared) < 0)
+			return 1;
+	}
+
+	if ((fd = socket(AF_PACKET, SOCK_RAW, 0)) < 0) {
+		perror("socket");
+		return 1;
+	}
+
+	gettimeofday(&start, NULL);
+	cpu = bench_cpu_time();
+	for (n = 0; n < npackets; n += BENCH_BATCH) {
+		for (i = 0; i < ndevs; ++i) {
+			bench_dev_t *dev = &devs[i];
+
+			for (k = 0; k < BENCH_BATCH * 4; ++k) {
+				uint32_t xid = (k % 4) ? dev->xid + k : dev->xid;
+
+				bench_build_reply(frame, dev, xid);
+				sendto(fd, frame, sizeof(frame), 0,
+					(struct sockaddr *)&dev->peer, sizeof(dev->peer));
+			}
+			expected += BENCH_BATCH;
+		}
+
+		for (idle = 0; bench_received < expected && idle < 10; ) {
+			unsigned int received = bench_received;
+
+			ni_socket_wait(10);
+			idle = bench_received == received ? idle + 1 : 0;
+		}
+	}
+	gettimeofday(&stop, NULL);
+	cpu = bench_cpu_time() - cpu;
+
+	printf("%s%s: %u interfaces, %u packet sockets, received %u of %u, "
+		"%.3f sec, %.3f sec cpu\n",
+		shared ? "shared" : "per-device",
+		ni_global.config->packet_capture.mmap_ring ? " ring" : "",
+		ndevs, shared ? 1 : ndevs, bench_received, expected,
+		(stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1e6, cpu);
+
+	for (i = 0; i < ndevs; ++i)
+		ni_capture_free(devs[i].capture);
+	free(devs);
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,436 @@
+/*
+ * Fuzz and benchmark of the DHCPv4 and DHCPv6 response parsers.
+ *
+ * Usage: dhcp-parse-bench [-4|-6] [-n rounds] [-f mutations] [-s seed] [-v] file ...
+ *
+ * The files are pcap captures (e.g. tcpdump -w) of DHCP server replies
+ * or, with -4 or -6, raw DHCP message payloads. Each message is parsed
+ * n rounds by the option index only (what decides about an offer) and
+ * by the complete lease parser. With -f, each message is additionally
+ * fed f times with random corruptions to both parsers; run it under
+ * valgrind or with -fsanitize=address to catch bad accesses.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <wicked/util.h>
+#include <wicked/logging.h>
+#include <wicked/netinfo.h>
+#include <wicked/addrconf.h>
+
+#include "dhcp4/dhcp.h"
+#include "dhcp4/protocol.h"
+#include "dhcp6/dhcp6.h"
+#include "dhcp6/device.h"
+#include "dhcp6/protocol.h"
+#include "buffer.h"
+
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_MAGIC_NSEC		0xa1b23c4d
+#define PCAP_LINKTYPE_ETHERNET	1
+#define PCAP_LINKTYPE_RAW	101
+#define PCAP_LINKTYPE_LINUX_SLL	113
+
+typedef struct bench_packet {
+	int			family;
+	size_t			len;
+	unsigned char *		data;
+} bench_packet_t;
+
+typedef struct bench_packet_array {
+	unsigned int		count;
+	bench_packet_t *	data;
+} bench_packet_array_t;
+
+typedef struct bench_stats {
+	unsigned int		packets;
+	double			index_nsec;
+	double			full_nsec;
+	unsigned int		fuzz_parsed;
+	unsigned int		fuzz_rejected;
+} bench_stats_t;
+
+static ni_dhcp6_device_t	bench_dev6;
+
+static void
+bench_packet_add(bench_packet_array_t *array, int family, const unsigned char *data, size_t len)
+{
+	bench_packet_t *pkt;
+
+	array->data = xrealloc(array->data, (array->count + 1) * sizeof(*pkt));
+	pkt = &array->data[array->count++];
+	pkt->family = family;
+	pkt->len = len;
+	pkt->data = xmalloc(len);
+	memcpy(pkt->data, data, len);
+}
+
+/*
+ * Find the UDP payload of a DHCP server reply in a captured frame.
+ */
+static void
+bench_frame_add(bench_packet_array_t *array, unsigned int linktype, const unsigned char *p, size_t len)
+{
+	unsigned int ethertype, hlen, sport;
+
+	switch (linktype) {
+	case PCAP_LINKTYPE_ETHERNET:
+		if (len < 14)
+			return;
+		ethertype = (p[12] << 8) | p[13];
+		p += 14;
+		len -= 14;
+		if (ethertype == 0x8100 && len >= 4) {
+			ethertype = (p[2] << 8) | p[3];
+			p += 4;
+			len -= 4;
+		}
+		break;
+	case PCAP_LINKTYPE_LINUX_SLL:
+		if (len < 16)
+			return;
+		ethertype = (p[14] << 8) | p[15];
+		p += 16;
+		len -= 16;
+		break;
+	case PCAP_LINKTYPE_RAW:
+		if (len < 1)
+			return;
+		ethertype = (p[0] >> 4) == 6 ? 0x86dd : 0x0800;
+		break;
+	default:
+		return;
+	}
+
+	if (ethertype == 0x0800) {
+		if (len < 20 || (hlen = (p[0] & 0x0f) * 4) < 20 || len < hlen + 8 || p[9] != IPPROTO_UDP)
+			return;
+	} else if (ethertype == 0x86dd) {
+		if (len < 40 + 8 || p[6] != IPPROTO_UDP)
+			return;
+		hlen = 40;
+	} else {
+		return;
+	}
+	p += hlen;
+	len -= hlen;
+
+	sport = (p[0] << 8) | p[1];
+	if (sport == DHCP4_SERVER_PORT && ethertype == 0x0800)
+		bench_packet_add(array, AF_INET, p + 8, len - 8);
+	else if (sport == NI_DHCP6_SERVER_PORT && ethertype == 0x86dd)
+		bench_packet_add(array, AF_INET6, p + 8, len - 8);
+}
+
+static uint32_t
+bench_pcap32(const unsigned char *p, ni_bool_t swap)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return swap ? __builtin_bswap32(v) : v;
+}
+
+static int
+bench_load(bench_packet_array_t *array, const char *filename, int family)
+{
+	unsigned char *data = NULL;
+	size_t size = 0, len, pos;
+	unsigned int linktype;
+	ni_bool_t swap;
+	uint32_t magic;
+	FILE *fp;
+
+	if (!(fp = fopen(filename, "r"))) {
+		fprintf(stderr, "%s: %m\n", filename);
+		return -1;
+	}
+	do {
+		data = xrealloc(data, size + 65536);
+		len = fread(data + size, 1, 65536, fp);
+		size += len;
+	} while (len);
+	fclose(fp);
+
+	if (family) {
+		bench_packet_add(array, family, data, size);
+		free(data);
+		return 0;
+	}
+
+	if (size < 24)
+		goto bad;
+	magic = bench_pcap32(data, FALSE);
+	swap = magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC;
+	magic = bench_pcap32(data, swap);
+	if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC)
+		goto bad;
+	linktype = bench_pcap32(data + 20, swap);
+
+	for (pos = 24; pos + 16 <= size; pos += 16 + len) {
+		len = bench_pcap32(data + pos + 8, swap);
+		if (pos + 16 + len > size)
+			break;
+		bench_frame_add(array, linktype, data + pos + 16, len);
+	}
+	free(data);
+	return 0;
+
+bad:
+	fprintf(stderr, "%s: not a pcap file, use -4 or -6 for raw payloads\n", filename);
+	free(data);
+	return -1;
+}
+
+static int
+bench_parse4_index(unsigned char *data, size_t len)
+{
+	ni_dhcp4_option_index_t index;
+	ni_dhcp4_message_t *message;
+	struct in_addr server_id;
+	ni_buffer_t buf;
+
+	ni_buffer_init_reader(&buf, data, len);
+	if (!(message = ni_buffer_pull_head(&buf, sizeof(*message))))
+		return -1;
+	if (ni_dhcp4_option_index_build(&index, message, &buf) < 0)
+		return -1;
+	return ni_dhcp4_parse_message_type(&index, &server_id);
+}
+
+static int
+bench_parse4_full(unsigned char *data, size_t len)
+{
+	ni_addrconf_lease_t *lease = NULL;
+	ni_dhcp4_message_t *message;
+	ni_buffer_t buf;
+	int rv;
+
+	ni_buffer_init_reader(&buf, data, len);
+	if (!(message = ni_buffer_pull_head(&buf, sizeof(*message))))
+		return -1;
+	if ((rv = ni_dhcp4_parse_response(message, &buf, &lease)) >= 0)
+		ni_addrconf_lease_free(lease);
+	return rv;
+}
+
+static int
+bench_parse6_index(unsigned char *data, size_t len)
+{
+	ni_dhcp6_option_index_t index;
+	ni_dhcp6_offer_info_t info;
+	unsigned int type, xid;
+	ni_buffer_t buf;
+
+	ni_buffer_init_reader(&buf, data, len);
+	if (ni_dhcp6_parse_client_header(&buf, &type, &xid) < 0)
+		return -1;
+	if (ni_dhcp6_option_index_build(&index, &buf) < 0)
+		return -1;
+	return ni_dhcp6_parse_offer_info(&index, &info);
+}
+
+static int
+bench_parse6_full(unsigned char *data, size_t len)
+{
+	ni_addrconf_lease_t *lease;
+	unsigned int type, xid;
+	ni_buffer_t buf;
+	int rv;
+
+	ni_buffer_init_reader(&buf, data, len);
+	if (ni_dhcp6_parse_client_header(&buf, &type, &xid) < 0)
+		return -1;
+
+	lease = ni_addrconf_lease_new(NI_ADDRCONF_DHCP, AF_INET6);
+	rv = ni_dhcp6_parse_client_options(&bench_dev6, &buf, lease);
+	ni_addrconf_lease_free(lease);
+	return rv;
+}
+
+static double
+bench_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+bench_run(const bench_packet_t *pkt, unsigned int rounds, bench_stats_t *stats)
+{
+	int (*parse_index)(unsigned char *, size_t);
+	int (*parse_full)(unsigned char *, size_t);
+	unsigned int n;
+	double start;
+
+	if (pkt->family == AF_INET) {
+		parse_index = bench_parse4_index;
+		parse_full = bench_parse4_full;
+	} else {
+		parse_index = bench_parse6_index;
+		parse_full = bench_parse6_full;
+	}
+
+	start = bench_nsec();
+	for (n = 0; n < rounds; ++n)
+		parse_index(pkt->data, pkt->len);
+	stats->index_nsec += bench_nsec() - start;
+
+	start = bench_nsec();
+	for (n = 0; n < rounds; ++n)
+		parse_full(pkt->data, pkt->len);
+	stats->full_nsec += bench_nsec() - start;
+}
+
+static void
+bench_fuzz(const bench_packet_t *pkt, unsigned int mutations, bench_stats_t *stats)
+{
+	unsigned int n, k, flips;
+	unsigned char *data;
+	size_t len;
+	int rv;
+
+	for (n = 0; n < mutations; ++n) {
+		/* exact size copy, so overreads hit the allocation boundary */
+		len = pkt->len;
+		if (len && random() % 4 == 0)
+			len = random() % len;
+		data = xmalloc(len ? len : 1);
+		memcpy(data, pkt->data, len);
+
+		flips = len ? 1 + random() % 8 : 0;
+		for (k = 0; k < flips; ++k) {
+			size_t pos = random() % len;
+
+			switch (random() % 3) {
+			case 0:
+				data[pos] ^= 1 << (random() % 8);
+				break;
+			case 1:
+				data[pos] = random() % 2 ? 0xff : 0x00;
+				break;
+			default:
+				data[pos] = random();
+				break;
+			}
+		}
+
+		if (pkt->family == AF_INET) {
+			bench_parse4_index(data, len);
+			rv = bench_parse4_full(data, len);
+		} else {
+			bench_parse6_index(data, len);
+			rv = bench_parse6_full(data, len);
+		}
+		if (rv < 0)
+			stats->fuzz_rejected++;
+		else
+			stats->fuzz_parsed++;
+		free(data);
+	}
+}
+
+static void
+bench_report(const char *name, const bench_stats_t *stats, unsigned int rounds, unsigned int mutations)
+{
+	double count = (double)stats->packets * rounds;
+
+	if (!stats->packets)
+		return;
+
+	printf("%s: %u packets, %u rounds, index %.0f nsec, full parse %.0f nsec per packet\n",
+		name, stats->packets, rounds,
+		count ? stats->index_nsec / count : 0,
+		count ? stats->full_nsec / count : 0);
+	if (mutations) {
+		printf("%s: %u mutations, %u parsed, %u rejected\n", name,
+			stats->packets * mutations, stats->fuzz_parsed,
+			stats->fuzz_rejected);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	bench_packet_array_t packets = { 0, NULL };
+	bench_stats_t stats4, stats6;
+	unsigned int rounds = 10000, mutations = 0, seed = 1, i;
+	ni_bool_t verbose = FALSE;
+	int family = 0, c;
+
+	while ((c = getopt(argc, argv, "46n:f:s:v")) != -1) {
+		switch (c) {
+		case '4':
+			family = AF_INET;
+			break;
+		case '6':
+			family = AF_INET6;
+			break;
+		case 'n':
+			rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			mutations = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			verbose = TRUE;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind >= argc) {
+usage:
+		fprintf(stderr, "Usage: %s [-4|-6] [-n rounds] [-f mutations] [-s seed] [-v] file ...\n",
+				argv[0]);
+		return 1;
+	}
+
+	for (i = optind; i < (unsigned int)argc; ++i) {
+		if (bench_load(&packets, argv[i], family) < 0)
+			return 1;
+	}
+	if (!packets.count) {
+		fprintf(stderr, "no DHCP server replies found\n");
+		return 1;
+	}
+
+	/* the parsers complain loudly about bad packets */
+	if (!verbose)
+		freopen("/dev/null", "w", stderr);
+
+	bench_dev6.ifname = "bench";
+	srandom(seed);
+	memset(&stats4, 0, sizeof(stats4));
+	memset(&stats6, 0, sizeof(stats6));
+	for (i = 0; i < packets.count; ++i) {
+		const bench_packet_t *pkt = &packets.data[i];
+		bench_stats_t *stats = pkt->family == AF_INET ? &stats4 : &stats6;
+
+		stats->packets++;
+		bench_run(pkt, rounds, stats);
+		if (mutations)
+			bench_fuzz(pkt, mutations, stats);
+	}
+
+	bench_report("dhcp4", &stats4, rounds, mutations);
+	bench_report("dhcp6", &stats6, rounds, mutations);
+
+	for (i = 0; i < packets.count; ++i)
+		free(packets.data[i].data);
+	free(packets.data);
+	return 0;
+}
@@ -0,0 +1,1003 @@
+/*
+ * Replay of DHCPv4 and DHCPv6 lease acquisitions against a fake server.
+ *
+ * Usage: dhcp-replay [-4|-6] [-l loss] [-d delay] [-k naks] [-F msec] [-A]
+ *                    [-s] [-r rate] [-j msec] [-t timeout] [-S seed] [-v]
+ *                    ifname:peer ...
+ *
+ * For each ifname, the supplicant state machines acquire a lease as in
+ * the tester mode, while an in-process fake server answers on the peer
+ * (e.g. the other end of a veth pair) interface:
+ *
+ *   -l  percentage of messages lost, in each direction
+ *   -d  reply delay in msec, plus a random jitter of up to the same
+ *   -k  percentage of lease requests refused by a NAK (DHCPv4) or a
+ *       NoAddrsAvail status (DHCPv6)
+ *   -F  run a secondary server, replying with twice the delay, and
+ *       let the primary server fail after msec
+ *   -A  skip the ARP validation of DHCPv4 leases
+ *   -s  use a shared DHCPv4 capture socket
+ *   -r  limit the initial transmissions to rate per second
+ *   -j  DHCPv4 start jitter in msec
+ *
+ * Reported are the acquisition latency percentiles, the messages sent
+ * by the clients per lease and the CPU time used, with the share of
+ * the fake server. See testing/scripts/dhcp_replay.sh for a setup.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <wicked/netinfo.h>
+#include <wicked/util.h>
+#include <wicked/logging.h>
+#include <wicked/socket.h>
+#include <wicked/addrconf.h>
+
+#if defined(HAVE_LINUX_IF_PACKET_H)
+#include <linux/if_packet.h>
+#else
+#include <netpacket/packet.h>
+#endif
+
+#include "dhcp4/dhcp.h"
+#include "dhcp4/protocol.h"
+#include "dhcp6/dhcp6.h"
+#include "dhcp6/device.h"
+#include "dhcp6/protocol.h"
+#include "socket_priv.h"
+#include "appconfig.h"
+
+extern ni_global_t ni_global;
+
+#define REPLAY_PACKET_MAX	1500
+#define REPLAY_SERVERS_MAX	2
+#define REPLAY_LEASE_TIME	3600
+
+typedef union replay_addr {
+	struct sockaddr		sa;
+	struct sockaddr_ll	ll;
+	struct sockaddr_in6	six;
+} replay_addr_t;
+
+typedef struct replay_server {
+	unsigned int		id;
+	unsigned int		delay;		/* msec */
+	long			fail_after;	/* msec, < 0 never */
+	unsigned int		offers;
+	unsigned int		acks;
+	unsigned int		naks;
+} replay_server_t;
+
+typedef struct replay_client {
+	unsigned int		index;
+	char *			ifname;
+	char *			peername;
+	unsigned int		peer_ifindex;
+	ni_hwaddr_t		hwaddr;
+	ni_socket_t *		sock;		/* fake server on the peer */
+
+	ni_dhcp4_device_t *	dev4;
+	ni_dhcp6_device_t *	dev6;
+
+	struct timeval		started;
+	double			latency;	/* msec */
+	ni_bool_t		acquired;
+	unsigned int		sent;		/* messages seen from the client */
+} replay_client_t;
+
+typedef struct replay_reply {
+	replay_client_t *	client;
+	replay_addr_t		dst;
+	socklen_t		dstlen;
+	size_t			len;
+	unsigned char		data[REPLAY_PACKET_MAX];
+} replay_reply_t;
+
+static struct replay {
+	int			family;
+	unsigned int		loss;
+	unsigned int		delay;
+	unsigned int		naks;
+	ni_bool_t		no_arp;
+
+	unsigned int		nservers;
+	replay_server_t		servers[REPLAY_SERVERS_MAX];
+
+	unsigned int		nclients;
+	replay_client_t *	clients;
+	unsigned int		acquired;
+	unsigned int		dropped;
+
+	struct timeval		start;
+	double			server_cpu;
+} replay;
+
+static double
+replay_msec_since(const struct timeval *since)
+{
+	struct timeval now, delta;
+
+	ni_timer_get_time(&now);
+	timersub(&now, since, &delta);
+	return delta.tv_sec * 1e3 + delta.tv_usec / 1e3;
+}
+
+static double
+replay_cpu_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static ni_bool_t
+replay_lost(void)
+{
+	if (replay.loss && (unsigned int)(random() % 100) < replay.loss) {
+		replay.dropped++;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+static ni_bool_t
+replay_server_alive(const replay_server_t *srv)
+{
+	return srv->fail_after < 0 || replay_msec_since(&replay.start) < srv->fail_after;
+}
+
+static replay_client_t *
+replay_client_by_ifindex(unsigned int ifindex)
+{
+	unsigned int i;
+
+	for (i = 0; i < replay.nclients; ++i) {
+		replay_client_t *client = &replay.clients[i];
+
+		if ((client->dev4 && client->dev4->link.ifindex == ifindex) ||
+		    (client->dev6 && client->dev6->link.ifindex == ifindex))
+			return client;
+	}
+	return NULL;
+}
+
+static void
+replay_acquired(unsigned int ifindex, const ni_addrconf_lease_t *lease)
+{
+	replay_client_t *client;
+
+	if (!lease || lease->state != NI_ADDRCONF_STATE_GRANTED)
+		return;
+	if (!(client = replay_client_by_ifindex(ifindex)) || client->acquired)
+		return;
+
+	client->latency = replay_msec_since(&client->started);
+	client->acquired = TRUE;
+	replay.acquired++;
+}
+
+static void
+replay_dhcp4_event(enum ni_dhcp4_event ev, const ni_dhcp4_device_t *dev,
+		ni_addrconf_lease_t *lease)
+{
+	if (ev == NI_DHCP4_EVENT_ACQUIRED)
+		replay_acquired(dev->link.ifindex, lease);
+}
+
+static void
+replay_dhcp6_event(enum ni_dhcp6_event ev, const ni_dhcp6_device_t *dev,
+		ni_addrconf_lease_t *lease)
+{
+	if (ev == NI_DHCP6_EVENT_ACQUIRED)
+		replay_acquired(dev->link.ifindex, lease);
+}
+
+/*
+ * Send the replies of the fake server, after the configured delay
+ */
+static void
+replay_transmit(replay_reply_t *reply)
+{
+	if (!replay_lost()) {
+		if (sendto(reply->client->sock->__fd, reply->data, reply->len, 0,
+				&reply->dst.sa, reply->dstlen) < 0)
+			ni_warn("%s: cannot send reply: %m", reply->client->peername);
+	}
+	free(reply);
+}
+
+static void
+replay_reply_timeout(void *user_data, const ni_timer_t *timer)
+{
+	double cpu = replay_cpu_time();
+
+	replay_transmit(user_data);
+	replay.server_cpu += replay_cpu_time() - cpu;
+}
+
+static void
+replay_send(replay_reply_t *reply, const replay_server_t *srv)
+{
+	unsigned long delay = srv->delay;
+
+	if (replay.delay)
+		delay += random() % (replay.delay + 1);
+
+	if (delay)
+		ni_timer_register(delay, replay_reply_timeout, reply);
+	else
+		replay_transmit(reply);
+}
+
+/*
+ * The DHCPv4 fake server
+ */
+static uint16_t
+replay_ip_checksum(const unsigned char *data, unsigned int len)
+{
+	uint32_t sum = 0;
+	unsigned int i;
+
+	for (i = 0; i + 1 < len; i += 2)
+		sum += (data[i] << 8) | data[i + 1];
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return htons(~sum & 0xffff);
+}
+
+static uint32_t
+replay_dhcp4_server_addr(const replay_server_t *srv)
+{
+	return htonl(0x0a630000 | srv->id);
+}
+
+static void
+replay_dhcp4_reply(replay_client_t *client, replay_server_t *srv,
+		const unsigned char *req, unsigned int type)
+{
+	replay_reply_t *reply = xcalloc(1, sizeof(*reply));
+	unsigned char *ip = reply->data, *udp = ip + 20, *bootp = udp + 8, *opt;
+	uint32_t server = replay_dhcp4_server_addr(srv), value;
+	unsigned int len;
+	uint16_t csum;
+
+	bootp[0] = DHCP4_BOOTREPLY;
+	memcpy(bootp + 1, req + 1, 2);			/* htype, hlen */
+	memcpy(bootp + 4, req + 4, 4);			/* xid */
+	memcpy(bootp + 10, req + 10, 2);		/* flags */
+	if (type != DHCP4_NAK) {
+		value = htonl(0x0a630000 | ((client->index / 250 + 1) << 8) |
+				(client->index % 250 + 2));
+		memcpy(bootp + 16, &value, 4);		/* yiaddr */
+		memcpy(bootp + 20, &server, 4);		/* siaddr */
+	}
+	memcpy(bootp + 28, req + 28, DHCP4_CHADDR_LEN);
+	value = htonl(MAGIC_COOKIE);
+	memcpy(bootp + 236, &value, 4);
+
+	opt = bootp + 240;
+	*opt++ = DHCP4_MESSAGETYPE;
+	*opt++ = 1;
+	*opt++ = type;
+	*opt++ = DHCP4_SERVERIDENTIFIER;
+	*opt++ = 4;
+	memcpy(opt, &server, 4);
+	opt += 4;
+	if (type != DHCP4_NAK) {
+		*opt++ = DHCP4_LEASETIME;
+		*opt++ = 4;
+		value = htonl(REPLAY_LEASE_TIME);
+		memcpy(opt, &value, 4);
+		opt += 4;
+		*opt++ = DHCP4_NETMASK;
+		*opt++ = 4;
+		value = htonl(0xffff0000);
+		memcpy(opt, &value, 4);
+		opt += 4;
+		*opt++ = DHCP4_ROUTERS;
+		*opt++ = 4;
+		memcpy(opt, &server, 4);
+		opt += 4;
+	}
+	*opt++ = DHCP4_END;
+
+	len = opt - bootp;
+	if (len < BOOTP_MESSAGE_LENGTH_MIN - 28)
+		len = BOOTP_MESSAGE_LENGTH_MIN - 28;
+	reply->len = 20 + 8 + len;
+
+	udp[1] = DHCP4_SERVER_PORT;
+	udp[3] = DHCP4_CLIENT_PORT;
+	udp[4] = (8 + len) >> 8;
+	udp[5] = (8 + len) & 0xff;
+
+	ip[0] = 0x45;
+	ip[2] = reply->len >> 8;
+	ip[3] = reply->len & 0xff;
+	ip[8] = 64;
+	ip[9] = IPPROTO_UDP;
+	memcpy(ip + 12, &server, 4);
+	memset(ip + 16, 0xff, 4);
+	csum = replay_ip_checksum(ip, 20);
+	memcpy(ip + 10, &csum, sizeof(csum));
+
+	reply->client = client;
+	reply->dst.ll.sll_family = AF_PACKET;
+	reply->dst.ll.sll_protocol = htons(ETHERTYPE_IP);
+	reply->dst.ll.sll_ifindex = client->peer_ifindex;
+	reply->dst.ll.sll_halen = ETH_ALEN;
+	memcpy(reply->dst.ll.sll_addr, client->hwaddr.data, ETH_ALEN);
+	reply->dstlen = sizeof(reply->dst.ll);
+
+	switch (type) {
+	case DHCP4_OFFER:
+		srv->offers++;
+		break;
+	case DHCP4_ACK:
+		srv->acks++;
+		break;
+	case DHCP4_NAK:
+		srv->naks++;
+		break;
+	}
+	replay_send(reply, srv);
+}
+
+static void
+replay_dhcp4_process(replay_client_t *client, const unsigned char *bootp, size_t len)
+{
+	unsigned int type = 0, server_id = 0, pos, i;
+	replay_server_t *srv = NULL;
+	uint32_t cookie;
+
+	if (len < 240 || bootp[0] != DHCP4_BOOTREQUEST)
+		return;
+	memcpy(&cookie, bootp + 236, 4);
+	if (cookie != htonl(MAGIC_COOKIE))
+		return;
+
+	for (pos = 240; pos < len && bootp[pos] != DHCP4_END; ) {
+		unsigned int code = bootp[pos++], optlen;
+
+		if (code == DHCP4_PAD)
+			continue;
+		if (pos >= len)
+			return;
+		optlen = bootp[pos++];
+		if (pos + optlen > len)
+			return;
+		if (code == DHCP4_MESSAGETYPE && optlen == 1)
+			type = bootp[pos];
+		else
+		if (code == DHCP4_SERVERIDENTIFIER && optlen == 4)
+			memcpy(&server_id, bootp + pos, 4);
+		pos += optlen;
+	}
+
+	client->sent++;
+	if (replay_lost())
+		return;
+
+	switch (type) {
+	case DHCP4_DISCOVER:
+		for (i = 0; i < replay.nservers; ++i) {
+			if (replay_server_alive(&replay.servers[i]))
+				replay_dhcp4_reply(client, &replay.servers[i], bootp, DHCP4_OFFER);
+		}
+		break;
+
+	case DHCP4_REQUEST:
+		for (i = 0; i < replay.nservers && !srv; ++i) {
+			if (server_id && server_id != replay_dhcp4_server_addr(&replay.servers[i]))
+				continue;
+			if (replay_server_alive(&replay.servers[i]))
+				srv = &replay.servers[i];
+		}
+		if (!srv)
+			break;
+
+		if (replay.naks && (unsigned int)(random() % 100) < replay.naks)
+			replay_dhcp4_reply(client, srv, bootp, DHCP4_NAK);
+		else
+			replay_dhcp4_reply(client, srv, bootp, DHCP4_ACK);
+		break;
+
+	default:
+		break;
+	}
+}
+
+static void
+replay_dhcp4_receive(ni_socket_t *sock)
+{
+	replay_client_t *client = sock->user_data;
+	unsigned char buf[REPLAY_PACKET_MAX];
+	struct sockaddr_ll sll;
+	socklen_t slen = sizeof(sll);
+	double cpu = replay_cpu_time();
+	unsigned int ihl;
+	ssize_t len;
+
+	len = recvfrom(sock->__fd, buf, sizeof(buf), 0, (struct sockaddr *)&sll, &slen);
+	if (len < 20 || sll.sll_pkttype == PACKET_OUTGOING)
+		goto done;
+
+	ihl = (buf[0] & 0x0f) * 4;
+	if ((buf[0] >> 4) != 4 || buf[9] != IPPROTO_UDP || len < ihl + 8)
+		goto done;
+	if (((buf[ihl + 2] << 8) | buf[ihl + 3]) != DHCP4_SERVER_PORT)
+		goto done;
+
+	replay_dhcp4_process(client, buf + ihl + 8, len - ihl - 8);
+done:
+	replay.server_cpu += replay_cpu_time() - cpu;
+}
+
+static int
+replay_dhcp4_server_open(replay_client_t *client)
+{
+	struct sockaddr_ll sll;
+	int fd;
+
+	if ((fd = socket(AF_PACKET, SOCK_DGRAM, htons(ETHERTYPE_IP))) < 0) {
+		ni_error("%s: cannot open packet socket: %m", client->peername);
+		return -1;
+	}
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETHERTYPE_IP);
+	sll.sll_ifindex = client->peer_ifindex;
+	if (bind(fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+		ni_error("%s: cannot bind packet socket: %m", client->peername);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * The DHCPv6 fake server
+ */
+static void
+replay_dhcp6_server_duid(const replay_server_t *srv, unsigned char *duid)
+{
+	/* DUID-LL with a locally administered ethernet address */
+	static const unsigned char prefix[] = { 0, 3, 0, 1, 2, 0, 0, 0, 0 };
+
+	memcpy(duid, prefix, sizeof(prefix));
+	duid[sizeof(prefix)] = srv->id;
+}
+
+static unsigned char *
+replay_dhcp6_put_option(unsigned char *opt, unsigned int code, unsigned int len)
+{
+	opt[0] = code >> 8;
+	opt[1] = code & 0xff;
+	opt[2] = len >> 8;
+	opt[3] = len & 0xff;
+	return opt + 4;
+}
+
+static void
+replay_dhcp6_reply(replay_client_t *client, replay_server_t *srv, const struct sockaddr_in6 *from,
+		const unsigned char *req, const unsigned char *clientid, unsigned int clientid_len,
+		const unsigned char *iaid, unsigned int type, unsigned int status)
+{
+	replay_reply_t *reply = xcalloc(1, sizeof(*reply));
+	unsigned char *opt = reply->data;
+	uint32_t value;
+
+	*opt++ = type;
+	memcpy(opt, req + 1, 3);
+	opt += 3;
+
+	opt = replay_dhcp6_put_option(opt, NI_DHCP6_OPTION_SERVERID, 10);
+	replay_dhcp6_server_duid(srv, opt);
+	opt += 10;
+
+	opt = replay_dhcp6_put_option(opt, NI_DHCP6_OPTION_CLIENTID, clientid_len);
+	memcpy(opt, clientid, clientid_len);
+	opt += clientid_len;
+
+	opt = replay_dhcp6_put_option(opt, NI_DHCP6_OPTION_IA_NA, 12 + 4 + (status ? 2 : 24));
+	memcpy(opt, iaid, 4);
+	value = htonl(REPLAY_LEASE_TIME / 2);
+	memcpy(opt + 4, &value, 4);
+	value = htonl(REPLAY_LEASE_TIME * 4 / 5);
+	memcpy(opt + 8, &value, 4);
+	opt += 12;
+
+	if (status) {
+		opt = replay_dhcp6_put_option(opt, NI_DHCP6_OPTION_STATUS_CODE, 2);
+		opt[0] = status >> 8;
+		opt[1] = status & 0xff;
+		opt += 2;
+	} else {
+		opt = replay_dhcp6_put_option(opt, NI_DHCP6_OPTION_IA_ADDRESS, 24);
+		memset(opt, 0, 16);
+		opt[0] = 0x20;
+		opt[1] = 0x01;
+		opt[2] = 0x0d;
+		opt[3] = 0xb8;
+		opt[5] = 0x99;
+		value = htonl(client->index + 2);
+		memcpy(opt + 12, &value, 4);
+		value = htonl(REPLAY_LEASE_TIME);
+		memcpy(opt + 16, &value, 4);
+		value = htonl(REPLAY_LEASE_TIME * 2);
+		memcpy(opt + 20, &value, 4);
+		opt += 24;
+	}
+	reply->len = opt - reply->data;
+
+	reply->client = client;
+	reply->dst.six = *from;
+	reply->dstlen = sizeof(reply->dst.six);
+
+	if (type == NI_DHCP6_ADVERTISE)
+		srv->offers++;
+	else if (status)
+		srv->naks++;
+	else
+		srv->acks++;
+	replay_send(reply, srv);
+}
+
+static void
+replay_dhcp6_process(replay_client_t *client, const struct sockaddr_in6 *from,
+		const unsigned char *msg, size_t len)
+{
+	const unsigned char *clientid = NULL, *serverid = NULL, *iaid = NULL;
+	unsigned int clientid_len = 0, serverid_len = 0, pos, i;
+	unsigned char duid[10];
+	replay_server_t *srv = NULL;
+
+	if (len < 4)
+		return;
+
+	for (pos = 4; pos + 4 <= len; ) {
+		unsigned int code = (msg[pos] << 8) | msg[pos + 1];
+		unsigned int optlen = (msg[pos + 2] << 8) | msg[pos + 3];
+
+		pos += 4;
+		if (pos + optlen > len)
+			return;
+		if (code == NI_DHCP6_OPTION_CLIENTID) {
+			clientid = msg + pos;
+			clientid_len = optlen;
+		} else
+		if (code == NI_DHCP6_OPTION_SERVERID) {
+			serverid = msg + pos;
+			serverid_len = optlen;
+		} else
+		if (code == NI_DHCP6_OPTION_IA_NA && optlen >= 12 && !iaid) {
+			iaid = msg + pos;
+		}
+		pos += optlen;
+	}
+	if (!clientid || !iaid)
+		return;
+
+	client->sent++;
+	if (replay_lost())
+		return;
+
+	switch (msg[0]) {
+	case NI_DHCP6_SOLICIT:
+		for (i = 0; i < replay.nservers; ++i) {
+			if (replay_server_alive(&replay.servers[i]))
+				replay_dhcp6_reply(client, &replay.servers[i], from, msg,
+						clientid, clientid_len, iaid,
+						NI_DHCP6_ADVERTISE, 0);
+		}
+		break;
+
+	case NI_DHCP6_REQUEST:
+		for (i = 0; i < replay.nservers && !srv; ++i) {
+			replay_dhcp6_server_duid(&replay.servers[i], duid);
+			if (serverid_len != sizeof(duid) || memcmp(serverid, duid, sizeof(duid)))
+				continue;
+			if (replay_server_alive(&replay.servers[i]))
+				srv = &replay.servers[i];
+		}
+		if (!srv)
+			break;
+
+		replay_dhcp6_reply(client, srv, from, msg, clientid, clientid_len, iaid,
+				NI_DHCP6_REPLY,
+				replay.naks && (unsigned int)(random() % 100) < replay.naks ?
+				NI_DHCP6_STATUS_NOADDRS : 0);
+		break;
+
+	default:
+		break;
+	}
+}
+
+static void
+replay_dhcp6_receive(ni_socket_t *sock)
+{
+	replay_client_t *client = sock->user_data;
+	unsigned char buf[REPLAY_PACKET_MAX];
+	struct sockaddr_in6 from;
+	socklen_t flen = sizeof(from);
+	double cpu = replay_cpu_time();
+	ssize_t len;
+
+	len = recvfrom(sock->__fd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &flen);
+	if (len > 0)
+		replay_dhcp6_process(client, &from, buf, len);
+	replay.server_cpu += replay_cpu_time() - cpu;
+}
+
+static int
+replay_dhcp6_server_open(replay_client_t *client)
+{
+	struct sockaddr_in6 sin6;
+	struct ipv6_mreq mreq;
+	int fd, on = 1;
+
+	if ((fd = socket(AF_INET6, SOCK_DGRAM, 0)) < 0) {
+		ni_error("%s: cannot open udp socket: %m", client->peername);
+		return -1;
+	}
+
+	memset(&sin6, 0, sizeof(sin6));
+	sin6.sin6_family = AF_INET6;
+	sin6.sin6_port = htons(NI_DHCP6_SERVER_PORT);
+	memset(&mreq, 0, sizeof(mreq));
+	inet_pton(AF_INET6, NI_DHCP6_ALL_RAGENTS, &mreq.ipv6mr_multiaddr);
+	mreq.ipv6mr_interface = client->peer_ifindex;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+	    setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, client->peername,
+			strlen(client->peername) + 1) < 0 ||
+	    bind(fd, (struct sockaddr *)&sin6, sizeof(sin6)) < 0 ||
+	    setsockopt(fd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof(mreq)) < 0) {
+		ni_error("%s: cannot set up dhcp6 server socket: %m", client->peername);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * The clients
+ */
+static int
+replay_client_init(replay_client_t *client, ni_netconfig_t *nc, const char *arg)
+{
+	ni_netdev_t *ifp, *peer;
+	char *sep;
+	int fd;
+
+	ni_string_dup(&client->ifname, arg);
+	if (!(sep = strchr(client->ifname, ':')))
+		return -1;
+	*sep++ = '\0';
+	ni_string_dup(&client->peername, sep);
+
+	if (!(ifp = ni_netdev_by_name(nc, client->ifname)) ||
+	    !(peer = ni_netdev_by_name(nc, client->peername))) {
+		ni_error("%s:%s: no such interface", client->ifname, client->peername);
+		return -1;
+	}
+	client->peer_ifindex = peer->link.ifindex;
+	client->hwaddr = ifp->link.hwaddr;
+
+	if (replay.family == AF_INET) {
+		if ((fd = replay_dhcp4_server_open(client)) < 0)
+			return -1;
+		client->dev4 = ni_dhcp4_device_new(ifp->name, &ifp->link);
+	} else {
+		if ((fd = replay_dhcp6_server_open(client)) < 0)
+			return -1;
+		client->dev6 = ni_dhcp6_device_new(ifp->name, &ifp->link);
+	}
+	if (!client->dev4 && !client->dev6) {
+		close(fd);
+		return -1;
+	}
+
+	client->sock = ni_socket_wrap(fd, SOCK_DGRAM);
+	client->sock->receive = replay.family == AF_INET ?
+				replay_dhcp4_receive : replay_dhcp6_receive;
+	client->sock->user_data = client;
+	ni_socket_activate(client->sock);
+	return 0;
+}
+
+static ni_bool_t
+replay_clients_ready(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < replay.nclients; ++i) {
+		if (replay.clients[i].dev6 && !ni_dhcp6_device_check_ready(replay.clients[i].dev6))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static int
+replay_client_start(replay_client_t *client, unsigned int timeout)
+{
+	char *err = NULL;
+	int rv;
+
+	ni_timer_get_time(&client->started);
+	if (client->dev4) {
+		ni_dhcp4_request_t *req = ni_dhcp4_request_new();
+
+		req->dry_run = NI_DHCP4_RUN_LEASE;
+		req->update = ~0;
+		req->acquire_timeout = timeout;
+		ni_uuid_generate(&req->uuid);
+
+		if ((rv = ni_dhcp4_acquire(client->dev4, req)) >= 0 && replay.no_arp)
+			client->dev4->config->doflags &= ~DHCP4_DO_ARP;
+		ni_dhcp4_request_free(req);
+	} else {
+		ni_dhcp6_request_t *req = ni_dhcp6_request_new();
+
+		req->dry_run = NI_DHCP6_RUN_LEASE;
+		req->mode = NI_DHCP6_MODE_MANAGED;
+		req->update = ~0;
+		req->acquire_timeout = timeout;
+		ni_uuid_generate(&req->uuid);
+
+		if ((rv = ni_dhcp6_acquire(client->dev6, req, &err)) < 0)
+			ni_error("%s: %s", client->ifname, err);
+		ni_string_free(&err);
+		ni_dhcp6_request_free(req);
+	}
+	return rv;
+}
+
+static void
+replay_client_destroy(replay_client_t *client)
+{
+	if (client->dev4) {
+		ni_addrconf_lease_file_remove(client->ifname, NI_ADDRCONF_DHCP, AF_INET);
+		ni_dhcp4_device_stop(client->dev4);
+		ni_dhcp4_device_put(client->dev4);
+	}
+	if (client->dev6) {
+		ni_addrconf_lease_file_remove(client->ifname, NI_ADDRCONF_DHCP, AF_INET6);
+		ni_dhcp6_device_stop(client->dev6);
+		ni_dhcp6_device_put(client->dev6);
+	}
+	ni_string_free(&client->ifname);
+	ni_string_free(&client->peername);
+}
+
+static int
+replay_latency_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void
+replay_report(double elapsed, double cpu)
+{
+	double *lat = xcalloc(replay.nclients + 1, sizeof(double));
+	unsigned int i, n = 0, sent = 0, offers = 0, acks = 0, naks = 0;
+
+	for (i = 0; i < replay.nclients; ++i) {
+		sent += replay.clients[i].sent;
+		if (replay.clients[i].acquired)
+			lat[n++] = replay.clients[i].latency;
+	}
+	for (i = 0; i < replay.nservers; ++i) {
+		offers += replay.servers[i].offers;
+		acks += replay.servers[i].acks;
+		naks += replay.servers[i].naks;
+	}
+	qsort(lat, n, sizeof(double), replay_latency_cmp);
+
+	printf("%s: %u clients, %u leases, %u failed, "
+		"latency p50 %.1f p90 %.1f p99 %.1f max %.1f msec\n",
+		replay.family == AF_INET ? "dhcp4" : "dhcp6",
+		replay.nclients, n, replay.nclients - n,
+		n ? lat[(n - 1) * 50 / 100] : 0.0,
+		n ? lat[(n - 1) * 90 / 100] : 0.0,
+		n ? lat[(n - 1) * 99 / 100] : 0.0,
+		n ? lat[n - 1] : 0.0);
+	printf("%s: %u client messages, %.2f per lease, %u offers, %u acks, "
+		"%u naks, %u lost\n",
+		replay.family == AF_INET ? "dhcp4" : "dhcp6",
+		sent, n ? (double)sent / n : 0.0, offers, acks, naks, replay.dropped);
+	printf("%s: %.3f sec, %.3f sec cpu, %.3f sec cpu in the fake server\n",
+		replay.family == AF_INET ? "dhcp4" : "dhcp6",
+		elapsed, cpu, replay.server_cpu);
+	free(lat);
+}
+
+static void
+replay_cleanup_statedir(const char *dirname)
+{
+	struct dirent *de;
+	char path[PATH_MAX];
+	DIR *dir;
+
+	if (!(dir = opendir(dirname)))
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dirname, de->d_name);
+		unlink(path);
+	}
+	closedir(dir);
+	rmdir(dirname);
+}
+
+int
+main(int argc, char **argv)
+{
+	char statedir[] = "/tmp/dhcp-replay.XXXXXX";
+	unsigned int timeout = 60, failover = 0, seed = 1, i;
+	ni_bool_t verbose = FALSE;
+	ni_netconfig_t *nc;
+	double cpu;
+	int c;
+
+	if (ni_init("dhcp-replay") < 0)
+		return 1;
+
+	replay.family = AF_INET;
+	while ((c = getopt(argc, argv, "46l:d:k:F:Asr:j:t:S:v")) != -1) {
+		switch (c) {
+		case '4':
+			replay.family = AF_INET;
+			break;
+		case '6':
+			replay.family = AF_INET6;
+			break;
+		case 'l':
+			replay.loss = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			replay.delay = strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			replay.naks = strtoul(optarg, NULL, 0);
+			break;
+		case 'F':
+			failover = strtoul(optarg, NULL, 0);
+			break;
+		case 'A':
+			replay.no_arp = TRUE;
+			break;
+		case 's':
+			ni_global.config->addrconf.dhcp4.shared_capture = TRUE;
+			break;
+		case 'r':
+			ni_global.config->addrconf.dhcp4.transmit_rate.rate = strtoul(optarg, NULL, 0);
+			ni_global.config->addrconf.dhcp6.transmit_rate.rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			ni_global.config->addrconf.dhcp4.start_jitter = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			timeout = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			verbose = TRUE;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind >= argc || !timeout) {
+usage:
+		fprintf(stderr, "Usage: %s [-4|-6] [-l loss] [-d delay] [-k naks] [-F msec] [-A]\n"
+				"\t[-s] [-r rate] [-j msec] [-t timeout] [-S seed] [-v] ifname:peer ...\n",
+				argv[0]);
+		return 1;
+	}
+
+	if (verbose) {
+		ni_enable_debug("dhcp");
+	} else {
+		ni_log_level_set("error");
+	}
+
+	/* keep the lease and duid files out of the way */
+	if (!mkdtemp(statedir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	ni_string_dup(&ni_global.config->statedir.path, statedir);
+	ni_string_dup(&ni_global.config->storedir.path, statedir);
+
+	srandom(seed);
+	replay.nservers = 1;
+	replay.servers[0].id = 1;
+	replay.servers[0].delay = replay.delay;
+	replay.servers[0].fail_after = -1;
+	if (failover) {
+		replay.servers[0].fail_after = failover;
+		replay.servers[1].id = 2;
+		replay.servers[1].delay = replay.delay * 2;
+		replay.servers[1].fail_after = -1;
+		replay.nservers = 2;
+	}
+
+	if (!(nc = ni_global_state_handle(1))) {
+		fprintf(stderr, "cannot refresh interface list\n");
+		goto failed;
+	}
+
+	ni_dhcp4_set_event_handler(replay_dhcp4_event);
+	ni_dhcp6_set_event_handler(replay_dhcp6_event);
+
+	replay.nclients = argc - optind;
+	replay.clients = xcalloc(replay.nclients, sizeof(replay_client_t));
+	for (i = 0; i < replay.nclients; ++i) {
+		replay.clients[i].index = i;
+		if (replay_client_init(&replay.clients[i], nc, argv[optind + i]) < 0)
+			goto failed;
+	}
+
+	/* DHCPv6 needs usable link-local addresses */
+	for (i = 0; !replay_clients_ready(); ++i) {
+		if (i >= 10) {
+			fprintf(stderr, "link-local addresses not ready\n");
+			goto failed;
+		}
+		sleep(1);
+		ni_global_state_handle(1);
+	}
+
+	ni_timer_get_time(&replay.start);
+	cpu = replay_cpu_time();
+	for (i = 0; i < replay.nclients; ++i) {
+		if (replay_client_start(&replay.clients[i], timeout) < 0)
+			goto failed;
+	}
+
+	while (replay.acquired < replay.nclients && !ni_caught_terminal_signal()) {
+		long wait = ni_timer_next_timeout();
+
+		if (replay_msec_since(&replay.start) >= timeout * 1000.0)
+			break;
+		if (wait < 0 || wait > 100)
+			wait = 100;
+		if (ni_socket_wait(wait) != 0)
+			break;
+	}
+	replay_report(replay_msec_since(&replay.start) / 1e3, replay_cpu_time() - cpu);
+
+	for (i = 0; i < replay.nclients; ++i)
+		replay_client_destroy(&replay.clients[i]);
+	free(replay.clients);
+	ni_socket_deactivate_all();
+	replay_cleanup_statedir(statedir);
+	return replay.acquired == replay.nclients ? 0 : 2;
+
+failed:
+	replay_cleanup_statedir(statedir);
+	return 1;
+}
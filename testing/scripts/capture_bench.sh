@@ -0,0 +1,52 @@
+#!/bin/bash
+#
+###############################################################
+#                                                             #
+# Benchmark of the DHCPv4 capture socket modes                #
+#                                                             #
+# Creates COUNT veth pairs and runs the capture-bench program #
+# with one capture socket per interface and with a single     #
+# shared capture socket, both with and without the mmap ring. #
+# Needs to be run as root.                                    #
+#                                                             #
+###############################################################
+
+BENCH=${BENCH:-`dirname $0`/../capture-bench}
+COUNT=${COUNT:-100}
+PACKETS=${PACKETS:-256}
+
+usage()
+{
+	echo "Usage: `basename $0`"
+	echo ""
+	echo "Environment:"
+	echo "  BENCH    capture-bench binary      [${BENCH}]"
+	echo "  COUNT    number of veth pairs      [${COUNT}]"
+	echo "  PACKETS  matching packets per pair [${PACKETS}]"
+	exit 1
+}
+
+test $# -eq 0 || usage
+test -x "$BENCH" || usage
+
+cleanup()
+{
+	local i
+	for ((i = 0; i < COUNT; i++)) ; do
+		ip link del "cbv$i" 2>/dev/null
+	done
+}
+trap cleanup EXIT
+
+args=""
+for ((i = 0; i < COUNT; i++)) ; do
+	ip link add "cbv$i" type veth peer name "cbp$i" || exit 1
+	ip link set "cbv$i" up && ip link set "cbp$i" up || exit 1
+	args="$args cbv$i:cbp$i"
+done
+
+for opts in "" "-s" "-r" "-s -r" ; do
+	$BENCH -n "$PACKETS" $opts $args || exit 1
+done
+
+# vim: ai
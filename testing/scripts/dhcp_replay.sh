@@ -0,0 +1,63 @@
+#!/bin/bash
+#
+###############################################################
+#                                                             #
+# Replay of DHCP lease acquisitions against a fake server     #
+#                                                             #
+# Creates COUNT veth pairs and runs the dhcp-replay program   #
+# for DHCPv4 and DHCPv6 on them, once on a clean network and  #
+# once with message loss, NAKs and a server failover.         #
+# Needs to be run as root.                                    #
+#                                                             #
+###############################################################
+
+REPLAY=${REPLAY:-`dirname $0`/../dhcp-replay}
+COUNT=${COUNT:-50}
+DELAY=${DELAY:-5}
+LOSS=${LOSS:-10}
+NAKS=${NAKS:-10}
+FAILOVER=${FAILOVER:-1500}
+
+usage()
+{
+	echo "Usage: `basename $0` [dhcp-replay options]"
+	echo ""
+	echo "Environment:"
+	echo "  REPLAY    dhcp-replay binary              [${REPLAY}]"
+	echo "  COUNT     number of veth pairs / clients  [${COUNT}]"
+	echo "  DELAY     server reply delay in msec      [${DELAY}]"
+	echo "  LOSS      lost messages in percent        [${LOSS}]"
+	echo "  NAKS      refused requests in percent     [${NAKS}]"
+	echo "  FAILOVER  primary server failure in msec  [${FAILOVER}]"
+	exit 1
+}
+
+test -x "$REPLAY" || usage
+case $1 in -h|--help) usage ;; esac
+
+cleanup()
+{
+	local i
+	for ((i = 0; i < COUNT; i++)) ; do
+		ip link del "drv$i" 2>/dev/null
+	done
+}
+trap cleanup EXIT
+
+args=""
+for ((i = 0; i < COUNT; i++)) ; do
+	ip link add "drv$i" type veth peer name "drp$i" || exit 1
+	for dev in "drv$i" "drp$i" ; do
+		# the link-local addresses are usable at once
+		sysctl -qw "net.ipv6.conf.$dev.accept_dad=0"
+		ip link set "$dev" up || exit 1
+	done
+	args="$args drv$i:drp$i"
+done
+
+for family in -4 -6 ; do
+	$REPLAY $family -d "$DELAY" "$@" $args
+	$REPLAY $family -d "$DELAY" -l "$LOSS" -k "$NAKS" -F "$FAILOVER" "$@" $args
+done
+
+# vim: ai
@@ -0,0 +1,131 @@
+#!/bin/bash
+#
+###############################################################
+#                                                             #
+# Timing harness for the suse ifcfg file parser               #
+#                                                             #
+# Generates a synthetic sysconfig network directory with      #
+# many ifcfg files and measures the time to read it using     #
+# a different number of WICKED_IFCFG_PARSE_WORKERS threads.   #
+# The generated configuration has to be the same for all      #
+# thread counts.                                              #
+#                                                             #
+###############################################################
+
+WICKED=${WICKED:-wicked}
+COUNT=${COUNT:-5000}
+WORKERS=${WORKERS:-"1 2 4 auto"}
+
+usage()
+{
+	echo "Usage: `basename $0` [directory]"
+	echo ""
+	echo "Environment:"
+	echo "  WICKED   wicked client binary      [${WICKED}]"
+	echo "  COUNT    number of ifcfg files     [${COUNT}]"
+	echo "  WORKERS  parser thread counts      [${WORKERS}]"
+	exit 1
+}
+
+test $# -le 1 || usage
+if test "X$1" = "X" ; then
+	dir=`mktemp -d /tmp/ifcfg-bench.XXXXXX` || exit 1
+	trap 'rm -rf "$dir"' EXIT
+else
+	dir=$1
+	mkdir -p "$dir" || exit 1
+fi
+
+generate()
+{
+	local i n b
+
+	cat > "$dir/routes" <<-EOF
+		default 10.0.0.1 - -
+		172.16.0.0/12 10.0.0.254 - -
+	EOF
+	cat > "$dir/ifsysctl" <<-EOF
+		net.ipv6.conf.all.accept_ra = 1
+		net.ipv4.conf.all.forwarding = 0
+	EOF
+
+	for ((i = 0; i < COUNT; i++)) ; do
+		n=$((i % 250 + 1))
+		b=$((i / 250))
+		case $((i % 4)) in
+		0)
+			cat > "$dir/ifcfg-eth$i" <<-EOF
+				STARTMODE='auto'
+				BOOTPROTO='static'
+				IPADDR='10.$b.$n.1/24'
+				IPADDR_1='10.$b.$n.2/24'
+				LABEL_1='1'
+				IPADDR_2='fd00:$b:$n::1/64'
+				MTU='1500'
+				ETHTOOL_OPTIONS='-K iface tso off gso off'
+			EOF
+			cat > "$dir/ifroute-eth$i" <<-EOF
+				192.168.$n.0/24 10.$b.$n.254 - eth$i
+			EOF
+		;;
+		1)
+			cat > "$dir/ifcfg-eth$i" <<-EOF
+				STARTMODE='hotplug'
+				BOOTPROTO='dhcp'
+				DHCLIENT_SET_HOSTNAME='no'
+			EOF
+		;;
+		2)
+			cat > "$dir/ifcfg-vlan$i" <<-EOF
+				STARTMODE='auto'
+				BOOTPROTO='static'
+				ETHERDEVICE='eth$((i - 2))'
+				VLAN_ID='$((i % 4094 + 1))'
+				IPADDR='10.$((b + 100)).$n.1/24'
+			EOF
+		;;
+		3)
+			cat > "$dir/ifcfg-bond$i" <<-EOF
+				STARTMODE='auto'
+				BOOTPROTO='none'
+				BONDING_MASTER='yes'
+				BONDING_MODULE_OPTS='mode=active-backup miimon=100'
+				BONDING_SLAVE_0='eth$((i - 3))'
+				BONDING_SLAVE_1='eth$((i - 2))'
+			EOF
+		;;
+		esac
+	done
+}
+
+readconf()
+{
+	printf 'WICKED_IFCFG_PARSE_WORKERS="%s"\n' "$1" > "$dir/config"
+	$WICKED show-config "compat:suse:$dir" 2>/dev/null
+}
+
+echo "Generating $COUNT ifcfg files in $dir"
+generate || exit 1
+
+ref=""
+for w in $WORKERS ; do
+	out="$dir/bench.out.$w"
+	start=`date +%s%N`
+	readconf "$w" > "$out" || { echo "$WICKED show-config failed" ; exit 1 ; }
+	stop=`date +%s%N`
+
+	printf "workers %-6s %8d ms  %6d interfaces\n" "$w" \
+		$(( (stop - start) / 1000000 )) `grep -c '^<interface' "$out"`
+
+	if test "X$ref" = "X" ; then
+		ref="$out"
+	elif ! cmp -s "$ref" "$out" ; then
+		echo "ERROR: config read with $w workers differs from $ref"
+		exit 1
+	else
+		rm -f "$out"
+	fi
+done
+rm -f "$ref"
+
+# vim: ai
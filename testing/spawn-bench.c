@@ -0,0 +1,152 @@
+/*
+ * Benchmark of the subprocess launch latency depending on the size of
+ * the (touched) heap of the calling process, as a daemon grows it.
+ *
+ * Usage: spawn-bench [-f] [-n runs] [-m max-heap-MB] [command]
+ *
+ * Runs the command (default /bin/true) n times via ni_process_run_and_wait()
+ * at heap sizes of 0, 16, 64, 256 ... max-heap MB and prints the average
+ * launch-to-exit latency. With -f, a plain fork+exec is measured instead
+ * for comparison.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <wicked/util.h>
+#include <wicked/logging.h>
+
+#include "util_priv.h"
+#include "process.h"
+
+#define BENCH_HEAP_CHUNK	(16UL << 20)
+
+static unsigned long
+bench_rss_kb(void)
+{
+	unsigned long size = 0, rss = 0;
+	FILE *fp;
+
+	if ((fp = fopen("/proc/self/statm", "r")) != NULL) {
+		if (fscanf(fp, "%lu %lu", &size, &rss) != 2)
+			rss = 0;
+		fclose(fp);
+	}
+	return rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int
+bench_fork_exec(const ni_shellcmd_t *cmd)
+{
+	int status;
+	pid_t pid;
+
+	if ((pid = fork()) < 0)
+		return -1;
+	if (pid == 0) {
+		execve(cmd->argv.data[0], cmd->argv.data, cmd->environ.data);
+		_exit(127);
+	}
+	while (waitpid(pid, &status, 0) < 0)
+		;
+	return status;
+}
+
+static double
+bench_run(ni_shellcmd_t *cmd, unsigned int nruns, ni_bool_t use_fork)
+{
+	struct timeval start, stop;
+	unsigned int i;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nruns; ++i) {
+		if (use_fork) {
+			if (bench_fork_exec(cmd) != 0)
+				return -1;
+		} else {
+			ni_process_t *pi = ni_process_new(cmd);
+			int rv;
+
+			rv = ni_process_run_and_wait(pi);
+			ni_process_free(pi);
+			if (rv != 0)
+				return -1;
+		}
+	}
+	gettimeofday(&stop, NULL);
+
+	return ((stop.tv_sec - start.tv_sec) * 1e6 +
+		(stop.tv_usec - start.tv_usec)) / nruns;
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned int nruns = 200, max_heap = 1024, heap = 0, chunks = 0;
+	ni_bool_t use_fork = FALSE;
+	const char *command = "/bin/true";
+	ni_shellcmd_t *cmd;
+	char **mem = NULL;
+	double usec;
+	int c;
+
+	while ((c = getopt(argc, argv, "fn:m:")) != -1) {
+		switch (c) {
+		case 'f':
+			use_fork = TRUE;
+			break;
+		case 'n':
+			nruns = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			max_heap = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-f] [-n runs] [-m max-heap-MB] [command]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind < argc)
+		command = argv[optind];
+
+	if (!nruns || !(cmd = ni_shellcmd_parse(command))) {
+		fprintf(stderr, "%s: invalid command or run count\n", argv[0]);
+		return 1;
+	}
+
+	while (1) {
+		/* grow and touch the heap, so fork has to copy its page tables */
+		for (; chunks * (BENCH_HEAP_CHUNK >> 20) < heap; ++chunks) {
+			mem = xrealloc(mem, (chunks + 1) * sizeof(char *));
+			mem[chunks] = xcalloc(1, BENCH_HEAP_CHUNK);
+			memset(mem[chunks], 0x5a, BENCH_HEAP_CHUNK);
+		}
+
+		if ((usec = bench_run(cmd, nruns, use_fork)) < 0) {
+			fprintf(stderr, "%s: %s failed\n", argv[0], command);
+			return 1;
+		}
+		printf("%s: rss %7lu kB, %u runs, %8.1f usec per run\n",
+			use_fork ? "fork+exec" : "ni_process",
+			bench_rss_kb(), nruns, usec);
+
+		if (heap >= max_heap)
+			break;
+		heap = heap ? heap * 4 : 16;
+		if (heap > max_heap)
+			heap = max_heap;
+	}
+
+	while (chunks--)
+		free(mem[chunks]);
+	free(mem);
+	ni_shellcmd_release(cmd);
+	return 0;
+}